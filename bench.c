@@ -0,0 +1,428 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "myjson.h"
+
+/*
+ * Usage: bench [-r reps] [corpus ...]
+ *
+ * Writes one CSV row per corpus and operation to stdout. Times are the best of reps runs
+ * after a warmup run; throughput is computed from the best time.
+ */
+
+#define BENCH_REPS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    char *buf;
+    size_t len, size;
+} bench_buffer;
+
+static void bench_printf(bench_buffer *b, const char *format, ...) {
+    va_list ap;
+    int n;
+    for (;;) {
+        va_start(ap, format);
+        n = vsnprintf(b->buf + b->len, b->size - b->len, format, ap);
+        va_end(ap);
+        if (b->len + n < b->size)
+            break;
+        b->size = b->size == 0 ? 4096 : b->size * 2;
+        while (b->len + n >= b->size)
+            b->size *= 2;
+        b->buf = (char *)realloc(b->buf, b->size);
+    }
+    b->len += n;
+}
+
+static unsigned bench_seed = 12345;
+
+static unsigned bench_rand() {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 16) & 0x7FFF;
+}
+
+/* String-heavy: log records with long messages and the odd escape */
+static void make_logs(bench_buffer *b) {
+    static const char *levels[] = { "debug", "info", "warn", "error" };
+    static const char *words[] = { "request", "completed", "upstream", "timeout", "retrying", "cache", "miss", "user", "session", "expired" };
+    size_t i, j;
+    bench_printf(b, "[");
+    for (i = 0; i < 20000; i++) {
+        bench_printf(b, "%s{\"ts\":\"2024-05-%02uT%02u:%02u:%02u.%03uZ\",\"level\":\"%s\",\"host\":\"web-%02u.example.com\",\"msg\":\"",
+            i > 0 ? "," : "", 1 + bench_rand() % 28, bench_rand() % 24, bench_rand() % 60, bench_rand() % 60, bench_rand() % 1000,
+            levels[bench_rand() % 4], bench_rand() % 32);
+        for (j = 0; j < 12; j++)
+            bench_printf(b, "%s%s", j > 0 ? " " : "", words[bench_rand() % 10]);
+        bench_printf(b, "%s\",\"path\":\"/api/v2/items/%u\"}", bench_rand() % 8 == 0 ? " \\\"quoted\\\"\\n\\ttrace" : "", bench_rand());
+    }
+    bench_printf(b, "]");
+}
+
+/* Number-heavy: polygons of coordinates, shaped like canada.json */
+static void make_geo(bench_buffer *b) {
+    size_t i, j;
+    bench_printf(b, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+        "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[");
+    for (i = 0; i < 200; i++) {
+        bench_printf(b, "%s[", i > 0 ? "," : "");
+        for (j = 0; j < 600; j++)
+            bench_printf(b, "%s[%.15g,%.15g]", j > 0 ? "," : "", -141.0 + bench_rand() * 1e-3 + bench_rand() * 1e-9, 41.6 + bench_rand() * 1e-3 + bench_rand() * 1e-9);
+        bench_printf(b, "]");
+    }
+    bench_printf(b, "]}}]}");
+}
+
+/* Deeply nested configuration: chains of small objects and arrays */
+static void make_config(bench_buffer *b) {
+    size_t i, j, depth;
+    bench_printf(b, "{");
+    for (i = 0; i < 2000; i++) {
+        depth = 8 + bench_rand() % 120;
+        bench_printf(b, "%s\"section%zu\":", i > 0 ? "," : "", i);
+        for (j = 0; j < depth; j++)
+            bench_printf(b, j % 3 == 2 ? "[" : "{\"enabled\":%s,\"level%zu\":", bench_rand() % 2 ? "true" : "false", j);
+        bench_printf(b, "null");
+        for (j = depth; j-- > 0; )
+            bench_printf(b, j % 3 == 2 ? "]" : "}");
+    }
+    bench_printf(b, "}");
+}
+
+/* Wide objects: hundreds of members each */
+static void make_wide(bench_buffer *b) {
+    size_t i, j;
+    bench_printf(b, "[");
+    for (i = 0; i < 100; i++) {
+        bench_printf(b, "%s{", i > 0 ? "," : "");
+        for (j = 0; j < 500; j++)
+            bench_printf(b, "%s\"field_%zu_%u\":%u", j > 0 ? "," : "", j, bench_rand() % 100, bench_rand());
+        bench_printf(b, "}");
+    }
+    bench_printf(b, "]");
+}
+
+/* Many small records, one document per line */
+static void make_ndjson(bench_buffer *b) {
+    size_t i;
+    for (i = 0; i < 50000; i++)
+        bench_printf(b, "{\"id\":%zu,\"name\":\"item-%zu\",\"price\":%.2f,\"tags\":[\"a\",\"b\"],\"stock\":{\"warehouse\":%zu,\"available\":%s}}\n",
+            i, i, i * 0.37, i % 17, i % 3 ? "true" : "false");
+}
+
+typedef struct {
+    const char *name;
+    void (*make)(bench_buffer *b);
+    int lines; /* one document per line */
+} bench_corpus_spec;
+
+static const bench_corpus_spec corpora[] = {
+    { "logs", make_logs, 0 },
+    { "geo", make_geo, 0 },
+    { "config", make_config, 0 },
+    { "wide", make_wide, 0 },
+    { "ndjson", make_ndjson, 1 }
+};
+
+typedef struct {
+    char *text;
+    char **docs;
+    size_t count, bytes;
+    myjson_value *values; /* parsed once, the input of stringify, copy and lookup */
+    myjson_value *scratch;
+    char **out; /* stringify results */
+    char **binary;
+    size_t *blen;
+    char **frozen;
+    size_t *flen;
+} bench_corpus;
+
+static void bench_load(bench_corpus *c, const bench_corpus_spec *spec) {
+    bench_buffer b = { NULL, 0, 0 };
+    size_t i;
+    char *p;
+    bench_seed = 12345; /* the same corpus whichever others are selected */
+    spec->make(&b);
+    c->text = b.buf;
+    c->bytes = b.len;
+    c->count = 1;
+    if (spec->lines)
+        for (c->count = 0, p = c->text; (p = strchr(p, '\n')) != NULL; p++)
+            c->count++;
+    c->docs = (char **)malloc(c->count * sizeof(char *));
+    c->docs[0] = c->text;
+    for (i = 1; i < c->count; i++) {
+        p = strchr(c->docs[i - 1], '\n');
+        *p = '\0';
+        c->docs[i] = p + 1;
+    }
+    if (spec->lines)
+        *strchr(c->docs[c->count - 1], '\n') = '\0';
+    c->values = (myjson_value *)malloc(c->count * sizeof(myjson_value));
+    c->scratch = (myjson_value *)malloc(c->count * sizeof(myjson_value));
+    c->out = (char **)calloc(c->count, sizeof(char *));
+    c->binary = (char **)malloc(c->count * sizeof(char *));
+    c->blen = (size_t *)malloc(c->count * sizeof(size_t));
+    c->frozen = (char **)malloc(c->count * sizeof(char *));
+    c->flen = (size_t *)malloc(c->count * sizeof(size_t));
+    for (i = 0; i < c->count; i++) {
+        myjson_init(&c->values[i]);
+        myjson_init(&c->scratch[i]);
+        if (myjson_parse(&c->values[i], c->docs[i]) != MYJSON_PARSE_OK) {
+            fprintf(stderr, "bench: corpus %s does not parse\n", spec->name);
+            exit(1);
+        }
+        c->binary[i] = myjson_dump_binary(&c->values[i], &c->blen[i], MYJSON_OPT_KEY_DICTIONARY);
+        c->frozen[i] = myjson_freeze(&c->values[i], &c->flen[i]);
+    }
+}
+
+static void bench_unload(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++) {
+        myjson_free(&c->values[i]);
+        free(c->binary[i]);
+        free(c->frozen[i]);
+    }
+    free(c->values);
+    free(c->scratch);
+    free(c->out);
+    free(c->binary);
+    free(c->blen);
+    free(c->frozen);
+    free(c->flen);
+    free(c->docs);
+    free(c->text);
+}
+
+static void free_scratch(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++)
+        myjson_free(&c->scratch[i]);
+}
+
+static void op_parse(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++)
+        myjson_parse(&c->scratch[i], c->docs[i]);
+}
+
+static void op_parse_utf8(bench_corpus *c) {
+    myjson_parse_options options;
+    size_t i;
+    memset(&options, 0, sizeof(options));
+    options.flags = MYJSON_OPT_VALIDATE_UTF8;
+    for (i = 0; i < c->count; i++)
+        myjson_parse_ex(&c->scratch[i], c->docs[i], &options);
+}
+
+/* There is no separate validator: a views parse that is thrown away is the cheapest full check */
+static void op_validate(bench_corpus *c) {
+    myjson_parse_options options;
+    size_t i;
+    memset(&options, 0, sizeof(options));
+    options.flags = MYJSON_OPT_VIEWS;
+    for (i = 0; i < c->count; i++)
+        myjson_parse_ex(&c->scratch[i], c->docs[i], &options);
+}
+
+static void op_stringify(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++)
+        c->out[i] = myjson_stringify(&c->values[i], NULL);
+}
+
+/* After the first repetition, every container comes from the cache */
+static void op_stringify_cached(bench_corpus *c) {
+    myjson_stringify_options options;
+    size_t i;
+    memset(&options, 0, sizeof(options));
+    options.flags = MYJSON_OPT_STRINGIFY_CACHE;
+    for (i = 0; i < c->count; i++)
+        c->out[i] = myjson_stringify_ex(&c->values[i], NULL, &options);
+}
+
+static void free_out(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++) {
+        free(c->out[i]);
+        c->out[i] = NULL;
+    }
+}
+
+/* Parse and write back unchanged, the numbers kept as text instead of round-tripping through double */
+static void op_passthrough(bench_corpus *c) {
+    myjson_parse_options options;
+    size_t i;
+    memset(&options, 0, sizeof(options));
+    options.flags = MYJSON_OPT_VIEWS | MYJSON_OPT_RAW_NUMBERS;
+    for (i = 0; i < c->count; i++) {
+        myjson_parse_ex(&c->scratch[i], c->docs[i], &options);
+        c->out[i] = myjson_stringify(&c->scratch[i], NULL);
+    }
+}
+
+static void free_passthrough(bench_corpus *c) {
+    free_out(c);
+    free_scratch(c);
+}
+
+static void op_copy(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++)
+        myjson_copy(&c->scratch[i], &c->values[i]);
+}
+
+static void op_free(bench_corpus *c) {
+    free_scratch(c);
+}
+
+static size_t lookup_value(const myjson_value *v) {
+    size_t i, n = 0;
+    switch (myjson_get_type(v)) {
+        case MYJSON_ARRAY:
+            for (i = 0; i < myjson_get_array_size(v); i++)
+                n += lookup_value(myjson_get_array_element_const(v, i));
+            return n;
+        case MYJSON_OBJECT:
+            for (i = 0; i < myjson_get_object_size(v); i++) {
+                n += myjson_find_object_index(v, myjson_get_object_key(v, i), myjson_get_object_key_length(v, i)) == i;
+                n += lookup_value(myjson_get_object_value_const(v, i));
+            }
+            return n;
+        default:
+            return 0;
+    }
+}
+
+static volatile size_t lookup_hits;
+
+/* Finds every member of every object by its key */
+static void op_lookup(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++)
+        lookup_hits += lookup_value(&c->values[i]);
+}
+
+static void op_load_binary(bench_corpus *c) {
+    size_t i;
+    for (i = 0; i < c->count; i++)
+        myjson_load_binary(&c->scratch[i], c->binary[i], c->blen[i]);
+}
+
+static size_t lookup_frozen(const myjson_frozen *f, size_t ref) {
+    size_t i, n = 0;
+    switch (myjson_frozen_get_type(f, ref)) {
+        case MYJSON_ARRAY:
+            for (i = 0; i < myjson_frozen_get_size(f, ref); i++)
+                n += lookup_frozen(f, myjson_frozen_get_array_element(f, ref, i));
+            return n;
+        case MYJSON_OBJECT:
+            for (i = 0; i < myjson_frozen_get_size(f, ref); i++) {
+                n += myjson_frozen_find_object_value(f, ref, myjson_frozen_get_object_key(f, ref, i), myjson_frozen_get_object_key_length(f, ref, i)) == myjson_frozen_get_object_value(f, ref, i);
+                n += lookup_frozen(f, myjson_frozen_get_object_value(f, ref, i));
+            }
+            return n;
+        default:
+            return 0;
+    }
+}
+
+/* As lookup, straight from frozen blocks: nothing is loaded or allocated */
+static void op_frozen_lookup(bench_corpus *c) {
+    myjson_frozen f;
+    size_t i;
+    for (i = 0; i < c->count; i++) {
+        myjson_frozen_open(&f, c->frozen[i], c->flen[i]);
+        lookup_hits += lookup_frozen(&f, myjson_frozen_root(&f));
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*prepare)(bench_corpus *c); /* untimed, before each run */
+    void (*run)(bench_corpus *c);
+    void (*cleanup)(bench_corpus *c); /* untimed, after each run */
+} bench_op;
+
+static const bench_op ops[] = {
+    { "parse", NULL, op_parse, free_scratch },
+    { "parse_utf8", NULL, op_parse_utf8, free_scratch },
+    { "validate", NULL, op_validate, free_scratch },
+    { "stringify", NULL, op_stringify, free_out },
+    { "stringify_cached", NULL, op_stringify_cached, free_out },
+    { "passthrough", NULL, op_passthrough, free_passthrough },
+    { "copy", NULL, op_copy, free_scratch },
+    { "free", op_parse, op_free, NULL },
+    { "lookup", NULL, op_lookup, NULL },
+    { "load_binary", NULL, op_load_binary, free_scratch },
+    { "frozen_lookup", NULL, op_frozen_lookup, NULL }
+};
+
+static double bench_run(bench_corpus *c, const bench_op *op, int reps, double *mean) {
+    double t, best = 0.0, total = 0.0;
+    int i;
+    for (i = -1; i < reps; i++) { /* run -1 warms up */
+        if (op->prepare)
+            op->prepare(c);
+        t = now();
+        op->run(c);
+        t = now() - t;
+        if (op->cleanup)
+            op->cleanup(c);
+        if (i < 0)
+            continue;
+        total += t;
+        if (i == 0 || t < best)
+            best = t;
+    }
+    *mean = total / reps;
+    return best;
+}
+
+static int selected(int argc, char *argv[], int first, const char *name) {
+    int i;
+    if (first == argc)
+        return 1;
+    for (i = first; i < argc; i++)
+        if (strcmp(argv[i], name) == 0)
+            return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_corpus c;
+    double best, mean;
+    size_t i, j;
+    int reps = BENCH_REPS, first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        reps = atoi(argv[2]);
+        first = 3;
+        if (reps <= 0) {
+            fprintf(stderr, "usage: %s [-r reps] [corpus ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    printf("corpus,op,bytes,docs,reps,best_ms,mean_ms,mb_per_s,docs_per_s\n");
+    for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        if (!selected(argc, argv, first, corpora[i].name))
+            continue;
+        bench_load(&c, &corpora[i]);
+        for (j = 0; j < sizeof(ops) / sizeof(ops[0]); j++) {
+            best = bench_run(&c, &ops[j], reps, &mean);
+            printf("%s,%s,%zu,%zu,%d,%.4f,%.4f,%.1f,%.0f\n", corpora[i].name, ops[j].name, c.bytes, c.count, reps,
+                best * 1e3, mean * 1e3, c.bytes / best / (1024 * 1024), c.count / best);
+            fflush(stdout);
+        }
+        bench_unload(&c);
+    }
+    return 0;
+}
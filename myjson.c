@@ -5,6 +5,22 @@
 #include <errno.h>
 #include <malloc.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#ifdef MYJSON_STATS
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+#include <sys/stat.h>
+/* The SSSE3 UTF-8 validator is compiled for x86 with GCC or Clang and picked when the CPU has it */
+#if !defined(MYJSON_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MYJSON_UTF8_SSSE3
+#include <tmmintrin.h>
+#endif
 
 #ifndef MYJSON_PARSR_STACK_INIT_SIZE
 #define MYJSON_PARSR_STACK_INIT_SIZE 256
@@ -14,6 +30,28 @@
 #define MYJSON_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
 
+/* Smaller containers are written out again rather than cached */
+#ifndef MYJSON_STRINGIFY_CACHE_MIN_SIZE
+#define MYJSON_STRINGIFY_CACHE_MIN_SIZE 64
+#endif
+
+#ifndef MYJSON_PARSE_PARALLEL_MIN_ELEMENTS
+#define MYJSON_PARSE_PARALLEL_MIN_ELEMENTS 64
+#endif
+
+/* How far the parallel stringify looks through small wrappers for a container worth splitting */
+#ifndef MYJSON_STRINGIFY_PARALLEL_MAX_DEPTH
+#define MYJSON_STRINGIFY_PARALLEL_MAX_DEPTH 32
+#endif
+
+#ifndef MYJSON_PARSE_MAX_DEPTH
+#define MYJSON_PARSE_MAX_DEPTH 1024
+#endif
+
+#ifndef MYJSON_EQUAL_LINEAR_MEMBERS
+#define MYJSON_EQUAL_LINEAR_MEMBERS 8
+#endif
+
 #define EXPECT(c, ch) do { assert(*c->json == (ch)); c->json++; } while(0)
 #define ISDIGITAL(ch) ((ch) >= '0' && (ch) <= '9')
 #define ISDIGITAL1TO9(ch) ((ch) >= '1' && (ch) <= '9')
@@ -22,12 +60,263 @@
 
 #define STRING_ERROR(ret) do { c->top = head; return ret; } while(0)
 
+#define MYJSON_VALUE_VIEW 0x1 /* string or number text points into a myjson_mapping and is not owned */
+#define MYJSON_VALUE_HAS_VIEWS 0x2 /* container was parsed with views somewhere below it */
+#define MYJSON_VALUE_SORTED 0x4 /* object members are in myjson_key_compare() order */
+#define MYJSON_VALUE_RAW_NUMBER 0x8 /* number keeps its text in val.num */
+#define MYJSON_VALUE_CONVERTED 0x10 /* val.num.n holds the raw number's value */
+
 typedef struct {
     const char *json;
     char *stack;
     size_t size, top;
+    unsigned flags;
+    size_t max_depth;
+    const myjson_allocator *allocator;
+    size_t max_bytes, max_string, max_members; /* parsing limits */
+    size_t allocated; /* by the parser for the value, not counting the stack */
+#ifdef MYJSON_STATS
+    myjson_stats *stats;
+#endif
 } myjson_context;
 
+#define MYJSON_MALLOC(a, size) ((a)->malloc((a)->ctx, size))
+#define MYJSON_REALLOC(a, p, size) ((a)->realloc((a)->ctx, p, size))
+#define MYJSON_FREE(a, p) do { if ((p) != NULL) (a)->free((a)->ctx, p); } while(0)
+
+#ifdef MYJSON_STATS
+#define MYJSON_STAT_ADD(c, field, n) do { if ((c)->stats != NULL) (c)->stats->field += (n); } while(0)
+#define MYJSON_STAT_MAX(c, field, n) do { if ((c)->stats != NULL && (c)->stats->field < (n)) (c)->stats->field = (n); } while(0)
+#else
+#define MYJSON_STAT_ADD(c, field, n) do { } while(0)
+#define MYJSON_STAT_MAX(c, field, n) do { } while(0)
+#endif
+
+#ifdef MYJSON_STATS
+static unsigned long long myjson_stats_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void myjson_stats_finish(myjson_context *c, size_t bytes, unsigned long long start) {
+    if (c->stats != NULL) {
+        c->stats->bytes = bytes;
+        c->stats->stack_size = c->size;
+        c->stats->cycles = myjson_stats_clock() - start;
+    }
+}
+#endif
+
+/* Starts an empty stack, or one of size bytes */
+static void myjson_context_init(myjson_context *c, const myjson_allocator *allocator, size_t size) {
+    c->allocator = allocator;
+    c->stack = size > 0 ? (char *)MYJSON_MALLOC(allocator, size) : NULL;
+    c->size = size;
+    c->top = 0;
+    c->flags = 0;
+#ifdef MYJSON_STATS
+    c->stats = NULL;
+#endif
+}
+
+static void *myjson_default_malloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *myjson_default_realloc(void *ctx, void *p, size_t size) {
+    (void)ctx;
+    return realloc(p, size);
+}
+
+static void myjson_default_free(void *ctx, void *p) {
+    (void)ctx;
+    free(p);
+}
+
+static const myjson_allocator myjson_default_allocator = { myjson_default_malloc, myjson_default_realloc, myjson_default_free, NULL };
+static const myjson_allocator *myjson_global_allocator = &myjson_default_allocator;
+
+void myjson_set_allocator(const myjson_allocator *allocator) {
+    myjson_global_allocator = allocator != NULL ? allocator : &myjson_default_allocator;
+}
+
+const myjson_allocator *myjson_get_allocator(void) {
+    return myjson_global_allocator;
+}
+
+/* Strings, array elements and object members live in reference-counted blocks so that
+ * myjson_copy() only shares them. A shared block is copied on the first mutation.
+ * hash caches myjson_hash() of the owning value, 0 meaning not computed yet, and text its
+ * stringify output under MYJSON_OPT_STRINGIFY_CACHE. Both are dropped by myjson_block_touch().
+ * A block is resized and freed by the allocator that made it, as are the keys of its members. */
+typedef struct {
+    size_t refcount;
+    size_t hash;
+    const myjson_allocator *allocator;
+    struct myjson_block_text *text;
+} myjson_block;
+
+typedef struct myjson_block_text {
+    size_t len;
+    unsigned flags; /* the MYJSON_OPT_SORT_KEYS it was written with */
+} myjson_block_text; /* followed by the text */
+
+#define MYJSON_BLOCK(p) ((myjson_block *)(p) - 1)
+
+static void *myjson_block_alloc(const myjson_allocator *a, size_t size) {
+    myjson_block *b = (myjson_block *)MYJSON_MALLOC(a, sizeof(myjson_block) + size);
+    b->refcount = 1;
+    b->hash = 0;
+    b->allocator = a;
+    b->text = NULL;
+    return b + 1;
+}
+
+/* A new block comes from the global allocator */
+static void *myjson_block_realloc(void *p, size_t size) {
+    const myjson_allocator *a;
+    if (p == NULL)
+        return myjson_block_alloc(myjson_global_allocator, size);
+    assert(MYJSON_BLOCK(p)->refcount == 1);
+    a = MYJSON_BLOCK(p)->allocator;
+    return (myjson_block *)MYJSON_REALLOC(a, MYJSON_BLOCK(p), sizeof(myjson_block) + size) + 1;
+}
+
+static void myjson_block_free(void *p) {
+    const myjson_allocator *a = MYJSON_BLOCK(p)->allocator;
+    MYJSON_FREE(a, MYJSON_BLOCK(p)->text);
+    MYJSON_FREE(a, MYJSON_BLOCK(p));
+}
+
+static char *myjson_string_alloc(const myjson_allocator *a, const char *s, size_t len) {
+    char *p = (char *)myjson_block_alloc(a, len + 1);
+    if (len > 0)
+        memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+static char *myjson_key_alloc(const myjson_allocator *a, const char *key, size_t klen) {
+    char *k = (char *)MYJSON_MALLOC(a, klen + 1);
+    memcpy(k, key, klen);
+    k[klen] = '\0';
+    return k;
+}
+
+/* Keys belong to the allocator of the member block holding them */
+static void myjson_key_free(const myjson_member *m, char *key) {
+    MYJSON_FREE(MYJSON_BLOCK(m)->allocator, key);
+}
+
+/* Bytewise, a key sorting before every longer key it is a prefix of */
+static int myjson_key_compare(const char *a, size_t alen, const char *b, size_t blen) {
+    int r = memcmp(a, b, alen < blen ? alen : blen);
+    return r != 0 ? r : (alen > blen) - (alen < blen);
+}
+
+#define MYJSON_MEMBER_LESS(x, y) (myjson_key_compare((x)->key, (x)->klen, (y)->key, (y)->klen) < 0)
+#define MYJSON_SORT_RUN 16
+
+/* Stable, so that among duplicate keys the first still wins lookups: insertion sorted runs
+ * merged bottom-up, back and forth between m and a scratch array from a */
+static void myjson_sort_members(myjson_member *m, size_t n, const myjson_allocator *a) {
+    myjson_member *src = m, *dst, *scratch, *swap, t;
+    size_t i, j, k, lo, mid, hi, width;
+    for (lo = 0; lo < n; lo += MYJSON_SORT_RUN) {
+        hi = lo + MYJSON_SORT_RUN < n ? lo + MYJSON_SORT_RUN : n;
+        for (i = lo + 1; i < hi; i++) {
+            memcpy(&t, &m[i], sizeof(myjson_member));
+            for (j = i; j > lo && MYJSON_MEMBER_LESS(&t, &m[j - 1]); j--)
+                memcpy(&m[j], &m[j - 1], sizeof(myjson_member));
+            memcpy(&m[j], &t, sizeof(myjson_member));
+        }
+    }
+    if (n <= MYJSON_SORT_RUN)
+        return;
+    dst = scratch = (myjson_member *)MYJSON_MALLOC(a, n * sizeof(myjson_member));
+    for (width = MYJSON_SORT_RUN; width < n; width *= 2) {
+        for (lo = 0; lo < n; lo += 2 * width) {
+            mid = lo + width < n ? lo + width : n;
+            hi = lo + 2 * width < n ? lo + 2 * width : n;
+            for (i = lo, j = mid, k = lo; k < hi; k++)
+                memcpy(&dst[k], j == hi || (i < mid && !MYJSON_MEMBER_LESS(&src[j], &src[i])) ? &src[i++] : &src[j++], sizeof(myjson_member));
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != m)
+        memcpy(m, src, n * sizeof(myjson_member));
+    MYJSON_FREE(a, scratch);
+}
+
+/* First member whose key does not sort before key */
+static size_t myjson_member_lower_bound(const myjson_member *m, size_t n, const char *key, size_t klen) {
+    size_t lo = 0, hi = n, mid;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (myjson_key_compare(m[mid].key, m[mid].klen, key, klen) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void myjson_block_retain(void *p) {
+    __atomic_add_fetch(&MYJSON_BLOCK(p)->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns 1 when the caller dropped the last reference and must free the contents */
+static int myjson_block_release(void *p) {
+    return __atomic_sub_fetch(&MYJSON_BLOCK(p)->refcount, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static int myjson_block_shared(const void *p) {
+    return p != NULL && __atomic_load_n(&MYJSON_BLOCK(p)->refcount, __ATOMIC_ACQUIRE) > 1;
+}
+
+/* Readers of a shared block may fill in its hash concurrently; they all store the same value */
+static size_t myjson_block_get_hash(const void *p) {
+    return __atomic_load_n(&MYJSON_BLOCK(p)->hash, __ATOMIC_RELAXED);
+}
+
+static void myjson_block_set_hash(const void *p, size_t hash) {
+    __atomic_store_n(&MYJSON_BLOCK(p)->hash, hash, __ATOMIC_RELAXED);
+}
+
+static const myjson_block_text *myjson_block_get_text(const void *p) {
+    return __atomic_load_n(&MYJSON_BLOCK(p)->text, __ATOMIC_ACQUIRE);
+}
+
+/* Readers of a shared block may race to fill in its text, which another may be copying out:
+ * the first text stays until the block is touched */
+static void myjson_block_set_text(const void *p, const char *s, size_t len, unsigned flags) {
+    myjson_block *b = MYJSON_BLOCK(p);
+    myjson_block_text *t = (myjson_block_text *)MYJSON_MALLOC(b->allocator, sizeof(myjson_block_text) + len), *expected = NULL;
+    t->len = len;
+    t->flags = flags;
+    memcpy(t + 1, s, len);
+    if (!__atomic_compare_exchange_n(&b->text, &expected, t, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        MYJSON_FREE(b->allocator, t);
+}
+
+/* Drops what is cached about the contents of a block its only owner is about to modify.
+ * The text is taken out before it is freed, as myjson_block_set_text() puts it in. */
+static void myjson_block_touch(void *p) {
+    myjson_block *b = MYJSON_BLOCK(p);
+    myjson_block_text *t;
+    __atomic_store_n(&b->hash, 0, __ATOMIC_RELAXED);
+    if ((t = __atomic_exchange_n(&b->text, NULL, __ATOMIC_ACQ_REL)) != NULL)
+        MYJSON_FREE(b->allocator, t);
+}
+
 static void *myjson_context_push(myjson_context *c, size_t size) {
     void *ret;
     assert(size > 0);
@@ -36,7 +325,8 @@ static void *myjson_context_push(myjson_context *c, size_t size) {
             c->size = MYJSON_PARSR_STACK_INIT_SIZE;
         while(c->top + size >= c->size)
             c->size += c->size >> 1;
-        c->stack = (char *)realloc(c->stack, c->size);
+        c->stack = (char *)MYJSON_REALLOC(c->allocator, c->stack, c->size);
+        MYJSON_STAT_ADD(c, stack_reallocs, 1);
     }
     ret = c->stack + c->top;
     c->top += size;
@@ -55,33 +345,6 @@ static void myjson_parse_whitespace(myjson_context *c) {
     c->json = p;
 }
 
-static int myjson_parse_true(myjson_context *c, myjson_value *v) {
-    EXPECT(c, 't');
-    if (c->json[0] != 'r' || c->json[1] != 'u' || c->json[2] != 'e')
-        return MYJSON_PARSE_INVALID_VALUE;
-    c->json += 3;
-    v->type = MYJSON_TRUE;
-    return MYJSON_PARSE_OK;
-}
-
-static int myjson_parse_false(myjson_context *c, myjson_value *v) {
-    EXPECT(c, 'f');
-    if (c->json[0] != 'a' || c->json[1] != 'l' || c->json[2] != 's' || c->json[3] != 'e')
-        return MYJSON_PARSE_INVALID_VALUE;
-    c->json += 4;
-    v->type = MYJSON_FALSE;
-    return MYJSON_PARSE_OK;
-}
-
-static int myjson_parse_null(myjson_context *c, myjson_value *v) {
-    EXPECT(c, 'n');
-    if (c->json[0] != 'u' || c->json[1] == 'l' || c->json[2] != 'l')
-        return MYJSON_PARSE_INVALID_VALUE;
-    c->json += 3;
-    v->type = MYJSON_NULL;
-    return MYJSON_PARSE_OK;
-}
-
 static int myjson_parse_literal(myjson_context *c, myjson_value *v, const char *literal, myjson_type type) {
     size_t i;
     EXPECT(c,  literal[0]);
@@ -93,6 +356,47 @@ static int myjson_parse_literal(myjson_context *c, myjson_value *v, const char *
     return MYJSON_PARSE_OK;
 }
 
+/* Pushes within the parse's memory budget: NULL once the stack and the value would exceed it */
+static void *myjson_parse_push(myjson_context *c, size_t size) {
+    if (c->top + size >= c->size && c->allocated + c->top + size > c->max_bytes)
+        return NULL;
+    return myjson_context_push(c, size);
+}
+
+/* Accounts for memory the parsed value will own */
+static int myjson_parse_charge(myjson_context *c, size_t size) {
+    MYJSON_STAT_ADD(c, allocations, 1);
+    MYJSON_STAT_ADD(c, allocated, size);
+    return (c->allocated += size) + c->top <= c->max_bytes;
+}
+
+/* Keeps the number text up to end. Only one with an exponent or over 300 integer digits can
+ * overflow, so only those are converted here, to report MYJSON_PARSE_NUMBER_TOO_BIG as usual. */
+static int myjson_parse_raw_number(myjson_context *c, myjson_value *v, const char *end) {
+    size_t len = (size_t)(end - c->json);
+    if (len > 300 || memchr(c->json, 'e', len) != NULL || memchr(c->json, 'E', len) != NULL) {
+        errno = 0;
+        v->val.num.n = strtod(c->json, NULL);
+        if (errno == ERANGE && (v->val.num.n == HUGE_VAL || v->val.num.n == -HUGE_VAL))
+            return MYJSON_PARSE_NUMBER_TOO_BIG;
+        v->flags |= MYJSON_VALUE_CONVERTED;
+    }
+    if (c->flags & MYJSON_OPT_VIEWS) {
+        v->val.num.text = (char *)c->json;
+        v->flags |= MYJSON_VALUE_VIEW;
+    }
+    else {
+        if (!myjson_parse_charge(c, len + 1))
+            return MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+        v->val.num.text = myjson_string_alloc(c->allocator, c->json, len);
+    }
+    v->val.num.len = len;
+    v->flags |= MYJSON_VALUE_RAW_NUMBER;
+    c->json = end;
+    v->type = MYJSON_NUMBER;
+    return MYJSON_PARSE_OK;
+}
+
 static int myjson_parse_number(myjson_context *c, myjson_value *v) {
     const char *p = c->json;
     if (*p == '-') p++;
@@ -100,7 +404,7 @@ static int myjson_parse_number(myjson_context *c, myjson_value *v) {
     else {
         if (!ISDIGITAL1TO9(*p)) return MYJSON_PARSE_INVALID_VALUE;
         p++;
-        while(ISDIGITAL1TO9(*p))
+        while(ISDIGITAL(*p))
             ++p;
     }
     if (*p == '.') {
@@ -119,6 +423,9 @@ static int myjson_parse_number(myjson_context *c, myjson_value *v) {
             ++p;
     }
 
+    if (c->flags & MYJSON_OPT_RAW_NUMBERS)
+        return myjson_parse_raw_number(c, v, p);
+
     errno = 0;
     v->val.n = strtod(c->json, NULL);
 
@@ -143,51 +450,223 @@ static const char *myjson_parse_hex4(const char *p, unsigned *u) {
     return p;
 }
 
-static void myjson_encode_utf8(myjson_context *c, unsigned u) {
-    if (u <= 0x7F)
-        PUTC(c, u & 0xFF);
-    else if (u <= 0x7FF) {
-        PUTC(c, 0xC0 | ((u >> 6) & 0xFF));
-        PUTC(c, 0x80 | (u & 0x3F));
+static size_t myjson_encode_utf8(char *p, unsigned u) {
+    if (u <= 0x7F) {
+        p[0] = u & 0xFF;
+        return 1;
     }
-    else if (u <= 0xFFFF) {
-        PUTC(c, 0xE0 | ((u >> 12) & 0xFF));
-        PUTC(c, 0x80 | ((u >> 6) & 0x3F));
-        PUTC(c, 0x80 | (u & 0x3F));
+    if (u <= 0x7FF) {
+        p[0] = 0xC0 | ((u >> 6) & 0xFF);
+        p[1] = 0x80 | (u & 0x3F);
+        return 2;
     }
-    else {
-        assert(u <= 0x10FFFF);
-        PUTC(c, 0xF0 | ((u >> 18) & 0xFF));
-        PUTC(c, 0x80 | ((u >> 12) & 0x3F));
-        PUTC(c, 0x80 | ((u >> 6) & 0x3F));
-        PUTC(c, 0x80 | (u & 0x3F));
+    if (u <= 0xFFFF) {
+        p[0] = 0xE0 | ((u >> 12) & 0xFF);
+        p[1] = 0x80 | ((u >> 6) & 0x3F);
+        p[2] = 0x80 | (u & 0x3F);
+        return 3;
+    }
+    assert(u <= 0x10FFFF);
+    p[0] = 0xF0 | ((u >> 18) & 0xFF);
+    p[1] = 0x80 | ((u >> 12) & 0x3F);
+    p[2] = 0x80 | ((u >> 6) & 0x3F);
+    p[3] = 0x80 | (u & 0x3F);
+    return 4;
+}
+
+/* Strict UTF-8 (RFC 3629): no overlong forms, surrogates or code points above U+10FFFF */
+static int myjson_utf8_valid_scalar(const unsigned char *s, size_t len) {
+    unsigned long long w;
+    unsigned char lo, hi;
+    size_t i = 0, n, k;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            /* skip ASCII a word at a time */
+            for (i++; i + 8 <= len; i += 8) {
+                memcpy(&w, s + i, 8);
+                if (w & 0x8080808080808080ULL)
+                    break;
+            }
+            continue;
+        }
+        lo = 0x80;
+        hi = 0xBF;
+        if (s[i] >= 0xC2 && s[i] <= 0xDF)
+            n = 1;
+        else if (s[i] >= 0xE0 && s[i] <= 0xEF) {
+            n = 2;
+            if (s[i] == 0xE0)
+                lo = 0xA0;
+            else if (s[i] == 0xED)
+                hi = 0x9F;
+        }
+        else if (s[i] >= 0xF0 && s[i] <= 0xF4) {
+            n = 3;
+            if (s[i] == 0xF0)
+                lo = 0x90;
+            else if (s[i] == 0xF4)
+                hi = 0x8F;
+        }
+        else
+            return 0;
+        if (len - i <= n || s[i + 1] < lo || s[i + 1] > hi)
+            return 0;
+        for (k = 2; k <= n; k++)
+            if ((s[i + k] & 0xC0) != 0x80)
+                return 0;
+        i += n + 1;
+    }
+    return 1;
+}
+
+#ifdef MYJSON_UTF8_SSSE3
+/* Lookup-table validation of 16 bytes at a time (Keiser and Lemire, "Validating UTF-8 In Less Than
+ * One Instruction Per Byte"). Each byte pair is classified by three table lookups on the high and
+ * low nibble of the first byte and the high nibble of the second; any bit left in their AND is an
+ * error, except that the second and third bytes after a 3- and 4-byte lead must be continuations. */
+#define MYJSON_UTF8_TOO_SHORT (1 << 0)
+#define MYJSON_UTF8_TOO_LONG (1 << 1)
+#define MYJSON_UTF8_OVERLONG_3 (1 << 2)
+#define MYJSON_UTF8_TOO_LARGE (1 << 3)
+#define MYJSON_UTF8_SURROGATE (1 << 4)
+#define MYJSON_UTF8_OVERLONG_2 (1 << 5)
+#define MYJSON_UTF8_TOO_LARGE_1000 (1 << 6)
+#define MYJSON_UTF8_OVERLONG_4 (1 << 6)
+#define MYJSON_UTF8_TWO_CONTS (1 << 7)
+#define MYJSON_UTF8_CARRY (MYJSON_UTF8_TOO_SHORT | MYJSON_UTF8_TOO_LONG | MYJSON_UTF8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i myjson_utf8_block(__m128i input, __m128i prev_input) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        MYJSON_UTF8_TOO_LONG, MYJSON_UTF8_TOO_LONG, MYJSON_UTF8_TOO_LONG, MYJSON_UTF8_TOO_LONG,
+        MYJSON_UTF8_TOO_LONG, MYJSON_UTF8_TOO_LONG, MYJSON_UTF8_TOO_LONG, MYJSON_UTF8_TOO_LONG,
+        MYJSON_UTF8_TWO_CONTS, MYJSON_UTF8_TWO_CONTS, MYJSON_UTF8_TWO_CONTS, MYJSON_UTF8_TWO_CONTS,
+        MYJSON_UTF8_TOO_SHORT | MYJSON_UTF8_OVERLONG_2,
+        MYJSON_UTF8_TOO_SHORT,
+        MYJSON_UTF8_TOO_SHORT | MYJSON_UTF8_OVERLONG_3 | MYJSON_UTF8_SURROGATE,
+        MYJSON_UTF8_TOO_SHORT | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000 | MYJSON_UTF8_OVERLONG_4);
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_OVERLONG_3 | MYJSON_UTF8_OVERLONG_2 | MYJSON_UTF8_OVERLONG_4,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_OVERLONG_2,
+        MYJSON_UTF8_CARRY,
+        MYJSON_UTF8_CARRY,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000 | MYJSON_UTF8_SURROGATE,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000,
+        MYJSON_UTF8_CARRY | MYJSON_UTF8_TOO_LARGE | MYJSON_UTF8_TOO_LARGE_1000);
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT,
+        MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT,
+        MYJSON_UTF8_TOO_LONG | MYJSON_UTF8_OVERLONG_2 | MYJSON_UTF8_TWO_CONTS | MYJSON_UTF8_OVERLONG_3 | MYJSON_UTF8_TOO_LARGE_1000 | MYJSON_UTF8_OVERLONG_4,
+        MYJSON_UTF8_TOO_LONG | MYJSON_UTF8_OVERLONG_2 | MYJSON_UTF8_TWO_CONTS | MYJSON_UTF8_OVERLONG_3 | MYJSON_UTF8_TOO_LARGE,
+        MYJSON_UTF8_TOO_LONG | MYJSON_UTF8_OVERLONG_2 | MYJSON_UTF8_TWO_CONTS | MYJSON_UTF8_SURROGATE | MYJSON_UTF8_TOO_LARGE,
+        MYJSON_UTF8_TOO_LONG | MYJSON_UTF8_OVERLONG_2 | MYJSON_UTF8_TWO_CONTS | MYJSON_UTF8_SURROGATE | MYJSON_UTF8_TOO_LARGE,
+        MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT, MYJSON_UTF8_TOO_SHORT);
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+    __m128i special = _mm_and_si128(_mm_and_si128(
+        _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+        _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+    /* bit 7 set where a byte is the second or third after a 3- or 4-byte lead */
+    __m128i must_be_continuation = _mm_or_si128(
+        _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+        _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    return _mm_xor_si128(_mm_and_si128(must_be_continuation, _mm_set1_epi8((char)0x80)), special);
+}
+
+/* Nonzero where the last bytes of a block start a sequence that does not end in it */
+__attribute__((target("ssse3")))
+static __m128i myjson_utf8_incomplete(__m128i input) {
+    const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm_subs_epu8(input, max);
+}
+
+__attribute__((target("ssse3")))
+static int myjson_utf8_valid_ssse3(const unsigned char *s, size_t len) {
+    __m128i error = _mm_setzero_si128(), prev = _mm_setzero_si128(), incomplete = _mm_setzero_si128(), input;
+    unsigned char tail[16];
+    size_t i;
+    for (i = 0; i + 16 <= len; i += 16) {
+        input = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(input) == 0)
+            error = _mm_or_si128(error, incomplete);
+        else {
+            error = _mm_or_si128(error, myjson_utf8_block(input, prev));
+            incomplete = myjson_utf8_incomplete(input);
+        }
+        prev = input;
     }
+    /* the tail is padded with ASCII, which ends any sequence left open */
+    if (i < len) {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, s + i, len - i);
+        input = _mm_loadu_si128((const __m128i *)tail);
+        error = _mm_or_si128(error, myjson_utf8_block(input, prev));
+        incomplete = myjson_utf8_incomplete(input);
+    }
+    error = _mm_or_si128(error, incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+
+static int myjson_utf8_valid(const char *s, size_t len) {
+#ifdef MYJSON_UTF8_SSSE3
+    if (len >= 16 && __builtin_cpu_supports("ssse3"))
+        return myjson_utf8_valid_ssse3((const unsigned char *)s, len);
+#endif
+    return myjson_utf8_valid_scalar((const unsigned char *)s, len);
 }
 
 static int myjson_parse_string_raw(myjson_context *c, char **str, size_t *len) {
-    size_t head = c->top;
+    size_t head = c->top, n;
     unsigned u, u2;
-    const char *p;
+    const char *p, *run;
+    char *dst, ch, buf[4];
     EXPECT(c, '\"');
     p = c->json;
     for(;;) {
-        char ch = *p++;
-        switch (ch) {
+        /* copy runs of plain characters at once, checking the limits once per run or escape */
+        for (run = p; (unsigned char)*p >= 0x20 && *p != '\"' && *p != '\\'; p++)
+            ;
+        if ((n = p - run) > 0) {
+            if (c->top - head + n > c->max_string)
+                STRING_ERROR(MYJSON_PARSE_STRING_TOO_LONG);
+            /* escapes are ASCII, so each run between them must be valid by itself */
+            if ((c->flags & MYJSON_OPT_VALIDATE_UTF8) && !myjson_utf8_valid(run, n))
+                STRING_ERROR(MYJSON_PARSE_INVALID_UTF8);
+            if ((dst = (char *)myjson_parse_push(c, n)) == NULL)
+                STRING_ERROR(MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED);
+            memcpy(dst, run, n);
+        }
+        switch (*p++) {
             case '\"':
                 *len = c->top - head;
                 *str = myjson_context_pop(c, *len);
                 c->json = p;
                 return MYJSON_PARSE_OK;
             case '\\':
+                n = 1;
                 switch (*p++) {
-                    case '\"': PUTC(c, '\"'); break;
-                    case '\\': PUTC(c, '\\'); break;
-                    case '/':  PUTC(c, '/' ); break;
-                    case 'b':  PUTC(c, '\b'); break;
-                    case 'f':  PUTC(c, '\f'); break;
-                    case 'n':  PUTC(c, '\n'); break;
-                    case 'r':  PUTC(c, '\r'); break;
-                    case 't':  PUTC(c, '\t'); break;
+                    case '\"': ch = '\"'; break;
+                    case '\\': ch = '\\'; break;
+                    case '/':  ch = '/' ; break;
+                    case 'b':  ch = '\b'; break;
+                    case 'f':  ch = '\f'; break;
+                    case 'n':  ch = '\n'; break;
+                    case 'r':  ch = '\r'; break;
+                    case 't':  ch = '\t'; break;
                     case 'u':
                         if (!(p = myjson_parse_hex4(p, &u)))
                             STRING_ERROR(MYJSON_PARSE_INVALID_UNICODE_HEX);
@@ -202,18 +681,27 @@ static int myjson_parse_string_raw(myjson_context *c, char **str, size_t *len) {
                                 STRING_ERROR(MYJSON_PARSE_INVALID_UNICODE_SURROGATE);
                             u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
                         }
-                        myjson_encode_utf8(c, u);
+                        else if (u >= 0xDC00 && u <= 0xDFFF && (c->flags & MYJSON_OPT_VALIDATE_UTF8))
+                            STRING_ERROR(MYJSON_PARSE_INVALID_UNICODE_SURROGATE); /* no valid UTF-8 for a lone low surrogate */
+                        n = myjson_encode_utf8(buf, u);
+                        ch = buf[0];
                         break;
                     default:
                         STRING_ERROR(MYJSON_PARSE_INVALID_STRING_ESCAPE);
                 }
+                if (c->top - head + n > c->max_string)
+                    STRING_ERROR(MYJSON_PARSE_STRING_TOO_LONG);
+                if ((dst = (char *)myjson_parse_push(c, n)) == NULL)
+                    STRING_ERROR(MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED);
+                if (n == 1)
+                    *dst = ch;
+                else
+                    memcpy(dst, buf, n);
                 break;
             case '\0':
                 STRING_ERROR(MYJSON_PARSE_MISS_QUOTATION_MARK);
             default:
-                if ((unsigned char)ch < 0x20)
-                    STRING_ERROR(MYJSON_PARSE_INVALID_STRING_CHAR);
-                PUTC(c, ch);
+                STRING_ERROR(MYJSON_PARSE_INVALID_STRING_CHAR);
         }
     }
 }
@@ -222,170 +710,793 @@ static int myjson_parse_string(myjson_context* c, myjson_value* v) {
     int ret;
     char *s;
     size_t len;
-    if ((ret = myjson_parse_string_raw(c, &s, &len)) == MYJSON_PARSE_OK)
-        myjson_set_string(v, s, len);
+    if (c->flags & MYJSON_OPT_VIEWS) {
+        /* Strings without escapes can refer to the input directly */
+        const char *p = c->json + 1;
+        while (*p != '\"' && *p != '\\' && (unsigned char)*p >= 0x20)
+            p++;
+        if (*p == '\"') {
+            if ((size_t)(p - (c->json + 1)) > c->max_string)
+                return MYJSON_PARSE_STRING_TOO_LONG;
+            if ((c->flags & MYJSON_OPT_VALIDATE_UTF8) && !myjson_utf8_valid(c->json + 1, p - (c->json + 1)))
+                return MYJSON_PARSE_INVALID_UTF8;
+            v->val.s.s = (char *)(c->json + 1);
+            v->val.s.len = p - (c->json + 1);
+            v->type = MYJSON_STRING;
+            v->flags |= MYJSON_VALUE_VIEW;
+            c->json = p + 1;
+            return MYJSON_PARSE_OK;
+        }
+    }
+    if ((ret = myjson_parse_string_raw(c, &s, &len)) == MYJSON_PARSE_OK) {
+        if (!myjson_parse_charge(c, len + 1))
+            return MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+        v->val.s.s = myjson_string_alloc(c->allocator, s, len);
+        v->val.s.len = len;
+        v->type = MYJSON_STRING;
+    }
     return ret;
 }
 
-static int myjson_parse_value(myjson_context *c, myjson_value *v);
+/* Containers being parsed keep a frame on the context stack, followed by the elements or
+ * members parsed so far. Frames link to their parent by stack offset as the stack may move. */
+typedef struct {
+    size_t parent, size;
+    char *key; /* of the member whose value is being parsed */
+    size_t klen;
+    myjson_type type;
+    unsigned flags;
+} myjson_parse_frame;
+
+#define MYJSON_NO_FRAME ((size_t)-1)
+#define MYJSON_FRAME(c, offset) ((myjson_parse_frame *)((c)->stack + (offset)))
 
-static int myjson_parse_array(myjson_context *c, myjson_value *v) {
-    size_t i, size = 0;
+static int myjson_parse_key(myjson_context *c, char **key, size_t *klen) {
+    char *str;
     int ret;
-    EXPECT(c, '[');
+    *key = NULL;
+    if (*c->json != '"')
+        return MYJSON_PARSE_MISS_KEY;
+    if ((ret = myjson_parse_string_raw(c, &str, klen)) != MYJSON_PARSE_OK)
+        return ret;
+    if (!myjson_parse_charge(c, *klen + 1))
+        return MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+    *key = myjson_key_alloc(c->allocator, str, *klen);
     myjson_parse_whitespace(c);
-    if (*c->json == ']') {
-        c->json++;
-        v->type = MYJSON_ARRAY;
-        v->val.arr.size = 0;
-        v->val.arr.e = NULL;
-        return MYJSON_PARSE_OK;
-    }
+    if (*c->json != ':')
+        return MYJSON_PARSE_MISS_COLON;
+    c->json++;
+    myjson_parse_whitespace(c);
+    return MYJSON_PARSE_OK;
+}
 
+static int myjson_parse_value(myjson_context *c, myjson_value *v) {
+    myjson_parse_frame *f;
+    myjson_member *m;
+    myjson_value e;
+    void *p;
+    size_t i, size, frame = MYJSON_NO_FRAME, depth = 0;
+    myjson_type type;
+    char *key;
+    size_t klen;
+    int ret;
     for (;;) {
-        myjson_value e;
+        /* parse a value into e, or open a container and go on with its first child */
         myjson_init(&e);
-        if ((ret = myjson_parse_value(c, &e)) != MYJSON_PARSE_OK)
-            break;
-        memcpy(myjson_context_push(c, sizeof(myjson_value)), &e, sizeof(myjson_value));
-        size++;
-        myjson_parse_whitespace(c);
-        if (*c->json == ',') {
-            c->json++;
-            myjson_parse_whitespace(c);
+        switch (*c->json) {
+            case 't': ret = myjson_parse_literal(c, &e, "true", MYJSON_TRUE); break;
+            case 'f': ret = myjson_parse_literal(c, &e, "false", MYJSON_FALSE); break;
+            case 'n': ret = myjson_parse_literal(c, &e, "null", MYJSON_NULL); break;
+            default: ret = myjson_parse_number(c, &e); break;
+            case '"': ret = myjson_parse_string(c, &e); break;
+            case '\0': ret = MYJSON_PARSE_EXPECT_VALUE; break;
+            case '[':
+            case '{':
+                if (depth == c->max_depth) {
+                    ret = MYJSON_PARSE_NESTING_TOO_DEEP;
+                    break;
+                }
+                type = *c->json == '[' ? MYJSON_ARRAY : MYJSON_OBJECT;
+                c->json++;
+                myjson_parse_whitespace(c);
+                if (*c->json == (type == MYJSON_ARRAY ? ']' : '}')) {
+                    c->json++;
+                    e.type = type;
+                    if (type == MYJSON_ARRAY) {
+                        e.val.arr.e = NULL;
+                        e.val.arr.size = e.val.arr.capacity = 0;
+                    }
+                    else {
+                        e.val.obj.m = NULL;
+                        e.val.obj.size = e.val.obj.capacity = 0;
+                    }
+                    ret = MYJSON_PARSE_OK;
+                    break;
+                }
+                if ((f = (myjson_parse_frame *)myjson_parse_push(c, sizeof(myjson_parse_frame))) == NULL) {
+                    ret = MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+                    break;
+                }
+                f->parent = frame;
+                f->size = 0;
+                f->key = NULL;
+                f->type = type;
+                f->flags = 0;
+                frame = c->top - sizeof(myjson_parse_frame);
+                depth++;
+                MYJSON_STAT_MAX(c, max_depth, depth);
+                if (type == MYJSON_ARRAY)
+                    continue;
+                ret = myjson_parse_key(c, &key, &klen);
+                f = MYJSON_FRAME(c, frame);
+                f->key = key;
+                f->klen = klen;
+                if (ret != MYJSON_PARSE_OK)
+                    goto error;
+                continue;
         }
-        else if (*c->json == ']') {
+        if (ret != MYJSON_PARSE_OK)
+            goto error;
+        /* e is complete: append it to its container, closing every container that ends here */
+        for (;;) {
+            MYJSON_STAT_ADD(c, values[e.type], 1);
+            if (frame == MYJSON_NO_FRAME) {
+                memcpy(v, &e, sizeof(myjson_value));
+                return MYJSON_PARSE_OK;
+            }
+            f = MYJSON_FRAME(c, frame);
+            if (f->type == MYJSON_OBJECT && f->size == c->max_members)
+                ret = MYJSON_PARSE_TOO_MANY_MEMBERS;
+            else if ((p = myjson_parse_push(c, f->type == MYJSON_ARRAY ? sizeof(myjson_value) : sizeof(myjson_member))) == NULL)
+                ret = MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+            if (ret != MYJSON_PARSE_OK) {
+                myjson_free(&e);
+                goto error;
+            }
+            f = MYJSON_FRAME(c, frame);
+            f->flags |= e.flags & (MYJSON_VALUE_VIEW | MYJSON_VALUE_HAS_VIEWS) ? MYJSON_VALUE_HAS_VIEWS : 0;
+            f->size++;
+            if (f->type == MYJSON_ARRAY)
+                memcpy(p, &e, sizeof(myjson_value));
+            else {
+                key = f->key;
+                klen = f->klen;
+                f->key = NULL;
+                m = (myjson_member *)p;
+                m->key = key;
+                m->klen = klen;
+                memcpy(&m->v, &e, sizeof(myjson_value));
+            }
+            f = MYJSON_FRAME(c, frame);
+            myjson_parse_whitespace(c);
+            if (*c->json == ',') {
+                c->json++;
+                myjson_parse_whitespace(c);
+                if (f->type == MYJSON_OBJECT) {
+                    ret = myjson_parse_key(c, &key, &klen);
+                    f = MYJSON_FRAME(c, frame);
+                    f->key = key;
+                    f->klen = klen;
+                    if (ret != MYJSON_PARSE_OK)
+                        goto error;
+                }
+                break;
+            }
+            if (*c->json != (f->type == MYJSON_ARRAY ? ']' : '}')) {
+                ret = f->type == MYJSON_ARRAY ? MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+                goto error;
+            }
             c->json++;
-            v->type = MYJSON_ARRAY;
-            v->val.arr.size = size;
-            size *= sizeof(myjson_value);
-            memcpy(v->val.arr.e = (myjson_value*)malloc(size), myjson_context_pop(c, size), size);
-            return MYJSON_PARSE_OK;
-        }
-        else {
-            ret = MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-            break;
+            if (!myjson_parse_charge(c, f->size * (f->type == MYJSON_ARRAY ? sizeof(myjson_value) : sizeof(myjson_member)) + sizeof(myjson_block))) {
+                ret = MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+                goto error;
+            }
+            /* the children sit right above the frame */
+            e.type = f->type;
+            e.flags = f->flags;
+            if (f->type == MYJSON_ARRAY) {
+                e.val.arr.size = e.val.arr.capacity = f->size;
+                size = f->size * sizeof(myjson_value);
+                memcpy(e.val.arr.e = (myjson_value *)myjson_block_alloc(c->allocator, size), myjson_context_pop(c, size), size);
+            }
+            else {
+                e.val.obj.size = e.val.obj.capacity = f->size;
+                size = f->size * sizeof(myjson_member);
+                memcpy(e.val.obj.m = (myjson_member *)myjson_block_alloc(c->allocator, size), myjson_context_pop(c, size), size);
+                if (c->flags & MYJSON_OPT_SORT_KEYS) {
+                    myjson_sort_members(e.val.obj.m, f->size, c->allocator);
+                    e.flags |= MYJSON_VALUE_SORTED;
+                }
+            }
+            frame = f->parent;
+            myjson_context_pop(c, sizeof(myjson_parse_frame));
+            depth--;
         }
     }
-
-    for (i = 0; i < size; i++) {
-        myjson_free((myjson_value*)myjson_context_pop(c, sizeof(myjson_value)));
+error:
+    while (frame != MYJSON_NO_FRAME) {
+        f = MYJSON_FRAME(c, frame);
+        if (f->key != NULL)
+            MYJSON_FREE(c->allocator, f->key);
+        for (i = 0; i < f->size; i++) {
+            if (f->type == MYJSON_ARRAY)
+                myjson_free((myjson_value *)myjson_context_pop(c, sizeof(myjson_value)));
+            else {
+                m = (myjson_member *)myjson_context_pop(c, sizeof(myjson_member));
+                MYJSON_FREE(c->allocator, m->key);
+                myjson_free(&m->v);
+            }
+        }
+        frame = f->parent;
+        myjson_context_pop(c, sizeof(myjson_parse_frame));
     }
     return ret;
 }
 
-static int myjson_parse_object(myjson_context *c, myjson_value *v) {
-    size_t i, size;
-    myjson_member m;
-    int ret;
-    EXPECT(c, '{');
-    myjson_parse_whitespace(c);
-    if (*c->json == '}') {
-        c->json++;
-        v->type = MYJSON_OBJECT;
-        v->val.obj.m = 0;
-        v->val.obj.size = 0;
-        return MYJSON_PARSE_OK;
+/* Projection paths compile into a trie. Node 0 is the root and index 0 ends child and sibling lists. */
+typedef struct {
+    const char *key; /* NULL for [*] */
+    size_t klen, child, sibling;
+    int leaf; /* the whole value is kept */
+} myjson_projection_node;
+
+#define MYJSON_NODE(nodes, i) ((myjson_projection_node *)(nodes)->stack + (i))
+
+static size_t myjson_projection_child(const myjson_context *nodes, size_t n, const char *key, size_t klen) {
+    size_t i;
+    for (i = MYJSON_NODE(nodes, n)->child; i != 0; i = MYJSON_NODE(nodes, i)->sibling) {
+        const myjson_projection_node *child = MYJSON_NODE(nodes, i);
+        if (key == NULL ? child->key == NULL : child->key != NULL && child->klen == klen && memcmp(child->key, key, klen) == 0)
+            return i;
     }
-    m.key = NULL;
-    size = 0;
-    for(;;) {
-        char *str;
-        myjson_init(&m.v);
-        // parse key
-        if (*c->json != '"') {
-            ret = MYJSON_PARSE_MISS_KEY;
-            break;
-        }
-        if ((ret = myjson_parse_string_raw(c, &str, &m.klen)) != MYJSON_PARSE_OK)
-            break;
-        memcpy(m.key = (char *)malloc(m.klen + 1), str, m.klen);
-        m.key[m.klen] = '\0';
-        // parse colon
-        myjson_parse_whitespace(c);
-        if (*c->json != ':') {
-            ret = MYJSON_PARSE_MISS_COLON;
-            break;
+    return 0;
+}
+
+static int myjson_projection_has_keys(const myjson_context *nodes, size_t n) {
+    size_t i;
+    for (i = MYJSON_NODE(nodes, n)->child; i != 0; i = MYJSON_NODE(nodes, i)->sibling)
+        if (MYJSON_NODE(nodes, i)->key != NULL)
+            return 1;
+    return 0;
+}
+
+/* Paths are keys separated by '.', with [*] for every element of an array: "items[*].price" */
+static int myjson_projection_compile(myjson_context *nodes, const char *const *paths, size_t count) {
+    myjson_projection_node *node;
+    const char *p, *key;
+    size_t i, n, child, klen;
+    node = (myjson_projection_node *)myjson_context_push(nodes, sizeof(myjson_projection_node));
+    memset(node, 0, sizeof(myjson_projection_node));
+    for (i = 0; i < count; i++) {
+        p = paths[i];
+        n = 0;
+        while (*p != '\0') {
+            if (*p == '[') {
+                if (p[1] != '*' || p[2] != ']')
+                    return 0;
+                key = NULL;
+                klen = 0;
+                p += 3;
+            }
+            else {
+                for (key = p; *p != '\0' && *p != '.' && *p != '['; p++)
+                    ;
+                if ((klen = p - key) == 0)
+                    return 0;
+            }
+            if (*p == '.' && (*++p == '\0' || *p == '.' || *p == '['))
+                return 0;
+            if ((child = myjson_projection_child(nodes, n, key, klen)) == 0) {
+                child = nodes->top / sizeof(myjson_projection_node);
+                node = (myjson_projection_node *)myjson_context_push(nodes, sizeof(myjson_projection_node));
+                node->key = key;
+                node->klen = klen;
+                node->child = 0;
+                node->sibling = MYJSON_NODE(nodes, n)->child;
+                node->leaf = 0;
+                MYJSON_NODE(nodes, n)->child = child;
+            }
+            n = child;
         }
-        c->json++;
-        myjson_parse_whitespace(c);
-        // parse value
-        if ((ret = myjson_parse_value(c, &m.v)) != MYJSON_PARSE_OK)
-            break;
-        memcpy(myjson_context_push(c, sizeof(myjson_member)), &m, sizeof(myjson_member));
-        size++;
-        m.key = NULL;
+        MYJSON_NODE(nodes, n)->leaf = 1;
+    }
+    return 1;
+}
 
-        myjson_parse_whitespace(c);
-        if (*c->json == ',') {
-            c->json++;
+/* Parses the value at c->json keeping only what node n asks for; *found is 0 if nothing matched.
+ * Whatever is not kept is passed over by myjson_skip_value() without being validated. */
+static int myjson_parse_projection(myjson_context *c, const myjson_context *nodes, size_t n, size_t depth, myjson_value *v, int *found) {
+    const myjson_projection_node *node = MYJSON_NODE(nodes, n);
+    size_t head = c->top, size = 0, i, klen, child, star = 0;
+    myjson_type type;
+    myjson_member *m;
+    myjson_value e;
+    unsigned flags = 0;
+    char *str, *key;
+    void *p;
+    int ret = MYJSON_PARSE_OK, kept;
+    myjson_init(v);
+    *found = 1;
+    if (node->leaf) {
+        c->max_depth -= depth;
+        ret = myjson_parse_value(c, v);
+        c->max_depth += depth;
+        return ret;
+    }
+    type = *c->json == '[' ? MYJSON_ARRAY : *c->json == '{' ? MYJSON_OBJECT : MYJSON_NULL;
+    if (type == MYJSON_ARRAY)
+        star = myjson_projection_child(nodes, n, NULL, 0);
+    if (type == MYJSON_NULL || (type == MYJSON_ARRAY && star == 0) || (type == MYJSON_OBJECT && !myjson_projection_has_keys(nodes, n))) {
+        *found = 0;
+        return myjson_skip_value(&c->json);
+    }
+    if (depth == c->max_depth)
+        return MYJSON_PARSE_NESTING_TOO_DEEP;
+    c->json++;
+    myjson_parse_whitespace(c);
+    if (*c->json != (type == MYJSON_ARRAY ? ']' : '}')) {
+        for (;;) {
+            key = NULL;
+            klen = 0;
+            if (type == MYJSON_ARRAY)
+                child = star;
+            else {
+                if (*c->json != '"') {
+                    ret = MYJSON_PARSE_MISS_KEY;
+                    break;
+                }
+                if ((ret = myjson_parse_string_raw(c, &str, &klen)) != MYJSON_PARSE_OK)
+                    break;
+                child = myjson_projection_child(nodes, n, str, klen);
+                if (child != 0) {
+                    if (!myjson_parse_charge(c, klen + 1)) {
+                        ret = MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+                        break;
+                    }
+                    key = myjson_key_alloc(c->allocator, str, klen);
+                }
+                myjson_parse_whitespace(c);
+                if (*c->json != ':') {
+                    MYJSON_FREE(c->allocator, key);
+                    ret = MYJSON_PARSE_MISS_COLON;
+                    break;
+                }
+                c->json++;
+                myjson_parse_whitespace(c);
+            }
+            if (child == 0)
+                ret = myjson_skip_value(&c->json);
+            else if ((ret = myjson_parse_projection(c, nodes, child, depth + 1, &e, &kept)) == MYJSON_PARSE_OK) {
+                if (type == MYJSON_OBJECT && !kept)
+                    MYJSON_FREE(c->allocator, key);
+                else if (c->max_members == size && type == MYJSON_OBJECT)
+                    ret = MYJSON_PARSE_TOO_MANY_MEMBERS;
+                else if ((p = myjson_parse_push(c, type == MYJSON_ARRAY ? sizeof(myjson_value) : sizeof(myjson_member))) == NULL)
+                    ret = MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+                else {
+                    /* elements keep their positions, as null where nothing matched */
+                    flags |= e.flags & (MYJSON_VALUE_VIEW | MYJSON_VALUE_HAS_VIEWS) ? MYJSON_VALUE_HAS_VIEWS : 0;
+                    if (type == MYJSON_ARRAY)
+                        memcpy(p, &e, sizeof(myjson_value));
+                    else {
+                        m = (myjson_member *)p;
+                        m->key = key;
+                        m->klen = klen;
+                        memcpy(&m->v, &e, sizeof(myjson_value));
+                    }
+                    size++;
+                    key = NULL;
+                }
+                if (ret != MYJSON_PARSE_OK)
+                    myjson_free(&e);
+            }
+            if (ret != MYJSON_PARSE_OK) {
+                MYJSON_FREE(c->allocator, key);
+                break;
+            }
             myjson_parse_whitespace(c);
-        }
-        else if (*c->json == '}') {
-            size_t s = sizeof(myjson_member) * size;
-            c->json++;
-            v->type = MYJSON_OBJECT;
-            v->val.obj.size = size;
-            memcpy(v->val.obj.m = (myjson_member *)malloc(s), myjson_context_pop(c, s), s);
-            return MYJSON_PARSE_OK;
-        }
-        else {
-            ret = MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+            if (*c->json == ',') {
+                c->json++;
+                myjson_parse_whitespace(c);
+                continue;
+            }
+            if (*c->json != (type == MYJSON_ARRAY ? ']' : '}'))
+                ret = type == MYJSON_ARRAY ? MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
             break;
         }
     }
-    // pop and free stack
-    free(m.key);
-    for (i = 0; i < size; i++) {
-        myjson_member *m = (myjson_member *)myjson_context_pop(c, sizeof(myjson_member));
-        free(m->key);
-        myjson_free(&m->v);
+    i = size * (type == MYJSON_ARRAY ? sizeof(myjson_value) : sizeof(myjson_member));
+    if (ret == MYJSON_PARSE_OK && size > 0 && !myjson_parse_charge(c, i + sizeof(myjson_block)))
+        ret = MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED;
+    if (ret != MYJSON_PARSE_OK) {
+        while (size-- > 0) {
+            if (type == MYJSON_ARRAY)
+                myjson_free((myjson_value *)myjson_context_pop(c, sizeof(myjson_value)));
+            else {
+                m = (myjson_member *)myjson_context_pop(c, sizeof(myjson_member));
+                MYJSON_FREE(c->allocator, m->key);
+                myjson_free(&m->v);
+            }
+        }
+        assert(c->top == head);
+        return ret;
     }
-    v->type = MYJSON_NULL;
-    return ret;
-}
-
-static int myjson_parse_value(myjson_context *c, myjson_value *v) { 
-    switch(*c->json) {
-        // case 't': return myjson_parse_true(c, v);
-        // case 'f': return myjson_parse_false(c, v);
-        // case 'n': return myjson_parse_null(c, v);
-        case 't': return myjson_parse_literal(c, v, "true", MYJSON_TRUE);
-        case 'f': return myjson_parse_literal(c, v, "false", MYJSON_FALSE);
-        case 'n': return myjson_parse_literal(c, v, "null", MYJSON_NULL);
-        default: return myjson_parse_number(c, v);
-        case '"': return myjson_parse_string(c, v);
-        case '[': return myjson_parse_array(c, v);
-        case '{': return myjson_parse_object(c, v);
-        case '\0': return MYJSON_PARSE_EXPECT_VALUE;
+    c->json++;
+    v->type = type;
+    v->flags = flags;
+    if (type == MYJSON_ARRAY) {
+        v->val.arr.size = v->val.arr.capacity = size;
+        v->val.arr.e = size > 0 ? (myjson_value *)myjson_block_alloc(c->allocator, i) : NULL;
+        if (size > 0)
+            memcpy(v->val.arr.e, myjson_context_pop(c, i), i);
+    }
+    else {
+        v->val.obj.size = v->val.obj.capacity = size;
+        v->val.obj.m = size > 0 ? (myjson_member *)myjson_block_alloc(c->allocator, i) : NULL;
+        if (size > 0)
+            memcpy(v->val.obj.m, myjson_context_pop(c, i), i);
+        if (c->flags & MYJSON_OPT_SORT_KEYS) {
+            myjson_sort_members(v->val.obj.m, size, c->allocator);
+            v->flags |= MYJSON_VALUE_SORTED;
+        }
     }
+    return MYJSON_PARSE_OK;
 }
 
-int myjson_parse(myjson_value *v, const char *json) {
-    myjson_context c;
-    int ret;
+int myjson_parse_ex(myjson_value *v, const char *json, const myjson_parse_options *options) {
+    myjson_context c, nodes;
+    int ret, found;
+#ifdef MYJSON_STATS
+    unsigned long long start = myjson_stats_clock();
+#endif
     assert(v != NULL);
+    myjson_context_init(&c, options != NULL && options->allocator != NULL ? options->allocator : myjson_global_allocator, 0);
+    if (options != NULL && options->stats != NULL)
+        memset(options->stats, 0, sizeof(myjson_stats));
+#ifdef MYJSON_STATS
+    c.stats = options != NULL ? options->stats : NULL;
+#endif
     c.json = json;
-    c.stack = NULL;
-    c.size = c.top = 0;
+    c.flags = options != NULL ? options->flags : 0;
+    c.max_depth = options != NULL && options->max_depth > 0 ? options->max_depth : MYJSON_PARSE_MAX_DEPTH;
+    c.max_bytes = options != NULL && options->max_bytes > 0 ? options->max_bytes : (size_t)-1;
+    c.max_string = options != NULL && options->max_string > 0 ? options->max_string : (size_t)-1;
+    c.max_members = options != NULL && options->max_members > 0 ? options->max_members : (size_t)-1;
+    c.allocated = 0;
     myjson_init(v);
+    if (options != NULL && options->max_input > 0 && strnlen(json, options->max_input + 1) > options->max_input)
+        return MYJSON_PARSE_INPUT_TOO_LARGE;
     myjson_parse_whitespace(&c);
-    if ((ret = myjson_parse_value(&c, v)) == MYJSON_PARSE_OK) {
+    if (options != NULL && options->npaths > 0) {
+        myjson_context_init(&nodes, c.allocator, 0);
+        if (!myjson_projection_compile(&nodes, options->paths, options->npaths))
+            ret = MYJSON_PARSE_INVALID_PROJECTION;
+        else
+            ret = myjson_parse_projection(&c, &nodes, 0, 0, v, &found);
+        MYJSON_FREE(nodes.allocator, nodes.stack);
+    }
+    else
+        ret = myjson_parse_value(&c, v);
+    if (ret == MYJSON_PARSE_OK) {
         myjson_parse_whitespace(&c);
         if (*c.json != '\0') {
-            v->type = MYJSON_NULL;
+            myjson_free(v);
             ret = MYJSON_PARSE_ROOT_NOT_SINGULAR;
         }
     }
     assert(c.top == 0);
-    free(c.stack);
+#ifdef MYJSON_STATS
+    myjson_stats_finish(&c, c.json - json, start);
+#endif
+    MYJSON_FREE(c.allocator, c.stack);
     return ret;
 }
 
-static void myjson_stringify_string(myjson_context *c, const char *s, size_t len) {
-    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-    size_t i, size;
-    char *head, *p;
+int myjson_parse(myjson_value *v, const char *json) {
+    return myjson_parse_ex(v, json, NULL);
+}
+
+struct myjson_mapping {
+    void *base;
+    size_t len;
+};
+
+int myjson_parse_file(myjson_value *v, const char *path, unsigned flags, myjson_mapping **mapping) {
+    myjson_parse_options options;
+    myjson_mapping *m;
+    struct stat st;
+    long page;
+    int fd, ret;
+    assert(v != NULL && path != NULL);
+    assert(!(flags & MYJSON_OPT_VIEWS) || mapping != NULL);
+    myjson_init(v);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return MYJSON_PARSE_FILE_ERROR;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MYJSON_PARSE_FILE_ERROR;
+    }
+    m = (myjson_mapping *)MYJSON_MALLOC(myjson_global_allocator, sizeof(myjson_mapping));
+    /* The parser needs a terminating '\0'. Reserve one zero page past the end of the file
+     * and map the file over the front of it; the tail of the last file page is zero-filled too. */
+    page = sysconf(_SC_PAGESIZE);
+    m->len = ((size_t)st.st_size / page + 1) * page;
+    m->base = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m->base == MAP_FAILED) {
+        MYJSON_FREE(myjson_global_allocator, m);
+        close(fd);
+        return MYJSON_PARSE_FILE_ERROR;
+    }
+    if (st.st_size > 0) {
+        if (mmap(m->base, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            myjson_unmap(m);
+            close(fd);
+            return MYJSON_PARSE_FILE_ERROR;
+        }
+        posix_madvise(m->base, st.st_size, POSIX_MADV_SEQUENTIAL);
+    }
+    close(fd);
+    options.flags = flags;
+    options.max_depth = 0;
+    options.allocator = NULL;
+    options.max_input = options.max_bytes = options.max_string = options.max_members = 0;
+    options.stats = NULL;
+    options.paths = NULL;
+    options.npaths = 0;
+    ret = myjson_parse_ex(v, (const char *)m->base, &options);
+    if (ret == MYJSON_PARSE_OK && (flags & MYJSON_OPT_VIEWS))
+        *mapping = m;
+    else {
+        myjson_unmap(m);
+        if (mapping)
+            *mapping = NULL;
+    }
+    return ret;
+}
+
+int myjson_frozen_map(myjson_frozen *f, const char *path, myjson_mapping **mapping) {
+    myjson_mapping *m;
+    struct stat st;
+    int fd, ret;
+    assert(f != NULL && path != NULL && mapping != NULL);
+    f->data = NULL;
+    f->size = 0;
+    *mapping = NULL;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return MYJSON_PARSE_FILE_ERROR;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MYJSON_PARSE_FILE_ERROR;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return MYJSON_PARSE_INVALID_BINARY;
+    }
+    m = (myjson_mapping *)MYJSON_MALLOC(myjson_global_allocator, sizeof(myjson_mapping));
+    m->len = (size_t)st.st_size;
+    m->base = mmap(NULL, m->len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m->base == MAP_FAILED) {
+        MYJSON_FREE(myjson_global_allocator, m);
+        return MYJSON_PARSE_FILE_ERROR;
+    }
+    if ((ret = myjson_frozen_open(f, m->base, m->len)) != MYJSON_PARSE_OK)
+        myjson_unmap(m);
+    else
+        *mapping = m;
+    return ret;
+}
+
+void myjson_unmap(myjson_mapping *mapping) {
+    if (mapping) {
+        munmap(mapping->base, mapping->len);
+        MYJSON_FREE(myjson_global_allocator, mapping);
+    }
+}
+
+/* Locates the top-level elements of the array at c->json without parsing them.
+ * bounds[i] is the first byte of element i and bounds[i + 1] - 1 its trailing ',' or ']',
+ * so n elements produce n + 1 bounds on the context stack. Only quotes, escapes and
+ * nesting are tracked; anything else is left for the element parsers to reject. */
+static int myjson_split_array(myjson_context *c, size_t *count) {
+    const char *p = c->json;
+    size_t depth = 0, n = 0;
+    EXPECT(c, '[');
+    p++;
+    *(const char **)myjson_context_push(c, sizeof(const char *)) = p;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+    if (*p == ']') {
+        /* an empty array has no element, not one blank one */
+        c->json = p + 1;
+        *count = 0;
+        return 1;
+    }
+    for (;;) {
+        char ch = *p++;
+        switch (ch) {
+            case '\0':
+                return 0;
+            case '\"':
+                for (;;) {
+                    ch = *p++;
+                    if (ch == '\"')
+                        break;
+                    if (ch == '\0' || (ch == '\\' && *p++ == '\0'))
+                        return 0;
+                }
+                break;
+            case '[':
+            case '{':
+                depth++;
+                break;
+            case '}':
+                if (depth == 0)
+                    return 0;
+                depth--;
+                break;
+            case ']':
+                if (depth > 0) {
+                    depth--;
+                    break;
+                }
+                /* fall through */
+            case ',':
+                if (depth > 0)
+                    break;
+                *(const char **)myjson_context_push(c, sizeof(const char *)) = p;
+                n++;
+                if (ch == ']') {
+                    c->json = p;
+                    *count = n;
+                    return 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+typedef struct {
+    const char **bounds;
+    myjson_value *e;
+    size_t begin, end;
+    pthread_t tid;
+    int threaded, ret;
+} myjson_parse_task;
+
+static void *myjson_parse_elements(void *arg) {
+    myjson_parse_task *t = (myjson_parse_task *)arg;
+    myjson_context c;
+    size_t i;
+    myjson_context_init(&c, myjson_global_allocator, 0);
+    c.flags = 0;
+    c.max_depth = MYJSON_PARSE_MAX_DEPTH - 1; /* below the root array */
+    c.max_bytes = c.max_string = c.max_members = (size_t)-1;
+    c.allocated = 0;
+    t->ret = MYJSON_PARSE_OK;
+    for (i = t->begin; i < t->end; i++) {
+        c.json = t->bounds[i];
+        myjson_parse_whitespace(&c);
+        if ((t->ret = myjson_parse_value(&c, &t->e[i])) != MYJSON_PARSE_OK)
+            break;
+        myjson_parse_whitespace(&c);
+        if (c.json != t->bounds[i + 1] - 1) {
+            t->ret = MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            break;
+        }
+    }
+    assert(c.top == 0);
+    MYJSON_FREE(c.allocator, c.stack);
+    return NULL;
+}
+
+/* 0 means one thread per online CPU; never give a thread fewer than the minimum elements */
+static size_t myjson_thread_count(size_t threads, size_t n) {
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+    if (threads > n / MYJSON_PARSE_PARALLEL_MIN_ELEMENTS)
+        threads = n / MYJSON_PARSE_PARALLEL_MIN_ELEMENTS;
+    return threads == 0 ? 1 : threads;
+}
+
+/* First element index whose start lies at or after p */
+static size_t myjson_lower_bound(const char **bounds, size_t n, const char *p) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (bounds[mid] < p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int myjson_parse_parallel(myjson_value *v, const char *json, size_t threads) {
+    myjson_context c;
+    myjson_parse_task *tasks;
+    const char **bounds;
+    myjson_value *e;
+    size_t i, n;
+    int ret = MYJSON_PARSE_OK;
+    assert(v != NULL);
+    c.json = json;
+    myjson_context_init(&c, myjson_global_allocator, 0);
+    c.flags = 0;
+    myjson_parse_whitespace(&c);
+    if (*c.json != '[' || !myjson_split_array(&c, &n)) {
+        MYJSON_FREE(c.allocator, c.stack);
+        return myjson_parse(v, json);
+    }
+    myjson_parse_whitespace(&c);
+    if (*c.json != '\0') {
+        MYJSON_FREE(c.allocator, c.stack);
+        return myjson_parse(v, json);
+    }
+    if (n == 0) {
+        MYJSON_FREE(c.allocator, c.stack);
+        myjson_init(v);
+        v->type = MYJSON_ARRAY;
+        v->val.arr.e = NULL;
+        v->val.arr.size = v->val.arr.capacity = 0;
+        return MYJSON_PARSE_OK;
+    }
+    bounds = (const char **)c.stack;
+
+    threads = myjson_thread_count(threads, n);
+
+    e = (myjson_value *)myjson_block_alloc(myjson_global_allocator, n * sizeof(myjson_value));
+    for (i = 0; i < n; i++)
+        myjson_init(&e[i]);
+    tasks = (myjson_parse_task *)MYJSON_MALLOC(myjson_global_allocator, threads * sizeof(myjson_parse_task));
+
+    /* Split by bytes rather than by count so that uneven elements still balance */
+    for (i = 0; i < threads; i++) {
+        tasks[i].bounds = bounds;
+        tasks[i].e = e;
+        tasks[i].begin = i == 0 ? 0 : tasks[i - 1].end;
+        tasks[i].end = i + 1 == threads ? n :
+            myjson_lower_bound(bounds, n, bounds[0] + (bounds[n] - bounds[0]) / threads * (i + 1));
+        if (tasks[i].end < tasks[i].begin)
+            tasks[i].end = tasks[i].begin;
+    }
+    for (i = 1; i < threads; i++)
+        tasks[i].threaded = pthread_create(&tasks[i].tid, NULL, myjson_parse_elements, &tasks[i]) == 0;
+    myjson_parse_elements(&tasks[0]);
+    for (i = 1; i < threads; i++) {
+        if (tasks[i].threaded)
+            pthread_join(tasks[i].tid, NULL);
+        else
+            myjson_parse_elements(&tasks[i]);
+    }
+    for (i = 0; i < threads; i++)
+        if (tasks[i].ret != MYJSON_PARSE_OK)
+            ret = tasks[i].ret;
+
+    MYJSON_FREE(myjson_global_allocator, tasks);
+    MYJSON_FREE(c.allocator, c.stack);
+    if (ret != MYJSON_PARSE_OK) {
+        /* Errors are the rare path: rerun serially so the reported code matches myjson_parse exactly */
+        for (i = 0; i < n; i++)
+            myjson_free(&e[i]);
+        myjson_block_free(e);
+        return myjson_parse(v, json);
+    }
+    myjson_init(v);
+    v->type = MYJSON_ARRAY;
+    v->val.arr.e = e;
+    v->val.arr.size = v->val.arr.capacity = n;
+    return MYJSON_PARSE_OK;
+}
+
+static void myjson_stringify_string(myjson_context *c, const char *s, size_t len) {
+    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+    size_t i, size;
+    char *head, *p;
     assert(s != NULL);
     p = head = myjson_context_push(c, size = len * 6 + 2);
     *p++ = '"';
@@ -417,74 +1528,392 @@ static void myjson_stringify_string(myjson_context *c, const char *s, size_t len
     c->top -= size - (p - head);
 }
 
-static void myjson_stringify_value(myjson_context *c, const myjson_value *v) {
+typedef struct {
+    const myjson_value *v;
+    const myjson_member *m; /* v's members, or a sorted copy of them to be freed */
     size_t i;
-    switch (v->type) {
-        case MYJSON_NULL: PUTS(c, "null", 4); break;
-        case MYJSON_FALSE: PUTS(c, "false", 5); break;
-        case MYJSON_TRUE: PUTS(c, "true", 4); break;
-        case MYJSON_NUMBER: c->top -= 32 - sprintf(myjson_context_push(c, 32), "%.17g", v->val.n); break;
-        case MYJSON_STRING: myjson_stringify_string(c, v->val.s.s, v->val.s.len); break;
-        case MYJSON_ARRAY:
-            PUTC(c, '[');
-            for (i = 0; i < v->val.arr.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                myjson_stringify_value(c, &v->val.arr.e[i]);
+    size_t start; /* of v's text in the output */
+} myjson_stringify_frame;
+
+/* Open containers are kept on a separate stack of frames, as c holds the output.
+ * With MYJSON_OPT_SORT_KEYS, objects not kept sorted are written from a sorted shallow copy.
+ * With MYJSON_OPT_STRINGIFY_CACHE, containers unchanged since they were last written are copied
+ * from their block's text, and those written here of at least MYJSON_STRINGIFY_CACHE_MIN_SIZE
+ * bytes keep it. */
+static void myjson_stringify_value(myjson_context *c, const myjson_value *v) {
+    myjson_context frames;
+    myjson_stringify_frame *f;
+    const myjson_block_text *t;
+    const void *block;
+    unsigned sort = c->flags & MYJSON_OPT_SORT_KEYS;
+    myjson_context_init(&frames, c->allocator, 0);
+    for (;;) {
+        MYJSON_STAT_ADD(c, values[v->type], 1);
+        switch (v->type) {
+            case MYJSON_NULL: PUTS(c, "null", 4); break;
+            case MYJSON_FALSE: PUTS(c, "false", 5); break;
+            case MYJSON_TRUE: PUTS(c, "true", 4); break;
+            case MYJSON_NUMBER:
+                if (v->flags & MYJSON_VALUE_RAW_NUMBER)
+                    PUTS(c, v->val.num.text, v->val.num.len);
+                else
+                    c->top -= 32 - sprintf(myjson_context_push(c, 32), "%.17g", v->val.n);
+                break;
+            case MYJSON_STRING: myjson_stringify_string(c, v->val.s.s, v->val.s.len); break;
+            case MYJSON_RAW: PUTS(c, v->val.s.s, v->val.s.len); break;
+            case MYJSON_ARRAY:
+            case MYJSON_OBJECT:
+                block = v->type == MYJSON_ARRAY ? (const void *)v->val.arr.e : (const void *)v->val.obj.m;
+                if ((c->flags & MYJSON_OPT_STRINGIFY_CACHE) && block != NULL && (t = myjson_block_get_text(block)) != NULL && t->flags == sort) {
+                    PUTS(c, (const char *)(t + 1), t->len);
+                    break;
+                }
+                f = (myjson_stringify_frame *)myjson_context_push(&frames, sizeof(myjson_stringify_frame));
+                f->v = v;
+                f->m = v->type == MYJSON_OBJECT ? v->val.obj.m : NULL;
+                f->i = 0;
+                f->start = c->top;
+                PUTC(c, v->type == MYJSON_ARRAY ? '[' : '{');
+                if ((c->flags & MYJSON_OPT_SORT_KEYS) && v->type == MYJSON_OBJECT && !(v->flags & MYJSON_VALUE_SORTED) && v->val.obj.size > 1) {
+                    f->m = (myjson_member *)MYJSON_MALLOC(frames.allocator, v->val.obj.size * sizeof(myjson_member));
+                    memcpy((myjson_member *)f->m, v->val.obj.m, v->val.obj.size * sizeof(myjson_member));
+                    myjson_sort_members((myjson_member *)f->m, v->val.obj.size, frames.allocator);
+                }
+                MYJSON_STAT_MAX(c, max_depth, frames.top / sizeof(myjson_stringify_frame));
+                break;
+            default: assert(0 && "invalid type");
+        }
+        /* move on to the next child, closing every container that is done */
+        for (;;) {
+            if (frames.top == 0) {
+                MYJSON_FREE(frames.allocator, frames.stack);
+                return;
             }
-            PUTC(c, ']');
-            break;
-        case MYJSON_OBJECT:
-            PUTC(c, '{');
-            for (i = 0; i < v->val.obj.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                myjson_stringify_string(c, v->val.obj.m[i].key, v->val.obj.m[i].klen);
+            f = (myjson_stringify_frame *)(frames.stack + frames.top - sizeof(myjson_stringify_frame));
+            if (f->i == (f->v->type == MYJSON_ARRAY ? f->v->val.arr.size : f->v->val.obj.size)) {
+                PUTC(c, f->v->type == MYJSON_ARRAY ? ']' : '}');
+                block = f->v->type == MYJSON_ARRAY ? (const void *)f->v->val.arr.e : (const void *)f->v->val.obj.m;
+                if ((c->flags & MYJSON_OPT_STRINGIFY_CACHE) && block != NULL && c->top - f->start >= MYJSON_STRINGIFY_CACHE_MIN_SIZE)
+                    myjson_block_set_text(block, c->stack + f->start, c->top - f->start, sort);
+                if (f->v->type == MYJSON_OBJECT && f->m != f->v->val.obj.m)
+                    MYJSON_FREE(frames.allocator, (myjson_member *)f->m);
+                myjson_context_pop(&frames, sizeof(myjson_stringify_frame));
+                continue;
+            }
+            if (f->i > 0)
+                PUTC(c, ',');
+            if (f->v->type == MYJSON_ARRAY)
+                v = &f->v->val.arr.e[f->i++];
+            else {
+                myjson_stringify_string(c, f->m[f->i].key, f->m[f->i].klen);
                 PUTC(c, ':');
-                myjson_stringify_value(c, &v->val.obj.m[i].v);
+                v = &f->m[f->i++].v;
             }
-            PUTC(c, '}');
             break;
-        default: assert(0 && "invalid type");
+        }
     }
 }
 
-char *myjson_stringify(const myjson_value *v, size_t *length) {
+char *myjson_stringify_ex(const myjson_value *v, size_t *length, const myjson_stringify_options *options) {
     myjson_context c;
+#ifdef MYJSON_STATS
+    unsigned long long start = myjson_stats_clock();
+#endif
     assert(v != NULL);
-    c.stack = (char *)malloc(c.size = MYJSON_PARSE_STRINGIFY_INIT_SIZE);
-    c.top = 0;
+    myjson_context_init(&c, options != NULL && options->allocator != NULL ? options->allocator : myjson_global_allocator, MYJSON_PARSE_STRINGIFY_INIT_SIZE);
+    c.flags = options != NULL ? options->flags : 0;
+    if (options != NULL && options->stats != NULL)
+        memset(options->stats, 0, sizeof(myjson_stats));
+#ifdef MYJSON_STATS
+    c.stats = options != NULL ? options->stats : NULL;
+#endif
     myjson_stringify_value(&c, v);
     if (length)
        *length = c.top;
     PUTC(&c, '\0');
+#ifdef MYJSON_STATS
+    MYJSON_STAT_ADD(&c, allocations, 1);
+    MYJSON_STAT_ADD(&c, allocated, c.size);
+    myjson_stats_finish(&c, c.top - 1, start);
+#endif
     return c.stack; 
 }
 
-void myjson_copy(myjson_value* dst, const myjson_value* src) {
-    assert(src != NULL &&dst != NULL && src != NULL);
-    switch(src->type) {
+char *myjson_stringify(const myjson_value *v, size_t *length) {
+    return myjson_stringify_ex(v, length, NULL);
+}
+
+typedef struct {
+    const myjson_value *v;
+    size_t begin, end;
+    myjson_context c;
+    pthread_t tid;
+    int threaded;
+} myjson_stringify_task;
+
+/* Serializes elements [begin, end) of an array or object, each preceded by ',' unless it is the first */
+static void *myjson_stringify_range(void *arg) {
+    myjson_stringify_task *t = (myjson_stringify_task *)arg;
+    myjson_context *c = &t->c;
+    const myjson_value *v = t->v;
+    size_t i;
+    myjson_context_init(c, myjson_global_allocator, MYJSON_PARSE_STRINGIFY_INIT_SIZE);
+    for (i = t->begin; i < t->end; i++) {
+        if (i > 0)
+            PUTC(c, ',');
+        if (v->type == MYJSON_ARRAY)
+            myjson_stringify_value(c, &v->val.arr.e[i]);
+        else {
+            myjson_stringify_string(c, v->val.obj.m[i].key, v->val.obj.m[i].klen);
+            PUTC(c, ':');
+            myjson_stringify_value(c, &v->val.obj.m[i].v);
+        }
+    }
+    return NULL;
+}
+
+static void myjson_stringify_parallel_value(myjson_context *c, const myjson_value *v, size_t threads, size_t depth) {
+    myjson_stringify_task *tasks;
+    size_t i, n, size;
+    char *p;
+    if ((v->type != MYJSON_ARRAY && v->type != MYJSON_OBJECT) || depth == MYJSON_STRINGIFY_PARALLEL_MAX_DEPTH) {
+        myjson_stringify_value(c, v);
+        return;
+    }
+    n = v->type == MYJSON_ARRAY ? v->val.arr.size : v->val.obj.size;
+    if (myjson_thread_count(threads, n) == 1) {
+        /* Too small to split here, but a wrapper such as {"rows":[...]} may hold a large child */
+        PUTC(c, v->type == MYJSON_ARRAY ? '[' : '{');
+        for (i = 0; i < n; i++) {
+            if (i > 0)
+                PUTC(c, ',');
+            if (v->type == MYJSON_ARRAY)
+                myjson_stringify_parallel_value(c, &v->val.arr.e[i], threads, depth + 1);
+            else {
+                myjson_stringify_string(c, v->val.obj.m[i].key, v->val.obj.m[i].klen);
+                PUTC(c, ':');
+                myjson_stringify_parallel_value(c, &v->val.obj.m[i].v, threads, depth + 1);
+            }
+        }
+        PUTC(c, v->type == MYJSON_ARRAY ? ']' : '}');
+        return;
+    }
+    threads = myjson_thread_count(threads, n);
+    tasks = (myjson_stringify_task *)MYJSON_MALLOC(myjson_global_allocator, threads * sizeof(myjson_stringify_task));
+    for (i = 0; i < threads; i++) {
+        tasks[i].v = v;
+        tasks[i].begin = n / threads * i;
+        tasks[i].end = i + 1 == threads ? n : n / threads * (i + 1);
+    }
+    for (i = 1; i < threads; i++)
+        tasks[i].threaded = pthread_create(&tasks[i].tid, NULL, myjson_stringify_range, &tasks[i]) == 0;
+    myjson_stringify_range(&tasks[0]);
+    for (i = 1; i < threads; i++) {
+        if (tasks[i].threaded)
+            pthread_join(tasks[i].tid, NULL);
+        else
+            myjson_stringify_range(&tasks[i]);
+    }
+    for (i = 0, size = 2; i < threads; i++)
+        size += tasks[i].c.top;
+    p = (char *)myjson_context_push(c, size);
+    *p++ = v->type == MYJSON_ARRAY ? '[' : '{';
+    for (i = 0; i < threads; i++) {
+        memcpy(p, tasks[i].c.stack, tasks[i].c.top);
+        p += tasks[i].c.top;
+        MYJSON_FREE(tasks[i].c.allocator, tasks[i].c.stack);
+    }
+    *p = v->type == MYJSON_ARRAY ? ']' : '}';
+    MYJSON_FREE(myjson_global_allocator, tasks);
+}
+
+char *myjson_stringify_parallel(const myjson_value *v, size_t *length, size_t threads) {
+    myjson_context c;
+    assert(v != NULL);
+    myjson_context_init(&c, myjson_global_allocator, MYJSON_PARSE_STRINGIFY_INIT_SIZE);
+    myjson_stringify_parallel_value(&c, v, threads, 0);
+    if (length)
+       *length = c.top;
+    PUTC(&c, '\0');
+    return c.stack;
+}
+
+/* Returns v, or for a raw fragment the value it parses to in temp, which is then to be freed */
+static const myjson_value *myjson_raw_expand(const myjson_value *v, myjson_value *temp) {
+    myjson_init(temp);
+    if (v->type != MYJSON_RAW)
+        return v;
+    myjson_parse(temp, v->val.s.s);
+    return temp;
+}
+
+/* Takes another reference to whatever v points to */
+static void myjson_retain(const myjson_value *v) {
+    switch (v->type) {
+        case MYJSON_NUMBER:
+            if ((v->flags & (MYJSON_VALUE_RAW_NUMBER | MYJSON_VALUE_VIEW)) == MYJSON_VALUE_RAW_NUMBER)
+                myjson_block_retain(v->val.num.text);
+            break;
         case MYJSON_STRING:
-            myjson_set_string(dst, src->val.s.s, src->val.s.len);
+        case MYJSON_RAW:
+            if (!(v->flags & MYJSON_VALUE_VIEW))
+                myjson_block_retain(v->val.s.s);
             break;
         case MYJSON_ARRAY:
-            // incomplete
+            if (v->val.arr.e != NULL)
+                myjson_block_retain(v->val.arr.e);
             break;
         case MYJSON_OBJECT:
-            // incomplete
+            if (v->val.obj.m != NULL)
+                myjson_block_retain(v->val.obj.m);
             break;
         default:
-            myjson_free(dst);
-            memcpy(dst, src, sizeof(myjson_value));
             break;
     }
 }
 
+/* Gives v its own element block before it is modified. The elements themselves stay shared.
+ * Also called before handing out a pointer to an element, so the cached hash and text are dropped. */
+static void myjson_detach_array(myjson_value *v) {
+    myjson_value *e = v->val.arr.e;
+    size_t i;
+    if (!myjson_block_shared(e)) {
+        if (e != NULL)
+            myjson_block_touch(e);
+        return;
+    }
+    v->val.arr.e = (myjson_value *)myjson_block_alloc(MYJSON_BLOCK(e)->allocator, v->val.arr.capacity * sizeof(myjson_value));
+    memcpy(v->val.arr.e, e, v->val.arr.size * sizeof(myjson_value));
+    for (i = 0; i < v->val.arr.size; i++)
+        myjson_retain(&e[i]);
+    if (myjson_block_release(e)) {
+        /* every other owner let go in the meantime */
+        for (i = 0; i < v->val.arr.size; i++)
+            myjson_free(&e[i]);
+        myjson_block_free(e);
+    }
+}
+
+static void myjson_detach_object(myjson_value *v) {
+    myjson_member *m = v->val.obj.m;
+    size_t i;
+    if (!myjson_block_shared(m)) {
+        if (m != NULL)
+            myjson_block_touch(m);
+        return;
+    }
+    v->val.obj.m = (myjson_member *)myjson_block_alloc(MYJSON_BLOCK(m)->allocator, v->val.obj.capacity * sizeof(myjson_member));
+    for (i = 0; i < v->val.obj.size; i++) {
+        myjson_member *d = &v->val.obj.m[i];
+        d->klen = m[i].klen;
+        d->key = myjson_key_alloc(MYJSON_BLOCK(m)->allocator, m[i].key, d->klen);
+        d->v = m[i].v;
+        myjson_retain(&d->v);
+    }
+    if (myjson_block_release(m)) {
+        for (i = 0; i < v->val.obj.size; i++) {
+            myjson_key_free(m, m[i].key);
+            myjson_free(&m[i].v);
+        }
+        myjson_block_free(m);
+    }
+}
+
+typedef struct {
+    myjson_value *dst;
+    const myjson_value *src;
+    size_t i;
+} myjson_copy_frame;
+
+/* Views cannot outlive their mapping, so values holding them are copied for real.
+ * Containers without views below them are still shared. dst starts out null. */
+static void myjson_copy_views(myjson_value *dst, const myjson_value *src) {
+    myjson_context frames;
+    myjson_copy_frame *f;
+    myjson_member *m;
+    size_t n;
+    myjson_context_init(&frames, myjson_global_allocator, 0);
+    for (;;) {
+        switch (src->type) {
+            case MYJSON_NUMBER:
+                dst->type = MYJSON_NUMBER;
+                dst->val.num = src->val.num;
+                dst->val.num.text = myjson_string_alloc(myjson_global_allocator, src->val.num.text, src->val.num.len);
+                dst->flags = src->flags & (MYJSON_VALUE_RAW_NUMBER | MYJSON_VALUE_CONVERTED);
+                break;
+            case MYJSON_STRING:
+                myjson_set_string(dst, src->val.s.s, src->val.s.len);
+                break;
+            default:
+                if (src->type == MYJSON_ARRAY)
+                    myjson_set_array(dst, src->val.arr.size);
+                else {
+                    myjson_set_object(dst, src->val.obj.size);
+                    dst->flags |= src->flags & MYJSON_VALUE_SORTED;
+                }
+                f = (myjson_copy_frame *)myjson_context_push(&frames, sizeof(myjson_copy_frame));
+                f->dst = dst;
+                f->src = src;
+                f->i = 0;
+                break;
+        }
+        /* move on to the next child that needs copying for real */
+        for (;;) {
+            if (frames.top == 0) {
+                MYJSON_FREE(frames.allocator, frames.stack);
+                return;
+            }
+            f = (myjson_copy_frame *)(frames.stack + frames.top - sizeof(myjson_copy_frame));
+            n = f->src->type == MYJSON_ARRAY ? f->src->val.arr.size : f->src->val.obj.size;
+            if (f->i == n) {
+                if (f->src->type == MYJSON_ARRAY)
+                    f->dst->val.arr.size = n;
+                else
+                    f->dst->val.obj.size = n;
+                myjson_context_pop(&frames, sizeof(myjson_copy_frame));
+                continue;
+            }
+            if (f->src->type == MYJSON_ARRAY) {
+                dst = &f->dst->val.arr.e[f->i];
+                src = &f->src->val.arr.e[f->i++];
+            }
+            else {
+                m = &f->dst->val.obj.m[f->i];
+                m->klen = f->src->val.obj.m[f->i].klen;
+                m->key = myjson_key_alloc(MYJSON_BLOCK(f->dst->val.obj.m)->allocator, f->src->val.obj.m[f->i].key, m->klen);
+                dst = &m->v;
+                src = &f->src->val.obj.m[f->i++].v;
+            }
+            myjson_init(dst);
+            if (src->flags & (MYJSON_VALUE_VIEW | MYJSON_VALUE_HAS_VIEWS))
+                break;
+            myjson_copy(dst, src);
+        }
+    }
+}
+
+void myjson_copy(myjson_value* dst, const myjson_value* src) {
+    myjson_value temp;
+    assert(src != NULL && dst != NULL);
+    if (dst == src)
+        return;
+    if (src->flags & (MYJSON_VALUE_VIEW | MYJSON_VALUE_HAS_VIEWS)) {
+        myjson_init(&temp);
+        myjson_copy_views(&temp, src);
+        myjson_free(dst);
+        memcpy(dst, &temp, sizeof(myjson_value));
+        return;
+    }
+    memcpy(&temp, src, sizeof(myjson_value));
+    myjson_retain(&temp);
+    myjson_free(dst);
+    memcpy(dst, &temp, sizeof(myjson_value));
+}
+
 void myjson_move(myjson_value* dst, myjson_value* src) {
     assert(dst != NULL && src != NULL);
     myjson_free(dst);
     memcpy(dst, src, sizeof(myjson_value));
-    myjson_free(src);
     myjson_init(src);
 }
 
@@ -498,28 +1927,66 @@ void myjson_swap(myjson_value* lhs, myjson_value* rhs) {
     }
 }
 
-void myjson_free(myjson_value *v) {
-    size_t i;
-    assert( v != NULL);
+/* Drops v's reference to its storage. A block whose last reference goes away is not emptied here
+ * but chained to a worklist through its header, which then holds the child count and the next block. */
+static void myjson_free_shallow(myjson_value *v, myjson_block **arrays, myjson_block **objects) {
+    myjson_block *b;
     switch (v->type) {
+        case MYJSON_NUMBER:
+            if ((v->flags & (MYJSON_VALUE_RAW_NUMBER | MYJSON_VALUE_VIEW)) == MYJSON_VALUE_RAW_NUMBER && myjson_block_release(v->val.num.text))
+                myjson_block_free(v->val.num.text);
+            break;
         case MYJSON_STRING:
-            free(v->val.s.s);
+        case MYJSON_RAW:
+            if (!(v->flags & MYJSON_VALUE_VIEW) && myjson_block_release(v->val.s.s))
+                myjson_block_free(v->val.s.s);
             break;
         case MYJSON_ARRAY:
-            for (i = 0; i < v->val.arr.size; i++)
-                myjson_free(&v->val.arr.e[i]);
-            free(v->val.arr.e);
+            if (v->val.arr.e != NULL && myjson_block_release(v->val.arr.e)) {
+                b = MYJSON_BLOCK(v->val.arr.e);
+                b->refcount = v->val.arr.size;
+                b->hash = (size_t)*arrays;
+                *arrays = b;
+            }
             break;
         case MYJSON_OBJECT:
-            for (i = 0; i < v->val.obj.size; i++) {
-                free(v->val.obj.m[i].key);
-                myjson_free(&v->val.obj.m[i].v);
+            if (v->val.obj.m != NULL && myjson_block_release(v->val.obj.m)) {
+                b = MYJSON_BLOCK(v->val.obj.m);
+                b->refcount = v->val.obj.size;
+                b->hash = (size_t)*objects;
+                *objects = b;
             }
-            free(v->val.obj.m);
             break;
         default: break;
     }
     v->type = MYJSON_NULL;
+    v->flags = 0;
+}
+
+void myjson_free(myjson_value *v) {
+    myjson_block *arrays = NULL, *objects = NULL, *b;
+    myjson_value *e;
+    myjson_member *m;
+    size_t i;
+    assert( v != NULL);
+    myjson_free_shallow(v, &arrays, &objects);
+    while (arrays != NULL || objects != NULL) {
+        if (arrays != NULL) {
+            b = arrays;
+            arrays = (myjson_block *)b->hash;
+            for (i = 0, e = (myjson_value *)(b + 1); i < b->refcount; i++)
+                myjson_free_shallow(&e[i], &arrays, &objects);
+        }
+        else {
+            b = objects;
+            objects = (myjson_block *)b->hash;
+            for (i = 0, m = (myjson_member *)(b + 1); i < b->refcount; i++) {
+                myjson_key_free(m, m[i].key);
+                myjson_free_shallow(&m[i].v, &arrays, &objects);
+            }
+        }
+        myjson_block_free(b + 1);
+    }
 }
 
 myjson_type myjson_get_type(const myjson_value *v) {
@@ -527,48 +1994,308 @@ myjson_type myjson_get_type(const myjson_value *v) {
     return v->type;
 }
 
-int myjson_is_equal(const myjson_value* lhs, const myjson_value* rhs) {
+static unsigned long long myjson_hash_mix(unsigned long long h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+static unsigned long long myjson_hash_bytes(const char *s, size_t len) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
     size_t i;
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs->type != rhs->type)
-        return 0;
-    switch (lhs->type) {
-        case MYJSON_STRING:
-            return lhs->val.s.len == rhs->val.s.len && memcmp(lhs->val.s.s, rhs->val.s.s, lhs->val.s.len);
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static size_t myjson_hash_finish(unsigned long long h, myjson_type type) {
+    h = myjson_hash_mix(h ^ type);
+    return h == 0 ? 1 : (size_t)h;
+}
+
+/* Hashes v unless it is a container whose hash has not been cached yet */
+static int myjson_hash_shallow(const myjson_value *v, size_t *h) {
+    myjson_value temp;
+    unsigned long long bits;
+    double n;
+    switch (v->type) {
         case MYJSON_NUMBER:
-            return lhs->val.n == rhs->val.n;
+            n = myjson_get_number(v);
+            n = n == 0.0 ? 0.0 : n; /* -0 equals 0 */
+            memcpy(&bits, &n, sizeof(bits));
+            *h = myjson_hash_finish(bits, MYJSON_NUMBER);
+            return 1;
+        case MYJSON_STRING:
+            if (v->flags & MYJSON_VALUE_VIEW)
+                *h = myjson_hash_finish(myjson_hash_bytes(v->val.s.s, v->val.s.len), MYJSON_STRING);
+            else if ((*h = myjson_block_get_hash(v->val.s.s)) == 0) {
+                *h = myjson_hash_finish(myjson_hash_bytes(v->val.s.s, v->val.s.len), MYJSON_STRING);
+                myjson_block_set_hash(v->val.s.s, *h);
+            }
+            return 1;
+        case MYJSON_RAW:
+            if ((*h = myjson_block_get_hash(v->val.s.s)) == 0) {
+                *h = myjson_hash(myjson_raw_expand(v, &temp));
+                myjson_free(&temp);
+                myjson_block_set_hash(v->val.s.s, *h);
+            }
+            return 1;
         case MYJSON_ARRAY:
-            if (lhs->val.arr.size != rhs->val.arr.size)
+            if (v->val.arr.e == NULL)
+                *h = myjson_hash_finish(0, MYJSON_ARRAY);
+            else if ((*h = myjson_block_get_hash(v->val.arr.e)) == 0)
                 return 0;
-            for (i = 0; i < lhs->val.arr.size; i++)
-                if (!myjson_is_equal(&lhs->val.arr.e[i], &rhs->val.arr.e[i])) 
-                    return 0;
             return 1;
         case MYJSON_OBJECT:
-            // incomplete
+            if (v->val.obj.m == NULL)
+                *h = myjson_hash_finish(0, MYJSON_OBJECT);
+            else if ((*h = myjson_block_get_hash(v->val.obj.m)) == 0)
+                return 0;
             return 1;
         default:
+            *h = myjson_hash_finish(0, v->type);
             return 1;
     }
 }
 
-int myjson_get_boolean(const myjson_value* v) {
-    assert(v != NULL && (v->type == MYJSON_TRUE || v->type == MYJSON_FALSE));
-    return v->type == MYJSON_TRUE;
+typedef struct {
+    const myjson_value *v;
+    size_t i;
+    unsigned long long h;
+} myjson_hash_frame;
+
+size_t myjson_hash(const myjson_value *v) {
+    myjson_context c;
+    myjson_hash_frame *f;
+    const myjson_value *child;
+    size_t h;
+    assert(v != NULL);
+    if (myjson_hash_shallow(v, &h))
+        return h;
+    myjson_context_init(&c, myjson_global_allocator, 0);
+    f = (myjson_hash_frame *)myjson_context_push(&c, sizeof(myjson_hash_frame));
+    f->v = v;
+    f->i = 0;
+    f->h = v->type == MYJSON_ARRAY ? v->val.arr.size : v->val.obj.size;
+    for (;;) {
+        f = (myjson_hash_frame *)(c.stack + c.top - sizeof(myjson_hash_frame));
+        v = f->v;
+        if (f->i < (v->type == MYJSON_ARRAY ? v->val.arr.size : v->val.obj.size)) {
+            child = v->type == MYJSON_ARRAY ? &v->val.arr.e[f->i] : &v->val.obj.m[f->i].v;
+            if (!myjson_hash_shallow(child, &h)) {
+                f = (myjson_hash_frame *)myjson_context_push(&c, sizeof(myjson_hash_frame));
+                f->v = child;
+                f->i = 0;
+                f->h = child->type == MYJSON_ARRAY ? child->val.arr.size : child->val.obj.size;
+                continue;
+            }
+        }
+        else {
+            h = myjson_hash_finish(f->h, v->type);
+            myjson_block_set_hash(v->type == MYJSON_ARRAY ? (const void *)v->val.arr.e : (const void *)v->val.obj.m, h);
+            myjson_context_pop(&c, sizeof(myjson_hash_frame));
+            if (c.top == 0)
+                break;
+            f = (myjson_hash_frame *)(c.stack + c.top - sizeof(myjson_hash_frame));
+            v = f->v;
+        }
+        /* fold h, the hash of child i, into its container; members are summed so that their order does not matter */
+        if (v->type == MYJSON_ARRAY)
+            f->h = myjson_hash_mix(f->h ^ h);
+        else
+            f->h += myjson_hash_mix(myjson_hash_bytes(v->val.obj.m[f->i].key, v->val.obj.m[f->i].klen) ^ h);
+        f->i++;
+    }
+    MYJSON_FREE(c.allocator, c.stack);
+    return h;
 }
 
-void myjson_set_boolean(myjson_value* v, int b) {
-    myjson_free(v);
-    v->type = b ? MYJSON_TRUE : MYJSON_FALSE;
+/* Open-addressing index over the keys of an object. Small objects are searched linearly instead.
+ * Duplicate keys resolve to the first, as in myjson_find_object_index(). */
+typedef struct {
+    const myjson_value *v;
+    size_t *slots, mask;
+} myjson_key_index;
+
+static size_t myjson_key_index_probe(const myjson_key_index *t, const char *key, size_t klen) {
+    const myjson_member *m = t->v->val.obj.m;
+    size_t j;
+    for (j = myjson_hash_bytes(key, klen) & t->mask; t->slots[j] != 0; j = (j + 1) & t->mask)
+        if (m[t->slots[j] - 1].klen == klen && memcmp(m[t->slots[j] - 1].key, key, klen) == 0)
+            break;
+    return j;
 }
 
-double myjson_get_number(const myjson_value *v) {
-    assert(v != NULL && v->type == MYJSON_NUMBER);
-    return v->val.n;
+static void myjson_key_index_init(myjson_key_index *t, const myjson_value *v) {
+    size_t i, j, n = v->val.obj.size;
+    t->v = v;
+    t->slots = NULL;
+    if (n <= MYJSON_EQUAL_LINEAR_MEMBERS)
+        return;
+    for (t->mask = 1; t->mask < n * 2; t->mask <<= 1)
+        ;
+    t->slots = (size_t *)MYJSON_MALLOC(myjson_global_allocator, t->mask * sizeof(size_t));
+    memset(t->slots, 0, t->mask-- * sizeof(size_t));
+    for (i = 0; i < n; i++)
+        if (t->slots[j = myjson_key_index_probe(t, v->val.obj.m[i].key, v->val.obj.m[i].klen)] == 0)
+            t->slots[j] = i + 1;
 }
 
-void myjson_set_number(myjson_value *v, double n) {
-    myjson_free(v);
+static size_t myjson_key_index_find(const myjson_key_index *t, const char *key, size_t klen) {
+    size_t j;
+    if (t->slots == NULL)
+        return myjson_find_object_index(t->v, key, klen);
+    j = myjson_key_index_probe(t, key, klen);
+    return t->slots[j] == 0 ? MYJSON_KEY_NOT_EXIST : t->slots[j] - 1;
+}
+
+static void myjson_key_index_free(myjson_key_index *t) {
+    MYJSON_FREE(myjson_global_allocator, t->slots);
+}
+
+/* A raw fragment equals whatever its text parses to */
+static int myjson_is_equal_raw(const myjson_value* lhs, const myjson_value* rhs) {
+    myjson_value l, r;
+    int ret;
+    if (lhs->type == rhs->type && lhs->val.s.len == rhs->val.s.len && memcmp(lhs->val.s.s, rhs->val.s.s, lhs->val.s.len) == 0)
+        return 1;
+    ret = myjson_is_equal(myjson_raw_expand(lhs, &l), myjson_raw_expand(rhs, &r));
+    myjson_free(&l);
+    myjson_free(&r);
+    return ret;
+}
+
+/* Compares everything but the children; *deep tells whether those still have to be compared */
+static int myjson_is_equal_shallow(const myjson_value* lhs, const myjson_value* rhs, int *deep) {
+    *deep = 0;
+    if (lhs->type == MYJSON_RAW || rhs->type == MYJSON_RAW)
+        return myjson_is_equal_raw(lhs, rhs);
+    if (lhs->type != rhs->type)
+        return 0;
+    switch (lhs->type) {
+        case MYJSON_STRING:
+            return lhs->val.s.len == rhs->val.s.len && memcmp(lhs->val.s.s, rhs->val.s.s, lhs->val.s.len) == 0;
+        case MYJSON_NUMBER:
+            return myjson_get_number(lhs) == myjson_get_number(rhs);
+        case MYJSON_ARRAY:
+            if (lhs->val.arr.size != rhs->val.arr.size)
+                return 0;
+            if (lhs->val.arr.e == rhs->val.arr.e)
+                return 1;
+            break;
+        case MYJSON_OBJECT:
+            if (lhs->val.obj.size != rhs->val.obj.size)
+                return 0;
+            if (lhs->val.obj.m == rhs->val.obj.m)
+                return 1;
+            break;
+        default:
+            return 1;
+    }
+    if (myjson_hash(lhs) != myjson_hash(rhs))
+        return 0;
+    *deep = 1;
+    return 1;
+}
+
+typedef struct {
+    const myjson_value *lhs, *rhs;
+    size_t i;
+    int merge; /* both objects sorted, so members pair up by position */
+    myjson_key_index index; /* over the rhs keys, unless merging */
+} myjson_equal_frame;
+
+static void myjson_equal_push(myjson_context *c, const myjson_value *lhs, const myjson_value *rhs) {
+    myjson_equal_frame *f = (myjson_equal_frame *)myjson_context_push(c, sizeof(myjson_equal_frame));
+    f->lhs = lhs;
+    f->rhs = rhs;
+    f->i = 0;
+    f->merge = lhs->type == MYJSON_OBJECT && (lhs->flags & rhs->flags & MYJSON_VALUE_SORTED);
+    if (lhs->type == MYJSON_OBJECT && !f->merge)
+        myjson_key_index_init(&f->index, rhs);
+}
+
+int myjson_is_equal(const myjson_value* lhs, const myjson_value* rhs) {
+    myjson_context c;
+    myjson_equal_frame *f;
+    size_t index;
+    int ret, deep;
+    assert(lhs != NULL && rhs != NULL);
+    if (!(ret = myjson_is_equal_shallow(lhs, rhs, &deep)) || !deep)
+        return ret;
+    myjson_context_init(&c, myjson_global_allocator, 0);
+    myjson_equal_push(&c, lhs, rhs);
+    while (ret && c.top > 0) {
+        f = (myjson_equal_frame *)(c.stack + c.top - sizeof(myjson_equal_frame));
+        if (f->i == (f->lhs->type == MYJSON_ARRAY ? f->lhs->val.arr.size : f->lhs->val.obj.size)) {
+            if (f->lhs->type == MYJSON_OBJECT && !f->merge)
+                myjson_key_index_free(&f->index);
+            myjson_context_pop(&c, sizeof(myjson_equal_frame));
+            continue;
+        }
+        if (f->lhs->type == MYJSON_ARRAY) {
+            lhs = &f->lhs->val.arr.e[f->i];
+            rhs = &f->rhs->val.arr.e[f->i];
+        }
+        else {
+            const myjson_member *m = &f->lhs->val.obj.m[f->i];
+            if (f->merge)
+                index = f->rhs->val.obj.m[f->i].klen == m->klen && memcmp(f->rhs->val.obj.m[f->i].key, m->key, m->klen) == 0 ? f->i : MYJSON_KEY_NOT_EXIST;
+            else
+                index = myjson_key_index_find(&f->index, m->key, m->klen);
+            if (index == MYJSON_KEY_NOT_EXIST) {
+                ret = 0;
+                break;
+            }
+            lhs = &m->v;
+            rhs = &f->rhs->val.obj.m[index].v;
+        }
+        f->i++;
+        if ((ret = myjson_is_equal_shallow(lhs, rhs, &deep)) && deep)
+            myjson_equal_push(&c, lhs, rhs);
+    }
+    while (c.top > 0) {
+        f = (myjson_equal_frame *)myjson_context_pop(&c, sizeof(myjson_equal_frame));
+        if (f->lhs->type == MYJSON_OBJECT && !f->merge)
+            myjson_key_index_free(&f->index);
+    }
+    MYJSON_FREE(c.allocator, c.stack);
+    return ret;
+}
+
+int myjson_get_boolean(const myjson_value* v) {
+    assert(v != NULL && (v->type == MYJSON_TRUE || v->type == MYJSON_FALSE));
+    return v->type == MYJSON_TRUE;
+}
+
+void myjson_set_boolean(myjson_value* v, int b) {
+    myjson_free(v);
+    v->type = b ? MYJSON_TRUE : MYJSON_FALSE;
+}
+
+double myjson_get_number(const myjson_value *v) {
+    myjson_value *raw = (myjson_value *)v;
+    assert(v != NULL && v->type == MYJSON_NUMBER);
+    if ((v->flags & (MYJSON_VALUE_RAW_NUMBER | MYJSON_VALUE_CONVERTED)) == MYJSON_VALUE_RAW_NUMBER) {
+        /* the text is followed by a '\0' or by something that cannot continue a number */
+        raw->val.num.n = strtod(v->val.num.text, NULL);
+        raw->flags |= MYJSON_VALUE_CONVERTED;
+    }
+    return v->val.n;
+}
+
+const char *myjson_get_number_text(const myjson_value *v, size_t *len) {
+    assert(v != NULL && v->type == MYJSON_NUMBER && len != NULL);
+    if (!(v->flags & MYJSON_VALUE_RAW_NUMBER))
+        return NULL;
+    *len = v->val.num.len;
+    return v->val.num.text;
+}
+
+void myjson_set_number(myjson_value *v, double n) {
+    myjson_free(v);
     v->val.n = n;
     v->type = MYJSON_NUMBER;
 }
@@ -586,13 +2313,46 @@ size_t myjson_get_string_length(const myjson_value* v) {
 void myjson_set_string(myjson_value* v, const char* s, size_t len) {
     assert(v != NULL && (s != NULL || len == 0));
     myjson_free(v);
-    v->val.s.s = (char *)malloc(len + 1);
-    memcpy(v->val.s.s, s, len);
-    v->val.s.s[len] = '\0';
+    v->val.s.s = myjson_string_alloc(myjson_global_allocator, s, len);
     v->val.s.len = len;
     v->type = MYJSON_STRING;
 }
 
+int myjson_set_raw(myjson_value* v, const char* json, size_t len, int validate) {
+    myjson_parse_options options;
+    myjson_value check;
+    char *text;
+    int ret;
+    assert(v != NULL && (json != NULL || len == 0));
+    text = myjson_string_alloc(myjson_global_allocator, json, len);
+    if (validate) {
+        memset(&options, 0, sizeof(options));
+        options.flags = MYJSON_OPT_VIEWS | MYJSON_OPT_RAW_NUMBERS;
+        myjson_init(&check);
+        ret = myjson_parse_ex(&check, text, &options);
+        myjson_free(&check);
+        if (ret != MYJSON_PARSE_OK || strlen(text) != len) {
+            myjson_block_free(text);
+            return ret != MYJSON_PARSE_OK ? ret : MYJSON_PARSE_INVALID_VALUE;
+        }
+    }
+    myjson_free(v);
+    v->val.s.s = text;
+    v->val.s.len = len;
+    v->type = MYJSON_RAW;
+    return MYJSON_PARSE_OK;
+}
+
+const char* myjson_get_raw(const myjson_value* v) {
+    assert(v != NULL && v->type == MYJSON_RAW);
+    return v->val.s.s;
+}
+
+size_t myjson_get_raw_length(const myjson_value* v) {
+    assert(v != NULL && v->type == MYJSON_RAW);
+    return v->val.s.len;
+}
+
 size_t myjson_get_array_size(const myjson_value *v) {
     assert(v != NULL && v->type == MYJSON_ARRAY);
     return v->val.arr.size;
@@ -604,7 +2364,7 @@ void myjson_set_array(myjson_value *v, size_t capacity) {
     v->type = MYJSON_ARRAY;
     v->val.arr.size = 0;
     v->val.arr.capacity = capacity;
-    v->val.arr.e = capacity > 0 ? (myjson_value*)malloc(capacity * sizeof(myjson_value)) : NULL;
+    v->val.arr.e = capacity > 0 ? (myjson_value*)myjson_block_alloc(myjson_global_allocator, capacity * sizeof(myjson_value)) : NULL;
 }
 
 size_t myjson_get_array_capacity(const myjson_value* v) {
@@ -612,19 +2372,29 @@ size_t myjson_get_array_capacity(const myjson_value* v) {
     return v->val.arr.capacity;
 }
 
+/* A shared block is copied straight into the larger one rather than copied and then reallocated */
 void myjson_reserve_array(myjson_value* v, size_t capacity) {
     assert(v != NULL && v->type == MYJSON_ARRAY);
+    if (myjson_block_shared(v->val.arr.e) && v->val.arr.capacity < capacity)
+        v->val.arr.capacity = capacity;
+    myjson_detach_array(v);
     if (v->val.arr.capacity < capacity) {
         v->val.arr.capacity = capacity;
-        v->val.arr.e = (myjson_value*)realloc(v->val.arr.e, v->val.arr.capacity * sizeof(myjson_value));
+        v->val.arr.e = (myjson_value*)myjson_block_realloc(v->val.arr.e, v->val.arr.capacity * sizeof(myjson_value));
     }
 }
 
 void myjson_shrink_array(myjson_value* v) {
     assert(v != NULL && v->type == MYJSON_ARRAY);
+    myjson_detach_array(v);
     if (v->val.arr.capacity > v->val.arr.size) {
         v->val.arr.capacity = v->val.arr.size;
-        v->val.arr.e = (myjson_value*)realloc(v->val.arr.e, v->val.arr.capacity * sizeof(myjson_value));
+        if (v->val.arr.size == 0) {
+            myjson_block_free(v->val.arr.e);
+            v->val.arr.e = NULL;
+        }
+        else
+            v->val.arr.e = (myjson_value*)myjson_block_realloc(v->val.arr.e, v->val.arr.capacity * sizeof(myjson_value));
     }
 }
 
@@ -634,49 +2404,111 @@ void myjson_clear_array(myjson_value* v) {
 }
 
 myjson_value* myjson_get_array_element(myjson_value* v, size_t index) {
+    assert(v != NULL && v->type == MYJSON_ARRAY);
+    assert(index < v->val.arr.size);
+    myjson_detach_array(v);
+    return &v->val.arr.e[index];
+}
+
+const myjson_value *myjson_get_array_element_const(const myjson_value *v, size_t index) {
     assert(v != NULL && v->type == MYJSON_ARRAY);
     assert(index < v->val.arr.size);
     return &v->val.arr.e[index];
 }
 
+/* Makes room for size elements in v's own block, growing by at least doubling */
+static void myjson_grow_array(myjson_value *v, size_t size) {
+    size_t capacity = v->val.arr.capacity;
+    if (size > capacity)
+        capacity = capacity * 2 > size ? capacity * 2 : size;
+    myjson_reserve_array(v, capacity);
+}
+
 myjson_value* myjson_pushback_array_element(myjson_value* v) {
     assert(v != NULL && v->type == MYJSON_ARRAY);
-    if (v->val.arr.size == v->val.arr.capacity)
-        myjson_reserve_array(v, v->val.arr.capacity == 0 ? 1 : v->val.arr.capacity * 2);
+    myjson_grow_array(v, v->val.arr.size + 1);
     myjson_init(&v->val.arr.e[v->val.arr.size]);
     return &v->val.arr.e[v->val.arr.size++];
 }
 
 void myjson_popback_array_element(myjson_value* v) {
     assert(v != NULL && v->type == MYJSON_ARRAY && v->val.arr.size > 0);
+    myjson_detach_array(v);
     myjson_free(&v->val.arr.e[--v->val.arr.size]);
 }
 
 myjson_value* myjson_insert_array_element(myjson_value* v, size_t index) {
     assert(v != NULL && v->type == MYJSON_ARRAY && index <= v->val.arr.size);
-    // incomplete
-    if (v->val.arr.capacity == v->val.arr.size)
-        myjson_reserve_array(v, v->val.arr.capacity * 2);
-    size_t i = v->val.arr.size - 1;
-    for (; i > index; i--) {
-        myjson_move(&v->val.arr.e[i + 1], &v->val.arr.e[i]);
-    }
-    myjson_init(&v->val.arr.e[i]);
-    v->val.arr.size += 1;
-    return &v->val.arr.e[i];
+    return myjson_insert_array_elements(v, index, 1);
+}
+
+myjson_value* myjson_insert_array_elements(myjson_value* v, size_t index, size_t count) {
+    size_t i;
+    assert(v != NULL && v->type == MYJSON_ARRAY && index <= v->val.arr.size);
+    myjson_grow_array(v, v->val.arr.size + count);
+    memmove(&v->val.arr.e[index + count], &v->val.arr.e[index], (v->val.arr.size - index) * sizeof(myjson_value));
+    for (i = index; i < index + count; i++)
+        myjson_init(&v->val.arr.e[i]);
+    v->val.arr.size += count;
+    return v->val.arr.e + index;
 }
 
 void myjson_erase_array_element(myjson_value* v, size_t index, size_t count) {
+    size_t i;
     assert(v != NULL && v->type == MYJSON_ARRAY && index + count <= v->val.arr.size);
-    //incomplete
     if (count == 0)
         return ;
+    myjson_detach_array(v);
+    for (i = index; i < index + count; i++)
+        myjson_free(&v->val.arr.e[i]);
+    memmove(&v->val.arr.e[index], &v->val.arr.e[index + count], (v->val.arr.size - index - count) * sizeof(myjson_value));
+    v->val.arr.size -= count;
+}
+
+/* values are copied, so they must not point into v itself */
+void myjson_append_array_elements(myjson_value* v, const myjson_value* values, size_t count) {
+    size_t i;
+    assert(v != NULL && v->type == MYJSON_ARRAY && (values != NULL || count == 0));
+    myjson_grow_array(v, v->val.arr.size + count);
+    for (i = 0; i < count; i++) {
+        myjson_init(&v->val.arr.e[v->val.arr.size + i]);
+        myjson_copy(&v->val.arr.e[v->val.arr.size + i], &values[i]);
+    }
+    v->val.arr.size += count;
+}
 
-    size_t i = index;
-    for (; i + count < v->val.arr.size; i++) {
-        myjson_move(&v->val.arr.e[i], &v->val.arr.e[i + count]);
+void myjson_resize_array(myjson_value* v, size_t size, const myjson_value* fill) {
+    size_t i;
+    assert(v != NULL && v->type == MYJSON_ARRAY);
+    if (size <= v->val.arr.size) {
+        myjson_erase_array_element(v, size, v->val.arr.size - size);
+        return;
+    }
+    myjson_reserve_array(v, size);
+    for (i = v->val.arr.size; i < size; i++) {
+        myjson_init(&v->val.arr.e[i]);
+        if (fill != NULL)
+            myjson_copy(&v->val.arr.e[i], fill);
     }
-    v->val.arr.size -= count;  
+    v->val.arr.size = size;
+}
+
+/* Moves count elements of src starting at src_index into dst before index. The elements change
+ * owner without being touched: one memmove opens the gap, one memcpy fills it, one closes src. */
+void myjson_splice_array(myjson_value* dst, size_t index, myjson_value* src, size_t src_index, size_t count) {
+    assert(dst != NULL && dst->type == MYJSON_ARRAY && index <= dst->val.arr.size);
+    assert(src != NULL && src->type == MYJSON_ARRAY && src_index + count <= src->val.arr.size);
+    assert(dst != src);
+    if (count == 0)
+        return;
+    myjson_detach_array(src);
+    myjson_grow_array(dst, dst->val.arr.size + count);
+    memmove(&dst->val.arr.e[index + count], &dst->val.arr.e[index], (dst->val.arr.size - index) * sizeof(myjson_value));
+    memcpy(&dst->val.arr.e[index], &src->val.arr.e[src_index], count * sizeof(myjson_value));
+    dst->val.arr.size += count;
+    memmove(&src->val.arr.e[src_index], &src->val.arr.e[src_index + count], (src->val.arr.size - src_index - count) * sizeof(myjson_value));
+    src->val.arr.size -= count;
+    dst->flags |= src->flags & MYJSON_VALUE_HAS_VIEWS;
 }
 
 void myjson_set_object(myjson_value* v, size_t capacity) {
@@ -685,7 +2517,7 @@ void myjson_set_object(myjson_value* v, size_t capacity) {
     v->type = MYJSON_OBJECT;
     v->val.obj.size = 0;
     v->val.obj.capacity = capacity;
-    v->val.obj.m = capacity > 0 ? (myjson_member *)malloc(capacity * sizeof(myjson_member)) : NULL;
+    v->val.obj.m = capacity > 0 ? (myjson_member *)myjson_block_alloc(myjson_global_allocator, capacity * sizeof(myjson_member)) : NULL;
 } 
 
 size_t myjson_get_object_size(const myjson_value *v) {
@@ -695,22 +2527,51 @@ size_t myjson_get_object_size(const myjson_value *v) {
 
 size_t myjson_get_object_capacity(const myjson_value* v) {
     assert(v != NULL && v->type == MYJSON_OBJECT);
-    // incomplete
+    return v->val.obj.capacity;
 }
 
 void myjson_reserve_object(myjson_value* v, size_t capacity) {
     assert(v != NULL && v->type == MYJSON_OBJECT);
-    // incomplete
+    if (myjson_block_shared(v->val.obj.m) && v->val.obj.capacity < capacity)
+        v->val.obj.capacity = capacity;
+    myjson_detach_object(v);
+    if (v->val.obj.capacity < capacity) {
+        v->val.obj.capacity = capacity;
+        v->val.obj.m = (myjson_member*)myjson_block_realloc(v->val.obj.m, v->val.obj.capacity * sizeof(myjson_member));
+    }
+}
+
+/* Makes room for size members in v's own block, growing by at least doubling */
+static void myjson_grow_object(myjson_value *v, size_t size) {
+    size_t capacity = v->val.obj.capacity;
+    if (size > capacity)
+        capacity = capacity * 2 > size ? capacity * 2 : size;
+    myjson_reserve_object(v, capacity);
 }
 
 void myjson_shrink_object(myjson_value *v) {
     assert(v != NULL && v->type == MYJSON_OBJECT);
-    // incomplete
+    myjson_detach_object(v);
+    if (v->val.obj.capacity > v->val.obj.size) {
+        v->val.obj.capacity = v->val.obj.size;
+        if (v->val.obj.size == 0) {
+            myjson_block_free(v->val.obj.m);
+            v->val.obj.m = NULL;
+        }
+        else
+            v->val.obj.m = (myjson_member*)myjson_block_realloc(v->val.obj.m, v->val.obj.capacity * sizeof(myjson_member));
+    }
 }
 
 void myjson_clear_object(myjson_value* v) {
+    size_t i;
     assert(v != NULL && v->type == MYJSON_OBJECT);
-    // incomplete
+    myjson_detach_object(v);
+    for (i = 0; i < v->val.obj.size; i++) {
+        myjson_key_free(v->val.obj.m, v->val.obj.m[i].key);
+        myjson_free(&v->val.obj.m[i].v);
+    }
+    v->val.obj.size = 0;
 }
 
 const char *myjson_get_object_key(const myjson_value *v, size_t index) {
@@ -725,7 +2586,14 @@ size_t myjson_get_object_key_length(const myjson_value *v, size_t index) {
     return v->val.obj.m[index].klen;
 }
 
-myjson_value *myjson_get_object_value(const myjson_value *v, size_t index) {
+myjson_value *myjson_get_object_value(myjson_value *v, size_t index) {
+    assert(v != NULL && v->type == MYJSON_OBJECT);
+    assert(index < v->val.obj.size);
+    myjson_detach_object(v);
+    return &v->val.obj.m[index].v;
+}
+
+const myjson_value *myjson_get_object_value_const(const myjson_value *v, size_t index) {
     assert(v != NULL && v->type == MYJSON_OBJECT);
     assert(index < v->val.obj.size);
     return &v->val.obj.m[index].v;
@@ -734,24 +2602,1741 @@ myjson_value *myjson_get_object_value(const myjson_value *v, size_t index) {
 size_t myjson_find_object_index(const myjson_value* v, const char* key, size_t klen) {
     size_t i;
     assert(v != NULL && v->type == MYJSON_OBJECT && key != NULL);
+    if (v->flags & MYJSON_VALUE_SORTED) {
+        i = myjson_member_lower_bound(v->val.obj.m, v->val.obj.size, key, klen);
+        if (i < v->val.obj.size && v->val.obj.m[i].klen == klen && memcmp(v->val.obj.m[i].key, key, klen) == 0)
+            return i;
+        return MYJSON_KEY_NOT_EXIST;
+    }
     for (i = 0; i < v->val.obj.size; i++)
-        if (v->val.obj.m[i],klen == klen && memcmp(v->val.obj.m[i].key, key, klen) == 0)
+        if (v->val.obj.m[i].klen == klen && memcmp(v->val.obj.m[i].key, key, klen) == 0)
             return i;
     return MYJSON_KEY_NOT_EXIST;
 }
 
 myjson_value* myjson_find_object_value(myjson_value* v, const char* key, size_t klen) {
     size_t index = myjson_find_object_index(v, key, klen);
-    return index != MYJSON_KEY_NOT_EXIST ? &v->val.obj.m[index].v : NULL;
+    if (index == MYJSON_KEY_NOT_EXIST)
+        return NULL;
+    myjson_detach_object(v);
+    return &v->val.obj.m[index].v;
+}
+
+const myjson_value *myjson_find_object_value_const(const myjson_value *v, const char *key, size_t klen) {
+    size_t index = myjson_find_object_index(v, key, klen);
+    return index == MYJSON_KEY_NOT_EXIST ? NULL : &v->val.obj.m[index].v;
 }
 
+/* New members go to the end, or to their place in a sorted object */
 myjson_value* myjson_set_object_value(myjson_value* v, const char* key, size_t klen) {
+    size_t index;
+    myjson_member *m;
     assert(v != NULL && v->type == MYJSON_OBJECT && key != NULL);
-    // incomplete
-    return NULL;
+    if ((index = myjson_find_object_index(v, key, klen)) != MYJSON_KEY_NOT_EXIST) {
+        myjson_detach_object(v);
+        return &v->val.obj.m[index].v;
+    }
+    myjson_grow_object(v, v->val.obj.size + 1);
+    index = v->flags & MYJSON_VALUE_SORTED ? myjson_member_lower_bound(v->val.obj.m, v->val.obj.size, key, klen) : v->val.obj.size;
+    m = &v->val.obj.m[index];
+    memmove(m + 1, m, (v->val.obj.size++ - index) * sizeof(myjson_member));
+    m->key = myjson_key_alloc(MYJSON_BLOCK(v->val.obj.m)->allocator, key, klen);
+    m->klen = klen;
+    myjson_init(&m->v);
+    return &m->v;
+}
+
+void myjson_sort_object_keys(myjson_value* v) {
+    assert(v != NULL && v->type == MYJSON_OBJECT);
+    if (v->flags & MYJSON_VALUE_SORTED)
+        return;
+    myjson_detach_object(v);
+    if (v->val.obj.size > 1)
+        myjson_sort_members(v->val.obj.m, v->val.obj.size, MYJSON_BLOCK(v->val.obj.m)->allocator);
+    v->flags |= MYJSON_VALUE_SORTED;
+}
+
+int myjson_is_object_sorted(const myjson_value* v) {
+    assert(v != NULL && v->type == MYJSON_OBJECT);
+    return (v->flags & MYJSON_VALUE_SORTED) != 0;
 }
 
 void myjson_remove_object_value(myjson_value* v, size_t index) {
     assert(v != NULL && v->type == MYJSON_OBJECT && index < v->val.obj.size);
-    // incomplete
-}
\ No newline at end of file
+    myjson_detach_object(v);
+    myjson_key_free(v->val.obj.m, v->val.obj.m[index].key);
+    myjson_free(&v->val.obj.m[index].v);
+    memmove(&v->val.obj.m[index], &v->val.obj.m[index + 1], (v->val.obj.size - index - 1) * sizeof(myjson_member));
+    v->val.obj.size--;
+}
+
+/* JSON Patch: each applied step logs how to undo it, so a failing patch leaves the target as it was.
+ * The log refers to containers by the parent part of the step's path, as pointers move around. */
+#define MYJSON_UNDO_REMOVE 0 /* erase what the step put at index */
+#define MYJSON_UNDO_INSERT 1 /* put old back at index, under key for object members */
+#define MYJSON_UNDO_REPLACE 2 /* move old back to index, or to the root when path is NULL */
+
+#define MYJSON_PATCH_IS(op, name) ((op)->val.s.len == sizeof(name) - 1 && memcmp((op)->val.s.s, name, sizeof(name) - 1) == 0)
+
+typedef struct {
+    const char *path; /* borrowed from the patch */
+    size_t plen, index;
+    int kind;
+    char *key;
+    size_t klen;
+    const myjson_allocator *allocator; /* of key */
+    myjson_value old;
+} myjson_undo;
+
+/* Decodes the reference token at *p, just past its '/', and leaves *p at the next '/' or the end */
+static int myjson_pointer_token(const char **p, const char *end, char *key, size_t *klen) {
+    const char *s;
+    *klen = 0;
+    for (s = *p; s < end && *s != '/'; s++) {
+        if (*s == '~') {
+            if (++s == end || (*s != '0' && *s != '1'))
+                return 0;
+            key[(*klen)++] = *s == '0' ? '~' : '/';
+        }
+        else
+            key[(*klen)++] = *s;
+    }
+    *p = s;
+    return 1;
+}
+
+static int myjson_pointer_index(const char *key, size_t klen, size_t bound, size_t *index) {
+    size_t i;
+    if (klen == 0 || klen > 18 || (key[0] == '0' && klen > 1))
+        return 0;
+    for (i = 0, *index = 0; i < klen; i++) {
+        if (!ISDIGITAL(key[i]))
+            return 0;
+        *index = *index * 10 + (key[i] - '0');
+    }
+    return *index < bound;
+}
+
+/* Walks path up to its last reference token, which is left decoded in key. *parent is NULL for the root.
+ * With modify set every container on the way is detached through the mutable accessors. */
+static int myjson_pointer_parent(myjson_value *v, const char *path, size_t plen, int modify, myjson_value **parent, char *key, size_t *klen) {
+    const char *p = path, *end = path + plen;
+    size_t index;
+    *parent = NULL;
+    if (plen == 0)
+        return MYJSON_PATCH_OK;
+    if (*p != '/')
+        return MYJSON_PATCH_INVALID_POINTER;
+    for (;;) {
+        p++;
+        if (!myjson_pointer_token(&p, end, key, klen))
+            return MYJSON_PATCH_INVALID_POINTER;
+        if (p == end) {
+            *parent = v;
+            return MYJSON_PATCH_OK;
+        }
+        if (v->type == MYJSON_OBJECT && (index = myjson_find_object_index(v, key, *klen)) != MYJSON_KEY_NOT_EXIST)
+            v = modify ? myjson_get_object_value(v, index) : &v->val.obj.m[index].v;
+        else if (v->type == MYJSON_ARRAY && myjson_pointer_index(key, *klen, v->val.arr.size, &index))
+            v = modify ? myjson_get_array_element(v, index) : &v->val.arr.e[index];
+        else
+            return MYJSON_PATCH_PATH_NOT_FOUND;
+    }
+}
+
+/* Finds the member or element index path refers to. For arrays "-" yields the size.
+ * *exists tells whether a value is there already; the root always exists. */
+static int myjson_pointer_locate(myjson_value *v, const char *path, size_t plen, int modify, char *key, size_t *klen, myjson_value **parent, size_t *index, int *exists) {
+    int ret;
+    if ((ret = myjson_pointer_parent(v, path, plen, modify, parent, key, klen)) != MYJSON_PATCH_OK)
+        return ret;
+    *exists = 1;
+    if (*parent == NULL)
+        return MYJSON_PATCH_OK;
+    if ((*parent)->type == MYJSON_OBJECT) {
+        *exists = (*index = myjson_find_object_index(*parent, key, *klen)) != MYJSON_KEY_NOT_EXIST;
+        return MYJSON_PATCH_OK;
+    }
+    if ((*parent)->type == MYJSON_ARRAY) {
+        if (*klen == 1 && key[0] == '-')
+            *index = (*parent)->val.arr.size;
+        else if (!myjson_pointer_index(key, *klen, (*parent)->val.arr.size + 1, index))
+            return MYJSON_PATCH_PATH_NOT_FOUND;
+        *exists = *index < (*parent)->val.arr.size;
+        return MYJSON_PATCH_OK;
+    }
+    return MYJSON_PATCH_PATH_NOT_FOUND;
+}
+
+static myjson_value *myjson_pointer_target(myjson_value *v, myjson_value *parent, size_t index, int modify) {
+    if (parent == NULL)
+        return v;
+    if (parent->type == MYJSON_OBJECT)
+        return modify ? myjson_get_object_value(parent, index) : &parent->val.obj.m[index].v;
+    return modify ? myjson_get_array_element(parent, index) : &parent->val.arr.e[index];
+}
+
+static int myjson_pointer_get(myjson_value *v, const char *path, size_t plen, int modify, char *key, myjson_value **target) {
+    myjson_value *parent;
+    size_t klen, index;
+    int ret, exists;
+    if ((ret = myjson_pointer_locate(v, path, plen, modify, key, &klen, &parent, &index, &exists)) != MYJSON_PATCH_OK)
+        return ret;
+    if (!exists)
+        return MYJSON_PATCH_PATH_NOT_FOUND;
+    *target = myjson_pointer_target(v, parent, index, modify);
+    return MYJSON_PATCH_OK;
+}
+
+static myjson_undo *myjson_undo_push(myjson_context *c, const char *path, size_t plen, size_t index, int kind) {
+    myjson_undo *u = (myjson_undo *)myjson_context_push(c, sizeof(myjson_undo));
+    u->path = NULL;
+    u->plen = 0;
+    if (plen > 0) {
+        /* keep the parent part only; path starts with '/' */
+        for (u->path = path, u->plen = plen - 1; path[u->plen] != '/'; u->plen--)
+            ;
+    }
+    u->index = index;
+    u->kind = kind;
+    u->key = NULL;
+    u->klen = 0;
+    myjson_init(&u->old);
+    return u;
+}
+
+/* Puts a member back at index, taking over key and value */
+static void myjson_insert_object_member(myjson_value *v, size_t index, char *key, size_t klen, myjson_value *value) {
+    myjson_member *m;
+    myjson_grow_object(v, v->val.obj.size + 1);
+    m = &v->val.obj.m[index];
+    memmove(m + 1, m, (v->val.obj.size - index) * sizeof(myjson_member));
+    m->key = key;
+    m->klen = klen;
+    memcpy(&m->v, value, sizeof(myjson_value));
+    myjson_init(value);
+    v->val.obj.size++;
+}
+
+static void myjson_undo_step(myjson_value *v, myjson_undo *u) {
+    myjson_value *parent;
+    char *key;
+    int ret;
+    if (u->path == NULL) {
+        myjson_move(v, &u->old);
+        return;
+    }
+    key = (char *)MYJSON_MALLOC(myjson_global_allocator, u->plen + 1);
+    ret = myjson_pointer_get(v, u->path, u->plen, 1, key, &parent);
+    assert(ret == MYJSON_PATCH_OK);
+    MYJSON_FREE(myjson_global_allocator, key);
+    switch (u->kind) {
+        case MYJSON_UNDO_REMOVE:
+            if (parent->type == MYJSON_OBJECT)
+                myjson_remove_object_value(parent, u->index);
+            else
+                myjson_erase_array_element(parent, u->index, 1);
+            break;
+        case MYJSON_UNDO_INSERT:
+            if (parent->type == MYJSON_OBJECT) {
+                myjson_insert_object_member(parent, u->index, u->key, u->klen, &u->old);
+                u->key = NULL;
+            }
+            else
+                myjson_move(myjson_insert_array_element(parent, u->index), &u->old);
+            break;
+        default:
+            myjson_move(myjson_pointer_target(v, parent, u->index, 1), &u->old);
+            break;
+    }
+}
+
+static void myjson_patch_replace_at(myjson_context *undo, myjson_value *v, const char *path, size_t plen, myjson_value *parent, size_t index, myjson_value *value) {
+    myjson_undo *u = myjson_undo_push(undo, path, plen, index, MYJSON_UNDO_REPLACE);
+    myjson_value *target = myjson_pointer_target(v, parent, index, 1);
+    myjson_move(&u->old, target);
+    myjson_move(target, value);
+}
+
+static int myjson_patch_add(myjson_context *undo, myjson_value *v, const char *path, size_t plen, char *key, myjson_value *value) {
+    myjson_value *parent, *target;
+    size_t klen, index;
+    int ret, exists;
+    if ((ret = myjson_pointer_locate(v, path, plen, 1, key, &klen, &parent, &index, &exists)) != MYJSON_PATCH_OK)
+        return ret;
+    if (exists && (parent == NULL || parent->type == MYJSON_OBJECT)) {
+        myjson_patch_replace_at(undo, v, path, plen, parent, index, value);
+        return MYJSON_PATCH_OK;
+    }
+    if (parent->type == MYJSON_OBJECT) {
+        target = myjson_set_object_value(parent, key, klen);
+        index = (size_t)((const char *)target - (const char *)parent->val.obj.m) / sizeof(myjson_member);
+    }
+    else
+        target = myjson_insert_array_element(parent, index);
+    myjson_move(target, value);
+    myjson_undo_push(undo, path, plen, index, MYJSON_UNDO_REMOVE);
+    return MYJSON_PATCH_OK;
+}
+
+static int myjson_patch_replace(myjson_context *undo, myjson_value *v, const char *path, size_t plen, char *key, myjson_value *value) {
+    myjson_value *parent;
+    size_t klen, index;
+    int ret, exists;
+    if ((ret = myjson_pointer_locate(v, path, plen, 1, key, &klen, &parent, &index, &exists)) != MYJSON_PATCH_OK)
+        return ret;
+    if (!exists)
+        return MYJSON_PATCH_PATH_NOT_FOUND;
+    myjson_patch_replace_at(undo, v, path, plen, parent, index, value);
+    return MYJSON_PATCH_OK;
+}
+
+/* A copy of the removed value is left in removed when it is not NULL; the copy shares its storage */
+static int myjson_patch_remove(myjson_context *undo, myjson_value *v, const char *path, size_t plen, char *key, myjson_value *removed) {
+    myjson_value *parent;
+    myjson_member *m;
+    myjson_undo *u;
+    size_t klen, index;
+    int ret, exists;
+    if ((ret = myjson_pointer_locate(v, path, plen, 1, key, &klen, &parent, &index, &exists)) != MYJSON_PATCH_OK)
+        return ret;
+    if (!exists)
+        return MYJSON_PATCH_PATH_NOT_FOUND;
+    if (parent == NULL) {
+        u = myjson_undo_push(undo, path, plen, 0, MYJSON_UNDO_REPLACE);
+        myjson_move(&u->old, v);
+    }
+    else if (parent->type == MYJSON_OBJECT) {
+        u = myjson_undo_push(undo, path, plen, index, MYJSON_UNDO_INSERT);
+        myjson_detach_object(parent);
+        m = &parent->val.obj.m[index];
+        u->key = m->key;
+        u->klen = m->klen;
+        u->allocator = MYJSON_BLOCK(parent->val.obj.m)->allocator;
+        memcpy(&u->old, &m->v, sizeof(myjson_value));
+        memmove(m, m + 1, (parent->val.obj.size - index - 1) * sizeof(myjson_member));
+        parent->val.obj.size--;
+    }
+    else {
+        u = myjson_undo_push(undo, path, plen, index, MYJSON_UNDO_INSERT);
+        myjson_move(&u->old, myjson_get_array_element(parent, index));
+        myjson_erase_array_element(parent, index, 1);
+    }
+    if (removed != NULL)
+        myjson_copy(removed, &u->old);
+    return MYJSON_PATCH_OK;
+}
+
+static const myjson_value *myjson_patch_member(const myjson_value *op, const char *name) {
+    size_t index = myjson_find_object_index(op, name, strlen(name));
+    return index == MYJSON_KEY_NOT_EXIST ? NULL : &op->val.obj.m[index].v;
+}
+
+static int myjson_patch_step(myjson_context *undo, myjson_value *v, const myjson_value *op) {
+    const myjson_value *name, *path, *from, *value;
+    const char *p;
+    myjson_value temp, *source;
+    char *key;
+    size_t plen;
+    int ret;
+    if (op->type != MYJSON_OBJECT
+        || (name = myjson_patch_member(op, "op")) == NULL || name->type != MYJSON_STRING
+        || (path = myjson_patch_member(op, "path")) == NULL || path->type != MYJSON_STRING)
+        return MYJSON_PATCH_INVALID_OPERATION;
+    if ((from = myjson_patch_member(op, "from")) != NULL && from->type != MYJSON_STRING)
+        return MYJSON_PATCH_INVALID_OPERATION;
+    value = myjson_patch_member(op, "value");
+    p = path->val.s.s;
+    plen = path->val.s.len;
+    key = (char *)MYJSON_MALLOC(myjson_global_allocator, plen + (from != NULL ? from->val.s.len : 0) + 1);
+    myjson_init(&temp);
+    if (MYJSON_PATCH_IS(name, "add") && value != NULL) {
+        myjson_copy(&temp, value);
+        ret = myjson_patch_add(undo, v, p, plen, key, &temp);
+    }
+    else if (MYJSON_PATCH_IS(name, "replace") && value != NULL) {
+        myjson_copy(&temp, value);
+        ret = myjson_patch_replace(undo, v, p, plen, key, &temp);
+    }
+    else if (MYJSON_PATCH_IS(name, "remove"))
+        ret = myjson_patch_remove(undo, v, p, plen, key, NULL);
+    else if (MYJSON_PATCH_IS(name, "test") && value != NULL) {
+        if ((ret = myjson_pointer_get(v, p, plen, 0, key, &source)) == MYJSON_PATCH_OK && !myjson_is_equal(source, value))
+            ret = MYJSON_PATCH_TEST_FAILED;
+    }
+    else if (MYJSON_PATCH_IS(name, "move") && from != NULL) {
+        if (from->val.s.len == plen && memcmp(from->val.s.s, p, plen) == 0)
+            ret = myjson_pointer_get(v, p, plen, 0, key, &source);
+        else if (from->val.s.len < plen && memcmp(from->val.s.s, p, from->val.s.len) == 0 && p[from->val.s.len] == '/')
+            ret = MYJSON_PATCH_INVALID_OPERATION; /* into one of its own children */
+        else if ((ret = myjson_patch_remove(undo, v, from->val.s.s, from->val.s.len, key, &temp)) == MYJSON_PATCH_OK)
+            ret = myjson_patch_add(undo, v, p, plen, key, &temp);
+    }
+    else if (MYJSON_PATCH_IS(name, "copy") && from != NULL) {
+        if ((ret = myjson_pointer_get(v, from->val.s.s, from->val.s.len, 0, key, &source)) == MYJSON_PATCH_OK) {
+            myjson_copy(&temp, source);
+            ret = myjson_patch_add(undo, v, p, plen, key, &temp);
+        }
+    }
+    else
+        ret = MYJSON_PATCH_INVALID_OPERATION;
+    myjson_free(&temp);
+    MYJSON_FREE(myjson_global_allocator, key);
+    return ret;
+}
+
+int myjson_apply_patch(myjson_value *v, const myjson_value *patch) {
+    myjson_context undo;
+    myjson_undo *u;
+    size_t i;
+    int ret = MYJSON_PATCH_OK;
+    assert(v != NULL && patch != NULL);
+    if (patch->type != MYJSON_ARRAY)
+        return MYJSON_PATCH_INVALID_OPERATION;
+    myjson_context_init(&undo, myjson_global_allocator, 0);
+    for (i = 0; i < patch->val.arr.size && ret == MYJSON_PATCH_OK; i++)
+        ret = myjson_patch_step(&undo, v, &patch->val.arr.e[i]);
+    while (undo.top > 0) {
+        u = (myjson_undo *)myjson_context_pop(&undo, sizeof(myjson_undo));
+        if (ret != MYJSON_PATCH_OK)
+            myjson_undo_step(v, u);
+        MYJSON_FREE(u->allocator, u->key);
+        myjson_free(&u->old);
+    }
+    MYJSON_FREE(undo.allocator, undo.stack);
+    return ret;
+}
+
+typedef struct {
+    myjson_value *v;
+    const myjson_value *patch;
+    size_t i;
+} myjson_merge_frame;
+
+void myjson_merge_patch(myjson_value *v, const myjson_value *patch) {
+    myjson_context frames;
+    myjson_merge_frame *f;
+    const myjson_member *m;
+    size_t index;
+    assert(v != NULL && patch != NULL);
+    myjson_context_init(&frames, myjson_global_allocator, 0);
+    for (;;) {
+        if (patch->type != MYJSON_OBJECT)
+            myjson_copy(v, patch);
+        else {
+            if (v->type != MYJSON_OBJECT)
+                myjson_set_object(v, 0);
+            f = (myjson_merge_frame *)myjson_context_push(&frames, sizeof(myjson_merge_frame));
+            f->v = v;
+            f->patch = patch;
+            f->i = 0;
+        }
+        /* a member's value is merged before the next member of its object, whose block it lives in */
+        for (;;) {
+            if (frames.top == 0) {
+                MYJSON_FREE(frames.allocator, frames.stack);
+                return;
+            }
+            f = (myjson_merge_frame *)(frames.stack + frames.top - sizeof(myjson_merge_frame));
+            if (f->i == f->patch->val.obj.size) {
+                myjson_context_pop(&frames, sizeof(myjson_merge_frame));
+                continue;
+            }
+            m = &f->patch->val.obj.m[f->i++];
+            if (m->v.type != MYJSON_NULL) {
+                v = myjson_set_object_value(f->v, m->key, m->klen);
+                patch = &m->v;
+                break;
+            }
+            if ((index = myjson_find_object_index(f->v, m->key, m->klen)) != MYJSON_KEY_NOT_EXIST)
+                myjson_remove_object_value(f->v, index);
+        }
+    }
+}
+
+/* Diff: the path of the value being compared is kept as a JSON pointer on a context stack */
+#ifndef MYJSON_DIFF_LCS_CELLS
+#define MYJSON_DIFF_LCS_CELLS (1 << 22)
+#endif
+
+/* Subtrees that differ below this depth are replaced whole */
+#ifndef MYJSON_DIFF_MAX_DEPTH
+#define MYJSON_DIFF_MAX_DEPTH 256
+#endif
+
+static void myjson_diff_value(myjson_value *patch, myjson_context *path, const myjson_value *a, const myjson_value *b, size_t depth);
+
+static void myjson_diff_op(myjson_value *patch, const char *op, const myjson_context *path, const myjson_value *value) {
+    myjson_value *o = myjson_pushback_array_element(patch);
+    myjson_set_object(o, value != NULL ? 3 : 2);
+    myjson_set_string(myjson_set_object_value(o, "op", 2), op, strlen(op));
+    myjson_set_string(myjson_set_object_value(o, "path", 4), path->stack, path->top);
+    if (value != NULL)
+        myjson_copy(myjson_set_object_value(o, "value", 5), value);
+}
+
+static void myjson_diff_push_key(myjson_context *c, const char *key, size_t klen) {
+    size_t i;
+    PUTC(c, '/');
+    for (i = 0; i < klen; i++) {
+        if (key[i] == '~')
+            PUTS(c, "~0", 2);
+        else if (key[i] == '/')
+            PUTS(c, "~1", 2);
+        else
+            PUTC(c, key[i]);
+    }
+}
+
+static void myjson_diff_push_index(myjson_context *c, size_t index) {
+    c->top -= 32 - sprintf(myjson_context_push(c, 32), "/%zu", index);
+}
+
+/* Both sides sorted: one pass in key order, the first of duplicate keys standing for them all */
+static void myjson_diff_sorted_object(myjson_value *patch, myjson_context *path, const myjson_value *a, const myjson_value *b, size_t depth) {
+    const myjson_member *ma = a->val.obj.m, *mb = b->val.obj.m;
+    size_t i = 0, j = 0, head = path->top;
+    int r;
+    while (i < a->val.obj.size || j < b->val.obj.size) {
+        if (i > 0 && i < a->val.obj.size && ma[i].klen == ma[i - 1].klen && memcmp(ma[i].key, ma[i - 1].key, ma[i].klen) == 0) {
+            i++;
+            continue;
+        }
+        if (j > 0 && j < b->val.obj.size && mb[j].klen == mb[j - 1].klen && memcmp(mb[j].key, mb[j - 1].key, mb[j].klen) == 0) {
+            j++;
+            continue;
+        }
+        r = i == a->val.obj.size ? 1 : j == b->val.obj.size ? -1 : myjson_key_compare(ma[i].key, ma[i].klen, mb[j].key, mb[j].klen);
+        if (r <= 0)
+            myjson_diff_push_key(path, ma[i].key, ma[i].klen);
+        else
+            myjson_diff_push_key(path, mb[j].key, mb[j].klen);
+        if (r < 0)
+            myjson_diff_op(patch, "remove", path, NULL);
+        else if (r > 0)
+            myjson_diff_op(patch, "add", path, &mb[j].v);
+        else
+            myjson_diff_value(patch, path, &ma[i].v, &mb[j].v, depth + 1);
+        i += r <= 0;
+        j += r >= 0;
+        path->top = head;
+    }
+}
+
+static void myjson_diff_object(myjson_value *patch, myjson_context *path, const myjson_value *a, const myjson_value *b, size_t depth) {
+    myjson_key_index t;
+    const myjson_member *m;
+    size_t i, index, head = path->top;
+    char *seen;
+    if (a->flags & b->flags & MYJSON_VALUE_SORTED) {
+        myjson_diff_sorted_object(patch, path, a, b, depth);
+        return;
+    }
+    seen = (char *)MYJSON_MALLOC(myjson_global_allocator, b->val.obj.size + 1);
+    memset(seen, 0, b->val.obj.size + 1);
+    myjson_key_index_init(&t, b);
+    for (i = 0; i < a->val.obj.size; i++) {
+        m = &a->val.obj.m[i];
+        myjson_diff_push_key(path, m->key, m->klen);
+        if ((index = myjson_key_index_find(&t, m->key, m->klen)) == MYJSON_KEY_NOT_EXIST)
+            myjson_diff_op(patch, "remove", path, NULL);
+        else {
+            seen[index] = 1;
+            myjson_diff_value(patch, path, &m->v, &b->val.obj.m[index].v, depth + 1);
+        }
+        path->top = head;
+    }
+    for (i = 0; i < b->val.obj.size; i++) {
+        m = &b->val.obj.m[i];
+        if (seen[i] || myjson_key_index_find(&t, m->key, m->klen) != i)
+            continue;
+        myjson_diff_push_key(path, m->key, m->klen);
+        myjson_diff_op(patch, "add", path, &m->v);
+        path->top = head;
+    }
+    myjson_key_index_free(&t);
+    MYJSON_FREE(myjson_global_allocator, seen);
+}
+
+/* Turns a[0, na) into b[0, nb) at array position *k: pairs are diffed in place, the rest removed or added */
+static void myjson_diff_run(myjson_value *patch, myjson_context *path, const myjson_value *a, size_t na, const myjson_value *b, size_t nb, size_t *k, size_t depth) {
+    size_t i, head = path->top;
+    for (i = 0; i < na || i < nb; i++) {
+        myjson_diff_push_index(path, *k);
+        if (i < na && i < nb)
+            myjson_diff_value(patch, path, &a[i], &b[i], depth + 1);
+        else if (i < na)
+            myjson_diff_op(patch, "remove", path, NULL);
+        else
+            myjson_diff_op(patch, "add", path, &b[i]);
+        if (i < nb)
+            (*k)++;
+        path->top = head;
+    }
+}
+
+#define MYJSON_DIFF_SAME(i, j) (ha[i] == hb[j] && myjson_is_equal(&a[i], &b[j]))
+
+/* The common prefix and suffix are skipped; what is left in between is aligned by a longest
+ * common subsequence when that table stays under MYJSON_DIFF_LCS_CELLS, else pairwise */
+static void myjson_diff_array(myjson_value *patch, myjson_context *path, const myjson_value *va, const myjson_value *vb, size_t depth) {
+    const myjson_value *a = va->val.arr.e, *b = vb->val.arr.e;
+    size_t na = va->val.arr.size, nb = vb->val.arr.size, pre = 0, suf = 0;
+    size_t i, j, ri, rj, k, *ha, *hb;
+    unsigned *lcs;
+    while (pre < na && pre < nb && myjson_is_equal(&a[pre], &b[pre]))
+        pre++;
+    while (suf < na - pre && suf < nb - pre && myjson_is_equal(&a[na - 1 - suf], &b[nb - 1 - suf]))
+        suf++;
+    a += pre;
+    b += pre;
+    na -= pre + suf;
+    nb -= pre + suf;
+    k = pre;
+    if (na == 0 || nb == 0 || (na + 1) * (nb + 1) > MYJSON_DIFF_LCS_CELLS) {
+        myjson_diff_run(patch, path, a, na, b, nb, &k, depth);
+        return;
+    }
+    ha = (size_t *)MYJSON_MALLOC(myjson_global_allocator, na * sizeof(size_t));
+    hb = (size_t *)MYJSON_MALLOC(myjson_global_allocator, nb * sizeof(size_t));
+    for (i = 0; i < na; i++)
+        ha[i] = myjson_hash(&a[i]);
+    for (j = 0; j < nb; j++)
+        hb[j] = myjson_hash(&b[j]);
+    /* lcs[i * (nb + 1) + j] is the length for a[i, na) and b[j, nb) */
+    lcs = (unsigned *)MYJSON_MALLOC(myjson_global_allocator, (na + 1) * (nb + 1) * sizeof(unsigned));
+    for (i = na + 1; i-- > 0; )
+        for (j = nb + 1; j-- > 0; ) {
+            unsigned *l = &lcs[i * (nb + 1) + j];
+            if (i == na || j == nb)
+                *l = 0;
+            else if (MYJSON_DIFF_SAME(i, j))
+                *l = l[nb + 2] + 1;
+            else
+                *l = l[nb + 1] > l[1] ? l[nb + 1] : l[1];
+        }
+    for (i = j = 0; i < na || j < nb; ) {
+        /* gather the deletions and insertions up to the next match */
+        for (ri = i, rj = j; i < na && j < nb && !MYJSON_DIFF_SAME(i, j); ) {
+            if (lcs[(i + 1) * (nb + 1) + j] >= lcs[i * (nb + 1) + j + 1])
+                i++;
+            else
+                j++;
+        }
+        if (i == na || j == nb)
+            i = na, j = nb;
+        myjson_diff_run(patch, path, a + ri, i - ri, b + rj, j - rj, &k, depth);
+        if (i < na) {
+            i++;
+            j++;
+            k++;
+        }
+    }
+    MYJSON_FREE(myjson_global_allocator, lcs);
+    MYJSON_FREE(myjson_global_allocator, ha);
+    MYJSON_FREE(myjson_global_allocator, hb);
+}
+
+static void myjson_diff_value(myjson_value *patch, myjson_context *path, const myjson_value *a, const myjson_value *b, size_t depth) {
+    if (myjson_is_equal(a, b))
+        return;
+    if (depth == MYJSON_DIFF_MAX_DEPTH)
+        myjson_diff_op(patch, "replace", path, b);
+    else if (a->type == MYJSON_OBJECT && b->type == MYJSON_OBJECT)
+        myjson_diff_object(patch, path, a, b, depth);
+    else if (a->type == MYJSON_ARRAY && b->type == MYJSON_ARRAY)
+        myjson_diff_array(patch, path, a, b, depth);
+    else
+        myjson_diff_op(patch, "replace", path, b);
+}
+
+void myjson_diff(myjson_value *patch, const myjson_value *a, const myjson_value *b) {
+    myjson_context path;
+    assert(patch != NULL && a != NULL && b != NULL);
+    myjson_context_init(&path, myjson_global_allocator, 0);
+    myjson_set_array(patch, 0);
+    myjson_diff_value(patch, &path, a, b, 0);
+    MYJSON_FREE(path.allocator, path.stack);
+}
+
+/* Tape: tag in the top byte, index or offset below. Numbers take a second word with the raw double.
+ * A container start holds the index of its end word; the end word holds the element count. */
+#define MYJSON_TAPE_WORD(tag, payload) (((unsigned long long)(tag) << 56) | (unsigned long long)(payload))
+#define MYJSON_TAPE_TAG(w) ((unsigned)((w) >> 56))
+#define MYJSON_TAPE_PAYLOAD(w) ((size_t)((w) & 0x00FFFFFFFFFFFFFFULL))
+#define MYJSON_TAPE_END 0x80
+#define PUTW(c, w) do { *(unsigned long long *)myjson_context_push(c, sizeof(unsigned long long)) = (w); } while(0)
+
+static void myjson_tape_put_string(myjson_context *words, myjson_context *strings, unsigned tag, const char *s, size_t len) {
+    size_t offset = strings->top;
+    char *p = (char *)myjson_context_push(strings, sizeof(size_t) + len + 1);
+    memcpy(p, &len, sizeof(size_t));
+    memcpy(p + sizeof(size_t), s, len);
+    p[sizeof(size_t) + len] = '\0';
+    PUTW(words, MYJSON_TAPE_WORD(tag, offset));
+}
+
+typedef struct {
+    const myjson_value *v;
+    size_t i, start;
+} myjson_tape_frame;
+
+static void myjson_tape_put_value(myjson_context *words, myjson_context *strings, const myjson_value *v) {
+    myjson_context frames;
+    myjson_tape_frame *f;
+    myjson_value temp;
+    double n;
+    myjson_context_init(&frames, myjson_global_allocator, 0);
+    for (;;) {
+        switch (v->type) {
+            case MYJSON_NUMBER:
+                PUTW(words, MYJSON_TAPE_WORD(MYJSON_NUMBER, 0));
+                n = myjson_get_number(v);
+                memcpy(myjson_context_push(words, sizeof(double)), &n, sizeof(double));
+                break;
+            case MYJSON_RAW:
+                /* a single nested call, as a parsed fragment holds no fragments */
+                myjson_tape_put_value(words, strings, myjson_raw_expand(v, &temp));
+                myjson_free(&temp);
+                break;
+            case MYJSON_STRING:
+                myjson_tape_put_string(words, strings, MYJSON_STRING, v->val.s.s, v->val.s.len);
+                break;
+            case MYJSON_ARRAY:
+            case MYJSON_OBJECT:
+                f = (myjson_tape_frame *)myjson_context_push(&frames, sizeof(myjson_tape_frame));
+                f->v = v;
+                f->i = 0;
+                f->start = words->top;
+                PUTW(words, 0);
+                break;
+            default:
+                PUTW(words, MYJSON_TAPE_WORD(v->type, 0));
+                break;
+        }
+        /* move on to the next child, closing every container that is done */
+        for (;;) {
+            if (frames.top == 0) {
+                MYJSON_FREE(frames.allocator, frames.stack);
+                return;
+            }
+            f = (myjson_tape_frame *)(frames.stack + frames.top - sizeof(myjson_tape_frame));
+            v = f->v;
+            if (f->i == (v->type == MYJSON_ARRAY ? v->val.arr.size : v->val.obj.size)) {
+                *(unsigned long long *)(words->stack + f->start) = MYJSON_TAPE_WORD(v->type, words->top / sizeof(unsigned long long));
+                PUTW(words, MYJSON_TAPE_WORD(MYJSON_TAPE_END | v->type, f->i));
+                myjson_context_pop(&frames, sizeof(myjson_tape_frame));
+                continue;
+            }
+            if (v->type == MYJSON_ARRAY)
+                v = &v->val.arr.e[f->i++];
+            else {
+                myjson_tape_put_string(words, strings, MYJSON_STRING, v->val.obj.m[f->i].key, v->val.obj.m[f->i].klen);
+                v = &v->val.obj.m[f->i++].v;
+            }
+            break;
+        }
+    }
+}
+
+void myjson_tape_from_value(myjson_tape *t, const myjson_value *v) {
+    myjson_context words, strings;
+    assert(t != NULL && v != NULL);
+    myjson_context_init(&words, myjson_global_allocator, 0);
+    myjson_context_init(&strings, myjson_global_allocator, 0);
+    myjson_tape_put_value(&words, &strings, v);
+    t->words = (unsigned long long *)words.stack;
+    t->size = words.top / sizeof(unsigned long long);
+    t->strings = strings.stack;
+    t->slen = strings.top;
+}
+
+void myjson_tape_free(myjson_tape *t) {
+    assert(t != NULL);
+    MYJSON_FREE(myjson_global_allocator, t->words);
+    MYJSON_FREE(myjson_global_allocator, t->strings);
+    t->words = NULL;
+    t->strings = NULL;
+    t->size = t->slen = 0;
+}
+
+myjson_type myjson_tape_get_type(const myjson_tape *t, size_t index) {
+    assert(t != NULL && index < t->size && !(MYJSON_TAPE_TAG(t->words[index]) & MYJSON_TAPE_END));
+    return (myjson_type)MYJSON_TAPE_TAG(t->words[index]);
+}
+
+int myjson_tape_get_boolean(const myjson_tape *t, size_t index) {
+    assert(myjson_tape_get_type(t, index) == MYJSON_TRUE || myjson_tape_get_type(t, index) == MYJSON_FALSE);
+    return MYJSON_TAPE_TAG(t->words[index]) == MYJSON_TRUE;
+}
+
+double myjson_tape_get_number(const myjson_tape *t, size_t index) {
+    double n;
+    assert(myjson_tape_get_type(t, index) == MYJSON_NUMBER);
+    memcpy(&n, &t->words[index + 1], sizeof(double));
+    return n;
+}
+
+const char *myjson_tape_get_string(const myjson_tape *t, size_t index) {
+    assert(myjson_tape_get_type(t, index) == MYJSON_STRING);
+    return t->strings + MYJSON_TAPE_PAYLOAD(t->words[index]) + sizeof(size_t);
+}
+
+size_t myjson_tape_get_string_length(const myjson_tape *t, size_t index) {
+    size_t len;
+    assert(myjson_tape_get_type(t, index) == MYJSON_STRING);
+    memcpy(&len, t->strings + MYJSON_TAPE_PAYLOAD(t->words[index]), sizeof(size_t));
+    return len;
+}
+
+size_t myjson_tape_get_size(const myjson_tape *t, size_t index) {
+    assert(myjson_tape_get_type(t, index) == MYJSON_ARRAY || myjson_tape_get_type(t, index) == MYJSON_OBJECT);
+    return MYJSON_TAPE_PAYLOAD(t->words[MYJSON_TAPE_PAYLOAD(t->words[index])]);
+}
+
+size_t myjson_tape_first(const myjson_tape *t, size_t index) {
+    assert(myjson_tape_get_type(t, index) == MYJSON_ARRAY || myjson_tape_get_type(t, index) == MYJSON_OBJECT);
+    return index + 1;
+}
+
+size_t myjson_tape_next(const myjson_tape *t, size_t index) {
+    switch (myjson_tape_get_type(t, index)) {
+        case MYJSON_NUMBER: return index + 2;
+        case MYJSON_ARRAY:
+        case MYJSON_OBJECT: return MYJSON_TAPE_PAYLOAD(t->words[index]) + 1;
+        default: return index + 1;
+    }
+}
+
+int myjson_tape_is_end(const myjson_tape *t, size_t index) {
+    assert(t != NULL && index < t->size);
+    return (MYJSON_TAPE_TAG(t->words[index]) & MYJSON_TAPE_END) != 0;
+}
+
+size_t myjson_tape_find_object_value(const myjson_tape *t, size_t index, const char *key, size_t klen) {
+    size_t i;
+    assert(myjson_tape_get_type(t, index) == MYJSON_OBJECT && key != NULL);
+    for (i = myjson_tape_first(t, index); !myjson_tape_is_end(t, i); i = myjson_tape_next(t, i + 1))
+        if (myjson_tape_get_string_length(t, i) == klen && memcmp(myjson_tape_get_string(t, i), key, klen) == 0)
+            return i + 1;
+    return MYJSON_KEY_NOT_EXIST;
+}
+
+typedef struct {
+    myjson_value *v;
+    size_t i, n;
+} myjson_tape_build_frame;
+
+void myjson_tape_to_value(const myjson_tape *t, size_t index, myjson_value *v) {
+    myjson_context frames;
+    myjson_tape_build_frame *f;
+    myjson_member *m;
+    size_t n;
+    assert(t != NULL && v != NULL);
+    myjson_context_init(&frames, myjson_global_allocator, 0);
+    for (;;) {
+        switch (myjson_tape_get_type(t, index)) {
+            case MYJSON_NUMBER:
+                myjson_set_number(v, myjson_tape_get_number(t, index));
+                index += 2;
+                break;
+            case MYJSON_STRING:
+                myjson_set_string(v, myjson_tape_get_string(t, index), myjson_tape_get_string_length(t, index));
+                index++;
+                break;
+            case MYJSON_ARRAY:
+            case MYJSON_OBJECT:
+                n = myjson_tape_get_size(t, index);
+                if (myjson_tape_get_type(t, index) == MYJSON_ARRAY)
+                    myjson_set_array(v, n);
+                else
+                    myjson_set_object(v, n);
+                f = (myjson_tape_build_frame *)myjson_context_push(&frames, sizeof(myjson_tape_build_frame));
+                f->v = v;
+                f->i = 0;
+                f->n = n;
+                index++;
+                break;
+            default:
+                myjson_free(v);
+                v->type = myjson_tape_get_type(t, index);
+                index++;
+                break;
+        }
+        /* the words run in document order: keys and end words are stepped over as they come */
+        for (;;) {
+            if (frames.top == 0) {
+                MYJSON_FREE(frames.allocator, frames.stack);
+                return;
+            }
+            f = (myjson_tape_build_frame *)(frames.stack + frames.top - sizeof(myjson_tape_build_frame));
+            if (f->i == f->n) {
+                if (f->v->type == MYJSON_ARRAY)
+                    f->v->val.arr.size = f->n;
+                else
+                    f->v->val.obj.size = f->n;
+                myjson_context_pop(&frames, sizeof(myjson_tape_build_frame));
+                index++;
+                continue;
+            }
+            if (f->v->type == MYJSON_ARRAY)
+                v = &f->v->val.arr.e[f->i++];
+            else {
+                m = &f->v->val.obj.m[f->i++];
+                m->klen = myjson_tape_get_string_length(t, index);
+                m->key = myjson_key_alloc(MYJSON_BLOCK(f->v->val.obj.m)->allocator, myjson_tape_get_string(t, index), m->klen);
+                v = &m->v;
+                index++;
+            }
+            myjson_init(v);
+            break;
+        }
+    }
+}
+
+/* A single pass over the words; the state stack only tracks comma and key/value position per level */
+char *myjson_tape_stringify(const myjson_tape *t, size_t *length) {
+    enum { FIRST = 0, NEXT = 1, VALUE = 2, OBJECT = 4 };
+    myjson_context c, states;
+    unsigned char *state;
+    size_t i;
+    assert(t != NULL);
+    myjson_context_init(&c, myjson_global_allocator, MYJSON_PARSE_STRINGIFY_INIT_SIZE);
+    myjson_context_init(&states, myjson_global_allocator, 0);
+    for (i = 0; i < t->size; i++) {
+        unsigned long long w = t->words[i];
+        unsigned tag = MYJSON_TAPE_TAG(w);
+        if (tag & MYJSON_TAPE_END) {
+            PUTC(&c, tag == (MYJSON_TAPE_END | MYJSON_ARRAY) ? ']' : '}');
+            myjson_context_pop(&states, 1);
+            continue;
+        }
+        if (states.top > 0) {
+            state = (unsigned char *)states.stack + states.top - 1;
+            if ((*state & 3) == NEXT)
+                PUTC(&c, ',');
+            if ((*state & OBJECT) && (*state & 3) != VALUE) {
+                myjson_stringify_string(&c, myjson_tape_get_string(t, i), myjson_tape_get_string_length(t, i));
+                PUTC(&c, ':');
+                *state = OBJECT | VALUE;
+                continue;
+            }
+            *state = (*state & OBJECT) | NEXT;
+        }
+        switch (tag) {
+            case MYJSON_NULL: PUTS(&c, "null", 4); break;
+            case MYJSON_FALSE: PUTS(&c, "false", 5); break;
+            case MYJSON_TRUE: PUTS(&c, "true", 4); break;
+            case MYJSON_NUMBER:
+                c.top -= 32 - sprintf(myjson_context_push(&c, 32), "%.17g", myjson_tape_get_number(t, i));
+                i++;
+                break;
+            case MYJSON_STRING:
+                myjson_stringify_string(&c, myjson_tape_get_string(t, i), myjson_tape_get_string_length(t, i));
+                break;
+            case MYJSON_ARRAY:
+                PUTC(&c, '[');
+                *(unsigned char *)myjson_context_push(&states, 1) = FIRST;
+                break;
+            case MYJSON_OBJECT:
+                PUTC(&c, '{');
+                *(unsigned char *)myjson_context_push(&states, 1) = OBJECT | FIRST;
+                break;
+            default: assert(0 && "invalid type");
+        }
+    }
+    MYJSON_FREE(states.allocator, states.stack);
+    if (length)
+       *length = c.top;
+    PUTC(&c, '\0');
+    return c.stack;
+}
+
+/* Primitives for bindings generated by myjson_gen: values are decoded straight from the text */
+static void myjson_read_context(myjson_context *c, const char *json) {
+    myjson_context_init(c, myjson_global_allocator, 0);
+    c->json = json;
+    c->flags = 0;
+    c->max_depth = MYJSON_PARSE_MAX_DEPTH;
+    c->max_bytes = c->max_string = c->max_members = (size_t)-1;
+    c->allocated = 0;
+}
+
+void myjson_read_whitespace(const char **json) {
+    const char *p = *json;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+    *json = p;
+}
+
+int myjson_read_null(const char **json) {
+    if (strncmp(*json, "null", 4) != 0)
+        return MYJSON_PARSE_INVALID_VALUE;
+    *json += 4;
+    return MYJSON_PARSE_OK;
+}
+
+int myjson_read_boolean(const char **json, int *b) {
+    if (strncmp(*json, "true", 4) == 0) {
+        *json += 4;
+        *b = 1;
+    }
+    else if (strncmp(*json, "false", 5) == 0) {
+        *json += 5;
+        *b = 0;
+    }
+    else
+        return MYJSON_PARSE_INVALID_VALUE;
+    return MYJSON_PARSE_OK;
+}
+
+/* Plain integers of up to max digits, without fraction or exponent, are read exactly without strtod() */
+static const char *myjson_read_digits(const char *p, size_t max, unsigned long long *u) {
+    const char *digits;
+    *u = 0;
+    if (*p == '-')
+        p++;
+    if (!ISDIGITAL(*p) || (*p == '0' && ISDIGITAL(p[1])))
+        return NULL;
+    for (digits = p; ISDIGITAL(*p) && (size_t)(p - digits) < max; p++)
+        *u = *u * 10 + (*p - '0');
+    return ISDIGITAL(*p) || *p == '.' || *p == 'e' || *p == 'E' ? NULL : p;
+}
+
+int myjson_read_number(const char **json, double *n) {
+    myjson_context c;
+    myjson_value v;
+    unsigned long long u;
+    const char *p;
+    int ret;
+    if ((p = myjson_read_digits(*json, 15, &u)) != NULL) {
+        *n = **json == '-' ? -(double)u : (double)u;
+        *json = p;
+        return MYJSON_PARSE_OK;
+    }
+    myjson_read_context(&c, *json);
+    if ((ret = myjson_parse_number(&c, &v)) == MYJSON_PARSE_OK) {
+        *n = v.val.n;
+        *json = c.json;
+    }
+    return ret;
+}
+
+/* Plain integers are read exactly with an overflow check; other numbers must be integral */
+int myjson_read_integer(const char **json, long long *n) {
+    unsigned long long u = 0, limit;
+    const char *p = *json;
+    double d;
+    int ret, negative = *p == '-';
+    if (negative)
+        p++;
+    if (ISDIGITAL(*p) && !(*p == '0' && ISDIGITAL(p[1]))) {
+        limit = negative ? 9223372036854775808ULL : 9223372036854775807ULL;
+        for (; ISDIGITAL(*p); p++) {
+            if (u > (limit - (unsigned)(*p - '0')) / 10)
+                return MYJSON_PARSE_NUMBER_TOO_BIG;
+            u = u * 10 + (unsigned)(*p - '0');
+        }
+        if (*p != '.' && *p != 'e' && *p != 'E') {
+            *n = negative && u > 0 ? -(long long)(u - 1) - 1 : (long long)u;
+            *json = p;
+            return MYJSON_PARSE_OK;
+        }
+    }
+    p = *json;
+    if ((ret = myjson_read_number(&p, &d)) != MYJSON_PARSE_OK)
+        return ret;
+    if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0))
+        return MYJSON_PARSE_NUMBER_TOO_BIG;
+    if ((double)(long long)d != d)
+        return MYJSON_PARSE_INVALID_VALUE;
+    *n = (long long)d;
+    *json = p;
+    return MYJSON_PARSE_OK;
+}
+
+/* Strings without escapes are copied as they are, the rest are decoded on a scratch stack */
+static int myjson_read_string_raw(const char **json, char *buf, size_t size, size_t *len, char **s) {
+    const char *p = *json + 1, *str = p;
+    myjson_context c;
+    int ret = MYJSON_PARSE_OK;
+    if (**json != '\"')
+        return MYJSON_PARSE_INVALID_VALUE;
+    myjson_read_context(&c, *json);
+    while (*p != '\"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+    if (*p == '\"') {
+        *len = p - str;
+        *json = p + 1;
+    }
+    else if ((ret = myjson_parse_string_raw(&c, (char **)&str, len)) == MYJSON_PARSE_OK)
+        *json = c.json;
+    if (ret == MYJSON_PARSE_OK) {
+        if (s != NULL)
+            *s = myjson_key_alloc(myjson_global_allocator, str, *len);
+        else
+            memcpy(buf, str, *len < size ? *len : size);
+    }
+    MYJSON_FREE(c.allocator, c.stack);
+    return ret;
+}
+
+int myjson_read_string(const char **json, char **s, size_t *len) {
+    return myjson_read_string_raw(json, NULL, 0, len, s);
+}
+
+int myjson_read_key(const char **json, char *buf, size_t size, size_t *klen) {
+    int ret;
+    if (**json != '\"')
+        return MYJSON_PARSE_MISS_KEY;
+    if ((ret = myjson_read_string_raw(json, buf, size, klen, NULL)) != MYJSON_PARSE_OK)
+        return ret;
+    myjson_read_whitespace(json);
+    if (**json != ':')
+        return MYJSON_PARSE_MISS_COLON;
+    (*json)++;
+    myjson_read_whitespace(json);
+    return MYJSON_PARSE_OK;
+}
+
+/* Skips a value by matching quotes and brackets only, so what is skipped is not validated */
+int myjson_skip_value(const char **json) {
+    const char *p = *json;
+    size_t depth = 0;
+    for (;;) {
+        switch (*p++) {
+            case '\0':
+                return MYJSON_PARSE_EXPECT_VALUE;
+            case '\"':
+                for (;;) {
+                    while (*p != '\"' && *p != '\\' && *p != '\0')
+                        p++;
+                    if (*p == '\"')
+                        break;
+                    if (*p == '\0' || *++p == '\0')
+                        return MYJSON_PARSE_MISS_QUOTATION_MARK;
+                    p++;
+                }
+                p++;
+                break;
+            case '[':
+            case '{':
+                depth++;
+                continue;
+            case ']':
+            case '}':
+                if (depth-- == 0)
+                    return MYJSON_PARSE_EXPECT_VALUE;
+                break;
+            default:
+                if (depth > 0)
+                    continue;
+                /* a scalar runs up to the next delimiter */
+                while (*p != ',' && *p != ']' && *p != '}' && *p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+                    p++;
+                break;
+        }
+        if (depth == 0) {
+            *json = p;
+            return MYJSON_PARSE_OK;
+        }
+    }
+}
+
+static void myjson_write_context(myjson_context *c, myjson_writer *w) {
+    myjson_context_init(c, myjson_global_allocator, 0);
+    c->stack = w->buf;
+    c->size = w->size;
+    c->top = w->len;
+}
+
+static void myjson_write_sync(myjson_writer *w, const myjson_context *c) {
+    w->buf = c->stack;
+    w->size = c->size;
+    w->len = c->top;
+}
+
+void myjson_write(myjson_writer *w, const char *s, size_t len) {
+    myjson_context c;
+    myjson_write_context(&c, w);
+    PUTS(&c, s, len);
+    myjson_write_sync(w, &c);
+}
+
+void myjson_write_string(myjson_writer *w, const char *s, size_t len) {
+    myjson_context c;
+    myjson_write_context(&c, w);
+    myjson_stringify_string(&c, s, len);
+    myjson_write_sync(w, &c);
+}
+
+void myjson_write_number(myjson_writer *w, double n) {
+    myjson_context c;
+    myjson_write_context(&c, w);
+    c.top -= 32 - sprintf(myjson_context_push(&c, 32), "%.17g", n);
+    myjson_write_sync(w, &c);
+}
+
+void myjson_write_integer(myjson_writer *w, long long n) {
+    myjson_context c;
+    myjson_write_context(&c, w);
+    c.top -= 32 - sprintf(myjson_context_push(&c, 32), "%lld", n);
+    myjson_write_sync(w, &c);
+}
+
+char *myjson_write_finish(myjson_writer *w, size_t *length) {
+    myjson_context c;
+    myjson_write_context(&c, w);
+    if (length)
+        *length = c.top;
+    PUTC(&c, '\0');
+    return c.stack;
+}
+
+void myjson_free_buffer(void *p) {
+    MYJSON_FREE(myjson_global_allocator, p);
+}
+
+/* Streaming query. The input is read in chunks into a window that only keeps what is still needed:
+ * nothing while values are skipped, the value itself while a match is captured. */
+#ifndef MYJSON_QUERY_CHUNK_SIZE
+#define MYJSON_QUERY_CHUNK_SIZE 4096
+#endif
+
+#define MYJSON_QUERY_MEMBER 0 /* .name or ['name'] */
+#define MYJSON_QUERY_ANY_MEMBER 1 /* .* */
+#define MYJSON_QUERY_INDEX 2 /* [N] */
+#define MYJSON_QUERY_ANY_INDEX 3 /* [*] */
+#define MYJSON_QUERY_FILTER 4 /* [?(@.name == literal)] or != */
+
+#define MYJSON_QUERY_NO_PIN ((size_t)-1)
+
+typedef struct {
+    int kind, negate;
+    char *name;
+    size_t nlen, index;
+    myjson_value literal;
+} myjson_query_step;
+
+struct myjson_query {
+    myjson_query_step *steps;
+    size_t n;
+};
+
+static int myjson_query_name_char(char ch, const char *stops) {
+    return ch != '\0' && strchr(stops, ch) == NULL;
+}
+
+/* Parses one step at *p into s; returns 0 on invalid syntax */
+static int myjson_query_step_compile(const char **p, myjson_query_step *s) {
+    const char *q = *p, *name, *literal;
+    char quote, *text;
+    int ret;
+    s->name = NULL;
+    s->nlen = s->index = 0;
+    s->negate = 0;
+    myjson_init(&s->literal);
+    if (*q == '.') {
+        q++;
+        if (*q == '*') {
+            s->kind = MYJSON_QUERY_ANY_MEMBER;
+            *p = q + 1;
+            return 1;
+        }
+        for (name = q; myjson_query_name_char(*q, ".["); q++)
+            ;
+        if (q == name)
+            return 0;
+        s->kind = MYJSON_QUERY_MEMBER;
+    }
+    else if (*q++ != '[')
+        return 0;
+    else if (*q == '*' && q[1] == ']') {
+        s->kind = MYJSON_QUERY_ANY_INDEX;
+        *p = q + 2;
+        return 1;
+    }
+    else if (ISDIGITAL(*q)) {
+        for (s->kind = MYJSON_QUERY_INDEX; ISDIGITAL(*q); q++)
+            s->index = s->index * 10 + (size_t)(*q - '0');
+        if (*q != ']')
+            return 0;
+        *p = q + 1;
+        return 1;
+    }
+    else if (*q == '\'' || *q == '"') {
+        for (quote = *q++, name = q; *q != quote && *q != '\0'; q++)
+            ;
+        if (*q != quote || q[1] != ']')
+            return 0;
+        s->kind = MYJSON_QUERY_MEMBER;
+        s->nlen = (size_t)(q - name);
+        s->name = myjson_key_alloc(myjson_global_allocator, name, s->nlen);
+        *p = q + 2;
+        return 1;
+    }
+    else {
+        if (strncmp(q, "?(@.", 4) != 0)
+            return 0;
+        for (q += 4, name = q; myjson_query_name_char(*q, " =!)"); q++)
+            ;
+        s->kind = MYJSON_QUERY_FILTER;
+        s->nlen = (size_t)(q - name);
+        while (*q == ' ')
+            q++;
+        if ((q[0] != '=' && q[0] != '!') || q[1] != '=' || s->nlen == 0)
+            return 0;
+        s->negate = q[0] == '!';
+        for (q += 2; *q == ' '; q++)
+            ;
+        literal = q;
+        /* a scalar ends at the closing parenthesis, which myjson_skip_value() does not stop at */
+        if (*q == '"' || *q == '[' || *q == '{') {
+            if (myjson_skip_value(&q) != MYJSON_PARSE_OK)
+                return 0;
+        }
+        else while (myjson_query_name_char(*q, " )"))
+            q++;
+        text = myjson_key_alloc(myjson_global_allocator, literal, (size_t)(q - literal));
+        ret = myjson_parse(&s->literal, text);
+        MYJSON_FREE(myjson_global_allocator, text);
+        while (*q == ' ')
+            q++;
+        if (ret != MYJSON_PARSE_OK || q[0] != ')' || q[1] != ']')
+            return 0;
+        s->name = myjson_key_alloc(myjson_global_allocator, name, s->nlen);
+        *p = q + 2;
+        return 1;
+    }
+    s->nlen = (size_t)(q - name);
+    s->name = myjson_key_alloc(myjson_global_allocator, name, s->nlen);
+    *p = q;
+    return 1;
+}
+
+static void myjson_query_free_steps(myjson_query_step *steps, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        MYJSON_FREE(myjson_global_allocator, steps[i].name);
+        myjson_free(&steps[i].literal);
+    }
+    MYJSON_FREE(myjson_global_allocator, steps);
+}
+
+int myjson_query_compile(myjson_query **query, const char *path) {
+    myjson_context steps;
+    myjson_query *q;
+    int ok = 1;
+    assert(query != NULL && path != NULL);
+    *query = NULL;
+    if (*path++ != '$')
+        return MYJSON_PARSE_INVALID_QUERY;
+    myjson_context_init(&steps, myjson_global_allocator, 0);
+    while (ok && *path != '\0')
+        ok = myjson_query_step_compile(&path, (myjson_query_step *)myjson_context_push(&steps, sizeof(myjson_query_step)));
+    if (!ok) {
+        myjson_query_free_steps((myjson_query_step *)steps.stack, steps.top / sizeof(myjson_query_step));
+        return MYJSON_PARSE_INVALID_QUERY;
+    }
+    q = (myjson_query *)MYJSON_MALLOC(myjson_global_allocator, sizeof(myjson_query));
+    q->steps = (myjson_query_step *)steps.stack;
+    q->n = steps.top / sizeof(myjson_query_step);
+    *query = q;
+    return MYJSON_PARSE_OK;
+}
+
+void myjson_query_free(myjson_query *q) {
+    if (q != NULL) {
+        myjson_query_free_steps(q->steps, q->n);
+        MYJSON_FREE(myjson_global_allocator, q);
+    }
+}
+
+typedef struct {
+    char *buf;
+    size_t pos, end, size;
+    size_t pin; /* first byte to keep when the window moves, or MYJSON_QUERY_NO_PIN */
+    myjson_read_func read;
+    void *ctx;
+    int eof;
+} myjson_stream;
+
+/* Moves the window on once buf[pos] has run out; returns 0 at the end of the input.
+ * One byte is always left spare, so a captured value can be '\0'-terminated in place. */
+static int myjson_stream_fill(myjson_stream *s) {
+    size_t keep, n;
+    if (s->eof)
+        return 0;
+    keep = s->pin == MYJSON_QUERY_NO_PIN ? s->pos : s->pin;
+    if (keep > 0) {
+        memmove(s->buf, s->buf + keep, s->end - keep);
+        s->end -= keep;
+        s->pos -= keep;
+        if (s->pin != MYJSON_QUERY_NO_PIN)
+            s->pin = 0;
+    }
+    if (s->size - s->end < MYJSON_QUERY_CHUNK_SIZE + 1) {
+        s->size = s->size * 2 > s->end + MYJSON_QUERY_CHUNK_SIZE + 1 ? s->size * 2 : s->end + MYJSON_QUERY_CHUNK_SIZE + 1;
+        s->buf = (char *)MYJSON_REALLOC(myjson_global_allocator, s->buf, s->size);
+    }
+    if ((n = s->read(s->ctx, s->buf + s->end, s->size - s->end - 1)) == 0) {
+        s->eof = 1;
+        return 0;
+    }
+    s->end += n;
+    return 1;
+}
+
+#define MYJSON_STREAM_MORE(s) ((s)->pos < (s)->end || myjson_stream_fill(s))
+#define MYJSON_STREAM_PEEK(s) (MYJSON_STREAM_MORE(s) ? (s)->buf[(s)->pos] : '\0')
+
+static void myjson_stream_whitespace(myjson_stream *s) {
+    char ch;
+    while ((ch = MYJSON_STREAM_PEEK(s)) == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+        s->pos++;
+}
+
+/* myjson_skip_value() over the window: nothing is validated or kept */
+static int myjson_stream_skip(myjson_stream *s) {
+    size_t depth = 0;
+    char ch;
+    while (MYJSON_STREAM_MORE(s)) {
+        switch (ch = s->buf[s->pos++]) {
+            case '\"':
+                for (;;) {
+                    while (s->pos < s->end && s->buf[s->pos] != '\"' && s->buf[s->pos] != '\\')
+                        s->pos++;
+                    if (s->pos == s->end) {
+                        if (!myjson_stream_fill(s))
+                            return MYJSON_PARSE_MISS_QUOTATION_MARK;
+                        continue;
+                    }
+                    if (s->buf[s->pos++] == '\"')
+                        break;
+                    if (!MYJSON_STREAM_MORE(s))
+                        return MYJSON_PARSE_MISS_QUOTATION_MARK;
+                    s->pos++;
+                }
+                break;
+            case '[':
+            case '{':
+                depth++;
+                continue;
+            case ']':
+            case '}':
+                if (depth-- == 0)
+                    return MYJSON_PARSE_EXPECT_VALUE;
+                break;
+            default:
+                if (depth > 0)
+                    continue;
+                while ((ch = MYJSON_STREAM_PEEK(s)) != ',' && ch != ']' && ch != '}' && ch != '\0' && ch != ' ' && ch != '\t' && ch != '\n' && ch != '\r')
+                    s->pos++;
+                break;
+        }
+        if (depth == 0)
+            return MYJSON_PARSE_OK;
+    }
+    return MYJSON_PARSE_EXPECT_VALUE;
+}
+
+/* Keeps the value at pos in the window and parses it in place */
+static int myjson_stream_capture(myjson_stream *s, myjson_value *v) {
+    size_t start = s->pos;
+    char saved;
+    int ret;
+    myjson_init(v);
+    s->pin = start;
+    ret = myjson_stream_skip(s);
+    start = s->pin;
+    s->pin = MYJSON_QUERY_NO_PIN;
+    if (ret != MYJSON_PARSE_OK)
+        return ret;
+    saved = s->buf[s->pos];
+    s->buf[s->pos] = '\0';
+    ret = myjson_parse(v, s->buf + start);
+    s->buf[s->pos] = saved;
+    return ret;
+}
+
+/* Reads the key at pos, which stays valid until the window moves again. Keys with escapes are
+ * decoded into *decoded, to be freed by the caller. */
+static int myjson_stream_key(myjson_stream *s, const char **key, size_t *klen, char **decoded) {
+    size_t start = s->pos;
+    const char *p;
+    char saved;
+    int ret;
+    *decoded = NULL;
+    if (MYJSON_STREAM_PEEK(s) != '\"')
+        return MYJSON_PARSE_MISS_KEY;
+    s->pin = start;
+    ret = myjson_stream_skip(s);
+    start = s->pin;
+    s->pin = MYJSON_QUERY_NO_PIN;
+    if (ret != MYJSON_PARSE_OK)
+        return ret;
+    *key = s->buf + start + 1;
+    *klen = s->pos - start - 2;
+    if (memchr(*key, '\\', *klen) == NULL)
+        return MYJSON_PARSE_OK;
+    saved = s->buf[s->pos];
+    s->buf[s->pos] = '\0';
+    p = s->buf + start;
+    ret = myjson_read_string(&p, decoded, klen);
+    s->buf[s->pos] = saved;
+    *key = *decoded;
+    return ret;
+}
+
+static int myjson_query_step_match(const myjson_query_step *step, const char *key, size_t klen) {
+    return step->kind == MYJSON_QUERY_ANY_MEMBER || (step->kind == MYJSON_QUERY_MEMBER && step->nlen == klen && memcmp(step->name, key, klen) == 0);
+}
+
+/* Matches go to the callback, or wait in the sink of an enclosing filter until it is decided */
+#define MYJSON_SINK_PENDING 0
+#define MYJSON_SINK_PASS 1
+#define MYJSON_SINK_DROP 2
+
+typedef struct myjson_query_sink {
+    struct myjson_query_sink *parent; /* NULL for the callback */
+    myjson_context pending;
+    int state;
+} myjson_query_sink;
+
+typedef struct {
+    myjson_stream s;
+    const myjson_query *q;
+    myjson_match_func match;
+    void *ctx;
+    int stopped;
+} myjson_query_run;
+
+static myjson_query_sink *myjson_query_target(myjson_query_sink *sink) {
+    while (sink != NULL && sink->state == MYJSON_SINK_PASS)
+        sink = sink->parent;
+    return sink;
+}
+
+/* Takes over v */
+static void myjson_query_emit(myjson_query_run *r, myjson_query_sink *sink, myjson_value *v) {
+    sink = myjson_query_target(sink);
+    if (sink == NULL) {
+        if (!r->stopped && r->match(r->ctx, v))
+            r->stopped = 1;
+        myjson_free(v);
+    }
+    else if (sink->state == MYJSON_SINK_DROP)
+        myjson_free(v);
+    else
+        memcpy(myjson_context_push(&sink->pending, sizeof(myjson_value)), v, sizeof(myjson_value));
+}
+
+static void myjson_query_resolve(myjson_query_run *r, myjson_query_sink *sink, int pass) {
+    myjson_value *v = (myjson_value *)sink->pending.stack;
+    size_t i, n = sink->pending.top / sizeof(myjson_value);
+    sink->state = pass ? MYJSON_SINK_PASS : MYJSON_SINK_DROP;
+    for (i = 0; i < n; i++)
+        myjson_query_emit(r, sink, &v[i]);
+    sink->pending.top = 0;
+}
+
+static int myjson_query_filter(const myjson_query_step *step, const myjson_value *element) {
+    const myjson_value *v;
+    size_t index;
+    /* a missing member is unequal to anything */
+    if (element->type != MYJSON_OBJECT || (index = myjson_find_object_index(element, step->name, step->nlen)) == MYJSON_KEY_NOT_EXIST)
+        return step->negate;
+    v = &element->val.obj.m[index].v;
+    return myjson_is_equal(v, &step->literal) != step->negate;
+}
+
+/* The same walk over a value already in memory, for the predicate member of a filtered element */
+static void myjson_query_value(myjson_query_run *r, size_t i, const myjson_value *v, myjson_query_sink *sink) {
+    const myjson_query_step *step = &r->q->steps[i];
+    myjson_value copy;
+    size_t k;
+    if (i == r->q->n) {
+        myjson_init(&copy);
+        myjson_copy(&copy, v);
+        myjson_query_emit(r, sink, &copy);
+        return;
+    }
+    if (v->type == MYJSON_OBJECT && (step->kind == MYJSON_QUERY_MEMBER || step->kind == MYJSON_QUERY_ANY_MEMBER)) {
+        for (k = 0; k < v->val.obj.size && !r->stopped; k++)
+            if (myjson_query_step_match(step, v->val.obj.m[k].key, v->val.obj.m[k].klen))
+                myjson_query_value(r, i + 1, &v->val.obj.m[k].v, sink);
+    }
+    else if (v->type == MYJSON_ARRAY && step->kind != MYJSON_QUERY_MEMBER && step->kind != MYJSON_QUERY_ANY_MEMBER) {
+        for (k = 0; k < v->val.arr.size && !r->stopped; k++)
+            if (step->kind == MYJSON_QUERY_ANY_INDEX || (step->kind == MYJSON_QUERY_INDEX && step->index == k)
+                || (step->kind == MYJSON_QUERY_FILTER && myjson_query_filter(step, &v->val.arr.e[k])))
+                myjson_query_value(r, i + 1, &v->val.arr.e[k], sink);
+    }
+}
+
+static int myjson_query_stream_value(myjson_query_run *r, size_t i, myjson_query_sink *sink);
+
+/* An element of a filtered array whose members are matched as they stream by. Those found before
+ * the predicate member wait in a sink of their own until it decides them. */
+static int myjson_query_stream_element(myjson_query_run *r, size_t i, myjson_query_sink *sink) {
+    const myjson_query_step *step = &r->q->steps[i], *next = &r->q->steps[i + 1];
+    myjson_stream *s = &r->s;
+    myjson_query_sink element;
+    myjson_value v;
+    const char *key;
+    char *decoded;
+    size_t klen;
+    int ret = MYJSON_PARSE_OK, predicate, descend, seen = 0;
+    s->pos++;
+    element.parent = sink;
+    element.state = MYJSON_SINK_PENDING;
+    myjson_context_init(&element.pending, myjson_global_allocator, 0);
+    myjson_stream_whitespace(s);
+    if (MYJSON_STREAM_PEEK(s) == '}')
+        s->pos++;
+    else for (;;) {
+        if ((ret = myjson_stream_key(s, &key, &klen, &decoded)) != MYJSON_PARSE_OK)
+            break;
+        predicate = !seen && klen == step->nlen && memcmp(key, step->name, klen) == 0;
+        descend = myjson_query_step_match(next, key, klen);
+        MYJSON_FREE(myjson_global_allocator, decoded);
+        myjson_stream_whitespace(s);
+        if (MYJSON_STREAM_PEEK(s) != ':') {
+            ret = MYJSON_PARSE_MISS_COLON;
+            break;
+        }
+        s->pos++;
+        myjson_stream_whitespace(s);
+        if (predicate) {
+            if ((ret = myjson_stream_capture(s, &v)) != MYJSON_PARSE_OK)
+                break;
+            seen = 1;
+            myjson_query_resolve(r, &element, myjson_is_equal(&v, &step->literal) != step->negate);
+            if (descend && element.state == MYJSON_SINK_PASS)
+                myjson_query_value(r, i + 2, &v, &element);
+            myjson_free(&v);
+        }
+        else if (descend && element.state != MYJSON_SINK_DROP && !r->stopped)
+            ret = myjson_query_stream_value(r, i + 2, &element);
+        else
+            ret = myjson_stream_skip(s);
+        if (ret != MYJSON_PARSE_OK)
+            break;
+        myjson_stream_whitespace(s);
+        if (MYJSON_STREAM_PEEK(s) == ',') {
+            s->pos++;
+            myjson_stream_whitespace(s);
+            continue;
+        }
+        if (MYJSON_STREAM_PEEK(s) == '}')
+            s->pos++;
+        else
+            ret = MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        break;
+    }
+    /* a missing predicate member only passes != */
+    if (element.state == MYJSON_SINK_PENDING)
+        myjson_query_resolve(r, &element, step->negate);
+    MYJSON_FREE(myjson_global_allocator, element.pending.stack);
+    return ret;
+}
+
+/* Walks the value at pos along steps i.., skipping whatever cannot match */
+static int myjson_query_stream_value(myjson_query_run *r, size_t i, myjson_query_sink *sink) {
+    const myjson_query_step *step = &r->q->steps[i];
+    myjson_stream *s = &r->s;
+    myjson_value v;
+    const char *key;
+    char *decoded, ch;
+    size_t klen, k;
+    int ret = MYJSON_PARSE_OK, match, object;
+    if (i == r->q->n) {
+        if ((ret = myjson_stream_capture(s, &v)) == MYJSON_PARSE_OK)
+            myjson_query_emit(r, sink, &v);
+        return ret;
+    }
+    ch = MYJSON_STREAM_PEEK(s);
+    object = step->kind == MYJSON_QUERY_MEMBER || step->kind == MYJSON_QUERY_ANY_MEMBER;
+    if (ch != (object ? '{' : '['))
+        return myjson_stream_skip(s);
+    /* a filter selecting whole elements has to see each one whole */
+    if (step->kind == MYJSON_QUERY_FILTER && i + 1 == r->q->n)
+        object = -1;
+    s->pos++;
+    myjson_stream_whitespace(s);
+    if (MYJSON_STREAM_PEEK(s) == (object > 0 ? '}' : ']')) {
+        s->pos++;
+        return MYJSON_PARSE_OK;
+    }
+    for (k = 0; ; k++) {
+        if (object > 0) {
+            if ((ret = myjson_stream_key(s, &key, &klen, &decoded)) != MYJSON_PARSE_OK)
+                return ret;
+            match = myjson_query_step_match(step, key, klen);
+            MYJSON_FREE(myjson_global_allocator, decoded);
+            myjson_stream_whitespace(s);
+            if (MYJSON_STREAM_PEEK(s) != ':')
+                return MYJSON_PARSE_MISS_COLON;
+            s->pos++;
+            myjson_stream_whitespace(s);
+            ret = match && !r->stopped ? myjson_query_stream_value(r, i + 1, sink) : myjson_stream_skip(s);
+        }
+        else if (object < 0 && MYJSON_STREAM_PEEK(s) != '{' && !step->negate)
+            ret = myjson_stream_skip(s);
+        else if (object < 0) {
+            if ((ret = myjson_stream_capture(s, &v)) == MYJSON_PARSE_OK) {
+                if (myjson_query_filter(step, &v))
+                    myjson_query_emit(r, sink, &v);
+                else
+                    myjson_free(&v);
+            }
+        }
+        else if (r->stopped || (step->kind == MYJSON_QUERY_INDEX && step->index != k))
+            ret = myjson_stream_skip(s);
+        else if (step->kind != MYJSON_QUERY_FILTER)
+            ret = myjson_query_stream_value(r, i + 1, sink);
+        else if (MYJSON_STREAM_PEEK(s) == '{')
+            ret = myjson_query_stream_element(r, i, sink);
+        else if (step->negate)
+            ret = myjson_query_stream_value(r, i + 1, sink);
+        else
+            ret = myjson_stream_skip(s);
+        if (ret != MYJSON_PARSE_OK)
+            return ret;
+        myjson_stream_whitespace(s);
+        if ((ch = MYJSON_STREAM_PEEK(s)) == ',') {
+            s->pos++;
+            myjson_stream_whitespace(s);
+            continue;
+        }
+        if (ch != (object > 0 ? '}' : ']'))
+            return object > 0 ? MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET : MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+        s->pos++;
+        return MYJSON_PARSE_OK;
+    }
+}
+
+int myjson_query_stream(const myjson_query *q, myjson_read_func read, void *read_ctx, myjson_match_func match, void *match_ctx) {
+    myjson_query_run r;
+    int ret = MYJSON_PARSE_OK;
+    assert(q != NULL && read != NULL && match != NULL);
+    r.s.buf = NULL;
+    r.s.pos = r.s.end = r.s.size = 0;
+    r.s.pin = MYJSON_QUERY_NO_PIN;
+    r.s.read = read;
+    r.s.ctx = read_ctx;
+    r.s.eof = 0;
+    r.q = q;
+    r.match = match;
+    r.ctx = match_ctx;
+    r.stopped = 0;
+    for (;;) {
+        myjson_stream_whitespace(&r.s);
+        if (r.stopped || !MYJSON_STREAM_MORE(&r.s))
+            break;
+        if ((ret = myjson_query_stream_value(&r, 0, NULL)) != MYJSON_PARSE_OK)
+            break;
+    }
+    MYJSON_FREE(myjson_global_allocator, r.s.buf);
+    return ret;
+}
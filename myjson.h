@@ -3,24 +3,36 @@
 
 #include <stddef.h>
 
-typedef enum { MYJSON_NULL, MYJSON_FALSE, MYJSON_TRUE, MYJSON_NUMBER, MYJSON_STRING, MYJSON_ARRAY, MYJSON_OBJECT } myjson_type;
+typedef enum { MYJSON_NULL, MYJSON_FALSE, MYJSON_TRUE, MYJSON_NUMBER, MYJSON_STRING, MYJSON_ARRAY, MYJSON_OBJECT, MYJSON_RAW } myjson_type;
 
 #define MYJSON_KEY_NOT_EXIST ((size_t)-1)
 
 typedef struct myjson_value myjson_value;
 typedef struct myjson_member myjson_member;
+typedef struct myjson_mapping myjson_mapping;
 
 struct myjson_value {
     // double n;
     union {
         struct { myjson_member *m; size_t size, capacity; } obj;
         struct { myjson_value *e; size_t size, capacity; } arr;
-        struct { char *s; size_t len; } s;
+        struct { char *s; size_t len; } s; /* also the text of a MYJSON_RAW fragment */
         double n;
+        struct { double n; char *text; size_t len; } num; /* n is converted from text on first use */
     } val;
     myjson_type type;
+    unsigned flags;
 };
 
+/* Flat document: tagged 64-bit words in document order plus a separate string buffer.
+ * Values are addressed by word index, the root being 0. */
+typedef struct {
+    unsigned long long *words;
+    size_t size;
+    char *strings;
+    size_t slen;
+} myjson_tape;
+
 struct myjson_member {
     char *key;
     size_t klen;
@@ -41,14 +53,123 @@ enum {
     MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
     MYJSON_PARSE_MISS_KEY,
     MYJSON_PARSE_MISS_COLON,
-    MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+    MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+    MYJSON_PARSE_FILE_ERROR,
+    MYJSON_PARSE_INVALID_BINARY,
+    MYJSON_PARSE_NESTING_TOO_DEEP,
+    MYJSON_PARSE_INPUT_TOO_LARGE,
+    MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED,
+    MYJSON_PARSE_STRING_TOO_LONG,
+    MYJSON_PARSE_TOO_MANY_MEMBERS,
+    MYJSON_PARSE_INVALID_PROJECTION,
+    MYJSON_PARSE_INVALID_QUERY,
+    MYJSON_PARSE_INVALID_UTF8
+};
+
+enum {
+    MYJSON_PATCH_OK = 0,
+    MYJSON_PATCH_INVALID_OPERATION,
+    MYJSON_PATCH_INVALID_POINTER,
+    MYJSON_PATCH_PATH_NOT_FOUND,
+    MYJSON_PATCH_TEST_FAILED
 };
 
-#define myjson_init(v) do { (v)->type = MYJSON_NULL; } while(0)
+/* Strings without escapes refer into the input (the file mapping for myjson_parse_file())
+ * instead of being copied. Such strings are not '\0'-terminated and live as long as the input;
+ * myjson_copy() of a value parsed this way copies the strings instead of sharing them. */
+#define MYJSON_OPT_VIEWS 0x1
+/* Binary snapshots store each distinct key once and refer to it by index */
+#define MYJSON_OPT_KEY_DICTIONARY 0x2
+/* Parsing keeps every object sorted by key, for binary search lookups and merge comparisons
+ * (see myjson_sort_object_keys()). Stringifying writes every object's members in key order. */
+#define MYJSON_OPT_SORT_KEYS 0x4
+/* Numbers keep their validated text, referring into the input under MYJSON_OPT_VIEWS, and are
+ * converted by the first myjson_get_number(). Stringifying writes the text back unchanged. */
+#define MYJSON_OPT_RAW_NUMBERS 0x8
+/* Stringifying keeps the text of every container in its storage, until the container is modified
+ * or an element pointer is taken from it, and copies it from there the next time. Writing a
+ * document with a few edits costs the changed paths and a memcpy of the rest. As with the cached
+ * hash, an element pointer obtained before stringifying must not be used to modify it afterwards. */
+#define MYJSON_OPT_STRINGIFY_CACHE 0x10
+/* Strings and keys must be well-formed UTF-8, failing with MYJSON_PARSE_INVALID_UTF8 otherwise,
+ * and a \u escape of a lone surrogate fails with MYJSON_PARSE_INVALID_UNICODE_SURROGATE.
+ * Checked 16 bytes at a time with SSSE3 where the CPU has it (unless built with MYJSON_NO_SIMD). */
+#define MYJSON_OPT_VALIDATE_UTF8 0x20
+
+/* ctx is passed back on every call and realloc() must accept NULL like realloc(). An allocator must outlive every value it allocated:
+ * blocks remember their allocator, so values are resized and freed by the one that made them. */
+typedef struct {
+    void *(*malloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *p, size_t size);
+    void (*free)(void *ctx, void *p);
+    void *ctx;
+} myjson_allocator;
+
+/* Filled by myjson_parse_ex() and myjson_stringify_ex() when the library is built with MYJSON_STATS,
+ * zeroed otherwise. cycles are TSC ticks on x86 and nanoseconds elsewhere. */
+typedef struct {
+    size_t bytes; /* of JSON consumed or produced */
+    size_t values[MYJSON_RAW + 1]; /* by myjson_type */
+    size_t allocations, allocated; /* heap blocks and bytes of the result */
+    size_t stack_reallocs, stack_size; /* growth and high-water mark of the context stack */
+    size_t max_depth;
+    unsigned long long cycles;
+} myjson_stats;
+
+/* NULL allocators mean the global one. The other limits are off when 0. */
+typedef struct {
+    unsigned flags; /* MYJSON_OPT_* */
+    size_t max_depth; /* of nested arrays and objects, 0 for MYJSON_PARSE_MAX_DEPTH */
+    const myjson_allocator *allocator;
+    size_t max_input; /* bytes of JSON text */
+    size_t max_bytes; /* allocated for the value and the parse stack */
+    size_t max_string; /* bytes of a decoded string or key */
+    size_t max_members; /* per object */
+    myjson_stats *stats;
+    /* Projection: keep only these paths, keys separated by '.' with [*] for every array element,
+     * as in "user.id" or "items[*].price". Objects keep the matching members, arrays keep every
+     * element with null where nothing matched, and a value of the wrong type at the root is null.
+     * The rest of the input is skipped without being validated. */
+    const char *const *paths;
+    size_t npaths;
+} myjson_parse_options;
+
+typedef struct {
+    unsigned flags; /* MYJSON_OPT_SORT_KEYS, MYJSON_OPT_STRINGIFY_CACHE */
+    const myjson_allocator *allocator; /* of the returned buffer */
+    myjson_stats *stats;
+} myjson_stringify_options;
+
+#define myjson_init(v) do { (v)->type = MYJSON_NULL; (v)->flags = 0; } while(0)
+
+/* The global allocator serves myjson_set_*(), the mutators, every buffer the library returns and
+ * its scratch memory. NULL restores malloc(). Set it before any value exists, not concurrently. */
+void myjson_set_allocator(const myjson_allocator *allocator);
+const myjson_allocator *myjson_get_allocator(void);
 
 int myjson_parse(myjson_value *v, const char *json);
+int myjson_parse_ex(myjson_value *v, const char *json, const myjson_parse_options *options);
+int myjson_parse_parallel(myjson_value *v, const char *json, size_t threads);
+/* flags are the parse flags of myjson_parse_options; under MYJSON_OPT_VIEWS *mapping keeps the file mapped */
+int myjson_parse_file(myjson_value *v, const char *path, unsigned flags, myjson_mapping **mapping);
+void myjson_unmap(myjson_mapping *mapping);
 char *myjson_stringify(const myjson_value *v, size_t *length);
+char *myjson_stringify_ex(const myjson_value *v, size_t *length, const myjson_stringify_options *options);
+char *myjson_stringify_parallel(const myjson_value *v, size_t *length, size_t threads);
+
+/* Loading and decoding fail with MYJSON_PARSE_NESTING_TOO_DEEP beyond MYJSON_PARSE_MAX_DEPTH nested
+ * containers (CBOR tags count as one each). Any depth can be dumped and encoded. */
+char *myjson_dump_binary(const myjson_value *v, size_t *length, unsigned flags);
+int myjson_load_binary(myjson_value *v, const char *data, size_t length);
+char *myjson_encode_msgpack(const myjson_value *v, size_t *length);
+int myjson_decode_msgpack(myjson_value *v, const char *data, size_t length);
+char *myjson_encode_cbor(const myjson_value *v, size_t *length);
+int myjson_decode_cbor(myjson_value *v, const char *data, size_t length);
 
+/* myjson_copy() shares the contents, which either value copies on its first modification.
+ * Any number of threads may call the functions taking a const myjson_value * on one value at once,
+ * as well as modify copies of their own, but a value being modified must not be read elsewhere.
+ * The first myjson_get_number() of a raw number is the exception, as it caches the conversion. */
 void myjson_copy(myjson_value* dst, const myjson_value* src);
 void myjson_move(myjson_value* dst, myjson_value* src);
 void myjson_swap(myjson_value* lhs, myjson_value* rhs);
@@ -57,30 +178,53 @@ void myjson_free(myjson_value *v);
 
 myjson_type myjson_get_type(const myjson_value *v);
 int myjson_is_equal(const myjson_value* lhs, const myjson_value* rhs);
+/* Structural hash, independent of object member order. Equal values hash alike.
+ * Containers cache it until they are modified; an element pointer obtained before
+ * its container was hashed must not be used to modify the element afterwards. */
+size_t myjson_hash(const myjson_value *v);
 
 #define myjson_set_null(v) myjson_free(v)
 
 int myjson_get_boolean(const myjson_value* v);
 void myjson_set_boolean(myjson_value* v, int b);
 
+/* Converting a raw number caches the result in v, so concurrent first calls must not share v */
 double myjson_get_number(const myjson_value *v);
+/* The text of a number parsed with MYJSON_OPT_RAW_NUMBERS, not '\0'-terminated; NULL otherwise */
+const char *myjson_get_number_text(const myjson_value *v, size_t *len);
 void myjson_set_number(myjson_value *v, double n);
 
 const char* myjson_get_string(const myjson_value* v);
 size_t myjson_get_string_length(const myjson_value* v);
 void myjson_set_string(myjson_value* v, const char* s, size_t len);
 
+/* Raw fragment: JSON text that stringify writes out verbatim, as for embedding a cached response.
+ * Comparison, hashing, diffs and the other encodings see the value it parses to, so the text must
+ * be one valid JSON value. With validate set, it is checked here (without converting numbers or
+ * copying strings) and v is left unchanged on error. */
+int myjson_set_raw(myjson_value* v, const char* json, size_t len, int validate);
+const char* myjson_get_raw(const myjson_value* v);
+size_t myjson_get_raw_length(const myjson_value* v);
+
 void myjson_set_array(myjson_value* v, size_t capacity);
 size_t myjson_get_array_size(const myjson_value* v);
 size_t myjson_get_array_capacity(const myjson_value* v);
 void myjson_reserve_array(myjson_value* v, size_t capacity);
 void myjson_shrink_array(myjson_value* v);
 void myjson_clear_array(myjson_value* v);
+/* Pointers for modifying in place: v first gets its own copy of contents it shares and drops its
+ * cached hash and text, so these count as modifications. The _const versions only read. */
 myjson_value *myjson_get_array_element(myjson_value *v, size_t index);
+const myjson_value *myjson_get_array_element_const(const myjson_value *v, size_t index);
 myjson_value* myjson_pushback_array_element(myjson_value* v);
 void myjson_popback_array_element(myjson_value* v);
 myjson_value* myjson_insert_array_element(myjson_value* v, size_t index);
 void myjson_erase_array_element(myjson_value* v, size_t index, size_t count);
+/* Bulk versions: each call reallocates at most once and moves the existing elements at most once */
+myjson_value* myjson_insert_array_elements(myjson_value* v, size_t index, size_t count);
+void myjson_append_array_elements(myjson_value* v, const myjson_value* values, size_t count);
+void myjson_resize_array(myjson_value* v, size_t size, const myjson_value* fill);
+void myjson_splice_array(myjson_value* dst, size_t index, myjson_value* src, size_t src_index, size_t count);
 
 void myjson_set_object(myjson_value* v, size_t capacity);
 size_t myjson_get_object_size(const myjson_value *v);
@@ -90,10 +234,116 @@ void myjson_shrink_object(myjson_value* v);
 void myjson_clear_object(myjson_value* v);
 const char *myjson_get_object_key(const myjson_value *v, size_t index);
 size_t myjson_get_object_key_length(const myjson_value *v, size_t index);
-myjson_value *myjson_get_object_value(const myjson_value *v, size_t index);
+myjson_value *myjson_get_object_value(myjson_value *v, size_t index);
+const myjson_value *myjson_get_object_value_const(const myjson_value *v, size_t index);
 size_t myjson_find_object_index(const myjson_value* v, const char* key, size_t klen);
 myjson_value* myjson_find_object_value(myjson_value* v, const char* key, size_t klen);
+const myjson_value *myjson_find_object_value_const(const myjson_value *v, const char *key, size_t klen);
 myjson_value* myjson_set_object_value(myjson_value* v, const char* key, size_t klen);
+/* Sorts the members by key bytes, duplicates keeping their order. The object stays sorted through
+ * myjson_set_object_value() and myjson_remove_object_value(), until it is reset with myjson_set_object(). */
+void myjson_sort_object_keys(myjson_value* v);
+int myjson_is_object_sorted(const myjson_value* v);
 void myjson_remove_object_value(myjson_value* v, size_t index);
 
+/* Applies an RFC 6902 patch in place. Either every operation succeeds or v is left unchanged. */
+int myjson_apply_patch(myjson_value *v, const myjson_value *patch);
+/* Applies an RFC 7396 merge patch in place */
+void myjson_merge_patch(myjson_value *v, const myjson_value *patch);
+
+/* Sets patch to an RFC 6902 patch that turns a into b. Subtrees shared by copies or with
+ * differing cached hashes are told apart without being walked. Differences nested deeper than
+ * MYJSON_DIFF_MAX_DEPTH (256) containers are replaced whole. */
+void myjson_diff(myjson_value *patch, const myjson_value *a, const myjson_value *b);
+
+void myjson_tape_from_value(myjson_tape *t, const myjson_value *v);
+void myjson_tape_to_value(const myjson_tape *t, size_t index, myjson_value *v);
+char *myjson_tape_stringify(const myjson_tape *t, size_t *length);
+void myjson_tape_free(myjson_tape *t);
+myjson_type myjson_tape_get_type(const myjson_tape *t, size_t index);
+int myjson_tape_get_boolean(const myjson_tape *t, size_t index);
+double myjson_tape_get_number(const myjson_tape *t, size_t index);
+const char *myjson_tape_get_string(const myjson_tape *t, size_t index);
+size_t myjson_tape_get_string_length(const myjson_tape *t, size_t index);
+size_t myjson_tape_get_size(const myjson_tape *t, size_t index);
+/* Children of a container run from myjson_tape_first() until myjson_tape_is_end(), stepping with
+ * myjson_tape_next(). Object members are a key string followed by its value at key index + 1. */
+size_t myjson_tape_first(const myjson_tape *t, size_t index);
+size_t myjson_tape_next(const myjson_tape *t, size_t index);
+int myjson_tape_is_end(const myjson_tape *t, size_t index);
+size_t myjson_tape_find_object_value(const myjson_tape *t, size_t index, const char *key, size_t klen);
+
+/* Frozen document: a read-only tree packed by myjson_freeze() into one block that refers to itself
+ * by offsets only, so it can be written out, mapped anywhere and read by any number of threads
+ * without locks. Values are addressed by reference, myjson_frozen_root() being the whole document.
+ * myjson_frozen_open() checks every offset and length in one pass over the block and refuses it
+ * with MYJSON_PARSE_INVALID_BINARY if any falls outside or the layout is not myjson_freeze()'s. */
+typedef struct {
+    const char *data;
+    size_t size;
+} myjson_frozen;
+
+char *myjson_freeze(const myjson_value *v, size_t *length);
+/* data must be 8-byte aligned, as malloc() and mmap() results are */
+int myjson_frozen_open(myjson_frozen *f, const void *data, size_t length);
+/* Maps a frozen file read-only and shared; release it with myjson_unmap() */
+int myjson_frozen_map(myjson_frozen *f, const char *path, myjson_mapping **mapping);
+size_t myjson_frozen_root(const myjson_frozen *f);
+myjson_type myjson_frozen_get_type(const myjson_frozen *f, size_t ref);
+int myjson_frozen_get_boolean(const myjson_frozen *f, size_t ref);
+double myjson_frozen_get_number(const myjson_frozen *f, size_t ref);
+const char *myjson_frozen_get_string(const myjson_frozen *f, size_t ref);
+size_t myjson_frozen_get_string_length(const myjson_frozen *f, size_t ref);
+size_t myjson_frozen_get_size(const myjson_frozen *f, size_t ref);
+size_t myjson_frozen_get_array_element(const myjson_frozen *f, size_t ref, size_t index);
+const char *myjson_frozen_get_object_key(const myjson_frozen *f, size_t ref, size_t index);
+size_t myjson_frozen_get_object_key_length(const myjson_frozen *f, size_t ref, size_t index);
+size_t myjson_frozen_get_object_value(const myjson_frozen *f, size_t ref, size_t index);
+size_t myjson_frozen_find_object_value(const myjson_frozen *f, size_t ref, const char *key, size_t klen);
+void myjson_frozen_to_value(const myjson_frozen *f, size_t ref, myjson_value *v);
+
+/* Streaming query over input of any length, pulled through read() in chunks. The path is a JSONPath
+ * subset: $ followed by .name, ['name'], .*, [N], [*] and [?(@.name == literal)] or !=, the filter
+ * comparing the first such member of each element to the JSON literal; a missing member is unequal.
+ * A sequence of top-level values, as in NDJSON, is queried one value at a time.
+ * Each match is parsed into a value and passed to match(), which may take it over with myjson_move()
+ * and returns nonzero to stop. Memory is bounded by the largest match plus the matches of an
+ * element waiting for its filter member; everything else is skipped in place without being
+ * validated. read() fills at most size bytes and returns 0 at the end. */
+typedef struct myjson_query myjson_query;
+typedef size_t (*myjson_read_func)(void *ctx, char *buf, size_t size);
+typedef int (*myjson_match_func)(void *ctx, myjson_value *v);
+
+int myjson_query_compile(myjson_query **q, const char *path);
+void myjson_query_free(myjson_query *q);
+int myjson_query_stream(const myjson_query *q, myjson_read_func read, void *read_ctx, myjson_match_func match, void *match_ctx);
+
+/* Frees a buffer returned by the library, such as a stringify result, with the global allocator */
+void myjson_free_buffer(void *p);
+
+/* Primitives for the bindings generated by myjson_gen. Readers decode the value at *json, advance
+ * it past the value and return a MYJSON_PARSE_* code. Strings are NUL-terminated buffers from the
+ * global allocator. myjson_read_key() stores at most size bytes of the key but reports its full
+ * length, and consumes the ':' that follows. */
+void myjson_read_whitespace(const char **json);
+int myjson_read_null(const char **json);
+int myjson_read_boolean(const char **json, int *b);
+int myjson_read_number(const char **json, double *n);
+int myjson_read_integer(const char **json, long long *n);
+int myjson_read_string(const char **json, char **s, size_t *len);
+int myjson_read_key(const char **json, char *buf, size_t size, size_t *klen);
+int myjson_skip_value(const char **json);
+
+/* Writers append to a buffer that starts zeroed; myjson_write_finish() terminates and returns it */
+typedef struct {
+    char *buf;
+    size_t len, size;
+} myjson_writer;
+
+void myjson_write(myjson_writer *w, const char *s, size_t len);
+void myjson_write_string(myjson_writer *w, const char *s, size_t len);
+void myjson_write_number(myjson_writer *w, double n);
+void myjson_write_integer(myjson_writer *w, long long n);
+char *myjson_write_finish(myjson_writer *w, size_t *length);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,1465 @@
+#include "myjson.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MYJSON_MALLOC(size) (myjson_get_allocator()->malloc(myjson_get_allocator()->ctx, size))
+#define MYJSON_REALLOC(p, size) (myjson_get_allocator()->realloc(myjson_get_allocator()->ctx, p, size))
+#define MYJSON_FREE(p) do { if ((p) != NULL) myjson_get_allocator()->free(myjson_get_allocator()->ctx, p); } while(0)
+
+/*
+ * Snapshot layout (all varints are LEB128, doubles are little-endian IEEE 754):
+ *
+ *   "MYJB" version flags [key dictionary] value
+ *
+ *   key dictionary: count, then count x (len, bytes)   -- only with MYJSON_OPT_KEY_DICTIONARY
+ *   value:  tag, then
+ *     NULL/FALSE/TRUE: nothing
+ *     NUMBER:          8 bytes
+ *     STRING:          len, bytes
+ *     ARRAY:           count, count x value
+ *     OBJECT:          count, count x (key, value)
+ *   key: dictionary index, or len, bytes without a dictionary
+ */
+
+#define MYJSON_BINARY_VERSION 1
+
+#ifndef MYJSON_BINARY_INIT_SIZE
+#define MYJSON_BINARY_INIT_SIZE 256
+#endif
+
+/* Decoders nest no deeper than the text parser does by default */
+#ifndef MYJSON_PARSE_MAX_DEPTH
+#define MYJSON_PARSE_MAX_DEPTH 1024
+#endif
+
+typedef struct {
+    char *buf;
+    size_t size, top;
+} myjson_buffer;
+
+typedef struct {
+    const char *key;
+    size_t klen, index;
+} myjson_dict_entry;
+
+typedef struct {
+    myjson_dict_entry *slots;
+    size_t size, count;
+    myjson_buffer raws; /* myjson_values parsed from raw fragments, whose keys the slots refer to */
+    size_t next; /* raw fragment to be encoded next */
+} myjson_dict;
+
+static char *myjson_buffer_push(myjson_buffer *b, size_t size) {
+    char *ret;
+    if (b->top + size > b->size) {
+        if (b->size == 0)
+            b->size = MYJSON_BINARY_INIT_SIZE;
+        while (b->top + size > b->size)
+            b->size += b->size >> 1;
+        b->buf = (char *)MYJSON_REALLOC(b->buf, b->size);
+    }
+    ret = b->buf + b->top;
+    b->top += size;
+    return ret;
+}
+
+static void myjson_put_varint(myjson_buffer *b, size_t n) {
+    char *p = myjson_buffer_push(b, 10), *head = p;
+    while (n >= 0x80) {
+        *p++ = (char)(n | 0x80);
+        n >>= 7;
+    }
+    *p++ = (char)n;
+    b->top -= 10 - (p - head);
+}
+
+static void myjson_put_bytes(myjson_buffer *b, const char *s, size_t len) {
+    myjson_put_varint(b, len);
+    if (len > 0)
+        memcpy(myjson_buffer_push(b, len), s, len);
+}
+
+static size_t myjson_hash_key(const char *key, size_t klen) {
+    size_t h = 14695981039346656037ULL, i;
+    for (i = 0; i < klen; i++)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    return h;
+}
+
+static myjson_dict_entry *myjson_dict_find(myjson_dict *d, const char *key, size_t klen) {
+    size_t i = myjson_hash_key(key, klen) & (d->size - 1);
+    for (;;) {
+        myjson_dict_entry *e = &d->slots[i];
+        if (e->key == NULL || (e->klen == klen && memcmp(e->key, key, klen) == 0))
+            return e;
+        i = (i + 1) & (d->size - 1);
+    }
+}
+
+static void myjson_dict_insert(myjson_dict *d, const char *key, size_t klen) {
+    myjson_dict_entry *e;
+    if ((d->count + 1) * 2 > d->size) {
+        myjson_dict old = *d;
+        size_t i;
+        d->size = d->size == 0 ? 64 : d->size * 2;
+        d->slots = (myjson_dict_entry *)MYJSON_MALLOC(d->size * sizeof(myjson_dict_entry));
+        memset(d->slots, 0, d->size * sizeof(myjson_dict_entry));
+        for (i = 0; i < old.size; i++)
+            if (old.slots[i].key != NULL)
+                *myjson_dict_find(d, old.slots[i].key, old.slots[i].klen) = old.slots[i];
+        MYJSON_FREE(old.slots);
+    }
+    e = myjson_dict_find(d, key, klen);
+    if (e->key == NULL) {
+        e->key = key;
+        e->klen = klen;
+        e->index = d->count++;
+    }
+}
+
+/* Raw fragments are encoded as the value they parse to */
+static void myjson_raw_parse(const myjson_value *raw, myjson_value *v) {
+    myjson_init(v);
+    myjson_parse(v, myjson_get_raw(raw));
+}
+
+static void myjson_dict_init(myjson_dict *d) {
+    d->slots = NULL;
+    d->size = d->count = 0;
+    d->raws.buf = NULL;
+    d->raws.size = d->raws.top = 0;
+    d->next = 0;
+}
+
+static void myjson_dict_free(myjson_dict *d) {
+    size_t i;
+    for (i = 0; i < d->raws.top / sizeof(myjson_value); i++)
+        myjson_free(&((myjson_value *)d->raws.buf)[i]);
+    MYJSON_FREE(d->raws.buf);
+    MYJSON_FREE(d->slots);
+}
+
+/* The parsed raw fragments stay in d, to be encoded in the same order as they are collected */
+static const myjson_value *myjson_dict_next_raw(myjson_dict *d) {
+    return &((myjson_value *)d->raws.buf)[d->next++];
+}
+
+typedef struct {
+    const myjson_value *v; /* array or object */
+    size_t i; /* next child */
+    size_t tag; /* set by the caller */
+    myjson_value *owned; /* parsed raw fragment that v is, freed with the frame */
+} myjson_walk_frame;
+
+/* Visits a tree in document order with a stack of open containers instead of recursion, so any
+ * depth the parser accepts can be encoded. Raw fragments are visited as the value they parse to:
+ * parsed into d->raws with collect set, taken from d->raws in the same order with collect clear,
+ * and parsed for the visit without d. */
+typedef struct {
+    myjson_buffer frames;
+    const myjson_value *root;
+    myjson_dict *d;
+    int collect;
+    myjson_value *scalar; /* parsed raw scalar visited last, freed on the next step */
+    size_t parent, index; /* tag of the container of the value visited last and its index there */
+} myjson_walk;
+
+static void myjson_walk_init(myjson_walk *w, const myjson_value *v, myjson_dict *d, int collect) {
+    w->frames.buf = NULL;
+    w->frames.size = w->frames.top = 0;
+    w->root = v;
+    w->d = d;
+    w->collect = collect;
+    w->scalar = NULL;
+    w->parent = 0;
+    w->index = MYJSON_KEY_NOT_EXIST;
+}
+
+static myjson_walk_frame *myjson_walk_top(myjson_walk *w) {
+    assert(w->frames.top > 0);
+    return (myjson_walk_frame *)(w->frames.buf + w->frames.top) - 1;
+}
+
+static void myjson_walk_free_owned(myjson_value *v) {
+    if (v != NULL) {
+        myjson_free(v);
+        MYJSON_FREE(v);
+    }
+}
+
+/* Returns the next value, NULL after the last one. *m is the member whose value it is, NULL for
+ * array elements and the root. A container's frame is on top when it is returned. */
+static const myjson_value *myjson_walk_next(myjson_walk *w, const myjson_member **m) {
+    const myjson_value *v;
+    myjson_value *owned = NULL;
+    myjson_walk_frame *f;
+    myjson_walk_free_owned(w->scalar);
+    w->scalar = NULL;
+    *m = NULL;
+    if (w->root != NULL) {
+        v = w->root;
+        w->root = NULL;
+    }
+    else {
+        for (;;) {
+            if (w->frames.top == 0) {
+                MYJSON_FREE(w->frames.buf);
+                w->frames.buf = NULL;
+                return NULL;
+            }
+            f = myjson_walk_top(w);
+            if (f->i < (f->v->type == MYJSON_ARRAY ? f->v->val.arr.size : f->v->val.obj.size))
+                break;
+            myjson_walk_free_owned(f->owned);
+            w->frames.top -= sizeof(myjson_walk_frame);
+        }
+        w->parent = f->tag;
+        w->index = f->i;
+        if (f->v->type == MYJSON_ARRAY)
+            v = &f->v->val.arr.e[f->i++];
+        else {
+            *m = &f->v->val.obj.m[f->i++];
+            v = &(*m)->v;
+        }
+    }
+    if (v->type == MYJSON_RAW) {
+        if (w->d == NULL) {
+            owned = (myjson_value *)MYJSON_MALLOC(sizeof(myjson_value));
+            myjson_raw_parse(v, owned);
+            v = owned;
+        }
+        else if (w->collect) {
+            myjson_value *raw = (myjson_value *)myjson_buffer_push(&w->d->raws, sizeof(myjson_value));
+            myjson_raw_parse(v, raw);
+            v = raw;
+        }
+        else
+            v = myjson_dict_next_raw(w->d);
+    }
+    if (v->type == MYJSON_ARRAY || v->type == MYJSON_OBJECT) {
+        f = (myjson_walk_frame *)myjson_buffer_push(&w->frames, sizeof(myjson_walk_frame));
+        f->v = v;
+        f->i = 0;
+        f->tag = 0;
+        f->owned = owned;
+    }
+    else
+        w->scalar = owned;
+    return v;
+}
+
+static void myjson_dict_collect(myjson_dict *d, const myjson_value *v) {
+    myjson_walk w;
+    const myjson_member *m;
+    myjson_walk_init(&w, v, d, 1);
+    while (myjson_walk_next(&w, &m) != NULL)
+        if (m != NULL)
+            myjson_dict_insert(d, m->key, m->klen);
+}
+
+static void myjson_dump_value(myjson_buffer *b, myjson_dict *d, const myjson_value *v) {
+    myjson_walk w;
+    const myjson_member *m;
+    unsigned char *p;
+    unsigned long long bits;
+    double n;
+    size_t i;
+    myjson_walk_init(&w, v, d, 0);
+    while ((v = myjson_walk_next(&w, &m)) != NULL) {
+        if (m != NULL) {
+            if (d != NULL)
+                myjson_put_varint(b, myjson_dict_find(d, m->key, m->klen)->index);
+            else
+                myjson_put_bytes(b, m->key, m->klen);
+        }
+        *myjson_buffer_push(b, 1) = (char)v->type;
+        switch (v->type) {
+            case MYJSON_NUMBER:
+                n = myjson_get_number(v);
+                memcpy(&bits, &n, sizeof(bits));
+                p = (unsigned char *)myjson_buffer_push(b, 8);
+                for (i = 0; i < 8; i++)
+                    p[i] = (unsigned char)(bits >> (i * 8));
+                break;
+            case MYJSON_STRING:
+                myjson_put_bytes(b, v->val.s.s, v->val.s.len);
+                break;
+            case MYJSON_ARRAY:
+                myjson_put_varint(b, v->val.arr.size);
+                break;
+            case MYJSON_OBJECT:
+                myjson_put_varint(b, v->val.obj.size);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+char *myjson_dump_binary(const myjson_value *v, size_t *length, unsigned flags) {
+    myjson_buffer b;
+    myjson_dict d;
+    char *p;
+    size_t i;
+    assert(v != NULL && length != NULL);
+    b.buf = NULL;
+    b.size = b.top = 0;
+    myjson_dict_init(&d);
+    p = myjson_buffer_push(&b, 6);
+    memcpy(p, "MYJB", 4);
+    p[4] = MYJSON_BINARY_VERSION;
+    p[5] = (char)(flags & MYJSON_OPT_KEY_DICTIONARY);
+    if (flags & MYJSON_OPT_KEY_DICTIONARY) {
+        const myjson_dict_entry **keys;
+        myjson_dict_collect(&d, v);
+        keys = (const myjson_dict_entry **)MYJSON_MALLOC((d.count + 1) * sizeof(*keys));
+        for (i = 0; i < d.size; i++)
+            if (d.slots[i].key != NULL)
+                keys[d.slots[i].index] = &d.slots[i];
+        myjson_put_varint(&b, d.count);
+        for (i = 0; i < d.count; i++)
+            myjson_put_bytes(&b, keys[i]->key, keys[i]->klen);
+        MYJSON_FREE(keys);
+    }
+    myjson_dump_value(&b, (flags & MYJSON_OPT_KEY_DICTIONARY) ? &d : NULL, v);
+    myjson_dict_free(&d);
+    *length = b.top;
+    return b.buf;
+}
+
+typedef struct {
+    const unsigned char *p, *end;
+    const char **keys;
+    size_t *klens, nkeys;
+} myjson_reader;
+
+static int myjson_get_varint(myjson_reader *r, size_t *n) {
+    unsigned shift = 0;
+    *n = 0;
+    for (;;) {
+        unsigned char ch;
+        if (r->p == r->end || shift >= sizeof(size_t) * 8)
+            return 0;
+        ch = *r->p++;
+        *n |= (size_t)(ch & 0x7F) << shift;
+        if (!(ch & 0x80))
+            return 1;
+        shift += 7;
+    }
+}
+
+static int myjson_get_bytes(myjson_reader *r, const char **s, size_t *len) {
+    if (!myjson_get_varint(r, len) || *len > (size_t)(r->end - r->p))
+        return 0;
+    *s = (const char *)r->p;
+    r->p += *len;
+    return 1;
+}
+
+static int myjson_load_value(myjson_reader *r, myjson_value *v, size_t depth) {
+    unsigned long long bits = 0;
+    const char *s;
+    size_t i, n;
+    int ret;
+    if (r->p == r->end)
+        return MYJSON_PARSE_INVALID_BINARY;
+    switch (*r->p++) {
+        case MYJSON_NULL: v->type = MYJSON_NULL; return MYJSON_PARSE_OK;
+        case MYJSON_FALSE: v->type = MYJSON_FALSE; return MYJSON_PARSE_OK;
+        case MYJSON_TRUE: v->type = MYJSON_TRUE; return MYJSON_PARSE_OK;
+        case MYJSON_NUMBER:
+            if (r->end - r->p < 8)
+                return MYJSON_PARSE_INVALID_BINARY;
+            for (i = 0; i < 8; i++)
+                bits |= (unsigned long long)r->p[i] << (i * 8);
+            r->p += 8;
+            memcpy(&v->val.n, &bits, sizeof(bits));
+            v->type = MYJSON_NUMBER;
+            return MYJSON_PARSE_OK;
+        case MYJSON_STRING:
+            if (!myjson_get_bytes(r, &s, &n))
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_string(v, s, n);
+            return MYJSON_PARSE_OK;
+        case MYJSON_ARRAY:
+            if (depth == MYJSON_PARSE_MAX_DEPTH)
+                return MYJSON_PARSE_NESTING_TOO_DEEP;
+            /* Every element takes at least one byte, which bounds hostile counts */
+            if (!myjson_get_varint(r, &n) || n > (size_t)(r->end - r->p))
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_array(v, n);
+            for (i = 0; i < n; i++) {
+                myjson_init(&v->val.arr.e[i]);
+                v->val.arr.size++;
+                if ((ret = myjson_load_value(r, &v->val.arr.e[i], depth + 1)) != MYJSON_PARSE_OK) {
+                    myjson_free(v);
+                    return ret;
+                }
+            }
+            return MYJSON_PARSE_OK;
+        case MYJSON_OBJECT:
+            if (depth == MYJSON_PARSE_MAX_DEPTH)
+                return MYJSON_PARSE_NESTING_TOO_DEEP;
+            if (!myjson_get_varint(r, &n) || n > (size_t)(r->end - r->p) / 2)
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_object(v, n);
+            for (i = 0; i < n; i++) {
+                myjson_member *m = &v->val.obj.m[i];
+                if (r->keys != NULL) {
+                    size_t index;
+                    if (!myjson_get_varint(r, &index) || index >= r->nkeys) {
+                        myjson_free(v);
+                        return MYJSON_PARSE_INVALID_BINARY;
+                    }
+                    s = r->keys[index];
+                    m->klen = r->klens[index];
+                }
+                else if (!myjson_get_bytes(r, &s, &m->klen)) {
+                    myjson_free(v);
+                    return MYJSON_PARSE_INVALID_BINARY;
+                }
+                memcpy(m->key = (char *)MYJSON_MALLOC(m->klen + 1), s, m->klen);
+                m->key[m->klen] = '\0';
+                myjson_init(&m->v);
+                v->val.obj.size++;
+                if ((ret = myjson_load_value(r, &m->v, depth + 1)) != MYJSON_PARSE_OK) {
+                    myjson_free(v);
+                    return ret;
+                }
+            }
+            return MYJSON_PARSE_OK;
+        default:
+            return MYJSON_PARSE_INVALID_BINARY;
+    }
+}
+
+int myjson_load_binary(myjson_value *v, const char *data, size_t length) {
+    myjson_reader r;
+    int ret;
+    assert(v != NULL && (data != NULL || length == 0));
+    myjson_init(v);
+    if (length < 6 || memcmp(data, "MYJB", 4) != 0 || data[4] != MYJSON_BINARY_VERSION)
+        return MYJSON_PARSE_INVALID_BINARY;
+    r.p = (const unsigned char *)data + 6;
+    r.end = (const unsigned char *)data + length;
+    r.keys = NULL;
+    r.klens = NULL;
+    r.nkeys = 0;
+    if (data[5] & MYJSON_OPT_KEY_DICTIONARY) {
+        size_t i;
+        if (!myjson_get_varint(&r, &r.nkeys) || r.nkeys > (size_t)(r.end - r.p))
+            return MYJSON_PARSE_INVALID_BINARY;
+        r.keys = (const char **)MYJSON_MALLOC((r.nkeys + 1) * sizeof(const char *));
+        r.klens = (size_t *)MYJSON_MALLOC((r.nkeys + 1) * sizeof(size_t));
+        for (i = 0; i < r.nkeys; i++)
+            if (!myjson_get_bytes(&r, &r.keys[i], &r.klens[i])) {
+                MYJSON_FREE(r.keys);
+                MYJSON_FREE(r.klens);
+                return MYJSON_PARSE_INVALID_BINARY;
+            }
+    }
+    ret = myjson_load_value(&r, v, 0);
+    if (ret == MYJSON_PARSE_OK && r.p != r.end) {
+        myjson_free(v);
+        ret = MYJSON_PARSE_INVALID_BINARY;
+    }
+    MYJSON_FREE(r.keys);
+    MYJSON_FREE(r.klens);
+    return ret;
+}
+
+/*
+ * Frozen layout: 8-byte words in native byte order, every record 8-byte aligned and every
+ * reference an offset from the start of the block, so the block works wherever it is mapped.
+ *
+ *   header:  "MYJSONF1", byte order word, block size, root slot
+ *   slot:    type in the top byte, below it the offset of the record, 0 for null and booleans
+ *   NUMBER:  the double
+ *   STRING:  len, bytes, '\0', padding          -- keys are stored once and shared
+ *   ARRAY:   count, count x slot
+ *   OBJECT:  count, count x (key offset, slot), count x 32-bit member index in key order, padding
+ */
+
+#define MYJSON_FROZEN_ORDER 0x0102030405060708ULL
+#define MYJSON_FROZEN_ROOT 24
+#define MYJSON_FROZEN_HEADER 32
+#define MYJSON_FROZEN_SLOT(type, offset) (((unsigned long long)(type) << 56) | (unsigned long long)(offset))
+#define MYJSON_FROZEN_TYPE(w) ((myjson_type)((w) >> 56))
+#define MYJSON_FROZEN_OFFSET(w) ((size_t)((w) & 0x00FFFFFFFFFFFFFFULL))
+#define MYJSON_FROZEN_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+static const unsigned long long *myjson_frozen_word(const myjson_frozen *f, size_t offset) {
+    assert(offset % 8 == 0 && offset + 8 <= f->size);
+    return (const unsigned long long *)(f->data + offset);
+}
+
+static void myjson_freeze_put_word(myjson_buffer *b, size_t offset, unsigned long long w) {
+    memcpy(b->buf + offset, &w, sizeof(w));
+}
+
+static size_t myjson_freeze_string(myjson_buffer *b, const char *s, size_t len) {
+    size_t offset = b->top;
+    unsigned long long n = len;
+    char *p = myjson_buffer_push(b, MYJSON_FROZEN_ALIGN(8 + len + 1));
+    memcpy(p, &n, 8);
+    memcpy(p + 8, s, len);
+    memset(p + 8 + len, 0, MYJSON_FROZEN_ALIGN(8 + len + 1) - 8 - len);
+    return offset;
+}
+
+typedef struct {
+    const char *key;
+    size_t klen;
+    unsigned index;
+} myjson_frozen_key;
+
+/* Bytewise key order, ties broken by position so the first of duplicate keys sorts first */
+static int myjson_frozen_key_compare(const void *a, const void *b) {
+    const myjson_frozen_key *x = (const myjson_frozen_key *)a, *y = (const myjson_frozen_key *)b;
+    int r = memcmp(x->key, y->key, x->klen < y->klen ? x->klen : y->klen);
+    if (r != 0)
+        return r;
+    if (x->klen != y->klen)
+        return x->klen < y->klen ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Records are laid out in document order; a container's tag is its record, so each value's slot
+ * is found from its parent's */
+static void myjson_freeze_value(myjson_buffer *b, myjson_dict *d, const size_t *keys, const myjson_value *v) {
+    myjson_walk w;
+    const myjson_member *m;
+    myjson_frozen_key *order;
+    size_t i, n, record, slot, sorted;
+    unsigned long long word;
+    unsigned index;
+    double x;
+    myjson_walk_init(&w, v, d, 0);
+    while ((v = myjson_walk_next(&w, &m)) != NULL) {
+        if (w.index == MYJSON_KEY_NOT_EXIST)
+            slot = MYJSON_FROZEN_ROOT;
+        else
+            slot = w.parent + 8 * (m != NULL ? 2 + 2 * w.index : 1 + w.index);
+        record = b->top;
+        switch (v->type) {
+            case MYJSON_NUMBER:
+                x = myjson_get_number(v);
+                memcpy(myjson_buffer_push(b, 8), &x, 8);
+                word = MYJSON_FROZEN_SLOT(MYJSON_NUMBER, record);
+                break;
+            case MYJSON_STRING:
+                word = MYJSON_FROZEN_SLOT(MYJSON_STRING, myjson_freeze_string(b, v->val.s.s, v->val.s.len));
+                break;
+            case MYJSON_ARRAY:
+                myjson_buffer_push(b, 8 * (1 + v->val.arr.size));
+                myjson_freeze_put_word(b, record, v->val.arr.size);
+                myjson_walk_top(&w)->tag = record;
+                word = MYJSON_FROZEN_SLOT(MYJSON_ARRAY, record);
+                break;
+            case MYJSON_OBJECT:
+                n = v->val.obj.size;
+                sorted = 8 * (1 + 2 * n);
+                assert(n <= 0xFFFFFFFFu);
+                memset(myjson_buffer_push(b, MYJSON_FROZEN_ALIGN(sorted + 4 * n)), 0, MYJSON_FROZEN_ALIGN(sorted + 4 * n));
+                myjson_freeze_put_word(b, record, n);
+                order = (myjson_frozen_key *)MYJSON_MALLOC((n + 1) * sizeof(myjson_frozen_key));
+                for (i = 0; i < n; i++) {
+                    m = &v->val.obj.m[i];
+                    myjson_freeze_put_word(b, record + 8 * (1 + 2 * i), keys[myjson_dict_find(d, m->key, m->klen)->index]);
+                    order[i].key = m->key;
+                    order[i].klen = m->klen;
+                    order[i].index = (unsigned)i;
+                }
+                if (n > 1)
+                    qsort(order, n, sizeof(myjson_frozen_key), myjson_frozen_key_compare);
+                for (i = 0; i < n; i++) {
+                    index = order[i].index;
+                    memcpy(b->buf + record + sorted + 4 * i, &index, 4);
+                }
+                MYJSON_FREE(order);
+                myjson_walk_top(&w)->tag = record;
+                word = MYJSON_FROZEN_SLOT(MYJSON_OBJECT, record);
+                break;
+            default:
+                word = MYJSON_FROZEN_SLOT(v->type, 0);
+                break;
+        }
+        myjson_freeze_put_word(b, slot, word);
+    }
+}
+
+char *myjson_freeze(const myjson_value *v, size_t *length) {
+    myjson_buffer b;
+    myjson_dict d;
+    size_t i, *keys;
+    assert(v != NULL && length != NULL);
+    b.buf = NULL;
+    b.size = b.top = 0;
+    myjson_dict_init(&d);
+    myjson_buffer_push(&b, MYJSON_FROZEN_HEADER);
+    memcpy(b.buf, "MYJSONF1", 8);
+    myjson_freeze_put_word(&b, 8, MYJSON_FROZEN_ORDER);
+    myjson_dict_collect(&d, v);
+    keys = (size_t *)MYJSON_MALLOC((d.count + 1) * sizeof(size_t));
+    for (i = 0; i < d.size; i++)
+        if (d.slots[i].key != NULL)
+            keys[d.slots[i].index] = i;
+    for (i = 0; i < d.count; i++)
+        keys[i] = myjson_freeze_string(&b, d.slots[keys[i]].key, d.slots[keys[i]].klen);
+    myjson_freeze_value(&b, &d, keys, v);
+    myjson_freeze_put_word(&b, 16, b.top);
+    MYJSON_FREE(keys);
+    myjson_dict_free(&d);
+    *length = b.top;
+    return b.buf;
+}
+
+/* Length of the string record at offset if it fits below end, MYJSON_KEY_NOT_EXIST otherwise */
+static size_t myjson_frozen_check_string(const char *data, size_t offset, size_t end) {
+    unsigned long long len;
+    if (offset % 8 != 0 || offset > end || end - offset < 16)
+        return MYJSON_KEY_NOT_EXIST;
+    memcpy(&len, data + offset, 8);
+    if (len > end - offset - 9 || MYJSON_FROZEN_ALIGN(8 + (size_t)len + 1) > end - offset || data[offset + 8 + len] != '\0')
+        return MYJSON_KEY_NOT_EXIST;
+    return (size_t)len;
+}
+
+typedef struct {
+    size_t record, i, n;
+    int object;
+} myjson_frozen_check_frame;
+
+/* Checks the block against the layout myjson_freeze() writes: the keys follow the header, then
+ * every other record follows the one before in document order. One pass over the slots thus
+ * bounds every offset and length, and reaches each record once. */
+static int myjson_frozen_check(const char *data, size_t size) {
+    myjson_buffer frames;
+    myjson_frozen_check_frame *f;
+    unsigned long long slot, n, key;
+    size_t i, keys, next, offset, len;
+    unsigned index;
+    int ret = MYJSON_PARSE_OK;
+    memcpy(&slot, data + MYJSON_FROZEN_ROOT, 8);
+    keys = MYJSON_FROZEN_TYPE(slot) >= MYJSON_NUMBER ? MYJSON_FROZEN_OFFSET(slot) : size;
+    if (size % 8 != 0 || keys > size)
+        return MYJSON_PARSE_INVALID_BINARY;
+    for (next = MYJSON_FROZEN_HEADER; next < keys; next += MYJSON_FROZEN_ALIGN(8 + len + 1))
+        if ((len = myjson_frozen_check_string(data, next, keys)) == MYJSON_KEY_NOT_EXIST)
+            return MYJSON_PARSE_INVALID_BINARY;
+    if (next != keys)
+        return MYJSON_PARSE_INVALID_BINARY;
+    frames.buf = NULL;
+    frames.size = frames.top = 0;
+    while (ret == MYJSON_PARSE_OK) {
+        offset = MYJSON_FROZEN_OFFSET(slot);
+        switch (MYJSON_FROZEN_TYPE(slot)) {
+            case MYJSON_NULL:
+            case MYJSON_FALSE:
+            case MYJSON_TRUE:
+                if (offset != 0)
+                    ret = MYJSON_PARSE_INVALID_BINARY;
+                break;
+            case MYJSON_NUMBER:
+                if (offset != next || size - next < 8)
+                    ret = MYJSON_PARSE_INVALID_BINARY;
+                else
+                    next += 8;
+                break;
+            case MYJSON_STRING:
+                if (offset != next || (len = myjson_frozen_check_string(data, next, size)) == MYJSON_KEY_NOT_EXIST)
+                    ret = MYJSON_PARSE_INVALID_BINARY;
+                else
+                    next += MYJSON_FROZEN_ALIGN(8 + len + 1);
+                break;
+            case MYJSON_ARRAY:
+                if (offset != next || size - next < 8 || (memcpy(&n, data + next, 8), n > (size - next) / 8 - 1)) {
+                    ret = MYJSON_PARSE_INVALID_BINARY;
+                    break;
+                }
+                f = (myjson_frozen_check_frame *)myjson_buffer_push(&frames, sizeof(myjson_frozen_check_frame));
+                f->record = next;
+                f->i = 0;
+                f->n = (size_t)n;
+                f->object = 0;
+                next += 8 * (1 + (size_t)n);
+                break;
+            case MYJSON_OBJECT:
+                if (offset != next || size - next < 8 || (memcpy(&n, data + next, 8), n > (size - next - 8) / 20)) {
+                    ret = MYJSON_PARSE_INVALID_BINARY;
+                    break;
+                }
+                /* keys must lie within the key records, member indexes within the object */
+                for (i = 0; i < n && ret == MYJSON_PARSE_OK; i++) {
+                    memcpy(&key, data + next + 8 * (1 + 2 * i), 8);
+                    memcpy(&index, data + next + 8 * (1 + 2 * (size_t)n) + 4 * i, 4);
+                    if (key < MYJSON_FROZEN_HEADER || key >= keys || myjson_frozen_check_string(data, (size_t)key, keys) == MYJSON_KEY_NOT_EXIST || index >= n)
+                        ret = MYJSON_PARSE_INVALID_BINARY;
+                }
+                if (ret != MYJSON_PARSE_OK)
+                    break;
+                f = (myjson_frozen_check_frame *)myjson_buffer_push(&frames, sizeof(myjson_frozen_check_frame));
+                f->record = next;
+                f->i = 0;
+                f->n = (size_t)n;
+                f->object = 1;
+                next += MYJSON_FROZEN_ALIGN(8 * (1 + 2 * (size_t)n) + 4 * (size_t)n);
+                break;
+            default:
+                ret = MYJSON_PARSE_INVALID_BINARY;
+                break;
+        }
+        /* move on to the next slot, closing every container that is done */
+        while (ret == MYJSON_PARSE_OK && frames.top > 0) {
+            f = (myjson_frozen_check_frame *)(frames.buf + frames.top) - 1;
+            if (f->i < f->n) {
+                memcpy(&slot, data + f->record + 8 * (f->object ? 2 + 2 * f->i : 1 + f->i), 8);
+                f->i++;
+                break;
+            }
+            frames.top -= sizeof(myjson_frozen_check_frame);
+        }
+        if (frames.top == 0)
+            break;
+    }
+    MYJSON_FREE(frames.buf);
+    if (ret == MYJSON_PARSE_OK && next != size)
+        ret = MYJSON_PARSE_INVALID_BINARY;
+    return ret;
+}
+
+int myjson_frozen_open(myjson_frozen *f, const void *data, size_t length) {
+    unsigned long long order, size;
+    assert(f != NULL && (data != NULL || length == 0));
+    f->data = NULL;
+    f->size = 0;
+    if (length < MYJSON_FROZEN_HEADER || ((size_t)data & 7) != 0 || memcmp(data, "MYJSONF1", 8) != 0)
+        return MYJSON_PARSE_INVALID_BINARY;
+    memcpy(&order, (const char *)data + 8, 8);
+    memcpy(&size, (const char *)data + 16, 8);
+    if (order != MYJSON_FROZEN_ORDER || size != length || myjson_frozen_check((const char *)data, length) != MYJSON_PARSE_OK)
+        return MYJSON_PARSE_INVALID_BINARY;
+    f->data = (const char *)data;
+    f->size = length;
+    return MYJSON_PARSE_OK;
+}
+
+size_t myjson_frozen_root(const myjson_frozen *f) {
+    assert(f != NULL && f->data != NULL);
+    return MYJSON_FROZEN_ROOT;
+}
+
+myjson_type myjson_frozen_get_type(const myjson_frozen *f, size_t ref) {
+    assert(f != NULL);
+    return MYJSON_FROZEN_TYPE(*myjson_frozen_word(f, ref));
+}
+
+int myjson_frozen_get_boolean(const myjson_frozen *f, size_t ref) {
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_TRUE || myjson_frozen_get_type(f, ref) == MYJSON_FALSE);
+    return myjson_frozen_get_type(f, ref) == MYJSON_TRUE;
+}
+
+double myjson_frozen_get_number(const myjson_frozen *f, size_t ref) {
+    double n;
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_NUMBER);
+    memcpy(&n, myjson_frozen_word(f, MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref))), sizeof(double));
+    return n;
+}
+
+const char *myjson_frozen_get_string(const myjson_frozen *f, size_t ref) {
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_STRING);
+    return f->data + MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)) + 8;
+}
+
+size_t myjson_frozen_get_string_length(const myjson_frozen *f, size_t ref) {
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_STRING);
+    return (size_t)*myjson_frozen_word(f, MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)));
+}
+
+size_t myjson_frozen_get_size(const myjson_frozen *f, size_t ref) {
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_ARRAY || myjson_frozen_get_type(f, ref) == MYJSON_OBJECT);
+    return (size_t)*myjson_frozen_word(f, MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)));
+}
+
+size_t myjson_frozen_get_array_element(const myjson_frozen *f, size_t ref, size_t index) {
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_ARRAY && index < myjson_frozen_get_size(f, ref));
+    return MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)) + 8 * (1 + index);
+}
+
+const char *myjson_frozen_get_object_key(const myjson_frozen *f, size_t ref, size_t index) {
+    size_t key;
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_OBJECT && index < myjson_frozen_get_size(f, ref));
+    key = (size_t)*myjson_frozen_word(f, MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)) + 8 * (1 + 2 * index));
+    return f->data + key + 8;
+}
+
+size_t myjson_frozen_get_object_key_length(const myjson_frozen *f, size_t ref, size_t index) {
+    size_t key;
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_OBJECT && index < myjson_frozen_get_size(f, ref));
+    key = (size_t)*myjson_frozen_word(f, MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)) + 8 * (1 + 2 * index));
+    return (size_t)*myjson_frozen_word(f, key);
+}
+
+size_t myjson_frozen_get_object_value(const myjson_frozen *f, size_t ref, size_t index) {
+    assert(myjson_frozen_get_type(f, ref) == MYJSON_OBJECT && index < myjson_frozen_get_size(f, ref));
+    return MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref)) + 8 * (2 + 2 * index);
+}
+
+/* Binary search over the members in key order; the first of duplicate keys wins */
+size_t myjson_frozen_find_object_value(const myjson_frozen *f, size_t ref, const char *key, size_t klen) {
+    size_t n = myjson_frozen_get_size(f, ref), record = MYJSON_FROZEN_OFFSET(*myjson_frozen_word(f, ref));
+    size_t lo = 0, hi = n, mid, len;
+    unsigned index;
+    int r;
+    assert(key != NULL);
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        memcpy(&index, f->data + record + 8 * (1 + 2 * n) + 4 * mid, 4);
+        len = myjson_frozen_get_object_key_length(f, ref, index);
+        r = memcmp(myjson_frozen_get_object_key(f, ref, index), key, len < klen ? len : klen);
+        if (r < 0 || (r == 0 && len < klen))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == n)
+        return MYJSON_KEY_NOT_EXIST;
+    memcpy(&index, f->data + record + 8 * (1 + 2 * n) + 4 * lo, 4);
+    if (myjson_frozen_get_object_key_length(f, ref, index) != klen || memcmp(myjson_frozen_get_object_key(f, ref, index), key, klen) != 0)
+        return MYJSON_KEY_NOT_EXIST;
+    return myjson_frozen_get_object_value(f, ref, index);
+}
+
+typedef struct {
+    myjson_value *v;
+    size_t ref, i, n;
+} myjson_thaw_frame;
+
+void myjson_frozen_to_value(const myjson_frozen *f, size_t ref, myjson_value *v) {
+    myjson_buffer frames;
+    myjson_thaw_frame *t;
+    myjson_member *m;
+    size_t n;
+    assert(f != NULL && v != NULL);
+    frames.buf = NULL;
+    frames.size = frames.top = 0;
+    for (;;) {
+        switch (myjson_frozen_get_type(f, ref)) {
+            case MYJSON_NUMBER:
+                myjson_set_number(v, myjson_frozen_get_number(f, ref));
+                break;
+            case MYJSON_STRING:
+                myjson_set_string(v, myjson_frozen_get_string(f, ref), myjson_frozen_get_string_length(f, ref));
+                break;
+            case MYJSON_ARRAY:
+            case MYJSON_OBJECT:
+                n = myjson_frozen_get_size(f, ref);
+                if (myjson_frozen_get_type(f, ref) == MYJSON_ARRAY)
+                    myjson_set_array(v, n);
+                else
+                    myjson_set_object(v, n);
+                t = (myjson_thaw_frame *)myjson_buffer_push(&frames, sizeof(myjson_thaw_frame));
+                t->v = v;
+                t->ref = ref;
+                t->i = 0;
+                t->n = n;
+                break;
+            default:
+                myjson_free(v);
+                v->type = myjson_frozen_get_type(f, ref);
+                break;
+        }
+        for (;;) {
+            if (frames.top == 0) {
+                MYJSON_FREE(frames.buf);
+                return;
+            }
+            t = (myjson_thaw_frame *)(frames.buf + frames.top) - 1;
+            if (t->i == t->n) {
+                if (t->v->type == MYJSON_ARRAY)
+                    t->v->val.arr.size = t->n;
+                else
+                    t->v->val.obj.size = t->n;
+                frames.top -= sizeof(myjson_thaw_frame);
+                continue;
+            }
+            if (t->v->type == MYJSON_ARRAY) {
+                v = &t->v->val.arr.e[t->i];
+                ref = myjson_frozen_get_array_element(f, t->ref, t->i++);
+            }
+            else {
+                m = &t->v->val.obj.m[t->i];
+                m->klen = myjson_frozen_get_object_key_length(f, t->ref, t->i);
+                memcpy(m->key = (char *)MYJSON_MALLOC(m->klen + 1), myjson_frozen_get_object_key(f, t->ref, t->i), m->klen + 1);
+                v = &m->v;
+                ref = myjson_frozen_get_object_value(f, t->ref, t->i++);
+            }
+            myjson_init(v);
+            break;
+        }
+    }
+}
+
+/* Splits an integral double into sign and magnitude; -0, fractions and out-of-range values stay floats */
+static int myjson_integral(double n, int *negative, unsigned long long *mag) {
+    if (n >= 0) {
+        if (n >= 18446744073709551616.0 || (double)(unsigned long long)n != n || (n == 0 && signbit(n)))
+            return 0;
+        *negative = 0;
+        *mag = (unsigned long long)n;
+    }
+    else {
+        if (n < -9223372036854775808.0 || (double)(long long)n != n)
+            return 0;
+        *negative = 1;
+        /* -1 - n, as CBOR wants it, in integers since n + 1 rounds beyond 2^53 */
+        *mag = n == -9223372036854775808.0 ? 0x7FFFFFFFFFFFFFFFULL : (unsigned long long)-(long long)n - 1;
+    }
+    return 1;
+}
+
+static void myjson_put_be(myjson_buffer *b, unsigned char head, unsigned long long n, int bytes) {
+    unsigned char *p = (unsigned char *)myjson_buffer_push(b, bytes + 1);
+    *p++ = head;
+    while (bytes-- > 0)
+        *p++ = (unsigned char)(n >> (bytes * 8));
+}
+
+static void myjson_put_float(myjson_buffer *b, unsigned char head32, unsigned char head64, double n) {
+    float f = (float)n;
+    if ((double)f == n) {
+        unsigned bits;
+        memcpy(&bits, &f, sizeof(bits));
+        myjson_put_be(b, head32, bits, 4);
+    }
+    else {
+        unsigned long long bits;
+        memcpy(&bits, &n, sizeof(bits));
+        myjson_put_be(b, head64, bits, 8);
+    }
+}
+
+static int myjson_get_be(myjson_reader *r, int bytes, unsigned long long *n) {
+    if (r->end - r->p < bytes)
+        return 0;
+    *n = 0;
+    while (bytes-- > 0)
+        *n = (*n << 8) | *r->p++;
+    return 1;
+}
+
+static int myjson_get_span(myjson_reader *r, unsigned long long len, const char **s) {
+    if (len > (unsigned long long)(r->end - r->p))
+        return 0;
+    *s = (const char *)r->p;
+    r->p += len;
+    return 1;
+}
+
+static int myjson_set_finite(myjson_value *v, double n) {
+    if (n - n != 0) /* inf and nan have no JSON representation */
+        return MYJSON_PARSE_INVALID_BINARY;
+    myjson_set_number(v, n);
+    return MYJSON_PARSE_OK;
+}
+
+static double myjson_get_float(unsigned long long bits, int bytes) {
+    if (bytes == 4) {
+        unsigned u = (unsigned)bits;
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+    else {
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+}
+
+/* MessagePack */
+
+static void myjson_msgpack_length(myjson_buffer *b, size_t len, unsigned char fix, size_t fixmax, unsigned char h8, unsigned char h16) {
+    if (len <= fixmax)
+        *myjson_buffer_push(b, 1) = (char)(fix | len);
+    else if (h8 != 0 && len <= 0xFF)
+        myjson_put_be(b, h8, len, 1);
+    else if (len <= 0xFFFF)
+        myjson_put_be(b, h16, len, 2);
+    else
+        myjson_put_be(b, h16 + 1, len, 4);
+}
+
+static void myjson_msgpack_string(myjson_buffer *b, const char *s, size_t len) {
+    myjson_msgpack_length(b, len, 0xA0, 31, 0xD9, 0xDA);
+    if (len > 0)
+        memcpy(myjson_buffer_push(b, len), s, len);
+}
+
+static void myjson_msgpack_number(myjson_buffer *b, double n) {
+    unsigned long long mag;
+    int negative;
+    if (!myjson_integral(n, &negative, &mag))
+        myjson_put_float(b, 0xCA, 0xCB, n);
+    else if (!negative) {
+        if (mag <= 0x7F)
+            *myjson_buffer_push(b, 1) = (char)mag;
+        else if (mag <= 0xFF)
+            myjson_put_be(b, 0xCC, mag, 1);
+        else if (mag <= 0xFFFF)
+            myjson_put_be(b, 0xCD, mag, 2);
+        else if (mag <= 0xFFFFFFFFULL)
+            myjson_put_be(b, 0xCE, mag, 4);
+        else
+            myjson_put_be(b, 0xCF, mag, 8);
+    }
+    else {
+        long long x = (long long)n;
+        if (x >= -32)
+            *myjson_buffer_push(b, 1) = (char)x;
+        else if (x >= -0x80)
+            myjson_put_be(b, 0xD0, (unsigned long long)x, 1);
+        else if (x >= -0x8000)
+            myjson_put_be(b, 0xD1, (unsigned long long)x, 2);
+        else if (x >= -0x80000000LL)
+            myjson_put_be(b, 0xD2, (unsigned long long)x, 4);
+        else
+            myjson_put_be(b, 0xD3, (unsigned long long)x, 8);
+    }
+}
+
+static void myjson_msgpack_value(myjson_buffer *b, const myjson_value *v) {
+    myjson_walk w;
+    const myjson_member *m;
+    myjson_walk_init(&w, v, NULL, 0);
+    while ((v = myjson_walk_next(&w, &m)) != NULL) {
+        if (m != NULL)
+            myjson_msgpack_string(b, m->key, m->klen);
+        switch (v->type) {
+            case MYJSON_NULL: *myjson_buffer_push(b, 1) = (char)0xC0; break;
+            case MYJSON_FALSE: *myjson_buffer_push(b, 1) = (char)0xC2; break;
+            case MYJSON_TRUE: *myjson_buffer_push(b, 1) = (char)0xC3; break;
+            case MYJSON_NUMBER: myjson_msgpack_number(b, myjson_get_number(v)); break;
+            case MYJSON_STRING: myjson_msgpack_string(b, v->val.s.s, v->val.s.len); break;
+            case MYJSON_ARRAY: myjson_msgpack_length(b, v->val.arr.size, 0x90, 15, 0, 0xDC); break;
+            case MYJSON_OBJECT: myjson_msgpack_length(b, v->val.obj.size, 0x80, 15, 0, 0xDE); break;
+            default: assert(0 && "invalid type");
+        }
+    }
+}
+
+char *myjson_encode_msgpack(const myjson_value *v, size_t *length) {
+    myjson_buffer b;
+    assert(v != NULL && length != NULL);
+    b.buf = NULL;
+    b.size = b.top = 0;
+    myjson_msgpack_value(&b, v);
+    *length = b.top;
+    return b.buf;
+}
+
+/* Reads a str or bin header and its bytes; returns 0 if the next item is neither */
+static int myjson_unpack_string(myjson_reader *r, const char **s, size_t *len) {
+    unsigned long long n = 0;
+    unsigned char head;
+    int bytes;
+    if (r->p == r->end)
+        return 0;
+    head = *r->p++;
+    if (head >= 0xA0 && head <= 0xBF) {
+        n = head & 0x1F;
+        bytes = 0;
+    }
+    else if (head == 0xD9 || head == 0xC4)
+        bytes = 1;
+    else if (head == 0xDA || head == 0xC5)
+        bytes = 2;
+    else if (head == 0xDB || head == 0xC6)
+        bytes = 4;
+    else
+        return 0;
+    if (bytes > 0 && !myjson_get_be(r, bytes, &n))
+        return 0;
+    *len = (size_t)n;
+    return myjson_get_span(r, n, s);
+}
+
+static int myjson_unpack_value(myjson_reader *r, myjson_value *v, size_t depth) {
+    unsigned long long n;
+    const char *s;
+    size_t i, len;
+    unsigned char head;
+    int ret;
+    if (r->p == r->end)
+        return MYJSON_PARSE_INVALID_BINARY;
+    head = *r->p;
+    if (head <= 0x7F || head >= 0xE0) {
+        r->p++;
+        myjson_set_number(v, (signed char)head);
+        return MYJSON_PARSE_OK;
+    }
+    if ((head >= 0xA0 && head <= 0xBF) || (head >= 0xC4 && head <= 0xC6) || (head >= 0xD9 && head <= 0xDB)) {
+        if (!myjson_unpack_string(r, &s, &len))
+            return MYJSON_PARSE_INVALID_BINARY;
+        myjson_set_string(v, s, len);
+        return MYJSON_PARSE_OK;
+    }
+    r->p++;
+    if (head >= 0x90 && head <= 0x9F)
+        n = head & 0x0F;
+    else if (head >= 0x80 && head <= 0x8F)
+        n = head & 0x0F;
+    else switch (head) {
+        case 0xC0: v->type = MYJSON_NULL; return MYJSON_PARSE_OK;
+        case 0xC2: v->type = MYJSON_FALSE; return MYJSON_PARSE_OK;
+        case 0xC3: v->type = MYJSON_TRUE; return MYJSON_PARSE_OK;
+        case 0xCA:
+        case 0xCB:
+            if (!myjson_get_be(r, head == 0xCA ? 4 : 8, &n))
+                return MYJSON_PARSE_INVALID_BINARY;
+            return myjson_set_finite(v, myjson_get_float(n, head == 0xCA ? 4 : 8));
+        case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+            if (!myjson_get_be(r, 1 << (head - 0xCC), &n))
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_number(v, (double)n);
+            return MYJSON_PARSE_OK;
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3: {
+            int bytes = 1 << (head - 0xD0);
+            if (!myjson_get_be(r, bytes, &n))
+                return MYJSON_PARSE_INVALID_BINARY;
+            if (bytes < 8 && (n >> (bytes * 8 - 1)))
+                n |= ~0ULL << (bytes * 8); /* sign-extend */
+            myjson_set_number(v, (double)(long long)n);
+            return MYJSON_PARSE_OK;
+        }
+        case 0xDC: case 0xDE:
+            if (!myjson_get_be(r, 2, &n))
+                return MYJSON_PARSE_INVALID_BINARY;
+            break;
+        case 0xDD: case 0xDF:
+            if (!myjson_get_be(r, 4, &n))
+                return MYJSON_PARSE_INVALID_BINARY;
+            break;
+        default: /* extension types have no JSON counterpart */
+            return MYJSON_PARSE_INVALID_BINARY;
+    }
+    if (depth == MYJSON_PARSE_MAX_DEPTH)
+        return MYJSON_PARSE_NESTING_TOO_DEEP;
+    if (head <= 0x8F || head == 0xDE || head == 0xDF) {
+        if (n > (unsigned long long)(r->end - r->p) / 2)
+            return MYJSON_PARSE_INVALID_BINARY;
+        myjson_set_object(v, (size_t)n);
+        for (i = 0; i < n; i++) {
+            myjson_member *m = &v->val.obj.m[i];
+            if (!myjson_unpack_string(r, &s, &m->klen)) {
+                myjson_free(v);
+                return MYJSON_PARSE_INVALID_BINARY;
+            }
+            memcpy(m->key = (char *)MYJSON_MALLOC(m->klen + 1), s, m->klen);
+            m->key[m->klen] = '\0';
+            myjson_init(&m->v);
+            v->val.obj.size++;
+            if ((ret = myjson_unpack_value(r, &m->v, depth + 1)) != MYJSON_PARSE_OK) {
+                myjson_free(v);
+                return ret;
+            }
+        }
+    }
+    else {
+        if (n > (unsigned long long)(r->end - r->p))
+            return MYJSON_PARSE_INVALID_BINARY;
+        myjson_set_array(v, (size_t)n);
+        for (i = 0; i < n; i++) {
+            myjson_init(&v->val.arr.e[i]);
+            v->val.arr.size++;
+            if ((ret = myjson_unpack_value(r, &v->val.arr.e[i], depth + 1)) != MYJSON_PARSE_OK) {
+                myjson_free(v);
+                return ret;
+            }
+        }
+    }
+    return MYJSON_PARSE_OK;
+}
+
+int myjson_decode_msgpack(myjson_value *v, const char *data, size_t length) {
+    myjson_reader r;
+    int ret;
+    assert(v != NULL && (data != NULL || length == 0));
+    myjson_init(v);
+    r.p = (const unsigned char *)data;
+    r.end = r.p + length;
+    if ((ret = myjson_unpack_value(&r, v, 0)) == MYJSON_PARSE_OK && r.p != r.end) {
+        myjson_free(v);
+        ret = MYJSON_PARSE_INVALID_BINARY;
+    }
+    return ret;
+}
+
+/* CBOR (RFC 8949) */
+
+static void myjson_cbor_head(myjson_buffer *b, int major, unsigned long long n) {
+    unsigned char head = (unsigned char)(major << 5);
+    if (n < 24)
+        *myjson_buffer_push(b, 1) = (char)(head | n);
+    else if (n <= 0xFF)
+        myjson_put_be(b, head | 24, n, 1);
+    else if (n <= 0xFFFF)
+        myjson_put_be(b, head | 25, n, 2);
+    else if (n <= 0xFFFFFFFFULL)
+        myjson_put_be(b, head | 26, n, 4);
+    else
+        myjson_put_be(b, head | 27, n, 8);
+}
+
+static void myjson_cbor_string(myjson_buffer *b, const char *s, size_t len) {
+    myjson_cbor_head(b, 3, len);
+    if (len > 0)
+        memcpy(myjson_buffer_push(b, len), s, len);
+}
+
+static void myjson_cbor_value(myjson_buffer *b, const myjson_value *v) {
+    myjson_walk w;
+    const myjson_member *m;
+    unsigned long long mag;
+    int negative;
+    myjson_walk_init(&w, v, NULL, 0);
+    while ((v = myjson_walk_next(&w, &m)) != NULL) {
+        if (m != NULL)
+            myjson_cbor_string(b, m->key, m->klen);
+        switch (v->type) {
+            case MYJSON_NULL: *myjson_buffer_push(b, 1) = (char)0xF6; break;
+            case MYJSON_FALSE: *myjson_buffer_push(b, 1) = (char)0xF4; break;
+            case MYJSON_TRUE: *myjson_buffer_push(b, 1) = (char)0xF5; break;
+            case MYJSON_NUMBER:
+                if (myjson_integral(myjson_get_number(v), &negative, &mag))
+                    myjson_cbor_head(b, negative, mag);
+                else
+                    myjson_put_float(b, 0xFA, 0xFB, myjson_get_number(v));
+                break;
+            case MYJSON_STRING: myjson_cbor_string(b, v->val.s.s, v->val.s.len); break;
+            case MYJSON_ARRAY: myjson_cbor_head(b, 4, v->val.arr.size); break;
+            case MYJSON_OBJECT: myjson_cbor_head(b, 5, v->val.obj.size); break;
+            default: assert(0 && "invalid type");
+        }
+    }
+}
+
+char *myjson_encode_cbor(const myjson_value *v, size_t *length) {
+    myjson_buffer b;
+    assert(v != NULL && length != NULL);
+    b.buf = NULL;
+    b.size = b.top = 0;
+    myjson_cbor_value(&b, v);
+    *length = b.top;
+    return b.buf;
+}
+
+#define MYJSON_CBOR_INDEFINITE (~0ULL)
+
+/* Reads an initial byte and its argument; indefinite lengths are reported as MYJSON_CBOR_INDEFINITE */
+static int myjson_cbor_get_head(myjson_reader *r, int *major, unsigned *info, unsigned long long *n) {
+    if (r->p == r->end)
+        return 0;
+    *major = *r->p >> 5;
+    *info = *r->p++ & 0x1F;
+    if (*info < 24)
+        *n = *info;
+    else if (*info <= 27)
+        return myjson_get_be(r, 1 << (*info - 24), n);
+    else if (*info == 31 && (*major == 2 || *major == 3 || *major == 4 || *major == 5))
+        *n = MYJSON_CBOR_INDEFINITE;
+    else
+        return 0;
+    return 1;
+}
+
+static int myjson_cbor_at_break(myjson_reader *r) {
+    if (r->p != r->end && *r->p == 0xFF) {
+        r->p++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Reads a byte or text string of the given major type; indefinite strings are joined on the reader stack */
+static int myjson_cbor_get_string(myjson_reader *r, int major, unsigned long long n, myjson_buffer *stack, const char **s, size_t *len) {
+    size_t head = stack->top;
+    if (n != MYJSON_CBOR_INDEFINITE) {
+        *len = (size_t)n;
+        return myjson_get_span(r, n, s);
+    }
+    while (!myjson_cbor_at_break(r)) {
+        const char *chunk;
+        int chunk_major;
+        unsigned info;
+        if (!myjson_cbor_get_head(r, &chunk_major, &info, &n) || chunk_major != major ||
+            n == MYJSON_CBOR_INDEFINITE || !myjson_get_span(r, n, &chunk)) {
+            stack->top = head;
+            return 0;
+        }
+        if (n > 0)
+            memcpy(myjson_buffer_push(stack, (size_t)n), chunk, (size_t)n);
+    }
+    *len = stack->top - head;
+    *s = stack->buf + head;
+    stack->top = head; /* the bytes stay valid until the next push */
+    return 1;
+}
+
+static int myjson_cbor_decode(myjson_reader *r, myjson_buffer *stack, myjson_value *v, size_t depth);
+
+static int myjson_cbor_decode_key(myjson_reader *r, myjson_buffer *stack, myjson_member *m, size_t depth) {
+    unsigned long long n;
+    const char *s;
+    unsigned info;
+    int major, ret;
+    if (!myjson_cbor_get_head(r, &major, &info, &n) || (major != 2 && major != 3) ||
+        !myjson_cbor_get_string(r, major, n, stack, &s, &m->klen))
+        return MYJSON_PARSE_INVALID_BINARY;
+    memcpy(m->key = (char *)MYJSON_MALLOC(m->klen + 1), s, m->klen);
+    m->key[m->klen] = '\0';
+    myjson_init(&m->v);
+    if ((ret = myjson_cbor_decode(r, stack, &m->v, depth)) != MYJSON_PARSE_OK) {
+        MYJSON_FREE(m->key);
+        return ret;
+    }
+    return MYJSON_PARSE_OK;
+}
+
+static int myjson_cbor_decode(myjson_reader *r, myjson_buffer *stack, myjson_value *v, size_t depth) {
+    unsigned long long n;
+    const char *s;
+    size_t i, len;
+    unsigned info;
+    int major, ret;
+    if (!myjson_cbor_get_head(r, &major, &info, &n))
+        return MYJSON_PARSE_INVALID_BINARY;
+    /* tags count as a level too, since each one is decoded by a nested call */
+    if ((major == 4 || major == 5 || major == 6) && depth == MYJSON_PARSE_MAX_DEPTH)
+        return MYJSON_PARSE_NESTING_TOO_DEEP;
+    switch (major) {
+        case 0:
+            myjson_set_number(v, (double)n);
+            return MYJSON_PARSE_OK;
+        case 1:
+            myjson_set_number(v, -1.0 - (double)n);
+            return MYJSON_PARSE_OK;
+        case 2:
+        case 3:
+            if (!myjson_cbor_get_string(r, major, n, stack, &s, &len))
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_string(v, s, len);
+            return MYJSON_PARSE_OK;
+        case 4:
+            if (n == MYJSON_CBOR_INDEFINITE) {
+                size_t head = stack->top, size = 0;
+                while (!myjson_cbor_at_break(r)) {
+                    myjson_value e;
+                    myjson_init(&e);
+                    if ((ret = myjson_cbor_decode(r, stack, &e, depth + 1)) != MYJSON_PARSE_OK) {
+                        for (i = 0; i < size; i++)
+                            myjson_free((myjson_value *)(stack->buf + head) + i);
+                        stack->top = head;
+                        return ret;
+                    }
+                    memcpy(myjson_buffer_push(stack, sizeof(myjson_value)), &e, sizeof(myjson_value));
+                    size++;
+                }
+                myjson_set_array(v, size);
+                if (size > 0)
+                    memcpy(v->val.arr.e, stack->buf + head, size * sizeof(myjson_value));
+                v->val.arr.size = size;
+                stack->top = head;
+                return MYJSON_PARSE_OK;
+            }
+            if (n > (unsigned long long)(r->end - r->p))
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_array(v, (size_t)n);
+            for (i = 0; i < n; i++) {
+                myjson_init(&v->val.arr.e[i]);
+                v->val.arr.size++;
+                if ((ret = myjson_cbor_decode(r, stack, &v->val.arr.e[i], depth + 1)) != MYJSON_PARSE_OK) {
+                    myjson_free(v);
+                    return ret;
+                }
+            }
+            return MYJSON_PARSE_OK;
+        case 5:
+            if (n == MYJSON_CBOR_INDEFINITE) {
+                size_t head = stack->top, size = 0;
+                while (!myjson_cbor_at_break(r)) {
+                    myjson_member m;
+                    if ((ret = myjson_cbor_decode_key(r, stack, &m, depth + 1)) != MYJSON_PARSE_OK) {
+                        for (i = 0; i < size; i++) {
+                            myjson_member *p = (myjson_member *)(stack->buf + head) + i;
+                            MYJSON_FREE(p->key);
+                            myjson_free(&p->v);
+                        }
+                        stack->top = head;
+                        return ret;
+                    }
+                    memcpy(myjson_buffer_push(stack, sizeof(myjson_member)), &m, sizeof(myjson_member));
+                    size++;
+                }
+                myjson_set_object(v, size);
+                if (size > 0)
+                    memcpy(v->val.obj.m, stack->buf + head, size * sizeof(myjson_member));
+                v->val.obj.size = size;
+                stack->top = head;
+                return MYJSON_PARSE_OK;
+            }
+            if (n > (unsigned long long)(r->end - r->p) / 2)
+                return MYJSON_PARSE_INVALID_BINARY;
+            myjson_set_object(v, (size_t)n);
+            for (i = 0; i < n; i++) {
+                if ((ret = myjson_cbor_decode_key(r, stack, &v->val.obj.m[i], depth + 1)) != MYJSON_PARSE_OK) {
+                    myjson_free(v);
+                    return ret;
+                }
+                v->val.obj.size++;
+            }
+            return MYJSON_PARSE_OK;
+        case 6: /* semantic tags are dropped, the tagged item is kept */
+            return myjson_cbor_decode(r, stack, v, depth + 1);
+        default:
+            switch (info) {
+                case 20: v->type = MYJSON_FALSE; return MYJSON_PARSE_OK;
+                case 21: v->type = MYJSON_TRUE; return MYJSON_PARSE_OK;
+                case 22:
+                case 23: v->type = MYJSON_NULL; return MYJSON_PARSE_OK;
+                case 25: {
+                    unsigned exp = (unsigned)(n >> 10) & 0x1F, mant = (unsigned)n & 0x3FF;
+                    double d;
+                    if (exp == 31)
+                        return MYJSON_PARSE_INVALID_BINARY;
+                    d = exp == 0 ? mant / 16777216.0 : (mant + 1024) * (double)(1 << exp) / 33554432.0;
+                    myjson_set_number(v, (n & 0x8000) ? -d : d);
+                    return MYJSON_PARSE_OK;
+                }
+                case 26: return myjson_set_finite(v, myjson_get_float(n, 4));
+                case 27: return myjson_set_finite(v, myjson_get_float(n, 8));
+                default: return MYJSON_PARSE_INVALID_BINARY;
+            }
+    }
+}
+
+int myjson_decode_cbor(myjson_value *v, const char *data, size_t length) {
+    myjson_reader r;
+    myjson_buffer stack;
+    int ret;
+    assert(v != NULL && (data != NULL || length == 0));
+    myjson_init(v);
+    r.p = (const unsigned char *)data;
+    r.end = r.p + length;
+    stack.buf = NULL;
+    stack.size = stack.top = 0;
+    if ((ret = myjson_cbor_decode(&r, &stack, v, 0)) == MYJSON_PARSE_OK && r.p != r.end) {
+        myjson_free(v);
+        ret = MYJSON_PARSE_INVALID_BINARY;
+    }
+    assert(stack.top == 0);
+    MYJSON_FREE(stack.buf);
+    return ret;
+}
@@ -0,0 +1,408 @@
+#include "myjson.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Generates C structs with parse, stringify and free functions from a JSON schema:
+ *
+ *   myjson_gen schema.json out      writes out.h and out.c
+ *
+ * The schema maps struct names to objects of field names and types, in declaration order:
+ *
+ *   { "point": { "x": "number", "y": "number" },
+ *     "shape": { "id": "integer", "name": "string", "closed": "boolean", "origin": "point", "path": "[point]" } }
+ *
+ *   number    double
+ *   integer   long long
+ *   boolean   int
+ *   string    char *name, size_t name_len; NULL reads and writes as null
+ *   S         struct S by value, S declared before
+ *   [T]       T *name, size_t name_count; T is any of the above but string, S may be any struct
+ *
+ * The generated code reads straight from the text without building values. Missing fields are left
+ * zeroed and unknown ones are skipped without being validated.
+ */
+
+typedef enum { GEN_NUMBER, GEN_INTEGER, GEN_BOOLEAN, GEN_STRING, GEN_STRUCT } gen_kind;
+
+typedef struct {
+    const char *name;
+    gen_kind kind;
+    int array;
+    size_t type; /* struct index for GEN_STRUCT */
+} gen_field;
+
+typedef struct {
+    const char *name;
+    gen_field *fields;
+    size_t count;
+} gen_struct;
+
+static gen_struct *structs;
+static size_t nstructs;
+
+static const char *c_types[] = { "double", "long long", "int", "char *" };
+static const char *readers[] = { "myjson_read_number", "myjson_read_integer", "myjson_read_boolean" };
+
+static int is_identifier(const char *s) {
+    if (!isalpha((unsigned char)*s) && *s != '_')
+        return 0;
+    while (isalnum((unsigned char)*s) || *s == '_')
+        s++;
+    return *s == '\0';
+}
+
+static size_t find_struct(const char *name, size_t len) {
+    size_t i;
+    for (i = 0; i < nstructs; i++)
+        if (strlen(structs[i].name) == len && memcmp(structs[i].name, name, len) == 0)
+            return i;
+    return nstructs;
+}
+
+static int load_schema(const myjson_value *schema) {
+    size_t i, j, len;
+    const char *type;
+    if (myjson_get_type(schema) != MYJSON_OBJECT || myjson_get_object_size(schema) == 0) {
+        fprintf(stderr, "myjson_gen: the schema must be an object of structs\n");
+        return 0;
+    }
+    nstructs = myjson_get_object_size(schema);
+    structs = (gen_struct *)calloc(nstructs, sizeof(gen_struct));
+    for (i = 0; i < nstructs; i++) {
+        structs[i].name = myjson_get_object_key(schema, i);
+        if (!is_identifier(structs[i].name) || find_struct(structs[i].name, strlen(structs[i].name)) != i) {
+            fprintf(stderr, "myjson_gen: bad or repeated struct name '%s'\n", structs[i].name);
+            return 0;
+        }
+    }
+    for (i = 0; i < nstructs; i++) {
+        const myjson_value *fields = myjson_get_object_value_const(schema, i);
+        if (myjson_get_type(fields) != MYJSON_OBJECT) {
+            fprintf(stderr, "myjson_gen: struct '%s' must be an object of fields\n", structs[i].name);
+            return 0;
+        }
+        structs[i].count = myjson_get_object_size(fields);
+        structs[i].fields = (gen_field *)calloc(structs[i].count + 1, sizeof(gen_field));
+        for (j = 0; j < structs[i].count; j++) {
+            gen_field *f = &structs[i].fields[j];
+            const myjson_value *t = myjson_get_object_value_const(fields, j);
+            f->name = myjson_get_object_key(fields, j);
+            if (!is_identifier(f->name) || myjson_get_type(t) != MYJSON_STRING) {
+                fprintf(stderr, "myjson_gen: bad field '%s.%s'\n", structs[i].name, f->name);
+                return 0;
+            }
+            type = myjson_get_string(t);
+            len = myjson_get_string_length(t);
+            if (len > 2 && type[0] == '[' && type[len - 1] == ']') {
+                f->array = 1;
+                type++;
+                len -= 2;
+            }
+            if (len == 6 && memcmp(type, "number", 6) == 0)
+                f->kind = GEN_NUMBER;
+            else if (len == 7 && memcmp(type, "integer", 7) == 0)
+                f->kind = GEN_INTEGER;
+            else if (len == 7 && memcmp(type, "boolean", 7) == 0)
+                f->kind = GEN_BOOLEAN;
+            else if (len == 6 && memcmp(type, "string", 6) == 0 && !f->array)
+                f->kind = GEN_STRING;
+            else if ((f->type = find_struct(type, len)) < (f->array ? nstructs : i))
+                f->kind = GEN_STRUCT; /* by value only once complete */
+            else {
+                fprintf(stderr, "myjson_gen: unsupported type '%s' of '%s.%s'\n", myjson_get_string(t), structs[i].name, f->name);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static const char *element_type(const gen_field *f) {
+    return f->kind == GEN_STRUCT ? structs[f->type].name : c_types[f->kind];
+}
+
+static void write_header(FILE *out, const char *guard, const char *source) {
+    size_t i, j;
+    fprintf(out, "/* Generated by myjson_gen from %s, do not edit */\n", source);
+    fprintf(out, "#ifndef %s\n#define %s\n\n#include <stddef.h>\n\n", guard, guard);
+    for (i = 0; i < nstructs; i++)
+        fprintf(out, "typedef struct %s %s;\n", structs[i].name, structs[i].name);
+    for (i = 0; i < nstructs; i++) {
+        fprintf(out, "\nstruct %s {\n", structs[i].name);
+        for (j = 0; j < structs[i].count; j++) {
+            const gen_field *f = &structs[i].fields[j];
+            if (f->array)
+                fprintf(out, "    %s *%s;\n    size_t %s_count;\n", element_type(f), f->name, f->name);
+            else if (f->kind == GEN_STRING)
+                fprintf(out, "    char *%s;\n    size_t %s_len;\n", f->name, f->name);
+            else
+                fprintf(out, "    %s %s;\n", element_type(f), f->name);
+        }
+        if (structs[i].count == 0)
+            fprintf(out, "    char unused;\n");
+        fprintf(out, "};\n");
+    }
+    fprintf(out, "\n/* parse() returns a MYJSON_PARSE_* code and leaves v zeroed on failure. Strings, arrays and\n"
+        " * stringify() results come from the library's global allocator. */\n");
+    for (i = 0; i < nstructs; i++) {
+        const char *s = structs[i].name;
+        fprintf(out, "int %s_parse(%s *v, const char *json);\n", s, s);
+        fprintf(out, "char *%s_stringify(const %s *v, size_t *length);\n", s, s);
+        fprintf(out, "void %s_free(%s *v);\n", s, s);
+    }
+    fprintf(out, "\n#endif\n");
+}
+
+/* Releases what a field owns, then zeroes it if reset */
+static void write_free_field(FILE *out, const gen_field *f, const char *indent, int reset) {
+    if (f->kind == GEN_STRUCT && f->array)
+        fprintf(out, "%swhile (v->%s_count > 0)\n%s    %s_free(&v->%s[--v->%s_count]);\n",
+            indent, f->name, indent, structs[f->type].name, f->name, f->name);
+    else if (f->kind == GEN_STRUCT)
+        fprintf(out, "%s%s_free(&v->%s);\n", indent, structs[f->type].name, f->name);
+    if (f->array || f->kind == GEN_STRING) {
+        fprintf(out, "%smyjson_free_buffer(v->%s);\n", indent, f->name);
+        if (reset)
+            fprintf(out, "%sv->%s = NULL;\n%sv->%s_%s = 0;\n", indent, f->name, indent, f->name, f->array ? "count" : "len");
+    }
+}
+
+static void write_free(FILE *out, const gen_struct *s) {
+    size_t j;
+    fprintf(out, "void %s_free(%s *v) {\n", s->name, s->name);
+    for (j = 0; j < s->count; j++)
+        write_free_field(out, &s->fields[j], "    ", 0);
+    fprintf(out, "    memset(v, 0, sizeof(*v));\n}\n\n");
+}
+
+static void write_array_reader(FILE *out, const gen_struct *s, const gen_field *f) {
+    const char *t = element_type(f);
+    fprintf(out, "static int %s_read_%s(const char **json, %s *v, size_t depth) {\n", s->name, f->name, s->name);
+    fprintf(out, "    int ret;\n");
+    if (f->kind != GEN_STRUCT)
+        fprintf(out, "    (void)depth;\n");
+    fprintf(out, "    if (**json != '[')\n        return MYJSON_PARSE_INVALID_VALUE;\n");
+    fprintf(out, "    (*json)++;\n    myjson_read_whitespace(json);\n");
+    fprintf(out, "    if (**json == ']') {\n        (*json)++;\n        return MYJSON_PARSE_OK;\n    }\n");
+    fprintf(out, "    for (;;) {\n");
+    fprintf(out, "        v->%s = (%s *)myjson_gen_reserve(v->%s, v->%s_count, sizeof(%s));\n", f->name, t, f->name, f->name, t);
+    if (f->kind == GEN_STRUCT) {
+        fprintf(out, "        memset(&v->%s[v->%s_count], 0, sizeof(%s));\n", f->name, f->name, t);
+        fprintf(out, "        ret = %s_read(json, &v->%s[v->%s_count++], depth + 1);\n", t, f->name, f->name);
+    }
+    else
+        fprintf(out, "        ret = %s(json, &v->%s[v->%s_count++]);\n", readers[f->kind], f->name, f->name);
+    fprintf(out, "        if (ret != MYJSON_PARSE_OK)\n            return ret;\n");
+    fprintf(out, "        myjson_read_whitespace(json);\n");
+    fprintf(out, "        if (**json == ',') {\n            (*json)++;\n            myjson_read_whitespace(json);\n            continue;\n        }\n");
+    fprintf(out, "        if (**json == ']') {\n            (*json)++;\n            return MYJSON_PARSE_OK;\n        }\n");
+    fprintf(out, "        return MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;\n    }\n}\n\n");
+}
+
+static void write_reader(FILE *out, const gen_struct *s) {
+    size_t j, len, longest = 0;
+    for (j = 0; j < s->count; j++)
+        if ((len = strlen(s->fields[j].name)) > longest)
+            longest = len;
+    for (j = 0; j < s->count; j++)
+        if (s->fields[j].array)
+            write_array_reader(out, s, &s->fields[j]);
+    fprintf(out, "static int %s_read(const char **json, %s *v, size_t depth) {\n", s->name, s->name);
+    fprintf(out, "    char key[%zu];\n    size_t klen;\n    int ret;\n", longest + 1);
+    if (s->count == 0)
+        fprintf(out, "    (void)v;\n");
+    fprintf(out, "    if (depth >= MYJSON_GEN_MAX_DEPTH)\n        return MYJSON_PARSE_NESTING_TOO_DEEP;\n");
+    fprintf(out, "    if (**json != '{')\n        return MYJSON_PARSE_INVALID_VALUE;\n");
+    fprintf(out, "    (*json)++;\n    myjson_read_whitespace(json);\n");
+    fprintf(out, "    if (**json == '}') {\n        (*json)++;\n        return MYJSON_PARSE_OK;\n    }\n");
+    fprintf(out, "    for (;;) {\n");
+    fprintf(out, "        if ((ret = myjson_read_key(json, key, sizeof(key), &klen)) != MYJSON_PARSE_OK)\n            return ret;\n");
+    for (j = 0; j < s->count; j++) {
+        const gen_field *f = &s->fields[j];
+        len = strlen(f->name);
+        fprintf(out, "        %sif (klen == %zu && memcmp(key, \"%s\", %zu) == 0) {\n", j > 0 ? "else " : "", len, f->name, len);
+        write_free_field(out, f, "            ", 1); /* a repeated key replaces the value */
+        switch (f->array ? -1 : (int)f->kind) {
+            case -1:
+                fprintf(out, "            ret = %s_read_%s(json, v, depth);\n", s->name, f->name);
+                break;
+            case GEN_STRING:
+                fprintf(out, "            ret = **json == 'n' ? myjson_read_null(json) : myjson_read_string(json, &v->%s, &v->%s_len);\n", f->name, f->name);
+                break;
+            case GEN_STRUCT:
+                fprintf(out, "            ret = %s_read(json, &v->%s, depth + 1);\n", structs[f->type].name, f->name);
+                break;
+            default:
+                fprintf(out, "            ret = %s(json, &v->%s);\n", readers[f->kind], f->name);
+        }
+        fprintf(out, "        }\n");
+    }
+    fprintf(out, "        %sret = myjson_skip_value(json);\n", s->count > 0 ? "else\n            " : "");
+    fprintf(out, "        if (ret != MYJSON_PARSE_OK)\n            return ret;\n");
+    fprintf(out, "        myjson_read_whitespace(json);\n");
+    fprintf(out, "        if (**json == ',') {\n            (*json)++;\n            myjson_read_whitespace(json);\n            continue;\n        }\n");
+    fprintf(out, "        if (**json == '}') {\n            (*json)++;\n            return MYJSON_PARSE_OK;\n        }\n");
+    fprintf(out, "        return MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET;\n    }\n}\n\n");
+}
+
+static void write_scalar(FILE *out, const gen_field *f, const char *value, const char *indent) {
+    switch (f->kind) {
+        case GEN_NUMBER: fprintf(out, "%smyjson_write_number(w, %s);\n", indent, value); break;
+        case GEN_INTEGER: fprintf(out, "%smyjson_write_integer(w, %s);\n", indent, value); break;
+        case GEN_BOOLEAN: fprintf(out, "%sif (%s)\n%s    myjson_write(w, \"true\", 4);\n%selse\n%s    myjson_write(w, \"false\", 5);\n",
+            indent, value, indent, indent, indent); break;
+        case GEN_STRUCT: fprintf(out, "%s%s_write(w, &%s);\n", indent, structs[f->type].name, value); break;
+        default: break;
+    }
+}
+
+static void write_writer(FILE *out, const gen_struct *s) {
+    size_t j;
+    int arrays = 0;
+    for (j = 0; j < s->count; j++)
+        arrays |= s->fields[j].array;
+    fprintf(out, "static void %s_write(myjson_writer *w, const %s *v) {\n", s->name, s->name);
+    if (arrays)
+        fprintf(out, "    size_t i;\n");
+    if (s->count == 0) {
+        fprintf(out, "    (void)v;\n    myjson_write(w, \"{}\", 2);\n}\n\n");
+        return;
+    }
+    for (j = 0; j < s->count; j++) {
+        const gen_field *f = &s->fields[j];
+        char value[256];
+        /* the key with its quotes, colon and any leading brace or comma, as C and JSON text */
+        fprintf(out, "    myjson_write(w, \"%c\\\"%s\\\":\", %zu);\n", j == 0 ? '{' : ',', f->name, strlen(f->name) + 4);
+        if (f->array) {
+            fprintf(out, "    myjson_write(w, \"[\", 1);\n");
+            fprintf(out, "    for (i = 0; i < v->%s_count; i++) {\n", f->name);
+            fprintf(out, "        if (i > 0)\n            myjson_write(w, \",\", 1);\n");
+            snprintf(value, sizeof(value), "v->%s[i]", f->name);
+            write_scalar(out, f, value, "        ");
+            fprintf(out, "    }\n    myjson_write(w, \"]\", 1);\n");
+        }
+        else if (f->kind == GEN_STRING) {
+            fprintf(out, "    if (v->%s != NULL)\n        myjson_write_string(w, v->%s, v->%s_len);\n", f->name, f->name, f->name);
+            fprintf(out, "    else\n        myjson_write(w, \"null\", 4);\n");
+        }
+        else {
+            snprintf(value, sizeof(value), "v->%s", f->name);
+            write_scalar(out, f, value, "    ");
+        }
+    }
+    fprintf(out, "    myjson_write(w, \"}\", 1);\n}\n\n");
+}
+
+static void write_source(FILE *out, const char *header, const char *source) {
+    size_t i;
+    fprintf(out, "/* Generated by myjson_gen from %s, do not edit */\n", source);
+    fprintf(out, "#include \"%s\"\n#include \"myjson.h\"\n#include <string.h>\n\n", header);
+    fprintf(out, "#ifndef MYJSON_GEN_MAX_DEPTH\n#define MYJSON_GEN_MAX_DEPTH 1024\n#endif\n\n");
+    fprintf(out, "/* Makes room for item count, doubling from 4 */\n");
+    fprintf(out, "static void *myjson_gen_reserve(void *items, size_t count, size_t size) {\n");
+    fprintf(out, "    const myjson_allocator *a = myjson_get_allocator();\n");
+    fprintf(out, "    if (count == 0 || (count >= 4 && (count & (count - 1)) == 0))\n");
+    fprintf(out, "        items = a->realloc(a->ctx, items, (count == 0 ? 4 : count * 2) * size);\n");
+    fprintf(out, "    return items;\n}\n\n");
+    for (i = 0; i < nstructs; i++) {
+        fprintf(out, "static int %s_read(const char **json, %s *v, size_t depth);\n", structs[i].name, structs[i].name);
+        fprintf(out, "static void %s_write(myjson_writer *w, const %s *v);\n", structs[i].name, structs[i].name);
+    }
+    fprintf(out, "\n");
+    for (i = 0; i < nstructs; i++) {
+        const char *s = structs[i].name;
+        write_free(out, &structs[i]);
+        write_reader(out, &structs[i]);
+        write_writer(out, &structs[i]);
+        fprintf(out, "int %s_parse(%s *v, const char *json) {\n", s, s);
+        fprintf(out, "    int ret;\n    memset(v, 0, sizeof(*v));\n    myjson_read_whitespace(&json);\n");
+        fprintf(out, "    if ((ret = %s_read(&json, v, 0)) == MYJSON_PARSE_OK) {\n", s);
+        fprintf(out, "        myjson_read_whitespace(&json);\n");
+        fprintf(out, "        if (*json != '\\0')\n            ret = MYJSON_PARSE_ROOT_NOT_SINGULAR;\n    }\n");
+        fprintf(out, "    if (ret != MYJSON_PARSE_OK)\n        %s_free(v);\n    return ret;\n}\n\n", s);
+        fprintf(out, "char *%s_stringify(const %s *v, size_t *length) {\n", s, s);
+        fprintf(out, "    myjson_writer w = { NULL, 0, 0 };\n    %s_write(&w, v);\n", s);
+        fprintf(out, "    return myjson_write_finish(&w, length);\n}\n\n");
+    }
+}
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    char *buf;
+    long len;
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        if (f != NULL)
+            fclose(f);
+        return NULL;
+    }
+    buf = (char *)malloc(len + 1);
+    if (fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+    }
+    else
+        buf[len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char *argv[]) {
+    myjson_value schema;
+    char *json, *path, *guard, *base;
+    FILE *out;
+    size_t i, len;
+    int ret;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s schema.json out\n", argv[0]);
+        return 1;
+    }
+    if ((json = read_file(argv[1])) == NULL) {
+        fprintf(stderr, "myjson_gen: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    myjson_init(&schema);
+    if ((ret = myjson_parse(&schema, json)) != MYJSON_PARSE_OK) {
+        fprintf(stderr, "myjson_gen: %s is not valid JSON (error %d)\n", argv[1], ret);
+        return 1;
+    }
+    if (!load_schema(&schema))
+        return 1;
+
+    len = strlen(argv[2]);
+    path = (char *)malloc(len + 3);
+    guard = (char *)malloc(len + 5);
+    base = strrchr(argv[2], '/') != NULL ? strrchr(argv[2], '/') + 1 : argv[2];
+    for (i = 0; base[i] != '\0'; i++)
+        guard[i] = isalnum((unsigned char)base[i]) ? toupper((unsigned char)base[i]) : '_';
+    strcpy(guard + i, "_H__");
+
+    sprintf(path, "%s.h", argv[2]);
+    if ((out = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "myjson_gen: cannot write %s\n", path);
+        return 1;
+    }
+    write_header(out, guard, argv[1]);
+    fclose(out);
+
+    sprintf(path, "%s.c", argv[2]);
+    if ((out = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "myjson_gen: cannot write %s\n", path);
+        return 1;
+    }
+    sprintf(guard, "%s.h", base);
+    write_source(out, guard, argv[1]);
+    fclose(out);
+
+    free(path);
+    free(guard);
+    for (i = 0; i < nstructs; i++)
+        free(structs[i].fields);
+    free(structs);
+    myjson_free(&schema);
+    free(json);
+    return 0;
+}
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "myjson.h"
+#include "test_schema.h"
 
 
 static int main_ret = 0;
@@ -320,6 +323,974 @@ static void test_parse_miss_comma_or_square_bracket() {
     TEST_ERROR(MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[[]");
 }
 
+#define TEST_NESTING_DEPTH 100000
+
+/* Alternates arrays and objects down to a single number */
+static char *make_nested_json(size_t depth) {
+    char *json = (char *)malloc(depth * 6 + 2);
+    size_t i, len = 0;
+    for (i = 0; i < depth; i++)
+        len += sprintf(json + len, i % 2 ? "{\"k\":" : "[");
+    json[len++] = '1';
+    for (i = depth; i-- > 0; )
+        json[len++] = i % 2 ? '}' : ']';
+    json[len] = '\0';
+    return json;
+}
+
+static void parse_nested(myjson_value *v, size_t depth) {
+    myjson_parse_options options;
+    char *json = make_nested_json(depth);
+    memset(&options, 0, sizeof(options));
+    options.max_depth = depth;
+    myjson_init(v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(v, json, &options));
+    free(json);
+}
+
+/* What parse_deep saw, checked on the main thread so that only it touches the test counters */
+typedef struct {
+    const char *json;
+    int ret_default, ret_deep, ret_again, ret_shallow, ret_views, ret_patch;
+    myjson_type type_default, type_shallow;
+    size_t length, patch_size;
+    int same_text, same_hash, equal, parallel, tape, copy, diff, merge, frozen;
+} deep_result;
+
+/* Runs on a thread with a small stack, far too small to recurse once per level */
+static void *parse_deep(void *arg) {
+    deep_result *r = (deep_result *)arg;
+    myjson_parse_options options;
+    myjson_value v1, v2, v3, patch, *e;
+    myjson_tape t;
+    myjson_frozen f;
+    char *json2;
+    size_t i, length;
+
+    options.flags = 0;
+    options.max_depth = TEST_NESTING_DEPTH;
+    options.allocator = NULL;
+    options.max_input = options.max_bytes = options.max_string = options.max_members = 0;
+    options.stats = NULL;
+    options.paths = NULL;
+    options.npaths = 0;
+    myjson_init(&v1);
+    myjson_init(&v2);
+    myjson_init(&v3);
+    myjson_init(&patch);
+    r->ret_default = myjson_parse(&v1, r->json);
+    r->type_default = myjson_get_type(&v1);
+    r->ret_deep = myjson_parse_ex(&v1, r->json, &options);
+    r->ret_again = myjson_parse_ex(&v2, r->json, &options);
+    json2 = myjson_stringify(&v1, &r->length);
+    r->same_text = r->length == strlen(r->json) && memcmp(r->json, json2, r->length) == 0;
+    r->same_hash = myjson_hash(&v1) == myjson_hash(&v2);
+    r->equal = myjson_is_equal(&v1, &v2);
+    free(json2);
+
+    json2 = myjson_stringify_parallel(&v1, &length, 4);
+    r->parallel = length == strlen(r->json) && memcmp(r->json, json2, length) == 0;
+    free(json2);
+
+    myjson_tape_from_value(&t, &v1);
+    myjson_tape_to_value(&t, 0, &v3);
+    r->tape = myjson_is_equal(&v1, &v3);
+    myjson_tape_free(&t);
+    myjson_free(&v3);
+
+    options.flags = MYJSON_OPT_VIEWS;
+    r->ret_views = myjson_parse_ex(&v3, r->json, &options);
+    options.flags = 0;
+    myjson_copy(&v2, &v3);
+    myjson_free(&v3);
+    r->copy = myjson_is_equal(&v1, &v2);
+
+    /* change the innermost number, far below where diff gives up and replaces */
+    for (e = &v2, i = 0; i < TEST_NESTING_DEPTH; i++)
+        e = i % 2 ? myjson_get_object_value(e, 0) : myjson_get_array_element(e, 0);
+    myjson_set_number(e, 2);
+    myjson_diff(&patch, &v1, &v2);
+    r->patch_size = myjson_get_array_size(&patch);
+    myjson_copy(&v3, &v1);
+    r->ret_patch = myjson_apply_patch(&v3, &patch);
+    r->diff = myjson_is_equal(&v2, &v3);
+    myjson_free(&patch);
+    myjson_free(&v3);
+
+    /* a merge patch only descends through objects */
+    for (e = &patch, i = 0; i < TEST_NESTING_DEPTH; i++) {
+        myjson_set_object(e, 1);
+        e = myjson_set_object_value(e, "k", 1);
+    }
+    myjson_set_number(e, 1);
+    myjson_set_object(&v3, 0);
+    myjson_merge_patch(&v3, &patch);
+    r->merge = myjson_is_equal(&patch, &v3);
+    myjson_free(&patch);
+    myjson_free(&v3);
+
+    json2 = myjson_freeze(&v1, &length);
+    r->frozen = myjson_frozen_open(&f, json2, length) == MYJSON_PARSE_OK;
+    if (r->frozen) {
+        myjson_frozen_to_value(&f, myjson_frozen_root(&f), &v3);
+        r->frozen = myjson_is_equal(&v1, &v3);
+    }
+    free(json2);
+    myjson_free(&v1);
+    myjson_free(&v2);
+    myjson_free(&v3);
+    options.max_depth = TEST_NESTING_DEPTH - 1;
+    r->ret_shallow = myjson_parse_ex(&v1, r->json, &options);
+    r->type_shallow = myjson_get_type(&v1);
+    return NULL;
+}
+
+static void test_parse_nesting() {
+    myjson_parse_options options;
+    myjson_value v;
+    pthread_attr_t attr;
+    pthread_t tid;
+    deep_result r;
+    char *json;
+    int ret;
+
+    options.flags = 0;
+    options.max_depth = 2;
+    options.allocator = NULL;
+    options.max_input = options.max_bytes = options.max_string = options.max_members = 0;
+    options.stats = NULL;
+    options.paths = NULL;
+    options.npaths = 0;
+    myjson_init(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "[{\"a\":1},[]]", &options));
+    myjson_free(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, myjson_parse_ex(&v, "[{\"a\":[]}]", &options));
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, myjson_parse_ex(&v, "{\"a\":[1,2,{}]}", &options));
+
+    r.json = json = make_nested_json(TEST_NESTING_DEPTH);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    ret = pthread_create(&tid, &attr, parse_deep, &r);
+    EXPECT_EQ_INT(0, ret);
+    if (ret == 0) {
+        pthread_join(tid, NULL);
+        EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, r.ret_default);
+        EXPECT_EQ_INT(MYJSON_NULL, r.type_default);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, r.ret_deep);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, r.ret_again);
+        EXPECT_EQ_SIZE_T(strlen(json), r.length);
+        EXPECT_TRUE(r.same_text);
+        EXPECT_TRUE(r.same_hash);
+        EXPECT_TRUE(r.equal);
+        EXPECT_TRUE(r.parallel);
+        EXPECT_TRUE(r.tape);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, r.ret_views);
+        EXPECT_TRUE(r.copy);
+        EXPECT_EQ_SIZE_T(1, r.patch_size);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, r.ret_patch);
+        EXPECT_TRUE(r.diff);
+        EXPECT_TRUE(r.merge);
+        EXPECT_TRUE(r.frozen);
+        EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, r.ret_shallow);
+        EXPECT_EQ_INT(MYJSON_NULL, r.type_shallow);
+    }
+    pthread_attr_destroy(&attr);
+    free(json);
+}
+
+#define TEST_PARALLEL_ERROR(json)\
+    do {\
+        myjson_value v1, v2;\
+        myjson_init(&v1);\
+        myjson_init(&v2);\
+        EXPECT_EQ_INT(myjson_parse(&v1, json), myjson_parse_parallel(&v2, json, 4));\
+        EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v2));\
+        myjson_free(&v1);\
+        myjson_free(&v2);\
+    } while(0)
+
+static char *make_parallel_json(size_t n, const char *tail) {
+    static const char *items[] = {
+        "null", "true", "false", "-1.5e3", "\"a,b]c\"", "\"\\\"[{\\\\\"",
+        "[1,[2,[3]],{}]", "{\"k\":\"v,\",\"a\":[true,{\"x\":[]}]}", " 42 ", "\"\\u00A2\""
+    };
+    size_t i, len = 0, cap = n * 48 + strlen(tail) + 8;
+    char *json = (char *)malloc(cap);
+    json[len++] = '[';
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            json[len++] = ',';
+        len += sprintf(json + len, "%s", items[i % (sizeof(items) / sizeof(items[0]))]);
+    }
+    len += sprintf(json + len, "%s", tail);
+    return json;
+}
+
+#define TEST_LIMIT(error, field, limit, json)\
+    do {\
+        myjson_parse_options options;\
+        myjson_value v;\
+        memset(&options, 0, sizeof(options));\
+        options.field = limit;\
+        myjson_init(&v);\
+        EXPECT_EQ_INT(error, myjson_parse_ex(&v, json, &options));\
+        myjson_free(&v);\
+    } while(0)
+
+static void test_parse_limits() {
+    char *json;
+    size_t i;
+
+    TEST_LIMIT(MYJSON_PARSE_OK, max_input, 7, "[1,2,3]");
+    TEST_LIMIT(MYJSON_PARSE_INPUT_TOO_LARGE, max_input, 6, "[1,2,3]");
+    TEST_LIMIT(MYJSON_PARSE_OK, max_string, 3, "[\"abc\",{\"def\":\"\\u00e9\"}]");
+    TEST_LIMIT(MYJSON_PARSE_STRING_TOO_LONG, max_string, 3, "[\"abc\",\"abcd\"]");
+    TEST_LIMIT(MYJSON_PARSE_STRING_TOO_LONG, max_string, 3, "{\"abcd\":1}");
+    TEST_LIMIT(MYJSON_PARSE_STRING_TOO_LONG, max_string, 3, "\"\\n\\n\\n\\n\"");
+    TEST_LIMIT(MYJSON_PARSE_STRING_TOO_LONG, max_string, 3, "\"ab\\u00e9\"");
+    TEST_LIMIT(MYJSON_PARSE_OK, max_members, 2, "{\"a\":{\"b\":1,\"c\":2},\"d\":[1,2,3]}");
+    TEST_LIMIT(MYJSON_PARSE_TOO_MANY_MEMBERS, max_members, 2, "{\"a\":{\"b\":1,\"c\":2,\"d\":3}}");
+    TEST_LIMIT(MYJSON_PARSE_TOO_MANY_MEMBERS, max_members, 2, "[{\"a\":1,\"b\":[],\"c\":\"x\"}]");
+    TEST_LIMIT(MYJSON_PARSE_OK, max_bytes, 4096, "{\"a\":[1,2,3],\"b\":\"c\"}");
+    TEST_LIMIT(MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED, max_bytes, 64, "[[1],[2],[3],[4],[5],[6],[7],[8]]");
+
+    /* an escape storm is cut off once the budget is spent, not after decoding it all */
+    json = (char *)malloc(2 * 100000 + 3);
+    json[0] = '"';
+    for (i = 0; i < 100000; i++)
+        memcpy(json + 1 + 2 * i, "\\t", 2);
+    strcpy(json + 1 + 2 * i, "\"");
+    TEST_LIMIT(MYJSON_PARSE_OK, max_bytes, 200000, json);
+    TEST_LIMIT(MYJSON_PARSE_MEMORY_LIMIT_EXCEEDED, max_bytes, 50000, json);
+    free(json);
+}
+
+#define TEST_PROJECTION(expect, json, ...)\
+    do {\
+        const char *paths[] = { __VA_ARGS__ };\
+        myjson_parse_options options;\
+        myjson_value v;\
+        char *out;\
+        size_t len;\
+        memset(&options, 0, sizeof(options));\
+        options.paths = paths;\
+        options.npaths = sizeof(paths) / sizeof(paths[0]);\
+        myjson_init(&v);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, json, &options));\
+        out = myjson_stringify(&v, &len);\
+        EXPECT_EQ_STRING(expect, out, len);\
+        free(out);\
+        myjson_free(&v);\
+    } while(0)
+
+#define TEST_PROJECTION_ERROR(error, json, ...)\
+    do {\
+        const char *paths[] = { __VA_ARGS__ };\
+        myjson_parse_options options;\
+        myjson_value v;\
+        memset(&options, 0, sizeof(options));\
+        options.paths = paths;\
+        options.npaths = sizeof(paths) / sizeof(paths[0]);\
+        myjson_init(&v);\
+        EXPECT_EQ_INT(error, myjson_parse_ex(&v, json, &options));\
+        EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v));\
+    } while(0)
+
+static void test_parse_projection() {
+    const char *event = "{\"user\":{\"id\":7,\"name\":\"ann\",\"tags\":[\"a\",{\"b\":\"}\"}]},\"ts\":1.5,"
+        "\"items\":[{\"sku\":\"x\",\"price\":2},{\"price\":3.5,\"qty\":[1,2]},4,{\"sku\":\"y\"}],\"extra\":[[[\"]\\\"\"]]]}";
+    TEST_PROJECTION("{\"user\":{\"id\":7}}", event, "user.id");
+    TEST_PROJECTION("{\"user\":{\"id\":7},\"ts\":1.5}", event, "ts", "user.id");
+    TEST_PROJECTION("{\"items\":[{\"price\":2},{\"price\":3.5},null,{}]}", event, "items[*].price");
+    TEST_PROJECTION("{\"user\":{\"id\":7,\"name\":\"ann\",\"tags\":[\"a\",{\"b\":\"}\"}]}}", event, "user", "user.id");
+    TEST_PROJECTION("{\"user\":{\"tags\":[null,{\"b\":\"}\"}]},\"items\":[{\"sku\":\"x\"},{\"qty\":[1,2]},null,{\"sku\":\"y\"}]}",
+        event, "items[*].sku", "user.tags[*].b", "items[*].qty");
+    TEST_PROJECTION("{\"user\":{}}", event, "missing", "user.id.deeper", "ts[*]");
+    TEST_PROJECTION("[[1,2],[3],null]", "[[1,2],[3],{\"a\":1}] ", "[*][*]");
+    TEST_PROJECTION("[{\"a\":1}]", "[{\"a\":1,\"b\":2}]", "[*].a");
+    TEST_PROJECTION("null", "[1,2]", "a");
+    TEST_PROJECTION("{\"a\":{\"b\":2}}", "{\"a.b\":1,\"a\":{\"b\":2}}", "a.b");
+
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_INVALID_PROJECTION, event, "user..id");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_INVALID_PROJECTION, event, "items[0]");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_INVALID_PROJECTION, event, "user.");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_MISS_COLON, "{\"a\" 1}", "a");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{\"b\":1 \"c\":2}}", "a.b");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_INVALID_VALUE, "{\"a\":{\"b\":tru}}", "a.b");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_EXPECT_VALUE, "{\"skipped\":[1,2", "a");
+    TEST_PROJECTION_ERROR(MYJSON_PARSE_ROOT_NOT_SINGULAR, "{\"a\":1} 2", "a");
+}
+
+/* Records every distinct thread that allocates, to see how many workers a parse ran on */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t seen[16];
+    size_t n;
+} thread_recorder;
+
+static void record_thread(thread_recorder *r) {
+    size_t i;
+    pthread_mutex_lock(&r->lock);
+    for (i = 0; i < r->n && !pthread_equal(r->seen[i], pthread_self()); i++)
+        ;
+    if (i == r->n && r->n < sizeof(r->seen) / sizeof(r->seen[0]))
+        r->seen[r->n++] = pthread_self();
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void *recording_malloc(void *ctx, size_t size) {
+    record_thread((thread_recorder *)ctx);
+    return malloc(size);
+}
+
+static void *recording_realloc(void *ctx, void *p, size_t size) {
+    record_thread((thread_recorder *)ctx);
+    return realloc(p, size);
+}
+
+static void recording_free(void *ctx, void *p) {
+    (void)ctx;
+    free(p);
+}
+
+static size_t parallel_workers(const char *json, size_t threads) {
+    thread_recorder r;
+    myjson_allocator a = { recording_malloc, recording_realloc, recording_free, &r };
+    myjson_value v;
+    pthread_mutex_init(&r.lock, NULL);
+    r.n = 0;
+    myjson_set_allocator(&a);
+    myjson_init(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_parallel(&v, json, threads));
+    myjson_free(&v);
+    myjson_set_allocator(NULL);
+    pthread_mutex_destroy(&r.lock);
+    return r.n;
+}
+
+static void test_parse_parallel() {
+    myjson_value v1, v2;
+    char *json, *s1, *s2;
+    size_t l1, l2, threads;
+
+    /* 5000 elements give every worker more than the minimum, so each of them allocates */
+    json = make_parallel_json(5000, "]");
+    EXPECT_EQ_SIZE_T(4, parallel_workers(json, 4));
+    EXPECT_EQ_SIZE_T(1, parallel_workers(json, 1));
+    free(json);
+    json = make_parallel_json(100, "]");
+    EXPECT_EQ_SIZE_T(1, parallel_workers(json, 4));
+    free(json);
+
+    json = make_parallel_json(5000, "] ");
+    myjson_init(&v1);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));
+    for (threads = 0; threads <= 8; threads += 4) {
+        myjson_init(&v2);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_parallel(&v2, json, threads));
+        EXPECT_EQ_INT(MYJSON_ARRAY, myjson_get_type(&v2));
+        EXPECT_EQ_SIZE_T(5000, myjson_get_array_size(&v2));
+        EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+        s1 = myjson_stringify(&v1, &l1);
+        s2 = myjson_stringify(&v2, &l2);
+        EXPECT_EQ_SIZE_T(l1, l2);
+        EXPECT_TRUE(memcmp(s1, s2, l1) == 0);
+        free(s1);
+        free(s2);
+        myjson_free(&v2);
+    }
+    myjson_free(&v1);
+    free(json);
+
+    json = make_parallel_json(5000, ",]");
+    TEST_PARALLEL_ERROR(json);
+    free(json);
+    json = make_parallel_json(5000, " 1]");
+    TEST_PARALLEL_ERROR(json);
+    free(json);
+    json = make_parallel_json(5000, ",[1}]");
+    TEST_PARALLEL_ERROR(json);
+    free(json);
+    json = make_parallel_json(5000, "] x");
+    TEST_PARALLEL_ERROR(json);
+    free(json);
+    json = make_parallel_json(5000, ",\"\\v\"]");
+    TEST_PARALLEL_ERROR(json);
+    free(json);
+    json = make_parallel_json(5000, ",\"abc");
+    TEST_PARALLEL_ERROR(json);
+    free(json);
+
+    TEST_PARALLEL_ERROR("[1");
+    TEST_PARALLEL_ERROR("[1 2]");
+    TEST_PARALLEL_ERROR("[");
+    TEST_PARALLEL_ERROR("");
+
+    myjson_init(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_parallel(&v2, "[]", 0));
+    EXPECT_EQ_INT(MYJSON_ARRAY, myjson_get_type(&v2));
+    EXPECT_EQ_SIZE_T(0, myjson_get_array_size(&v2));
+    myjson_free(&v2);
+    myjson_init(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_parallel(&v2, " [ ] ", 4));
+    EXPECT_EQ_INT(MYJSON_ARRAY, myjson_get_type(&v2));
+    EXPECT_EQ_SIZE_T(0, myjson_get_array_size(&v2));
+    EXPECT_EQ_SIZE_T(0, myjson_get_array_capacity(&v2));
+    myjson_free(&v2);
+    myjson_init(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_parallel(&v2, "[\n\t\r ]", 4));
+    EXPECT_EQ_SIZE_T(0, myjson_get_array_size(&v2));
+    myjson_free(&v2);
+    TEST_PARALLEL_ERROR("[ ]x");
+    TEST_PARALLEL_ERROR("[ ,]");
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_parallel(&v2, "{\"a\":[1,2]}", 4));
+    EXPECT_EQ_INT(MYJSON_OBJECT, myjson_get_type(&v2));
+    myjson_free(&v2);
+}
+
+static void test_stringify_parallel() {
+    myjson_value v;
+    char *json, *s1, *s2;
+    size_t l1, l2, threads;
+    static const char *docs[] = {
+        "null", "\"abc\"", "[]", "{}", "[1,2,3]",
+        "{\"rows\":[],\"n\":1}"
+    };
+
+    json = make_parallel_json(5000, "]");
+    myjson_init(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, json));
+    s1 = myjson_stringify(&v, &l1);
+    for (threads = 0; threads <= 8; threads += 4) {
+        s2 = myjson_stringify_parallel(&v, &l2, threads);
+        EXPECT_EQ_SIZE_T(l1, l2);
+        EXPECT_TRUE(memcmp(s1, s2, l1 + 1) == 0);
+        free(s2);
+    }
+    free(s1);
+
+    myjson_free(&v);
+
+    /* a large array wrapped in a small object is still split */
+    s2 = (char *)malloc(strlen(json) + 16);
+    sprintf(s2, "{\"rows\":%s}", json);
+    free(json);
+    json = s2;
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, json));
+    s1 = myjson_stringify(&v, &l1);
+    s2 = myjson_stringify_parallel(&v, &l2, 4);
+    EXPECT_EQ_SIZE_T(l1, l2);
+    EXPECT_TRUE(memcmp(s1, s2, l1 + 1) == 0);
+    free(s1);
+    free(s2);
+    myjson_free(&v);
+    free(json);
+
+    for (l1 = 0; l1 < sizeof(docs) / sizeof(docs[0]); l1++) {
+        myjson_init(&v);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, docs[l1]));
+        s2 = myjson_stringify_parallel(&v, &l2, 4);
+        EXPECT_EQ_SIZE_T(strlen(docs[l1]), l2);
+        EXPECT_TRUE(memcmp(docs[l1], s2, l2) == 0);
+        free(s2);
+        myjson_free(&v);
+    }
+}
+
+static void write_temp_file(char *path, const char *data, size_t len) {
+    FILE *fp;
+    strcpy(path, "/tmp/myjson_testXXXXXX");
+    close(mkstemp(path));
+    fp = fopen(path, "wb");
+    fwrite(data, 1, len, fp);
+    fclose(fp);
+}
+
+static void test_parse_file() {
+    myjson_value v1, v2;
+    myjson_mapping *m;
+    char path[32], *json;
+    size_t len;
+
+    json = make_parallel_json(2000, "]");
+    write_temp_file(path, json, strlen(json));
+    myjson_init(&v1);
+    myjson_init(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_file(&v2, path, 0, NULL));
+    EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+    myjson_free(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_file(&v2, path, MYJSON_OPT_VIEWS, &m));
+    EXPECT_TRUE(m != NULL);
+    EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+    myjson_free(&v2);
+    myjson_unmap(m);
+    myjson_free(&v1);
+    remove(path);
+    free(json);
+
+    /* a file filling whole pages still gets a terminator */
+    len = 4096;
+    json = (char *)malloc(len);
+    memset(json, ' ', len);
+    memcpy(json, "\"Hello\\nWorld\"", 14);
+    memcpy(json + len - 7, "\"tail\"", 6);
+    write_temp_file(path, json, len);
+    EXPECT_EQ_INT(MYJSON_PARSE_ROOT_NOT_SINGULAR, myjson_parse_file(&v1, path, MYJSON_OPT_VIEWS, &m));
+    EXPECT_TRUE(m == NULL);
+    remove(path);
+    memset(json + len - 7, ' ', 6);
+    write_temp_file(path, json, len);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_file(&v1, path, MYJSON_OPT_VIEWS, &m));
+    EXPECT_EQ_STRING("Hello\nWorld", myjson_get_string(&v1), myjson_get_string_length(&v1));
+    myjson_free(&v1);
+    myjson_unmap(m);
+    remove(path);
+    free(json);
+
+    json = "{\"key\":[\"view\",\"esc\\taped\"]}";
+    write_temp_file(path, json, strlen(json));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_file(&v1, path, MYJSON_OPT_VIEWS, &m));
+    EXPECT_EQ_STRING("view", myjson_get_string(myjson_get_array_element(myjson_get_object_value(&v1, 0), 0)), 4);
+    myjson_init(&v2);
+    myjson_copy(&v2, myjson_get_object_value(&v1, 0));
+    myjson_free(&v1);
+    myjson_unmap(m);
+    EXPECT_EQ_STRING("esc\taped", myjson_get_string(myjson_get_array_element(&v2, 1)), myjson_get_string_length(myjson_get_array_element(&v2, 1)));
+    EXPECT_EQ_STRING("view", myjson_get_string(myjson_get_array_element(&v2, 0)), myjson_get_string_length(myjson_get_array_element(&v2, 0)));
+    myjson_free(&v2);
+    remove(path);
+
+    /* the other parse flags apply to files too */
+    json = "{\"b\":[1.50,1e2],\"a\":\"\xc3\xa9\xff\"}";
+    write_temp_file(path, json, strlen(json));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UTF8, myjson_parse_file(&v1, path, MYJSON_OPT_VALIDATE_UTF8, NULL));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UTF8, myjson_parse_file(&v1, path, MYJSON_OPT_VIEWS | MYJSON_OPT_VALIDATE_UTF8, &m));
+    EXPECT_TRUE(m == NULL);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_file(&v1, path, MYJSON_OPT_VIEWS | MYJSON_OPT_RAW_NUMBERS | MYJSON_OPT_SORT_KEYS, &m));
+    EXPECT_EQ_STRING("a", myjson_get_object_key(&v1, 0), myjson_get_object_key_length(&v1, 0));
+    json = myjson_stringify(&v1, &len);
+    EXPECT_EQ_STRING("{\"a\":\"\xc3\xa9\xff\",\"b\":[1.50,1e2]}", json, len);
+    myjson_free_buffer(json);
+    myjson_free(&v1);
+    myjson_unmap(m);
+    remove(path);
+
+    write_temp_file(path, "", 0);
+    EXPECT_EQ_INT(MYJSON_PARSE_EXPECT_VALUE, myjson_parse_file(&v1, path, 0, NULL));
+    remove(path);
+    EXPECT_EQ_INT(MYJSON_PARSE_FILE_ERROR, myjson_parse_file(&v1, path, 0, NULL));
+}
+
+#define TEST_BINARY_ROUNDTRIP(json, flags)\
+    do {\
+        myjson_value v1, v2;\
+        char *bin;\
+        size_t length;\
+        myjson_init(&v1);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));\
+        bin = myjson_dump_binary(&v1, &length, flags);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_load_binary(&v2, bin, length));\
+        EXPECT_TRUE(myjson_is_equal(&v1, &v2));\
+        myjson_free(&v1);\
+        myjson_free(&v2);\
+        free(bin);\
+    } while(0)
+
+static void test_binary() {
+    static const char *docs[] = {
+        "null", "false", "true", "0", "-0", "1.5", "1.7976931348623157e+308", "4.9406564584124654e-324",
+        "\"\"", "\"Hello\\u0000World\"", "[]", "{}", "[null,false,true,123,\"abc\",[1,2,3]]",
+        "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}",
+        "[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"},{\"name\":\"c\",\"id\":3,\"\":{}}]"
+    };
+    myjson_value v, v2;
+    char *bin, *json;
+    size_t i, length, plain;
+
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        TEST_BINARY_ROUNDTRIP(docs[i], 0);
+        TEST_BINARY_ROUNDTRIP(docs[i], MYJSON_OPT_KEY_DICTIONARY);
+    }
+
+    json = make_parallel_json(1000, "]");
+    TEST_BINARY_ROUNDTRIP(json, 0);
+    TEST_BINARY_ROUNDTRIP(json, MYJSON_OPT_KEY_DICTIONARY);
+    free(json);
+
+    /* repeated keys are stored once with a dictionary */
+    myjson_init(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, docs[14]));
+    free(myjson_dump_binary(&v, &plain, 0));
+    bin = myjson_dump_binary(&v, &length, MYJSON_OPT_KEY_DICTIONARY);
+    EXPECT_TRUE(length < plain);
+
+    /* every truncation is rejected */
+    for (i = 0; i < length; i++) {
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_load_binary(&v2, bin, i));
+        EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v2));
+    }
+    free(bin);
+    myjson_free(&v);
+
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_load_binary(&v, "MYJC\1\0\0", 7));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_load_binary(&v, "MYJB\1\0\7", 7));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_load_binary(&v, "MYJB\1\0\0\0", 8));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_load_binary(&v, "MYJB\1\0\5\xff\xff\xff\xff\x0f", 12));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_load_binary(&v, "MYJB\1\2\1\1a\6\1\1\0", 13));
+
+    /* any depth dumps; loading stops at the parser's default limit */
+    parse_nested(&v, TEST_NESTING_DEPTH);
+    bin = myjson_dump_binary(&v, &length, MYJSON_OPT_KEY_DICTIONARY);
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, myjson_load_binary(&v2, bin, length));
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v2));
+    free(bin);
+    myjson_free(&v);
+    parse_nested(&v, 1024);
+    bin = myjson_dump_binary(&v, &length, 0);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_load_binary(&v2, bin, length));
+    EXPECT_TRUE(myjson_is_equal(&v, &v2));
+    free(bin);
+    myjson_free(&v);
+    myjson_free(&v2);
+
+    /* a hostile snapshot of one-element arrays nested a million deep */
+    length = 6 + 2 * 1000000 + 1;
+    bin = (char *)malloc(length);
+    memcpy(bin, "MYJB\1\0", 6);
+    for (i = 6; i < length - 1; i += 2) {
+        bin[i] = MYJSON_ARRAY;
+        bin[i + 1] = 1;
+    }
+    bin[length - 1] = MYJSON_NULL;
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, myjson_load_binary(&v2, bin, length));
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v2));
+    free(bin);
+}
+
+#define TEST_FROZEN_ROUNDTRIP(json)\
+    do {\
+        myjson_value v1, v2;\
+        myjson_frozen f;\
+        char *bin;\
+        size_t length;\
+        myjson_init(&v1);\
+        myjson_init(&v2);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));\
+        bin = myjson_freeze(&v1, &length);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_frozen_open(&f, bin, length));\
+        myjson_frozen_to_value(&f, myjson_frozen_root(&f), &v2);\
+        EXPECT_TRUE(myjson_is_equal(&v1, &v2));\
+        myjson_free(&v1);\
+        myjson_free(&v2);\
+        free(bin);\
+    } while(0)
+
+static void test_frozen() {
+    static const char *docs[] = {
+        "null", "false", "true", "0", "-0", "1.5", "\"\"", "\"Hello\\u0000World\"", "[]", "{}",
+        "[null,false,true,123,\"abc\",[1,2,3]]",
+        "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}",
+        "[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"},{\"name\":\"c\",\"id\":3,\"\":{}}]"
+    };
+    myjson_value v;
+    myjson_frozen f, g;
+    myjson_mapping *m;
+    char path[32], *json, *bin;
+    unsigned long long *moved, word, bad;
+    size_t i, j, length, root, ref, a, o;
+    int ret;
+
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++)
+        TEST_FROZEN_ROUNDTRIP(docs[i]);
+    json = make_parallel_json(1000, "]");
+    TEST_FROZEN_ROUNDTRIP(json);
+    free(json);
+
+    myjson_init(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, "{\"b\":[1,\"two\",false],\"a\":{\"k\":null},\"ab\":1,\"a\":2,\"\":true}"));
+    bin = myjson_freeze(&v, &length);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_frozen_open(&f, bin, length));
+    root = myjson_frozen_root(&f);
+    EXPECT_EQ_INT(MYJSON_OBJECT, myjson_frozen_get_type(&f, root));
+    EXPECT_EQ_SIZE_T(5, myjson_frozen_get_size(&f, root));
+    /* members keep document order, lookups go by key order with the first duplicate winning */
+    EXPECT_EQ_STRING("b", myjson_frozen_get_object_key(&f, root, 0), myjson_frozen_get_object_key_length(&f, root, 0));
+    EXPECT_EQ_STRING("ab", myjson_frozen_get_object_key(&f, root, 2), myjson_frozen_get_object_key_length(&f, root, 2));
+    EXPECT_EQ_SIZE_T(myjson_frozen_get_object_value(&f, root, 1), myjson_frozen_find_object_value(&f, root, "a", 1));
+    EXPECT_EQ_SIZE_T(myjson_frozen_get_object_value(&f, root, 4), myjson_frozen_find_object_value(&f, root, "", 0));
+    EXPECT_EQ_SIZE_T(MYJSON_KEY_NOT_EXIST, myjson_frozen_find_object_value(&f, root, "c", 1));
+    EXPECT_EQ_SIZE_T(MYJSON_KEY_NOT_EXIST, myjson_frozen_find_object_value(&f, root, "aa", 2));
+    a = myjson_frozen_find_object_value(&f, root, "b", 1);
+    EXPECT_EQ_INT(MYJSON_ARRAY, myjson_frozen_get_type(&f, a));
+    EXPECT_EQ_SIZE_T(3, myjson_frozen_get_size(&f, a));
+    EXPECT_EQ_DOUBLE(1.0, myjson_frozen_get_number(&f, myjson_frozen_get_array_element(&f, a, 0)));
+    ref = myjson_frozen_get_array_element(&f, a, 1);
+    EXPECT_EQ_STRING("two", myjson_frozen_get_string(&f, ref), myjson_frozen_get_string_length(&f, ref));
+    EXPECT_FALSE(myjson_frozen_get_boolean(&f, myjson_frozen_get_array_element(&f, a, 2)));
+    o = myjson_frozen_find_object_value(&f, root, "a", 1);
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_frozen_get_type(&f, myjson_frozen_find_object_value(&f, o, "k", 1)));
+    EXPECT_TRUE(myjson_frozen_get_boolean(&f, myjson_frozen_find_object_value(&f, root, "", 0)));
+
+    /* the block holds no pointers, so a copy anywhere else reads the same */
+    moved = (unsigned long long *)malloc(length + 8);
+    memcpy(moved + 1, bin, length);
+    free(bin);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_frozen_open(&g, moved + 1, length));
+    ref = myjson_frozen_get_array_element(&g, myjson_frozen_find_object_value(&g, myjson_frozen_root(&g), "b", 1), 1);
+    EXPECT_EQ_STRING("two", myjson_frozen_get_string(&g, ref), myjson_frozen_get_string_length(&g, ref));
+
+    /* and so does a mapped file */
+    write_temp_file(path, (const char *)(moved + 1), length);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_frozen_map(&g, path, &m));
+    EXPECT_TRUE(m != NULL);
+    EXPECT_EQ_INT(MYJSON_NUMBER, myjson_frozen_get_type(&g, myjson_frozen_find_object_value(&g, myjson_frozen_root(&g), "ab", 2)));
+    myjson_unmap(m);
+    remove(path);
+    EXPECT_EQ_INT(MYJSON_PARSE_FILE_ERROR, myjson_frozen_map(&g, path, &m));
+
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_frozen_open(&g, moved + 1, length - 8));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_frozen_open(&g, moved + 1, 16));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_frozen_open(&g, (char *)(moved + 1) + 1, length - 1));
+    ((char *)(moved + 1))[0] = 'X';
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_frozen_open(&g, moved + 1, length));
+    EXPECT_TRUE(g.data == NULL);
+    free(moved);
+
+    /* a truncated or corrupted block is refused, or else reads back without going out of bounds */
+    bin = myjson_freeze(&v, &length);
+    for (i = 32; i < length; i += 8) {
+        word = i;
+        memcpy(bin + 16, &word, 8);
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_frozen_open(&g, bin, i));
+    }
+    word = length;
+    memcpy(bin + 16, &word, 8);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_frozen_open(&f, bin, length));
+    root = myjson_frozen_root(&f);
+    a = myjson_frozen_find_object_value(&f, root, "b", 1);
+    for (i = 24; i < length; i += 8) {
+        memcpy(&word, bin + i, 8);
+        for (j = 0; j < 5; j++) {
+            bad = j == 0 ? ~0ULL : j == 1 ? 0 : j == 2 ? word + 8 : j == 3 ? word - 8 : word ^ (1ULL << 58);
+            memcpy(bin + i, &bad, 8);
+            if ((ret = myjson_frozen_open(&g, bin, length)) == MYJSON_PARSE_OK) {
+                myjson_value w;
+                myjson_init(&w);
+                myjson_frozen_to_value(&g, myjson_frozen_root(&g), &w);
+                myjson_free(&w);
+            }
+            else
+                EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, ret);
+        }
+        memcpy(bin + i, &word, 8);
+    }
+    /* an element that refers back to the root would loop forever */
+    memcpy(&word, bin + root, 8);
+    word = ((unsigned long long)MYJSON_OBJECT << 56) | (word & 0x00FFFFFFFFFFFFFFULL);
+    memcpy(bin + myjson_frozen_get_array_element(&f, a, 0), &word, 8);
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, myjson_frozen_open(&g, bin, length));
+    EXPECT_TRUE(g.data == NULL);
+    free(bin);
+    myjson_free(&v);
+}
+
+#define TEST_CODEC_ROUNDTRIP(json, encode, decode)\
+    do {\
+        myjson_value v1, v2;\
+        char *bin;\
+        size_t length;\
+        myjson_init(&v1);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));\
+        bin = encode(&v1, &length);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, decode(&v2, bin, length));\
+        EXPECT_TRUE(myjson_is_equal(&v1, &v2));\
+        myjson_free(&v1);\
+        myjson_free(&v2);\
+        free(bin);\
+    } while(0)
+
+#define TEST_CODEC_BYTES(json, encode, expect)\
+    do {\
+        myjson_value v;\
+        char *bin;\
+        size_t length;\
+        myjson_init(&v);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, json));\
+        bin = encode(&v, &length);\
+        EXPECT_EQ_SIZE_T(sizeof(expect) - 1, length);\
+        EXPECT_TRUE(memcmp(expect, bin, length) == 0);\
+        myjson_free(&v);\
+        free(bin);\
+    } while(0)
+
+#define TEST_CODEC_DECODE(bytes, decode, json)\
+    do {\
+        myjson_value v1, v2;\
+        myjson_init(&v1);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, decode(&v2, bytes, sizeof(bytes) - 1));\
+        EXPECT_TRUE(myjson_is_equal(&v1, &v2));\
+        myjson_free(&v1);\
+        myjson_free(&v2);\
+    } while(0)
+
+#define TEST_CODEC_ERROR(bytes, decode)\
+    do {\
+        myjson_value v;\
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_BINARY, decode(&v, bytes, sizeof(bytes) - 1));\
+        EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v));\
+    } while(0)
+
+/* prefix repeated count times, then a null; decoding must stop at the depth limit */
+#define TEST_CODEC_DEEP(prefix, null, decode)\
+    do {\
+        myjson_value v;\
+        size_t count = 5000000 / (sizeof(prefix) - 1), k, len = 0;\
+        char *bin = (char *)malloc(5000000 + 1);\
+        for (k = 0; k < count; k++, len += sizeof(prefix) - 1)\
+            memcpy(bin + len, prefix, sizeof(prefix) - 1);\
+        bin[len++] = null;\
+        EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, decode(&v, bin, len));\
+        EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v));\
+        free(bin);\
+    } while(0)
+
+static void test_msgpack_cbor() {
+    static const char *docs[] = {
+        "null", "false", "true", "0", "-0", "1", "-1", "127", "128", "-32", "-33", "255", "256", "-128", "-129",
+        "65535", "65536", "-32768", "-32769", "4294967295", "4294967296", "-2147483648", "-2147483649",
+        "9007199254740993", "-9223372036854775808", "18446744073709549568", "1e300", "-1e300",
+        "1.5", "0.1", "3.1416", "1.7976931348623157e+308", "4.9406564584124654e-324",
+        "\"\"", "\"Hello\\u0000World\"", "\"0123456789012345678901234567890123456789\"",
+        "[]", "{}", "[null,false,true,123,\"abc\",[1,2,3]]", "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17]",
+        "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}"
+    };
+    myjson_value v, v2;
+    char *json, *bin;
+    size_t i, length;
+
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        TEST_CODEC_ROUNDTRIP(docs[i], myjson_encode_msgpack, myjson_decode_msgpack);
+        TEST_CODEC_ROUNDTRIP(docs[i], myjson_encode_cbor, myjson_decode_cbor);
+    }
+    json = make_parallel_json(1000, "]");
+    TEST_CODEC_ROUNDTRIP(json, myjson_encode_msgpack, myjson_decode_msgpack);
+    TEST_CODEC_ROUNDTRIP(json, myjson_encode_cbor, myjson_decode_cbor);
+    free(json);
+
+    /* integers use the shortest integer encoding */
+    TEST_CODEC_BYTES("[1,-1,200,-200,1.5]", myjson_encode_msgpack, "\x95\x01\xff\xcc\xc8\xd1\xff\x38\xca\x3f\xc0\x00\x00");
+    TEST_CODEC_BYTES("{\"a\":[1,-1,500]}", myjson_encode_cbor, "\xa1\x61\x61\x83\x01\x20\x19\x01\xf4");
+    TEST_CODEC_BYTES("-9007199254740994", myjson_encode_cbor, "\x3b\x00\x20\x00\x00\x00\x00\x00\x01");
+    TEST_CODEC_BYTES("-1152921504606846976", myjson_encode_cbor, "\x3b\x0f\xff\xff\xff\xff\xff\xff\xff");
+    TEST_CODEC_BYTES("-9223372036854775808", myjson_encode_cbor, "\x3b\x7f\xff\xff\xff\xff\xff\xff\xff");
+
+    /* binary strings, wide integers and other encoders' choices decode too */
+    TEST_CODEC_DECODE("\x92\xc4\x02hi\xcf\x00\x00\x00\x01\x00\x00\x00\x00", myjson_decode_msgpack, "[\"hi\",4294967296]");
+    TEST_CODEC_DECODE("\x81\xc4\x01k\xd3\xff\xff\xff\xff\xff\xff\xff\xff", myjson_decode_msgpack, "{\"k\":-1}");
+    TEST_CODEC_DECODE("\x9f\x5f\x42hi\x41!\xff\xbf\x61k\xf9\x3e\x00\xff\xc1\x00\xf7\xff", myjson_decode_cbor, "[\"hi!\",{\"k\":1.5},0,null]");
+    TEST_CODEC_DECODE("\x7f\xff", myjson_decode_cbor, "\"\"");
+
+    TEST_CODEC_ERROR("", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\xc1", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\xd4\x01\x00", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\x92\x01", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\x81\x01\x01", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\xdd\xff\xff\xff\xff", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\xcb\x7f\xf0\x00\x00\x00\x00\x00\x00", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("\x01\x02", myjson_decode_msgpack);
+    TEST_CODEC_ERROR("", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\x9f\x01", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\xa1\x01\x01", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\x5f\x61\x61\xff", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\xff", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\x1c", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\xf9\x7c\x00", myjson_decode_cbor);
+    TEST_CODEC_ERROR("\x9b\xff\xff\xff\xff\xff\xff\xff\xff", myjson_decode_cbor);
+
+    /* any depth encodes; decoding stops at the parser's default limit */
+    json = make_nested_json(1024);
+    TEST_CODEC_ROUNDTRIP(json, myjson_encode_msgpack, myjson_decode_msgpack);
+    TEST_CODEC_ROUNDTRIP(json, myjson_encode_cbor, myjson_decode_cbor);
+    free(json);
+    parse_nested(&v, TEST_NESTING_DEPTH);
+    bin = myjson_encode_msgpack(&v, &length);
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, myjson_decode_msgpack(&v2, bin, length));
+    free(bin);
+    bin = myjson_encode_cbor(&v, &length);
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, myjson_decode_cbor(&v2, bin, length));
+    free(bin);
+    myjson_free(&v);
+
+    TEST_CODEC_DEEP("\x91", '\xc0', myjson_decode_msgpack);
+    TEST_CODEC_DEEP("\x81\xa1k", '\xc0', myjson_decode_msgpack);
+    TEST_CODEC_DEEP("\x81", '\xf6', myjson_decode_cbor);
+    TEST_CODEC_DEEP("\x9f", '\xf6', myjson_decode_cbor);
+    TEST_CODEC_DEEP("\xa1\x61k", '\xf6', myjson_decode_cbor);
+    TEST_CODEC_DEEP("\xc6", '\xf6', myjson_decode_cbor);
+}
+
+static void test_tape() {
+    static const char *docs[] = {
+        "null", "false", "true", "123", "\"Hello\\u0000World\"", "[]", "{}",
+        "[null,false,true,123,\"abc\",[1,2,3]]",
+        "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}",
+        "[{},[],{\"a\":[{}]},[[]],\"\\\"\"]"
+    };
+    myjson_value v1, v2;
+    myjson_tape tape;
+    char *json;
+    size_t i, length, index, count;
+
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        myjson_init(&v1);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, docs[i]));
+        myjson_tape_from_value(&tape, &v1);
+        json = myjson_tape_stringify(&tape, &length);
+        EXPECT_EQ_SIZE_T(strlen(docs[i]), length);
+        EXPECT_TRUE(memcmp(docs[i], json, length) == 0);
+        free(json);
+        myjson_init(&v2);
+        myjson_tape_to_value(&tape, 0, &v2);
+        EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+        myjson_tape_free(&tape);
+        myjson_free(&v1);
+        myjson_free(&v2);
+    }
+
+    myjson_init(&v1);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, docs[8]));
+    myjson_tape_from_value(&tape, &v1);
+    EXPECT_EQ_INT(MYJSON_OBJECT, myjson_tape_get_type(&tape, 0));
+    EXPECT_EQ_SIZE_T(7, myjson_tape_get_size(&tape, 0));
+    count = 0;
+    for (index = myjson_tape_first(&tape, 0); !myjson_tape_is_end(&tape, index); index = myjson_tape_next(&tape, index + 1)) {
+        EXPECT_EQ_SIZE_T(1, myjson_tape_get_string_length(&tape, index));
+        count++;
+    }
+    EXPECT_EQ_SIZE_T(7, count);
+    EXPECT_EQ_SIZE_T(MYJSON_KEY_NOT_EXIST, myjson_tape_find_object_value(&tape, 0, "x", 1));
+    index = myjson_tape_find_object_value(&tape, 0, "t", 1);
+    EXPECT_TRUE(myjson_tape_get_boolean(&tape, index));
+    index = myjson_tape_find_object_value(&tape, 0, "s", 1);
+    EXPECT_EQ_STRING("abc", myjson_tape_get_string(&tape, index), myjson_tape_get_string_length(&tape, index));
+    index = myjson_tape_find_object_value(&tape, 0, "a", 1);
+    EXPECT_EQ_INT(MYJSON_ARRAY, myjson_tape_get_type(&tape, index));
+    EXPECT_EQ_SIZE_T(3, myjson_tape_get_size(&tape, index));
+    for (i = 0, index = myjson_tape_first(&tape, index); !myjson_tape_is_end(&tape, index); index = myjson_tape_next(&tape, index))
+        EXPECT_EQ_DOUBLE((double)++i, myjson_tape_get_number(&tape, index));
+    index = myjson_tape_find_object_value(&tape, 0, "o", 1);
+    index = myjson_tape_find_object_value(&tape, index, "2", 1);
+    EXPECT_EQ_DOUBLE(2.0, myjson_tape_get_number(&tape, index));
+    myjson_init(&v2);
+    myjson_tape_to_value(&tape, myjson_tape_find_object_value(&tape, 0, "o", 1), &v2);
+    EXPECT_TRUE(myjson_is_equal(myjson_find_object_value(&v1, "o", 1), &v2));
+    myjson_free(&v2);
+    myjson_tape_free(&tape);
+    myjson_free(&v1);
+}
+
 static void test_access_null() {
     myjson_value v;
     myjson_init(&v);
@@ -444,6 +1415,7 @@ static void test_stringify() {
     test_stringify_string();
     test_stringify_array();
     test_stringify_object();    
+    test_stringify_parallel();
 }
 
 #define TEST_EQUAL(json1, json2, equalify)\
@@ -485,6 +1457,259 @@ static void test_equal() {
 
 }
 
+static void test_hash() {
+    myjson_value v1, v2;
+    char json1[1024], json2[1024];
+    size_t i, len1 = 0, len2 = 0;
+
+    myjson_init(&v1);
+    myjson_init(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, "{\"a\":[1,{\"x\":null}],\"b\":\"s\",\"c\":-0}"));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v2, "{\"c\":0,\"b\":\"s\",\"a\":[1,{\"x\":null}]}"));
+    EXPECT_EQ_SIZE_T(myjson_hash(&v1), myjson_hash(&v2));
+    EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+
+    /* the cached hash follows modifications */
+    myjson_set_number(myjson_get_array_element(myjson_find_object_value(&v2, "a", 1), 0), 2);
+    EXPECT_TRUE(myjson_hash(&v1) != myjson_hash(&v2));
+    EXPECT_FALSE(myjson_is_equal(&v1, &v2));
+    myjson_set_number(myjson_get_array_element(myjson_find_object_value(&v2, "a", 1), 0), 1);
+    EXPECT_EQ_SIZE_T(myjson_hash(&v1), myjson_hash(&v2));
+    myjson_pushback_array_element(myjson_find_object_value(&v2, "a", 1));
+    EXPECT_FALSE(myjson_is_equal(&v1, &v2));
+    myjson_copy(&v1, &v2);
+    EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+
+    myjson_free(&v1);
+    myjson_free(&v2);
+
+    /* arrays are ordered */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, "[1,2]"));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v2, "[2,1]"));
+    EXPECT_TRUE(myjson_hash(&v1) != myjson_hash(&v2));
+
+    myjson_free(&v1);
+    myjson_free(&v2);
+
+    /* large objects are matched through a hash table */
+    json1[len1++] = json2[len2++] = '{';
+    for (i = 0; i < 40; i++) {
+        len1 += sprintf(json1 + len1, "%s\"k%zu\":%zu", i > 0 ? "," : "", i, i);
+        len2 += sprintf(json2 + len2, "%s\"k%zu\":%zu", i > 0 ? "," : "", 39 - i, 39 - i);
+    }
+    strcpy(json1 + len1, "}");
+    strcpy(json2 + len2, "}");
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json1));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v2, json2));
+    EXPECT_TRUE(myjson_is_equal(&v1, &v2));
+    myjson_set_number(myjson_find_object_value(&v2, "k7", 2), 8);
+    EXPECT_FALSE(myjson_is_equal(&v1, &v2));
+    myjson_remove_object_value(&v2, myjson_find_object_index(&v2, "k7", 2));
+    myjson_set_number(myjson_set_object_value(&v2, "k77", 3), 7);
+    EXPECT_FALSE(myjson_is_equal(&v1, &v2));
+    myjson_free(&v1);
+    myjson_free(&v2);
+}
+
+#define TEST_PATCH(expect, json, patch)\
+    do {\
+        myjson_value v, p;\
+        char* json1;\
+        size_t length;\
+        myjson_init(&v);\
+        myjson_init(&p);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, json));\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&p, patch));\
+        EXPECT_EQ_INT(MYJSON_PATCH_OK, myjson_apply_patch(&v, &p));\
+        json1 = myjson_stringify(&v, &length);\
+        EXPECT_EQ_STRING(expect, json1, length);\
+        myjson_free(&v);\
+        myjson_free(&p);\
+        free(json1);\
+    } while(0)
+
+/* A failing patch must leave the document exactly as it was */
+#define TEST_PATCH_ERROR(error, json, patch)\
+    do {\
+        myjson_value v, p;\
+        char* json1;\
+        size_t length;\
+        myjson_init(&v);\
+        myjson_init(&p);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, json));\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&p, patch));\
+        EXPECT_EQ_INT(error, myjson_apply_patch(&v, &p));\
+        json1 = myjson_stringify(&v, &length);\
+        EXPECT_EQ_STRING(json, json1, length);\
+        myjson_free(&v);\
+        myjson_free(&p);\
+        free(json1);\
+    } while(0)
+
+static void test_patch() {
+    TEST_PATCH("{\"foo\":\"bar\",\"baz\":\"qux\"}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]");
+    TEST_PATCH("{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]");
+    TEST_PATCH("{\"foo\":[\"bar\",[\"abc\",\"def\"]]}", "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]");
+    TEST_PATCH("{\"foo\":\"bar\"}", "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]");
+    TEST_PATCH("{\"foo\":[\"bar\",\"baz\"]}", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]");
+    TEST_PATCH("{\"baz\":\"boo\",\"foo\":\"bar\"}", "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]");
+    TEST_PATCH("{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}",
+        "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+        "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]");
+    TEST_PATCH("{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]");
+    TEST_PATCH("{\"a\":[1,2],\"b\":[1,2]}", "{\"a\":[1,2]}", "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/b\"}]");
+    TEST_PATCH("{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}", "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+        "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]");
+    TEST_PATCH("{\"a/b\":1,\"m~n\":3}", "{\"a/b\":1,\"m~n\":2}", "[{\"op\":\"test\",\"path\":\"/a~1b\",\"value\":1},{\"op\":\"replace\",\"path\":\"/m~0n\",\"value\":3}]");
+    TEST_PATCH("[1]", "{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]");
+    TEST_PATCH("{\"a\":{\"b\":1}}", "{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a\"}]");
+    TEST_PATCH("{\"b\":[1,3],\"c\":2}", "{\"a\":[1,2,3]}",
+        "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/b\"},{\"op\":\"move\",\"from\":\"/b/1\",\"path\":\"/c\"}]");
+
+    TEST_PATCH_ERROR(MYJSON_PATCH_PATH_NOT_FOUND, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_PATH_NOT_FOUND, "{\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_PATH_NOT_FOUND, "[1,2]", "[{\"op\":\"add\",\"path\":\"/3\",\"value\":3}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_PATH_NOT_FOUND, "[1,2]", "[{\"op\":\"replace\",\"path\":\"/-\",\"value\":3}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_PATH_NOT_FOUND, "[1,2]", "[{\"op\":\"remove\",\"path\":\"/01\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_PATH_NOT_FOUND, "{\"a\":1}", "[{\"op\":\"add\",\"path\":\"/a/b\",\"value\":3}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_INVALID_POINTER, "{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"a\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_INVALID_POINTER, "{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"/a~2\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_INVALID_OPERATION, "{\"a\":1}", "{\"op\":\"remove\",\"path\":\"/a\"}");
+    TEST_PATCH_ERROR(MYJSON_PATCH_INVALID_OPERATION, "{\"a\":1}", "[{\"op\":\"delete\",\"path\":\"/a\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_INVALID_OPERATION, "{\"a\":1}", "[{\"op\":\"add\",\"path\":\"/b\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_INVALID_OPERATION, "{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/c\"}]");
+    TEST_PATCH_ERROR(MYJSON_PATCH_TEST_FAILED, "{\"a\":[1,2]}", "[{\"op\":\"test\",\"path\":\"/a\",\"value\":[2,1]}]");
+
+    /* every step before the failing one is rolled back */
+    TEST_PATCH_ERROR(MYJSON_PATCH_TEST_FAILED, "{\"a\":[1,2,3],\"b\":{\"c\":\"d\",\"e\":false},\"f\":null}",
+        "[{\"op\":\"add\",\"path\":\"/a/1\",\"value\":9},"
+        "{\"op\":\"remove\",\"path\":\"/b/c\"},"
+        "{\"op\":\"replace\",\"path\":\"/f\",\"value\":{\"x\":1}},"
+        "{\"op\":\"add\",\"path\":\"/f/y\",\"value\":2},"
+        "{\"op\":\"move\",\"from\":\"/a/0\",\"path\":\"/b/e\"},"
+        "{\"op\":\"copy\",\"from\":\"/b\",\"path\":\"/a/-\"},"
+        "{\"op\":\"remove\",\"path\":\"/a/0\"},"
+        "{\"op\":\"add\",\"path\":\"/z\",\"value\":[]},"
+        "{\"op\":\"remove\",\"path\":\"\"},"
+        "{\"op\":\"test\",\"path\":\"\",\"value\":{}}]");
+}
+
+#define TEST_MERGE_PATCH(expect, json, patch)\
+    do {\
+        myjson_value v, p;\
+        char* json1;\
+        size_t length;\
+        myjson_init(&v);\
+        myjson_init(&p);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, json));\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&p, patch));\
+        myjson_merge_patch(&v, &p);\
+        json1 = myjson_stringify(&v, &length);\
+        EXPECT_EQ_STRING(expect, json1, length);\
+        myjson_free(&v);\
+        myjson_free(&p);\
+        free(json1);\
+    } while(0)
+
+static void test_merge_patch() {
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":\"b\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":\"b\"}", "{\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{}", "{\"a\":\"b\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":[\"b\"]}");
+    TEST_MERGE_PATCH("{\"a\":{\"b\":\"d\"}}", "{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}");
+    TEST_MERGE_PATCH("{\"a\":[1]}", "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}");
+    TEST_MERGE_PATCH("[\"c\"]", "[\"a\",\"b\"]", "[\"c\"]");
+    TEST_MERGE_PATCH("null", "{\"a\":\"foo\"}", "null");
+    TEST_MERGE_PATCH("{\"e\":null,\"a\":1}", "{\"e\":null}", "{\"a\":1}");
+    TEST_MERGE_PATCH("{\"a\":\"foo\"}", "[1,2]", "{\"a\":\"foo\",\"b\":null}");
+    TEST_MERGE_PATCH("{\"a\":{\"bb\":{}}}", "{}", "{\"a\":{\"bb\":{\"ccc\":null}}}");
+}
+
+/* The patch must turn json1 into json2; when expect is not NULL it must also read exactly so */
+#define TEST_DIFF(json1, json2, expect)\
+    do {\
+        myjson_value a, b, p;\
+        char* patch;\
+        size_t length;\
+        myjson_init(&a);\
+        myjson_init(&b);\
+        myjson_init(&p);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&a, json1));\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&b, json2));\
+        myjson_diff(&p, &a, &b);\
+        patch = myjson_stringify(&p, &length);\
+        EXPECT_EQ_STRING(expect, patch, length);\
+        free(patch);\
+        EXPECT_EQ_INT(MYJSON_PATCH_OK, myjson_apply_patch(&a, &p));\
+        EXPECT_TRUE(myjson_is_equal(&a, &b));\
+        myjson_free(&a);\
+        myjson_free(&b);\
+        myjson_free(&p);\
+    } while(0)
+
+/* for patches whose exact operations do not matter, only that they turn json1 into json2 */
+#define TEST_DIFF_APPLY(json1, json2)\
+    do {\
+        myjson_value a, b, p;\
+        myjson_init(&a);\
+        myjson_init(&b);\
+        myjson_init(&p);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&a, json1));\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&b, json2));\
+        myjson_diff(&p, &a, &b);\
+        EXPECT_EQ_INT(MYJSON_PATCH_OK, myjson_apply_patch(&a, &p));\
+        EXPECT_TRUE(myjson_is_equal(&a, &b));\
+        myjson_free(&a);\
+        myjson_free(&b);\
+        myjson_free(&p);\
+    } while(0)
+
+static void test_diff() {
+    myjson_value a, b, p;
+    char *json, *patch;
+    size_t i, len;
+
+    TEST_DIFF("{\"a\":[1,2,3]}", "{\"a\":[1,2,3]}", "[]");
+    TEST_DIFF("1", "\"x\"", "[{\"op\":\"replace\",\"path\":\"\",\"value\":\"x\"}]");
+    TEST_DIFF("{\"a\":1,\"b\":2}", "{\"b\":2,\"c\":3}", "[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"add\",\"path\":\"/c\",\"value\":3}]");
+    TEST_DIFF("{\"a/b\":{\"m~n\":1}}", "{\"a/b\":{\"m~n\":2}}", "[{\"op\":\"replace\",\"path\":\"/a~1b/m~0n\",\"value\":2}]");
+    TEST_DIFF("[1,2,3,4,5]", "[1,2,9,3,4,5]", "[{\"op\":\"add\",\"path\":\"/2\",\"value\":9}]");
+    TEST_DIFF("[1,2,3,4,5]", "[1,2,4,5]", "[{\"op\":\"remove\",\"path\":\"/2\"}]");
+    TEST_DIFF("[1,{\"x\":[true]},3]", "[1,{\"x\":[false]},3]", "[{\"op\":\"replace\",\"path\":\"/1/x/0\",\"value\":false}]");
+    TEST_DIFF("[1,2,3,4]", "[4,1,2,3]", "[{\"op\":\"add\",\"path\":\"/0\",\"value\":4},{\"op\":\"remove\",\"path\":\"/4\"}]");
+    TEST_DIFF_APPLY("[\"a\",\"b\",\"c\",\"d\",\"e\"]", "[\"x\",\"b\",\"y\",\"z\",\"e\",\"f\"]");
+    TEST_DIFF_APPLY("[[1],[2],[3]]", "[[3],[2],[1],[0]]");
+    TEST_DIFF_APPLY("{\"a\":{\"b\":[1,2,{\"c\":null}]},\"d\":\"e\"}", "{\"d\":\"f\",\"a\":{\"b\":[2,{\"c\":0},1]},\"g\":[]}");
+    TEST_DIFF_APPLY("[]", "[1,2]");
+    TEST_DIFF_APPLY("[1,2]", "{}");
+
+    /* a copy shares every subtree but the one that was modified */
+    json = (char *)malloc(64 * 1000 + 2);
+    len = 0;
+    json[len++] = '[';
+    for (i = 0; i < 1000; i++)
+        len += sprintf(json + len, "%s{\"id\":%zu,\"tags\":[\"t%zu\"]}", i > 0 ? "," : "", i, i % 7);
+    strcpy(json + len, "]");
+    myjson_init(&a);
+    myjson_init(&b);
+    myjson_init(&p);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&a, json));
+    myjson_copy(&b, &a);
+    myjson_pushback_array_element(myjson_find_object_value(myjson_get_array_element(&b, 500), "tags", 4));
+    myjson_diff(&p, &a, &b);
+    patch = myjson_stringify(&p, &len);
+    EXPECT_EQ_STRING("[{\"op\":\"add\",\"path\":\"/500/tags/1\",\"value\":null}]", patch, len);
+    EXPECT_EQ_INT(MYJSON_PATCH_OK, myjson_apply_patch(&a, &p));
+    EXPECT_TRUE(myjson_is_equal(&a, &b));
+    free(patch);
+    free(json);
+    myjson_free(&a);
+    myjson_free(&b);
+    myjson_free(&p);
+}
+
 static void test_copy() {
     myjson_value v1, v2;
     myjson_init(&v1);
@@ -511,6 +1736,112 @@ static void test_move() {
     myjson_free(&v3);
 }
 
+static void *copy_and_read(void *arg) {
+    const myjson_value *shared = (const myjson_value *)arg;
+    char *expect = myjson_stringify(shared, NULL);
+    int i;
+    for (i = 0; i < 200; i++) {
+        myjson_value v;
+        char *json;
+        myjson_init(&v);
+        myjson_copy(&v, shared);
+        myjson_set_number(myjson_get_array_element(myjson_find_object_value(&v, "a", 1), 0), i);
+        myjson_free(&v);
+        myjson_init(&v);
+        myjson_copy(&v, shared);
+        json = myjson_stringify(&v, NULL);
+        if (strcmp(json, expect) != 0)
+            main_ret = 1;
+        free(json);
+        myjson_free(&v);
+    }
+    free(expect);
+    return NULL;
+}
+
+/* Only reads the shared value, through the accessors and functions that take it const */
+static void *read_shared(void *arg) {
+    const myjson_value *shared = (const myjson_value *)arg;
+    myjson_stringify_options so;
+    char *expect = myjson_stringify(shared, NULL);
+    size_t hash = myjson_hash(shared);
+    int i;
+    so.flags = MYJSON_OPT_STRINGIFY_CACHE;
+    so.allocator = NULL;
+    so.stats = NULL;
+    for (i = 0; i < 200; i++) {
+        const myjson_value *a = myjson_find_object_value_const(shared, "a", 1);
+        char *json;
+        if (myjson_get_number(myjson_get_array_element_const(a, 2)) != 3.0 ||
+            myjson_get_type(myjson_get_object_value_const(shared, 0)) != MYJSON_STRING)
+            main_ret = 1;
+        json = myjson_stringify_ex(shared, NULL, &so);
+        if (strcmp(json, expect) != 0 || myjson_hash(shared) != hash)
+            main_ret = 1;
+        free(json);
+    }
+    free(expect);
+    return NULL;
+}
+
+static void test_copy_on_write() {
+    static const char *json = "{\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"x\":[true]}}";
+    myjson_value v1, v2;
+    pthread_t threads[4];
+    char *s;
+    size_t i, len;
+
+    myjson_init(&v1);
+    myjson_init(&v2);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));
+    myjson_copy(&v2, &v1);
+    EXPECT_TRUE(v1.val.obj.m == v2.val.obj.m); /* O(1): the member block is shared */
+
+    /* reading keeps sharing, asking for a pointer to modify through does not */
+    EXPECT_TRUE(myjson_find_object_value_const(&v2, "a", 1) == myjson_find_object_value_const(&v1, "a", 1));
+    EXPECT_EQ_DOUBLE(2.0, myjson_get_number(myjson_get_array_element_const(myjson_get_object_value_const(&v2, 1), 1)));
+    EXPECT_TRUE(myjson_find_object_value_const(&v2, "z", 1) == NULL);
+    EXPECT_TRUE(v1.val.obj.m == v2.val.obj.m);
+    myjson_get_object_value(&v2, 1);
+    EXPECT_TRUE(v1.val.obj.m != v2.val.obj.m);
+
+    myjson_pushback_array_element(myjson_find_object_value(&v2, "a", 1));
+    myjson_set_boolean(myjson_get_array_element(myjson_find_object_value(myjson_find_object_value(&v2, "o", 1), "x", 1), 0), 0);
+    myjson_set_string(myjson_find_object_value(&v2, "s", 1), "xyz", 3);
+    myjson_remove_object_value(&v2, 0);
+    myjson_move(myjson_set_object_value(&v2, "n", 1), &v1);
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v1));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v1, json));
+
+    /* the original is untouched */
+    s = myjson_stringify(&v1, &len);
+    EXPECT_EQ_STRING("{\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"x\":[true]}}", s, len);
+    free(s);
+    s = myjson_stringify(&v2, &len);
+    EXPECT_EQ_STRING("{\"a\":[1,2,3,null],\"o\":{\"x\":[false]},\"n\":{\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"x\":[true]}}}", s, len);
+    free(s);
+    myjson_free(&v2);
+
+    /* copies made and mutated concurrently never disturb each other */
+    for (i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, copy_and_read, &v1);
+    for (i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+    EXPECT_EQ_INT(0, main_ret);
+
+    /* nor do readers of one value, filling in its cached hash and text */
+    for (i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, read_shared, &v1);
+    for (i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+    EXPECT_EQ_INT(0, main_ret);
+    myjson_copy(&v1, &v1);
+    s = myjson_stringify(&v1, &len);
+    EXPECT_EQ_STRING("{\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"x\":[true]}}", s, len);
+    free(s);
+    myjson_free(&v1);
+}
+
 static void test_swap() {
     myjson_value v1, v2;
     myjson_init(&v1);
@@ -599,8 +1930,88 @@ static void test_access_array() {
     myjson_free(&a);
 }
 
+#define EXPECT_ARRAY_NUMBERS(a, ...)\
+    do {\
+        static const double expect_[] = { __VA_ARGS__ };\
+        size_t k_;\
+        EXPECT_EQ_SIZE_T(sizeof(expect_) / sizeof(expect_[0]), myjson_get_array_size(a));\
+        for (k_ = 0; k_ < sizeof(expect_) / sizeof(expect_[0]) && k_ < myjson_get_array_size(a); k_++)\
+            EXPECT_EQ_DOUBLE(expect_[k_], myjson_get_number(myjson_get_array_element(a, k_)));\
+    } while(0)
+
+static void test_access_array_bulk() {
+    myjson_value a, b, c, fill, values[3];
+    myjson_value *pv;
+    size_t i;
+
+    myjson_init(&a);
+    myjson_init(&b);
+    myjson_init(&c);
+    myjson_init(&fill);
+    for (i = 0; i < 3; i++) {
+        myjson_init(&values[i]);
+        myjson_set_number(&values[i], i);
+    }
+
+    myjson_set_array(&a, 0);
+    myjson_append_array_elements(&a, values, 3);
+    myjson_append_array_elements(&a, values, 0);
+    EXPECT_ARRAY_NUMBERS(&a, 0, 1, 2);
+    EXPECT_EQ_SIZE_T(3, myjson_get_array_capacity(&a));
+
+    pv = myjson_insert_array_elements(&a, 1, 2);
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&pv[0]));
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&pv[1]));
+    myjson_set_number(&pv[0], 10);
+    myjson_set_number(&pv[1], 11);
+    EXPECT_ARRAY_NUMBERS(&a, 0, 10, 11, 1, 2);
+    myjson_insert_array_elements(&a, 5, 0);
+    EXPECT_ARRAY_NUMBERS(&a, 0, 10, 11, 1, 2);
+
+    myjson_set_number(&fill, 7);
+    myjson_resize_array(&a, 7, &fill);
+    EXPECT_ARRAY_NUMBERS(&a, 0, 10, 11, 1, 2, 7, 7);
+    myjson_resize_array(&a, 2, NULL);
+    EXPECT_ARRAY_NUMBERS(&a, 0, 10);
+    myjson_resize_array(&a, 3, NULL);
+    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(myjson_get_array_element(&a, 2)));
+    myjson_resize_array(&a, 2, NULL);
+
+    /* strings moved between arrays must keep exactly one owner */
+    myjson_set_array(&b, 0);
+    myjson_set_string(&fill, "moved", 5);
+    myjson_resize_array(&b, 3, &fill);
+    myjson_set_number(myjson_get_array_element(&b, 0), 1);
+    myjson_splice_array(&a, 1, &b, 1, 2);
+    EXPECT_EQ_SIZE_T(4, myjson_get_array_size(&a));
+    EXPECT_EQ_STRING("moved", myjson_get_string(myjson_get_array_element(&a, 1)), 5);
+    EXPECT_EQ_STRING("moved", myjson_get_string(myjson_get_array_element(&a, 2)), 5);
+    EXPECT_EQ_DOUBLE(10.0, myjson_get_number(myjson_get_array_element(&a, 3)));
+    EXPECT_ARRAY_NUMBERS(&b, 1);
+
+    /* a shared source or destination is detached first, the other owner is left alone */
+    myjson_copy(&c, &a);
+    myjson_splice_array(&b, 0, &a, 0, 3);
+    EXPECT_ARRAY_NUMBERS(&a, 10);
+    EXPECT_EQ_SIZE_T(4, myjson_get_array_size(&c));
+    EXPECT_EQ_SIZE_T(4, myjson_get_array_size(&b));
+    EXPECT_EQ_STRING("moved", myjson_get_string(myjson_get_array_element(&b, 2)), 5);
+    myjson_copy(&c, &b);
+    myjson_resize_array(&b, 1, NULL);
+    myjson_append_array_elements(&c, values, 3);
+    EXPECT_ARRAY_NUMBERS(&b, 0);
+    EXPECT_EQ_SIZE_T(7, myjson_get_array_size(&c));
+    EXPECT_EQ_STRING("moved", myjson_get_string(myjson_get_array_element(&c, 1)), 5);
+
+    myjson_free(&a);
+    myjson_free(&b);
+    myjson_free(&c);
+    myjson_free(&fill);
+    for (i = 0; i < 3; i++)
+        myjson_free(&values[i]);
+}
+
 static void test_access_object() {
-#if 0
     myjson_value o, v, *pv;
     size_t i, j, index;
 
@@ -669,7 +2080,6 @@ static void test_access_object() {
     EXPECT_EQ_SIZE_T(0, myjson_get_object_capacity(&o));
 
     myjson_free(&o);
-#endif
 }
 
 static void test_parse() {
@@ -694,15 +2104,867 @@ static void test_parse() {
     test_parse_miss_key();
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
+    test_parse_nesting();
+    test_parse_limits();
+    test_parse_projection();
+    test_parse_parallel();
+    test_parse_file();
 
     test_access_null();
     test_access_boolean();
     test_access_number();
     test_access_string();
     test_access_array();
+    test_access_array_bulk();
     test_access_object();
 }
 
+#define TEST_GEN_ERROR(error, json)\
+    do {\
+        test_request r;\
+        EXPECT_EQ_INT(error, test_request_parse(&r, json));\
+        EXPECT_TRUE(r.method == NULL && r.path == NULL && r.tree.children == NULL);\
+    } while(0)
+
+static void test_codegen() {
+    test_request r;
+    test_point pt;
+    test_empty e;
+    test_node n;
+    char *json, *out;
+    size_t i, len;
+
+    /* unknown members of every kind are skipped, duplicates replace */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_request_parse(&r,
+        " { \"id\" : 9007199254740993, \"extra\" : {\"a\":[1,{\"b\":\"]}\\\"\"}],\"c\":null}, \"method\":\"old\","
+        "\"method\":\"get\\u00e9\\n\", \"verbose\":true, \"origin\":{\"y\":-2.5,\"z\":[],\"x\":1e3},"
+        "\"path\":[{\"x\":1,\"y\":2},{},{\"x\":3}], \"weights\":[0.5,-1,2e-3,4,5], \"flags\":[false,true],"
+        "\"ids\":[-12,0,123456789012345678,1e2], \"more\":\"skipped\", \"\\u0074ree\":{\"name\":\"root\",\"children\":[{\"name\":null,\"children\":[]},{\"name\":\"leaf\"}]} } "));
+    EXPECT_TRUE(r.id == 9007199254740993LL);
+    EXPECT_EQ_STRING("get\xC3\xA9\n", r.method, r.method_len);
+    EXPECT_TRUE(r.verbose);
+    EXPECT_EQ_DOUBLE(1000.0, r.origin.x);
+    EXPECT_EQ_DOUBLE(-2.5, r.origin.y);
+    EXPECT_EQ_SIZE_T(3, r.path_count);
+    EXPECT_EQ_DOUBLE(2.0, r.path[0].y);
+    EXPECT_EQ_DOUBLE(0.0, r.path[1].x);
+    EXPECT_EQ_DOUBLE(3.0, r.path[2].x);
+    EXPECT_EQ_SIZE_T(5, r.weights_count);
+    EXPECT_EQ_DOUBLE(2e-3, r.weights[2]);
+    EXPECT_EQ_SIZE_T(2, r.flags_count);
+    EXPECT_TRUE(!r.flags[0] && r.flags[1]);
+    EXPECT_EQ_SIZE_T(4, r.ids_count);
+    EXPECT_TRUE(r.ids[0] == -12 && r.ids[2] == 123456789012345678LL && r.ids[3] == 100);
+    EXPECT_EQ_STRING("root", r.tree.name, r.tree.name_len);
+    EXPECT_EQ_SIZE_T(2, r.tree.children_count);
+    EXPECT_TRUE(r.tree.children[0].name == NULL);
+    EXPECT_EQ_STRING("leaf", r.tree.children[1].name, r.tree.children[1].name_len);
+    out = test_request_stringify(&r, &len);
+    EXPECT_EQ_STRING("{\"id\":9007199254740993,\"method\":\"get\xC3\xA9\\n\",\"verbose\":true,\"origin\":{\"x\":1000,\"y\":-2.5},"
+        "\"path\":[{\"x\":1,\"y\":2},{\"x\":0,\"y\":0},{\"x\":3,\"y\":0}],\"weights\":[0.5,-1,0.002,4,5],\"flags\":[false,true],"
+        "\"ids\":[-12,0,123456789012345678,100],\"tree\":{\"name\":\"root\",\"children\":[{\"name\":null,\"children\":[]},"
+        "{\"name\":\"leaf\",\"children\":[]}]}}", out, len);
+    test_request_free(&r);
+    /* and parses back to the same text */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_request_parse(&r, out));
+    json = test_request_stringify(&r, &i);
+    EXPECT_TRUE(i == len && memcmp(json, out, len) == 0);
+    test_request_free(&r);
+    free(json);
+    free(out);
+
+    /* every long long reads back exactly, however many digits it has */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_request_parse(&r, "{\"id\":1234567890123456789,\"ids\":[9223372036854775807,-9223372036854775808,-0,1.0e1]}"));
+    EXPECT_TRUE(r.id == 1234567890123456789LL);
+    EXPECT_EQ_SIZE_T(4, r.ids_count);
+    EXPECT_TRUE(r.ids[0] == 9223372036854775807LL && r.ids[1] == -9223372036854775807LL - 1 && r.ids[2] == 0 && r.ids[3] == 10);
+    test_request_free(&r);
+
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_empty_parse(&e, "{\"ignored\":[[[]]]}"));
+    out = test_empty_stringify(&e, &len);
+    EXPECT_EQ_STRING("{}", out, len);
+    test_empty_free(&e);
+    free(out);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_point_parse(&pt, "{}"));
+    EXPECT_EQ_DOUBLE(0.0, pt.x);
+
+    TEST_GEN_ERROR(MYJSON_PARSE_INVALID_VALUE, "[]");
+    TEST_GEN_ERROR(MYJSON_PARSE_INVALID_VALUE, "{\"id\":\"1\"}");
+    TEST_GEN_ERROR(MYJSON_PARSE_INVALID_VALUE, "{\"method\":1}");
+    TEST_GEN_ERROR(MYJSON_PARSE_INVALID_VALUE, "{\"method\":\"x\",\"path\":[1]}");
+    TEST_GEN_ERROR(MYJSON_PARSE_INVALID_VALUE, "{\"ids\":[1.5]}");
+    TEST_GEN_ERROR(MYJSON_PARSE_INVALID_VALUE, "{\"id\":-0.5}");
+    TEST_GEN_ERROR(MYJSON_PARSE_NUMBER_TOO_BIG, "{\"id\":9223372036854775808}");
+    TEST_GEN_ERROR(MYJSON_PARSE_NUMBER_TOO_BIG, "{\"id\":-9223372036854775809}");
+    TEST_GEN_ERROR(MYJSON_PARSE_NUMBER_TOO_BIG, "{\"ids\":[12345678901234567890123]}");
+    TEST_GEN_ERROR(MYJSON_PARSE_NUMBER_TOO_BIG, "{\"ids\":[1e19]}");
+    TEST_GEN_ERROR(MYJSON_PARSE_MISS_KEY, "{\"method\":\"x\",}");
+    TEST_GEN_ERROR(MYJSON_PARSE_MISS_COLON, "{\"id\" 1}");
+    TEST_GEN_ERROR(MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"method\":\"x\" \"id\":1}");
+    TEST_GEN_ERROR(MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "{\"tree\":{\"name\":\"a\",\"children\":[{}}}");
+    TEST_GEN_ERROR(MYJSON_PARSE_MISS_QUOTATION_MARK, "{\"extra\":\"abc");
+    TEST_GEN_ERROR(MYJSON_PARSE_EXPECT_VALUE, "{\"extra\":[1,2");
+    TEST_GEN_ERROR(MYJSON_PARSE_ROOT_NOT_SINGULAR, "{\"method\":\"x\"} x");
+
+    /* nesting through arrays of structs is bounded */
+    json = (char *)malloc(2000 * 15 + 1);
+    for (i = 0, len = 0; i < 2000; i++)
+        len += sprintf(json + len, "{\"children\":[");
+    for (i = 0; i < 2000; i++)
+        len += sprintf(json + len, "]}");
+    EXPECT_EQ_INT(MYJSON_PARSE_NESTING_TOO_DEEP, test_node_parse(&n, json));
+    EXPECT_TRUE(n.children == NULL);
+    free(json);
+}
+
+static void test_sorted_keys() {
+    myjson_parse_options po;
+    myjson_stringify_options so;
+    myjson_value a, b, p;
+    char *json, *out;
+    size_t i, len;
+
+    memset(&po, 0, sizeof(po));
+    memset(&so, 0, sizeof(so));
+    po.flags = MYJSON_OPT_SORT_KEYS;
+    so.flags = MYJSON_OPT_SORT_KEYS;
+    myjson_init(&a);
+    myjson_init(&b);
+    myjson_init(&p);
+
+    /* duplicates keep their order, so lookups still find the first */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&a, "{\"b\":1,\"ab\":3,\"a\":2,\"\":0,\"a\":4,\"c\":{\"y\":1,\"x\":2}}", &po));
+    EXPECT_TRUE(myjson_is_object_sorted(&a));
+    out = myjson_stringify(&a, &len);
+    EXPECT_EQ_STRING("{\"\":0,\"a\":2,\"a\":4,\"ab\":3,\"b\":1,\"c\":{\"x\":2,\"y\":1}}", out, len);
+    free(out);
+    EXPECT_EQ_SIZE_T(1, myjson_find_object_index(&a, "a", 1));
+    EXPECT_EQ_SIZE_T(0, myjson_find_object_index(&a, "", 0));
+    EXPECT_EQ_SIZE_T(MYJSON_KEY_NOT_EXIST, myjson_find_object_index(&a, "aa", 2));
+    EXPECT_EQ_SIZE_T(MYJSON_KEY_NOT_EXIST, myjson_find_object_index(&a, "d", 1));
+
+    /* and stay sorted through insertions and removals */
+    myjson_set_number(myjson_set_object_value(&a, "aa", 2), 5);
+    myjson_set_number(myjson_set_object_value(&a, "d", 1), 6);
+    myjson_remove_object_value(&a, myjson_find_object_index(&a, "b", 1));
+    EXPECT_TRUE(myjson_is_object_sorted(&a));
+    out = myjson_stringify(&a, &len);
+    EXPECT_EQ_STRING("{\"\":0,\"a\":2,\"a\":4,\"aa\":5,\"ab\":3,\"c\":{\"x\":2,\"y\":1},\"d\":6}", out, len);
+    free(out);
+    myjson_set_object(&a, 0);
+    EXPECT_FALSE(myjson_is_object_sorted(&a));
+
+    /* long enough to be merged after the insertion sorted runs */
+    json = (char *)malloc(16 * 100 + 2);
+    len = 0;
+    json[len++] = '{';
+    for (i = 0; i < 100; i++)
+        len += sprintf(json + len, "%s\"k%zu\":%zu", i > 0 ? "," : "", (i * 37) % 100, i);
+    strcpy(json + len, "}");
+    myjson_free(&a);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&a, json));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&b, json));
+    EXPECT_FALSE(myjson_is_object_sorted(&a));
+    myjson_sort_object_keys(&a);
+    EXPECT_TRUE(myjson_is_object_sorted(&a));
+    for (i = 1; i < 100; i++)
+        EXPECT_TRUE(strcmp(myjson_get_object_key(&a, i - 1), myjson_get_object_key(&a, i)) < 0);
+    for (i = 0; i < 100; i++) {
+        char key[8];
+        size_t klen = (size_t)sprintf(key, "k%zu", (i * 37) % 100);
+        EXPECT_EQ_INT(0, strcmp(key, myjson_get_object_key(&a, myjson_find_object_index(&a, key, klen))));
+        EXPECT_EQ_DOUBLE((double)i, myjson_get_number(myjson_find_object_value(&a, key, klen)));
+    }
+    EXPECT_TRUE(myjson_is_equal(&a, &b));
+    myjson_sort_object_keys(&b);
+    EXPECT_TRUE(myjson_is_equal(&a, &b));
+    myjson_set_number(myjson_find_object_value(&b, "k50", 3), -1);
+    EXPECT_FALSE(myjson_is_equal(&a, &b));
+    free(json);
+
+    /* canonical output does not depend on insertion order */
+    myjson_free(&a);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&a, "{\"z\":{\"y\":1,\"x\":2},\"a\":[{\"d\":1,\"c\":2}]}"));
+    out = myjson_stringify_ex(&a, &len, &so);
+    EXPECT_EQ_STRING("{\"a\":[{\"c\":2,\"d\":1}],\"z\":{\"x\":2,\"y\":1}}", out, len);
+    EXPECT_FALSE(myjson_is_object_sorted(&a));
+    free(out);
+    out = myjson_stringify(&a, &len);
+    EXPECT_EQ_STRING("{\"z\":{\"y\":1,\"x\":2},\"a\":[{\"d\":1,\"c\":2}]}", out, len);
+    free(out);
+
+    /* sorted objects compare and diff by merging */
+    myjson_free(&a);
+    myjson_free(&b);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&a, "{\"a\":1,\"b\":{\"x\":[1]},\"c\":3,\"e\":5}", &po));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&b, "{\"e\":5,\"d\":4,\"b\":{\"x\":[2]},\"a\":1}", &po));
+    EXPECT_FALSE(myjson_is_equal(&a, &b));
+    myjson_diff(&p, &a, &b);
+    out = myjson_stringify(&p, &len);
+    EXPECT_EQ_STRING("[{\"op\":\"replace\",\"path\":\"/b/x/0\",\"value\":2},{\"op\":\"remove\",\"path\":\"/c\"},{\"op\":\"add\",\"path\":\"/d\",\"value\":4}]", out, len);
+    free(out);
+    EXPECT_EQ_INT(MYJSON_PATCH_OK, myjson_apply_patch(&a, &p));
+    EXPECT_TRUE(myjson_is_object_sorted(&a));
+    EXPECT_TRUE(myjson_is_equal(&a, &b));
+    myjson_diff(&p, &a, &b);
+    out = myjson_stringify(&p, &len);
+    EXPECT_EQ_STRING("[]", out, len);
+    free(out);
+
+    myjson_free(&a);
+    myjson_free(&b);
+    myjson_free(&p);
+}
+
+#define TEST_RAW_NUMBER(expect, json, opt)\
+    do {\
+        myjson_parse_options o_;\
+        myjson_value v_;\
+        char *out_;\
+        size_t len_;\
+        memset(&o_, 0, sizeof(o_));\
+        o_.flags = MYJSON_OPT_RAW_NUMBERS | (opt);\
+        myjson_init(&v_);\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v_, json, &o_));\
+        EXPECT_EQ_INT(MYJSON_NUMBER, myjson_get_type(&v_));\
+        EXPECT_EQ_DOUBLE(expect, myjson_get_number(&v_));\
+        out_ = myjson_stringify(&v_, &len_);\
+        EXPECT_EQ_STRING(json, out_, len_);\
+        free(out_);\
+        myjson_free(&v_);\
+    } while(0)
+
+static void test_raw_numbers() {
+    myjson_parse_options po;
+    myjson_value a, b, c;
+    const char *text;
+    char *json, *out;
+    size_t len;
+
+    TEST_RAW_NUMBER(0.0, "0", 0);
+    TEST_RAW_NUMBER(0.0, "-0.0", 0);
+    TEST_RAW_NUMBER(1.0, "1.000", 0);
+    TEST_RAW_NUMBER(1.5, "1.5", MYJSON_OPT_VIEWS);
+    TEST_RAW_NUMBER(-1e10, "-1E+10", 0);
+    TEST_RAW_NUMBER(1.0000000000000002, "1.0000000000000002", MYJSON_OPT_VIEWS);
+    TEST_RAW_NUMBER(12345678901234567890.0, "12345678901234567890", 0);
+    TEST_RAW_NUMBER(1.7976931348623157e+308, "1.7976931348623157e+308", 0);
+
+    memset(&po, 0, sizeof(po));
+    po.flags = MYJSON_OPT_RAW_NUMBERS;
+    myjson_init(&a);
+    myjson_init(&b);
+    myjson_init(&c);
+    EXPECT_EQ_INT(MYJSON_PARSE_NUMBER_TOO_BIG, myjson_parse_ex(&a, "1e309", &po));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_VALUE, myjson_parse_ex(&a, "+1", &po));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_VALUE, myjson_parse_ex(&a, "1.", &po));
+    EXPECT_EQ_INT(MYJSON_PARSE_ROOT_NOT_SINGULAR, myjson_parse_ex(&a, "0x1", &po));
+
+    /* the text survives copies, including those of views, and compares by value */
+    json = "{\"a\":[1.10,2e0,-0],\"b\":100000000000000000001}";
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&a, json, &po));
+    out = myjson_stringify(&a, &len);
+    EXPECT_EQ_STRING("{\"a\":[1.10,2e0,-0],\"b\":100000000000000000001}", out, len);
+    free(out);
+    text = myjson_get_number_text(myjson_get_array_element(myjson_get_object_value(&a, 0), 0), &len);
+    EXPECT_EQ_STRING("1.10", text, len);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&b, "{\"a\":[1.1,2,0],\"b\":1e20}"));
+    EXPECT_TRUE(myjson_get_number_text(myjson_get_object_value(&b, 1), &len) == NULL);
+    EXPECT_TRUE(myjson_is_equal(&a, &b));
+    EXPECT_EQ_SIZE_T(myjson_hash(&b), myjson_hash(&a));
+    myjson_copy(&c, &a);
+    myjson_free(&a);
+    po.flags |= MYJSON_OPT_VIEWS;
+    json = (char *)malloc(64);
+    strcpy(json, "[3.140,[-7]]");
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&a, json, &po));
+    myjson_copy(myjson_pushback_array_element(myjson_get_object_value(&c, 0)), &a);
+    myjson_free(&a);
+    memset(json, ' ', 12);
+    free(json);
+    out = myjson_stringify(&c, &len);
+    EXPECT_EQ_STRING("{\"a\":[1.10,2e0,-0,[3.140,[-7]]],\"b\":100000000000000000001}", out, len);
+    free(out);
+
+    /* setting a number drops its text */
+    myjson_set_number(myjson_get_object_value(&c, 1), 5.0);
+    out = myjson_stringify(&c, &len);
+    EXPECT_EQ_STRING("{\"a\":[1.10,2e0,-0,[3.140,[-7]]],\"b\":5}", out, len);
+    free(out);
+
+    myjson_free(&b);
+    myjson_free(&c);
+}
+
+static void test_raw_fragments() {
+    static const char cached[] = "{\"items\":[1,2.50,\"\\u00e9\"],\"total\":3}";
+    myjson_frozen f;
+    myjson_tape t;
+    myjson_value v, parsed, e;
+    char *out, *bin;
+    size_t len, blen;
+    int i;
+
+    myjson_init(&v);
+    myjson_init(&parsed);
+    myjson_init(&e);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_set_raw(&e, cached, sizeof(cached) - 1, 1));
+    EXPECT_EQ_INT(MYJSON_RAW, myjson_get_type(&e));
+    EXPECT_EQ_SIZE_T(sizeof(cached) - 1, myjson_get_raw_length(&e));
+    EXPECT_TRUE(strcmp(cached, myjson_get_raw(&e)) == 0);
+
+    /* invalid text is rejected and the value kept */
+    EXPECT_EQ_INT(MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, myjson_set_raw(&e, "[1 2]", 5, 1));
+    EXPECT_EQ_INT(MYJSON_PARSE_ROOT_NOT_SINGULAR, myjson_set_raw(&e, "1 2", 3, 1));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_VALUE, myjson_set_raw(&e, "1\0", 2, 1));
+    EXPECT_EQ_INT(MYJSON_PARSE_EXPECT_VALUE, myjson_set_raw(&e, "", 0, 1));
+    EXPECT_EQ_INT(MYJSON_RAW, myjson_get_type(&e));
+    EXPECT_EQ_SIZE_T(sizeof(cached) - 1, myjson_get_raw_length(&e));
+
+    /* stringify writes the fragment as is, everything else sees its value */
+    myjson_set_object(&v, 0);
+    myjson_set_string(myjson_set_object_value(&v, "id", 2), "x", 1);
+    myjson_copy(myjson_set_object_value(&v, "body", 4), &e);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_set_raw(myjson_set_object_value(&v, "list", 4), " [ true ] ", 10, 0));
+    out = myjson_stringify(&v, &len);
+    EXPECT_EQ_STRING("{\"id\":\"x\",\"body\":{\"items\":[1,2.50,\"\\u00e9\"],\"total\":3},\"list\": [ true ] }", out, len);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&parsed, out));
+    free(out);
+    EXPECT_TRUE(myjson_is_equal(&v, &parsed));
+    EXPECT_TRUE(myjson_is_equal(&parsed, &v));
+    EXPECT_EQ_SIZE_T(myjson_hash(&parsed), myjson_hash(&v));
+    EXPECT_FALSE(myjson_is_equal(&e, myjson_get_object_value(&parsed, 0)));
+
+    bin = myjson_dump_binary(&v, &blen, MYJSON_OPT_KEY_DICTIONARY);
+    myjson_free(&e);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_load_binary(&e, bin, blen));
+    EXPECT_TRUE(myjson_is_equal(&parsed, &e));
+    free(bin);
+    for (i = 0; i < 2; i++) {
+        bin = i == 0 ? myjson_encode_msgpack(&v, &blen) : myjson_encode_cbor(&v, &blen);
+        myjson_free(&e);
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, i == 0 ? myjson_decode_msgpack(&e, bin, blen) : myjson_decode_cbor(&e, bin, blen));
+        EXPECT_TRUE(myjson_is_equal(&parsed, &e));
+        free(bin);
+    }
+    bin = myjson_freeze(&v, &blen);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_frozen_open(&f, bin, blen));
+    myjson_free(&e);
+    myjson_frozen_to_value(&f, myjson_frozen_root(&f), &e);
+    EXPECT_TRUE(myjson_is_equal(&parsed, &e));
+    free(bin);
+    myjson_tape_from_value(&t, &v);
+    out = myjson_tape_stringify(&t, &len);
+    EXPECT_EQ_STRING("{\"id\":\"x\",\"body\":{\"items\":[1,2.5,\"\xc3\xa9\"],\"total\":3},\"list\":[true]}", out, len);
+    free(out);
+    myjson_tape_free(&t);
+
+    /* a diff against the parsed document is empty */
+    myjson_diff(&e, &v, &parsed);
+    out = myjson_stringify(&e, &len);
+    EXPECT_EQ_STRING("[]", out, len);
+    free(out);
+
+    myjson_free(&v);
+    myjson_free(&parsed);
+    myjson_free(&e);
+}
+
+/* Stringifies v with so, which has the cache on, and without, expecting the same text */
+#define TEST_CACHED_STRINGIFY(v, so)\
+    do {\
+        char *cached_, *plain_;\
+        size_t clen_, plen_;\
+        cached_ = myjson_stringify_ex(v, &clen_, so);\
+        plain_ = myjson_stringify(v, &plen_);\
+        EXPECT_EQ_SIZE_T(plen_, clen_);\
+        EXPECT_TRUE(plen_ == clen_ && memcmp(plain_, cached_, clen_) == 0);\
+        free(cached_);\
+        free(plain_);\
+    } while(0)
+
+static void test_stringify_cache() {
+    myjson_stringify_options so;
+    myjson_value v, w;
+    myjson_value *e;
+    char *out;
+    size_t len;
+
+    memset(&so, 0, sizeof(so));
+    so.flags = MYJSON_OPT_STRINGIFY_CACHE;
+    myjson_init(&v);
+    myjson_init(&w);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, "{\"users\":[{\"name\":\"alice\",\"tags\":[\"admin\",\"ops\",\"dev\"],\"id\":1},"
+        "{\"name\":\"bob\",\"tags\":[\"dev\"],\"id\":2}],\"meta\":{\"version\":3,\"generated\":\"2024-01-01T00:00:00Z\",\"pad\":[]}}"));
+
+    TEST_CACHED_STRINGIFY(&v, &so);
+    TEST_CACHED_STRINGIFY(&v, &so);
+
+    /* modifications reach the cache through the containers on their path */
+    myjson_set_number(myjson_find_object_value(myjson_get_array_element(myjson_find_object_value(&v, "users", 5), 1), "id", 2), 20);
+    TEST_CACHED_STRINGIFY(&v, &so);
+    myjson_set_string(myjson_pushback_array_element(myjson_find_object_value(myjson_get_array_element(myjson_find_object_value(&v, "users", 5), 0), "tags", 4)), "new", 3);
+    TEST_CACHED_STRINGIFY(&v, &so);
+    myjson_remove_object_value(myjson_find_object_value(&v, "meta", 4), 1);
+    TEST_CACHED_STRINGIFY(&v, &so);
+    myjson_erase_array_element(myjson_find_object_value(&v, "users", 5), 0, 1);
+    TEST_CACHED_STRINGIFY(&v, &so);
+    myjson_sort_object_keys(myjson_get_array_element(myjson_find_object_value(&v, "users", 5), 0));
+    TEST_CACHED_STRINGIFY(&v, &so);
+
+    /* a copy shares the text until one side is modified */
+    myjson_copy(&w, &v);
+    myjson_set_boolean(myjson_set_object_value(&w, "extra", 5), 1);
+    TEST_CACHED_STRINGIFY(&w, &so);
+    TEST_CACHED_STRINGIFY(&v, &so);
+
+    /* the text is kept per output format */
+    so.flags |= MYJSON_OPT_SORT_KEYS;
+    out = myjson_stringify_ex(&v, &len, &so);
+    EXPECT_EQ_STRING("{\"meta\":{\"pad\":[],\"version\":3},\"users\":[{\"id\":20,\"name\":\"bob\",\"tags\":[\"dev\"]}]}", out, len);
+    free(out);
+    so.flags = MYJSON_OPT_STRINGIFY_CACHE;
+
+    /* an element modified through a pointer taken before stringifying is not noticed */
+    myjson_free(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, "[[\"0123456789\",\"0123456789\",\"0123456789\",\"0123456789\",\"0123456789\"]]"));
+    e = myjson_get_array_element(myjson_get_array_element(&v, 0), 0);
+    free(myjson_stringify_ex(&v, &len, &so));
+    myjson_set_string(e, "x", 1);
+    out = myjson_stringify_ex(&v, &len, &so);
+    EXPECT_EQ_STRING("[[\"0123456789\",\"0123456789\",\"0123456789\",\"0123456789\",\"0123456789\"]]", out, len);
+    free(out);
+    out = myjson_stringify(&v, &len);
+    EXPECT_EQ_STRING("[[\"x\",\"0123456789\",\"0123456789\",\"0123456789\",\"0123456789\"]]", out, len);
+    free(out);
+
+    myjson_free(&v);
+    myjson_free(&w);
+}
+
+static void test_utf8() {
+    static const char *valid[] = {
+        "", "ASCII", "\xC2\x80", "\xDF\xBF", "\xC3\xA9t\xC3\xA9", "\xE0\xA0\x80", "\xE2\x82\xAC", "\xED\x9F\xBF",
+        "\xEE\x80\x80", "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF"
+    };
+    static const char *invalid[] = {
+        "\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC2", "\xC2" "A", "\xC2\x80\x80", "\xE0\x80\x80", "\xE0\x9F\xBF",
+        "\xED\xA0\x80", "\xED\xBF\xBF", "\xE1\x80", "\xE1\x80" "A", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+        "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF1\x80\x80", "\xF8\x88\x80\x80\x80", "\xFE", "\xFF"
+    };
+    myjson_parse_options po;
+    myjson_value v;
+    char json[128];
+    size_t i, before, after, flags;
+
+    memset(&po, 0, sizeof(po));
+    myjson_init(&v);
+    /* every sequence at every offset around the 16-byte blocks, in values, keys and views */
+    for (flags = 0; flags < 2; flags++) {
+        po.flags = MYJSON_OPT_VALIDATE_UTF8 | (flags ? MYJSON_OPT_VIEWS : 0);
+        for (before = 0; before < 34; before++) {
+            for (after = 0; after < 18; after += 17) {
+                for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+                    sprintf(json, "[\"%.*s%s%.*s\"]", (int)before, "0123456789abcdef0123456789abcdef01", valid[i], (int)after, "0123456789abcdef0");
+                    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, json, &po));
+                    myjson_free(&v);
+                    sprintf(json, "{\"%.*s%s\\n%.*s\":0}", (int)before, "0123456789abcdef0123456789abcdef01", valid[i], (int)after, "0123456789abcdef0");
+                    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, json, &po));
+                    myjson_free(&v);
+                }
+                for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+                    sprintf(json, "[\"%.*s%s%.*s\"]", (int)before, "0123456789abcdef0123456789abcdef01", invalid[i], (int)after, "0123456789abcdef0");
+                    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UTF8, myjson_parse_ex(&v, json, &po));
+                    EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v));
+                    sprintf(json, "{\"%.*s%s\\n%.*s\":0}", (int)before, "0123456789abcdef0123456789abcdef01", invalid[i], (int)after, "0123456789abcdef0");
+                    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UTF8, myjson_parse_ex(&v, json, &po));
+                }
+            }
+        }
+    }
+
+    /* a sequence cannot be split by an escape, and is not checked without the option */
+    po.flags = MYJSON_OPT_VALIDATE_UTF8;
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UTF8, myjson_parse_ex(&v, "\"\xC3\\n\xA9\"", &po));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "\"\\u00e9\xC3\xA9\"", &po));
+    EXPECT_EQ_STRING("\xC3\xA9\xC3\xA9", myjson_get_string(&v), myjson_get_string_length(&v));
+    myjson_free(&v);
+
+    /* escapes must not produce encoded surrogates either */
+    for (flags = 0; flags < 2; flags++) {
+        po.flags = MYJSON_OPT_VALIDATE_UTF8 | (flags ? MYJSON_OPT_VIEWS : 0);
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UNICODE_SURROGATE, myjson_parse_ex(&v, "\"\\uDC00\"", &po));
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UNICODE_SURROGATE, myjson_parse_ex(&v, "[\"a\\uDFFFb\"]", &po));
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UNICODE_SURROGATE, myjson_parse_ex(&v, "{\"\\uDC00\":0}", &po));
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UNICODE_SURROGATE, myjson_parse_ex(&v, "\"\\uD800\"", &po));
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UNICODE_SURROGATE, myjson_parse_ex(&v, "\"\\uDBFF\\u0041\"", &po));
+        EXPECT_EQ_INT(MYJSON_PARSE_INVALID_UNICODE_SURROGATE, myjson_parse_ex(&v, "\"\\uDC00\\uD800\"", &po));
+        EXPECT_EQ_INT(MYJSON_NULL, myjson_get_type(&v));
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "\"\\uD800\\uDC00\"", &po));
+        EXPECT_EQ_STRING("\xF0\x90\x80\x80", myjson_get_string(&v), myjson_get_string_length(&v));
+        myjson_free(&v);
+    }
+
+    po.flags = 0;
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "\"\xFF\"", &po));
+    myjson_free(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "\"\\uDC00\"", &po));
+    EXPECT_EQ_STRING("\xED\xB0\x80", myjson_get_string(&v), myjson_get_string_length(&v));
+    myjson_free(&v);
+}
+
+typedef struct {
+    const char *json;
+    size_t len, pos, chunk;
+} test_reader;
+
+static size_t test_read(void *ctx, char *buf, size_t size) {
+    test_reader *r = (test_reader *)ctx;
+    size_t n = r->len - r->pos;
+    if (n > r->chunk)
+        n = r->chunk;
+    if (n > size)
+        n = size;
+    memcpy(buf, r->json + r->pos, n);
+    r->pos += n;
+    return n;
+}
+
+typedef struct {
+    myjson_value matches;
+    size_t limit;
+} test_matches;
+
+static int test_match(void *ctx, myjson_value *v) {
+    test_matches *m = (test_matches *)ctx;
+    myjson_move(myjson_pushback_array_element(&m->matches), v);
+    return myjson_get_array_size(&m->matches) == m->limit;
+}
+
+/* Runs path over json read in chunks of every size in chunks[], expecting the same matches each time */
+static int test_query_run(const char *path, const char *json, size_t limit, char **out, size_t *len) {
+    static const size_t chunks[] = { 1, 3, 7, 4096 };
+    myjson_query *q;
+    test_reader r;
+    test_matches m;
+    char *first = NULL, *json_out;
+    size_t i, first_len = 0, n;
+    int ret = myjson_query_compile(&q, path);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, ret);
+    *out = NULL;
+    *len = 0;
+    if (ret != MYJSON_PARSE_OK)
+        return ret;
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        r.json = json;
+        r.len = strlen(json);
+        r.pos = 0;
+        r.chunk = chunks[i];
+        myjson_init(&m.matches);
+        myjson_set_array(&m.matches, 0);
+        m.limit = limit;
+        ret = myjson_query_stream(q, test_read, &r, test_match, &m);
+        json_out = myjson_stringify(&m.matches, &n);
+        myjson_free(&m.matches);
+        if (first == NULL) {
+            first = json_out;
+            first_len = n;
+            continue;
+        }
+        EXPECT_EQ_SIZE_T(first_len, n);
+        EXPECT_TRUE(first_len == n && memcmp(first, json_out, n) == 0);
+        free(json_out);
+    }
+    myjson_query_free(q);
+    *out = first;
+    *len = first_len;
+    return ret;
+}
+
+#define TEST_QUERY(expect, path, json)\
+    do {\
+        char *out_;\
+        size_t len_;\
+        EXPECT_EQ_INT(MYJSON_PARSE_OK, test_query_run(path, json, 0, &out_, &len_));\
+        EXPECT_EQ_STRING(expect, out_, len_);\
+        free(out_);\
+    } while(0)
+
+#define TEST_QUERY_ERROR(error, path, json)\
+    do {\
+        char *out_;\
+        size_t len_;\
+        EXPECT_EQ_INT(error, test_query_run(path, json, 0, &out_, &len_));\
+        free(out_);\
+    } while(0)
+
+static size_t window_peak;
+
+static void *window_realloc(void *ctx, void *p, size_t size) {
+    (void)ctx;
+    if (size > window_peak)
+        window_peak = size;
+    return realloc(p, size);
+}
+
+static void *window_malloc(void *ctx, size_t size) {
+    return window_realloc(ctx, NULL, size);
+}
+
+static void window_free(void *ctx, void *p) {
+    (void)ctx;
+    free(p);
+}
+
+static void test_query() {
+    static const char events[] = "{\"events\":[{\"type\":\"click\",\"payload\":{\"x\":1}},{\"payload\":2,\"type\":\"view\"},"
+        "{\"payload\":[3],\"type\":\"click\"},{\"payload\":4},5,{\"type\":\"click\"}],\"type\":\"click\"}";
+    myjson_allocator a = { window_malloc, window_realloc, window_free, NULL };
+    myjson_query *q;
+    char *json, *out;
+    size_t i, len;
+
+    TEST_QUERY("[{\"x\":1},[3]]", "$.events[?(@.type==\"click\")].payload", events);
+    TEST_QUERY("[2,4]", "$.events[?(@.type != \"click\")].payload", events);
+    TEST_QUERY("[{\"payload\":2,\"type\":\"view\"},{\"payload\":4},5]", "$.events[?(@.type!=\"click\")]", events);
+    TEST_QUERY("[2]", "$[?(@.a!=1)][0]", "[[2],{\"a\":1}]");
+    TEST_QUERY("[{\"x\":1},2,[3],4]", "$.events[*].payload", events);
+    TEST_QUERY("[{\"type\":\"click\",\"payload\":{\"x\":1}},{\"payload\":[3],\"type\":\"click\"},{\"type\":\"click\"}]", "$.events[?(@.type==\"click\")]", events);
+    TEST_QUERY("[\"click\",\"click\",\"click\"]", "$.events[?(@.type==\"click\")].type", events);
+    TEST_QUERY("[5]", "$.events[4]", events);
+    TEST_QUERY("[]", "$.events[6]", events);
+    TEST_QUERY("[\"click\"]", "$.type", events);
+    TEST_QUERY("[1,[2]]", "$.*", "{\"a\":1,\"b\":[2]}");
+    TEST_QUERY("[true]", "$['a b'].c", "{\"a b\":{\"c\":true}}");
+    TEST_QUERY("[1]", "$.ab", "{\"a\\u0062\":1,\"abc\":2}");
+    TEST_QUERY("[1]", "$.a", " {\"skip\":\"]}\\\"[{\" , \"a\" : 1 } ");
+    TEST_QUERY("[{\"a\":[1,2]}]", "$", "{\"a\":[1,2]}");
+    TEST_QUERY("[1,2]", "$.id", "{\"id\":1}\n{\"id\":2}\n{\"x\":3}\n[4]\n");
+    TEST_QUERY("[1]", "$.g[?(@.k==1)].items[?(@.v==\"y\")].id",
+        "{\"g\":[{\"items\":[{\"id\":1,\"v\":\"y\"},{\"v\":\"n\",\"id\":2}],\"k\":1},{\"k\":2,\"items\":[{\"id\":3,\"v\":\"y\"}]}]}");
+    TEST_QUERY("[[1,2]]", "$[?(@.k==[1,2])].k", "[{\"k\":[1,2]},{\"k\":[1]}]");
+    TEST_QUERY("[]", "$.a[0]", "{\"a\":{\"0\":1}}");
+    TEST_QUERY("[]", "$.a.b", "{\"a\":[{\"b\":1}]}");
+
+    /* match() can stop the query */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_query_run("$[*]", "[1,2,3]", 2, &out, &len));
+    EXPECT_EQ_STRING("[1,2]", out, len);
+    free(out);
+
+    TEST_QUERY_ERROR(MYJSON_PARSE_EXPECT_VALUE, "$.a", "{\"a\":");
+    TEST_QUERY_ERROR(MYJSON_PARSE_MISS_COLON, "$.a", "{\"a\" 1}");
+    TEST_QUERY_ERROR(MYJSON_PARSE_MISS_KEY, "$.a", "{1:1}");
+    TEST_QUERY_ERROR(MYJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "$.b", "{\"a\":1 \"b\":2}");
+    TEST_QUERY_ERROR(MYJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "$[*]", "[1 2]");
+    TEST_QUERY_ERROR(MYJSON_PARSE_MISS_QUOTATION_MARK, "$.a", "{\"b\":\"xyz");
+    TEST_QUERY_ERROR(MYJSON_PARSE_INVALID_VALUE, "$.a", "{\"a\":[1,tru]}");
+
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, ""));
+    EXPECT_TRUE(q == NULL);
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "a.b"));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$."));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$.a["));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$[1"));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$['a]"));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$[?(@.x=1)]"));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$.a[?(@.x==1]"));
+    EXPECT_EQ_INT(MYJSON_PARSE_INVALID_QUERY, myjson_query_compile(&q, "$[?(@.x==tru)]"));
+
+    /* the window does not grow with the input, only with what is kept */
+    json = (char *)malloc(100000 * 64 + 64);
+    len = (size_t)sprintf(json, "{\"events\":[");
+    for (i = 0; i < 100000; i++)
+        len += (size_t)sprintf(json + len, "%s{\"payload\":\"%030zu\",\"type\":\"%s\"}", i > 0 ? "," : "", i, i % 50000 == 7 ? "click" : "view");
+    strcpy(json + len, "]}");
+    window_peak = 0;
+    myjson_set_allocator(&a);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, test_query_run("$.events[?(@.type==\"click\")].payload", json, 0, &out, &len));
+    myjson_set_allocator(NULL);
+    EXPECT_EQ_STRING("[\"000000000000000000000000000007\",\"000000000000000000000000050007\"]", out, len);
+    EXPECT_TRUE(window_peak < 4 * 4096);
+    free(out);
+    free(json);
+}
+
+static void test_stats() {
+    const char json[] = "{\"a\":[1,true,\"x\"],\"b\":{\"c\":null}}";
+    myjson_parse_options po;
+    myjson_stringify_options so;
+    myjson_stats ps, ss;
+    myjson_value v;
+    char *out;
+    size_t len;
+
+    memset(&po, 0, sizeof(po));
+    memset(&so, 0, sizeof(so));
+    memset(&ps, 0xFF, sizeof(ps));
+    memset(&ss, 0xFF, sizeof(ss));
+    po.stats = &ps;
+    so.stats = &ss;
+    myjson_init(&v);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, json, &po));
+    out = myjson_stringify_ex(&v, &len, &so);
+#ifdef MYJSON_STATS
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, ps.bytes);
+    EXPECT_EQ_SIZE_T(1, ps.values[MYJSON_NULL]);
+    EXPECT_EQ_SIZE_T(0, ps.values[MYJSON_FALSE]);
+    EXPECT_EQ_SIZE_T(1, ps.values[MYJSON_TRUE]);
+    EXPECT_EQ_SIZE_T(1, ps.values[MYJSON_NUMBER]);
+    EXPECT_EQ_SIZE_T(1, ps.values[MYJSON_STRING]);
+    EXPECT_EQ_SIZE_T(1, ps.values[MYJSON_ARRAY]);
+    EXPECT_EQ_SIZE_T(2, ps.values[MYJSON_OBJECT]);
+    EXPECT_EQ_SIZE_T(7, ps.allocations); /* a string, three keys, three blocks */
+    EXPECT_TRUE(ps.allocated > 0);
+    EXPECT_TRUE(ps.stack_size > 0);
+    EXPECT_EQ_SIZE_T(2, ps.max_depth);
+    EXPECT_EQ_SIZE_T(len, ss.bytes);
+    EXPECT_TRUE(memcmp(ps.values, ss.values, sizeof(ps.values)) == 0);
+    EXPECT_EQ_SIZE_T(1, ss.allocations);
+    EXPECT_EQ_SIZE_T(2, ss.max_depth);
+#else
+    EXPECT_EQ_SIZE_T(0, ps.bytes);
+    EXPECT_EQ_SIZE_T(0, ps.allocations);
+    EXPECT_EQ_SIZE_T(0, ss.bytes);
+    EXPECT_EQ_SIZE_T(0, ss.max_depth);
+#endif
+    free(out);
+    myjson_free(&v);
+}
+
+typedef struct {
+    size_t allocs, reallocs, live;
+} counting_stats;
+
+static void *counting_malloc(void *ctx, size_t size) {
+    counting_stats *st = (counting_stats *)ctx;
+    st->allocs++;
+    st->live++;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ctx, void *p, size_t size) {
+    counting_stats *st = (counting_stats *)ctx;
+    if (p == NULL) {
+        st->allocs++;
+        st->live++;
+    }
+    else
+        st->reallocs++;
+    return realloc(p, size);
+}
+
+static void counting_free(void *ctx, void *p) {
+    counting_stats *st = (counting_stats *)ctx;
+    st->live--;
+    free(p);
+}
+
+static void test_allocator() {
+    counting_stats st = { 0, 0, 0 }, global = { 0, 0, 0 };
+    myjson_allocator a = { counting_malloc, counting_realloc, counting_free, &st };
+    myjson_allocator g = { counting_malloc, counting_realloc, counting_free, &global };
+    static const char *paths[] = { "a[*].b", "c" };
+    myjson_parse_options po;
+    myjson_stringify_options so;
+    myjson_value v, w, p;
+    char *json, *bin;
+    size_t len, i;
+
+    po.flags = 0;
+    po.max_depth = 0;
+    po.allocator = &a;
+    po.max_input = po.max_bytes = po.max_string = po.max_members = 0;
+    po.stats = NULL;
+    po.paths = NULL;
+    po.npaths = 0;
+    so.flags = 0;
+    so.allocator = &a;
+    so.stats = NULL;
+    myjson_init(&v);
+    myjson_init(&w);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "{\"a\":[1,\"two\",{\"b\":null}],\"c\":\"d\"}", &po));
+    EXPECT_TRUE(st.allocs > 0);
+    /* blocks grow and release through the allocator that made them */
+    myjson_set_string(myjson_pushback_array_element(myjson_find_object_value(&v, "a", 1)), "e", 1);
+    myjson_set_boolean(myjson_set_object_value(&v, "f", 1), 1);
+    myjson_copy(&w, &v);
+    myjson_set_number(myjson_find_object_value(&w, "c", 1), 1.0);
+    json = myjson_stringify_ex(&v, &len, &so);
+    EXPECT_EQ_STRING("{\"a\":[1,\"two\",{\"b\":null},\"e\"],\"c\":\"d\",\"f\":true}", json, len);
+    counting_free(&st, json);
+    myjson_free(&v);
+    myjson_free(&w);
+    EXPECT_EQ_SIZE_T(0, st.live);
+
+    /* so does the projection trie, leaving the global one alone */
+    myjson_set_allocator(&g);
+    po.paths = paths;
+    po.npaths = sizeof(paths) / sizeof(paths[0]);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse_ex(&v, "{\"a\":[1,{\"b\":2}],\"c\":{\"d\":3}}", &po));
+    json = myjson_stringify_ex(&v, &len, &so);
+    EXPECT_EQ_STRING("{\"a\":[null,{\"b\":2}],\"c\":{\"d\":3}}", json, len);
+    counting_free(&st, json);
+    myjson_free(&v);
+    EXPECT_EQ_SIZE_T(0, global.allocs);
+    EXPECT_EQ_SIZE_T(0, st.live);
+    myjson_set_allocator(NULL);
+    po.paths = NULL;
+    po.npaths = 0;
+
+    /* everything else goes through the global one */
+    myjson_set_allocator(&g);
+    EXPECT_TRUE(myjson_get_allocator() == &g);
+    myjson_init(&p);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, "{\"a\":[1,2],\"b\":{\"c\":\"x\"}}"));
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&p, "[{\"op\":\"add\",\"path\":\"/b/d\",\"value\":[true]},{\"op\":\"remove\",\"path\":\"/a/0\"}]"));
+    EXPECT_EQ_INT(MYJSON_PATCH_OK, myjson_apply_patch(&v, &p));
+    bin = myjson_dump_binary(&v, &len, MYJSON_OPT_KEY_DICTIONARY);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_load_binary(&w, bin, len));
+    EXPECT_TRUE(myjson_is_equal(&v, &w));
+    counting_free(&global, bin);
+    myjson_free(&p);
+    myjson_diff(&p, &v, &w);
+    json = myjson_stringify(&p, &len);
+    EXPECT_EQ_STRING("[]", json, len);
+    counting_free(&global, json);
+    myjson_free(&v);
+    myjson_free(&w);
+    myjson_free(&p);
+
+    /* a shared block grows by a single copy into its new size, never a copy and a realloc */
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, "[1,2,3]"));
+    myjson_copy(&w, &v);
+    len = global.allocs;
+    i = global.reallocs;
+    myjson_resize_array(&w, 100, NULL);
+    EXPECT_EQ_SIZE_T(len + 1, global.allocs);
+    EXPECT_EQ_SIZE_T(i, global.reallocs);
+    EXPECT_EQ_SIZE_T(3, myjson_get_array_size(&v));
+    myjson_copy(&w, &v);
+    myjson_reserve_array(&w, 100);
+    EXPECT_EQ_SIZE_T(len + 2, global.allocs);
+    EXPECT_EQ_SIZE_T(i, global.reallocs);
+    myjson_free(&v);
+    myjson_free(&w);
+    EXPECT_EQ_INT(MYJSON_PARSE_OK, myjson_parse(&v, "{\"a\":1}"));
+    myjson_copy(&w, &v);
+    i = global.reallocs;
+    myjson_set_number(myjson_set_object_value(&w, "b", 1), 2);
+    myjson_copy(&p, &v);
+    myjson_reserve_object(&p, 100);
+    EXPECT_EQ_SIZE_T(i, global.reallocs);
+    EXPECT_EQ_SIZE_T(1, myjson_get_object_size(&v));
+    EXPECT_EQ_SIZE_T(2, myjson_get_object_size(&w));
+    EXPECT_EQ_SIZE_T(100, myjson_get_object_capacity(&p));
+    myjson_free(&v);
+    myjson_free(&w);
+    myjson_free(&p);
+    EXPECT_TRUE(global.allocs > 0);
+    EXPECT_EQ_SIZE_T(0, global.live);
+    myjson_set_allocator(NULL);
+    EXPECT_TRUE(myjson_get_allocator() != &g);
+}
+
 int main() {
     test_parse();
     test_stringify();
@@ -710,6 +2972,24 @@ int main() {
     test_copy();
     test_move();
     test_swap();
+    test_copy_on_write();
+    test_hash();
+    test_patch();
+    test_merge_patch();
+    test_diff();
+    test_sorted_keys();
+    test_raw_numbers();
+    test_raw_fragments();
+    test_stringify_cache();
+    test_utf8();
+    test_query();
+    test_binary();
+    test_frozen();
+    test_msgpack_cbor();
+    test_tape();
+    test_allocator();
+    test_stats();
+    test_codegen();
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;
 }
\ No newline at end of file